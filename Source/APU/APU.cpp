@@ -355,7 +355,7 @@ bool CAPU::SetupSound(int SampleRate, int NrChannels, int Machine)
 
 	SAFE_RELEASE_ARRAY(m_pSoundBuffer);
 
-	m_pSoundBuffer = new int16[m_iSoundBufferSize << 1];
+	m_pSoundBuffer = new int32[m_iSoundBufferSize << 1];
 
 	if (m_pSoundBuffer == NULL)
 		return false;
@@ -139,7 +139,7 @@ private:
 	uint32		m_iSampleSizeShift;					// To convert samples to bytes
 	uint32		m_iSoundBufferSize;					// Size of buffer, in samples
 	uint32		m_iBufferPointer;					// Fill pos in buffer
-	int16		*m_pSoundBuffer;					// Sound transfer buffer
+	int32		*m_pSoundBuffer;					// Sound transfer buffer, 24-bit samples
 
 	uint8		m_iRegs[0x20];
 	uint8		m_iRegsVRC6[0x10];
@@ -232,7 +232,7 @@ void CMixer::SetNamcoVolume(float fVol)
 	SynthN163.volume(fVolume * 1.1f * m_fLevelN163);
 }
 
-void CMixer::MixSamples(blip_sample_t *pBuffer, uint32 Count)
+void CMixer::MixSamples(blip_wide_sample_t *pBuffer, uint32 Count)
 {
 	// For VRC7
 	BlipBuffer.mix_samples(pBuffer, Count);
@@ -394,7 +394,7 @@ void CMixer::AddValue(int ChanID, int Chip, int Value, int AbsValue, int FrameCy
 
 int CMixer::ReadBuffer(int Size, void *Buffer, bool Stereo)
 {
-	return BlipBuffer.read_samples((blip_sample_t*)Buffer, Size);
+	return BlipBuffer.read_samples((blip_wide_sample_t*)Buffer, Size);
 }
 
 int32 CMixer::GetChanOutput(uint8 Chan) const
@@ -51,7 +51,7 @@ public:
 	void	ClearBuffer();
 	int		FinishBuffer(int t);
 	int		SamplesAvail() const;
-	void	MixSamples(blip_sample_t *pBuffer, uint32 Count);
+	void	MixSamples(blip_wide_sample_t *pBuffer, uint32 Count);
 	uint32	GetMixSampleCount(int t) const;
 
 	void	AddSample(int ChanID, int Value);
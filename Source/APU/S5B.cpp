@@ -55,7 +55,7 @@ void CS5B::Process(uint32 Time)
 	m_iTime += Time;
 }
 
-int16 m_pBuffer[4000];
+int32 m_pBuffer[4000];
 uint32 m_iBufferPtr = 0;
 
 void CS5B::EndFrame()
@@ -72,11 +72,15 @@ void CS5B::GetMixMono()
 	// Generate samples
 	while (m_iBufferPtr < WantSamples) {
 		int32 Sample = int32(float(PSG_calc(psg)) * m_fVolume);
-		m_pBuffer[m_iBufferPtr++] = int16((Sample + LastSample) >> 1);
+		if (Sample > blip_mix_sample_max)
+			Sample = blip_mix_sample_max;
+		if (Sample < -blip_mix_sample_max)
+			Sample = -blip_mix_sample_max;
+		m_pBuffer[m_iBufferPtr++] = (Sample + LastSample) >> 1;
 		LastSample = Sample;
 	}
 
-	m_pMixer->MixSamples((blip_sample_t*)m_pBuffer, WantSamples);
+	m_pMixer->MixSamples((blip_wide_sample_t*)m_pBuffer, WantSamples);
 
 	m_iBufferPtr -= WantSamples;
 	m_iTime = 0;
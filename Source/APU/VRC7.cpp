@@ -62,8 +62,8 @@ void CVRC7::SetSampleSpeed(uint32 SampleRate, double ClockRate, uint32 FrameRate
 	m_iMaxSamples = (SampleRate / FrameRate) * 2;	// Allow some overflow
 
 	SAFE_RELEASE_ARRAY(m_pBuffer);
-	m_pBuffer = new int16[m_iMaxSamples];
-	memset(m_pBuffer, 0, sizeof(int16) * m_iMaxSamples);
+	m_pBuffer = new int32[m_iMaxSamples];
+	memset(m_pBuffer, 0, sizeof(int32) * m_iMaxSamples);
 }
 
 void CVRC7::SetVolume(float Volume)
@@ -107,16 +107,17 @@ void CVRC7::EndFrame()
 		// Apply volume
 		int32 Sample = int(float(RawSample) * m_fVolume);
 
-		if (Sample > 32767)
-			Sample = 32767;
-		if (Sample < -32768)
-			Sample = -32768;
+		// Keep headroom, the mixer output is wider than 16 bits
+		if (Sample > blip_mix_sample_max)
+			Sample = blip_mix_sample_max;
+		if (Sample < -blip_mix_sample_max)
+			Sample = -blip_mix_sample_max;
 
-		m_pBuffer[m_iBufferPtr++] = int16((Sample + LastSample) >> 1);
+		m_pBuffer[m_iBufferPtr++] = (Sample + LastSample) >> 1;
 		LastSample = Sample;
 	}
 
-	m_pMixer->MixSamples((blip_sample_t*)m_pBuffer, WantSamples);
+	m_pMixer->MixSamples((blip_wide_sample_t*)m_pBuffer, WantSamples);
 
 	m_iBufferPtr -= WantSamples;
 	m_iTime = 0;
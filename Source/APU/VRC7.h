@@ -46,7 +46,7 @@ private:
 	uint32	m_iTime;
 	uint32	m_iMaxSamples;
 
-	int16	*m_pBuffer;
+	int32	*m_pBuffer;
 	uint32	m_iBufferPtr;
 
 	uint8	m_iSoundReg;
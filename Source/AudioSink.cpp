@@ -0,0 +1,262 @@
+/*
+** FamiTracker - NES/Famicom sound tracker
+** Copyright (C) 2005-2014  Jonathan Liss
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+*/
+
+#include "stdafx.h"
+#include "AudioSink.h"
+
+// CNullAudioSink
+
+CNullAudioSink::CNullAudioSink(HANDLE hInterrupt, int SampleRate, int SampleSize, int Channels, int BufferLength, int Blocks) :
+	m_hInterrupt(hInterrupt),
+	m_iSampleSize(SampleSize),
+	m_iSampleRate(SampleRate),
+	m_iChannels(Channels),
+	m_bPlaying(false),
+	m_iWrittenBlocks(0),
+	m_iSkippedBlocks(0)
+{
+	ASSERT(Blocks > 1);
+
+	// Same block layout as a DirectSound channel
+	while ((SampleRate * BufferLength / (Blocks * 1000) != (double)SampleRate * BufferLength / (Blocks * 1000)))
+		++BufferLength;
+
+	m_iBufferLength = BufferLength;
+	m_iBlocks		= Blocks;
+	m_iBlockSize	= (((SampleRate * BufferLength) / 1000) * (SampleSize / 8) * Channels) / Blocks;
+	m_iBlockSamples	= m_iBlockSize / ((SampleSize / 8) * Channels);
+
+	QueryPerformanceFrequency(&m_iFrequency);
+	m_iStartTime.QuadPart = 0;
+}
+
+bool CNullAudioSink::Stop()
+{
+	m_bPlaying = false;
+	return true;
+}
+
+bool CNullAudioSink::ClearBuffer()
+{
+	Stop();
+	m_iWrittenBlocks = 0;
+	return true;
+}
+
+bool CNullAudioSink::WriteBuffer(char *pBuffer, unsigned int Samples)
+{
+	ASSERT(Samples == m_iBlockSize);
+	++m_iWrittenBlocks;
+	return true;
+}
+
+buffer_event_t CNullAudioSink::WaitForSyncEvent(DWORD dwTimeout)
+{
+	// Block n may be written when the play position has left it, that is after n + 1 blocks 
+	// have been played. If the play position has already come around to block n again 
+	// the player is late, skip ahead and report it the same way as a sound card.
+
+	if (!m_bPlaying) {
+		QueryPerformanceCounter(&m_iStartTime);
+		m_bPlaying = true;
+	}
+
+	DWORD StartTime = GetTickCount();
+
+	for (;;) {
+		LONGLONG Played = GetPlayedBlocks();
+
+		if (Played >= m_iWrittenBlocks + m_iBlocks) {
+			m_iSkippedBlocks = Played - 1 - m_iWrittenBlocks;
+			m_iWrittenBlocks = Played - 1;
+			return BUFFER_OUT_OF_SYNC;
+		}
+
+		if (Played > m_iWrittenBlocks)
+			return BUFFER_IN_SYNC;
+
+		DWORD Elapsed = GetTickCount() - StartTime;
+		if (Elapsed >= dwTimeout)
+			return BUFFER_TIMEOUT;
+
+		// Sleep until the current block is played
+		LARGE_INTEGER Now;
+		QueryPerformanceCounter(&Now);
+		LONGLONG NextBlock = ((m_iWrittenBlocks + 1) * m_iBlockSamples * 1000) / m_iSampleRate;
+		LONGLONG PlayTime = ((Now.QuadPart - m_iStartTime.QuadPart) * 1000) / m_iFrequency.QuadPart;
+		DWORD Wait = (DWORD)max(NextBlock - PlayTime, 0LL);
+
+		if (::WaitForSingleObject(m_hInterrupt, min(Wait, dwTimeout - Elapsed)) == WAIT_OBJECT_0)
+			return BUFFER_CUSTOM_EVENT;
+	}
+}
+
+int CNullAudioSink::GetFillLevel() const
+{
+	if (!m_bPlaying)
+		return 0;
+
+	LONGLONG Fill = m_iWrittenBlocks + m_iBlocks - 1 - GetPlayedBlocks();
+	return (Fill > 0) ? (int)Fill : 0;
+}
+
+LONGLONG CNullAudioSink::GetPlayedBlocks() const
+{
+	LARGE_INTEGER Now;
+	QueryPerformanceCounter(&Now);
+	return ((Now.QuadPart - m_iStartTime.QuadPart) * m_iSampleRate) / (m_iFrequency.QuadPart * m_iBlockSamples);
+}
+
+// CWaveAudioSink
+
+CWaveAudioSink::CWaveAudioSink(HANDLE hInterrupt, int SampleRate, int SampleSize, int Channels, int BufferLength, int Blocks) :
+	CNullAudioSink(hInterrupt, SampleRate, SampleSize, Channels, BufferLength, Blocks),
+	m_bFileOpen(false)
+{
+}
+
+CWaveAudioSink::~CWaveAudioSink()
+{
+	if (m_bFileOpen)
+		m_WaveFile.CloseFile();
+}
+
+bool CWaveAudioSink::OpenFile(LPCTSTR pFile)
+{
+	CString File(pFile);
+	m_bFileOpen = m_WaveFile.OpenFile(File.GetBuffer(), m_iSampleRate, m_iSampleSize, m_iChannels);
+	File.ReleaseBuffer();
+	return m_bFileOpen;
+}
+
+bool CWaveAudioSink::WriteBuffer(char *pBuffer, unsigned int Samples)
+{
+	if (m_bFileOpen)
+		m_WaveFile.WriteWave(pBuffer, Samples);
+
+	return CNullAudioSink::WriteBuffer(pBuffer, Samples);
+}
+
+buffer_event_t CWaveAudioSink::WaitForSyncEvent(DWORD dwTimeout)
+{
+	buffer_event_t Event = CNullAudioSink::WaitForSyncEvent(dwTimeout);
+
+	// Fill blocks lost in an underrun with silence to keep the file in time
+	if (Event == BUFFER_OUT_OF_SYNC && m_bFileOpen) {
+		char *pSilence = new char[m_iBlockSize];
+		memset(pSilence, (m_iSampleSize == 8) ? 0x80 : 0x00, m_iBlockSize);
+		for (LONGLONG i = 0; i < m_iSkippedBlocks; ++i)
+			m_WaveFile.WriteWave(pSilence, m_iBlockSize);
+		SAFE_RELEASE_ARRAY(pSilence);
+	}
+
+	return Event;
+}
+
+// CAudioStats
+
+CAudioStats::CAudioStats()
+{
+	Reset(1, 1);
+}
+
+void CAudioStats::Reset(int BlockSamples, int SampleRate)
+{
+	m_csLock.Lock();
+
+	memset(&m_Stats, 0, sizeof(stAudioStats));
+	m_iJitterSum = 0;
+	m_iJitterCount = 0;
+	m_iBlockPeriod = (LONGLONG(BlockSamples) * 1000000) / SampleRate;
+	m_iUnderrunBurst = 0;
+	m_iLastBlock.QuadPart = 0;
+
+	QueryPerformanceFrequency(&m_iFrequency);
+
+	m_csLock.Unlock();
+}
+
+void CAudioStats::Restart()
+{
+	// Output was restarted, next block event has no period to compare with
+	m_csLock.Lock();
+	m_iLastBlock.QuadPart = 0;
+	m_csLock.Unlock();
+}
+
+void CAudioStats::BlockReady()
+{
+	m_csLock.Lock();
+
+	LARGE_INTEGER Now;
+	QueryPerformanceCounter(&Now);
+
+	if (m_iLastBlock.QuadPart != 0) {
+		LONGLONG Interval = ((Now.QuadPart - m_iLastBlock.QuadPart) * 1000000) / m_iFrequency.QuadPart;
+		unsigned int Jitter = (unsigned int)((Interval > m_iBlockPeriod) ? (Interval - m_iBlockPeriod) : (m_iBlockPeriod - Interval));
+		m_iJitterSum += Jitter;
+		++m_iJitterCount;
+		if (Jitter > m_Stats.MaxJitter)
+			m_Stats.MaxJitter = Jitter;
+		++m_Stats.JitterHistogram[GetBucket(Jitter, 250, stAudioStats::JITTER_BUCKETS)];
+	}
+
+	if (m_iUnderrunBurst > 0) {
+		++m_Stats.UnderrunHistogram[GetBucket(m_iUnderrunBurst - 1, 1, stAudioStats::UNDERRUN_BUCKETS)];
+		m_iUnderrunBurst = 0;
+	}
+
+	m_iLastBlock = Now;
+
+	m_csLock.Unlock();
+}
+
+void CAudioStats::Underrun()
+{
+	m_csLock.Lock();
+	++m_Stats.Underruns;
+	++m_iUnderrunBurst;
+	m_csLock.Unlock();
+}
+
+void CAudioStats::BlockWritten(int FillLevel)
+{
+	m_csLock.Lock();
+	++m_Stats.Blocks;
+	++m_Stats.FillHistogram[min(max(FillLevel, 0), stAudioStats::FILL_BUCKETS - 1)];
+	m_csLock.Unlock();
+}
+
+void CAudioStats::GetStats(stAudioStats &Stats) const
+{
+	m_csLock.Lock();
+	Stats = m_Stats;
+	Stats.AverageJitter = (m_iJitterCount > 0) ? (unsigned int)(m_iJitterSum / m_iJitterCount) : 0;
+	m_csLock.Unlock();
+}
+
+int CAudioStats::GetBucket(unsigned int Value, unsigned int First, int Buckets)
+{
+	// Bucket 0 holds values below First, the limit doubles for each bucket after that
+	int Bucket = 0;
+	for (unsigned int Limit = First; Bucket < Buckets - 1 && Value >= Limit; Limit <<= 1)
+		++Bucket;
+	return Bucket;
+}
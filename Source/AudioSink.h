@@ -0,0 +1,167 @@
+/*
+** FamiTracker - NES/Famicom sound tracker
+** Copyright (C) 2005-2014  Jonathan Liss
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+*/
+
+#pragma once
+
+#include <afxmt.h>		// Synchronization objects
+#include "WaveFile.h"
+
+// Return values from WaitForSyncEvent()
+enum buffer_event_t {
+	BUFFER_NONE = 0,
+	BUFFER_CUSTOM_EVENT = 1, 
+	BUFFER_TIMEOUT, 
+	BUFFER_IN_SYNC, 
+	BUFFER_OUT_OF_SYNC
+};
+
+// Audio output devices
+enum audio_output_t {
+	OUTPUT_DIRECTSOUND,		// Sound card
+	OUTPUT_NULL,			// No output, paced by the system clock
+	OUTPUT_WAVE				// Wave file, paced by the system clock
+};
+
+// Audio output interface. The output is a ring of blocks, the player waits 
+// for a block to be freed and then writes exactly one block.
+class IAudioSink
+{
+public:
+	virtual ~IAudioSink() {};
+
+	virtual bool Stop() = 0;
+	virtual bool ClearBuffer() = 0;
+	virtual bool WriteBuffer(char *pBuffer, unsigned int Samples) = 0;
+	virtual buffer_event_t WaitForSyncEvent(DWORD dwTimeout) = 0;
+
+	virtual int GetFillLevel() const = 0;		// Blocks queued ahead of the play position
+
+	virtual int GetBlockSize() const = 0;		// in bytes
+	virtual int GetBlocks() const = 0;
+	virtual int GetBufferLength() const = 0;	// in ms
+	virtual int GetSampleSize() const = 0;
+	virtual int GetSampleRate() const = 0;
+	virtual int GetChannels() const = 0;
+};
+
+// Output without a sound device, blocks are consumed in real time by the system clock
+class CNullAudioSink : public IAudioSink
+{
+public:
+	CNullAudioSink(HANDLE hInterrupt, int SampleRate, int SampleSize, int Channels, int BufferLength, int Blocks);
+
+	virtual bool Stop();
+	virtual bool ClearBuffer();
+	virtual bool WriteBuffer(char *pBuffer, unsigned int Samples);
+	virtual buffer_event_t WaitForSyncEvent(DWORD dwTimeout);
+
+	virtual int GetFillLevel() const;
+
+	virtual int GetBlockSize() const	{ return m_iBlockSize; };
+	virtual int GetBlocks() const		{ return m_iBlocks; };
+	virtual int GetBufferLength() const { return m_iBufferLength; };
+	virtual int GetSampleSize() const	{ return m_iSampleSize; };
+	virtual int GetSampleRate() const	{ return m_iSampleRate; };
+	virtual int GetChannels() const		{ return m_iChannels; };
+
+protected:
+	LONGLONG GetPlayedBlocks() const;
+
+protected:
+	HANDLE			m_hInterrupt;
+
+	unsigned int	m_iSampleSize;
+	unsigned int	m_iSampleRate;
+	unsigned int	m_iChannels;
+	unsigned int	m_iBufferLength;
+	unsigned int	m_iBlocks;
+	unsigned int	m_iBlockSize;				// in bytes
+	unsigned int	m_iBlockSamples;
+
+	LARGE_INTEGER	m_iFrequency;
+	LARGE_INTEGER	m_iStartTime;
+	bool			m_bPlaying;
+	LONGLONG		m_iWrittenBlocks;
+	LONGLONG		m_iSkippedBlocks;			// Blocks lost in the last underrun
+};
+
+// Streams the output to a wave file, paced like the null output so the file 
+// contains what would have been heard, including gaps from underruns
+class CWaveAudioSink : public CNullAudioSink
+{
+public:
+	CWaveAudioSink(HANDLE hInterrupt, int SampleRate, int SampleSize, int Channels, int BufferLength, int Blocks);
+	virtual ~CWaveAudioSink();
+
+	bool OpenFile(LPCTSTR pFile);
+
+	virtual bool WriteBuffer(char *pBuffer, unsigned int Samples);
+	virtual buffer_event_t WaitForSyncEvent(DWORD dwTimeout);
+
+private:
+	CWaveFile		m_WaveFile;
+	bool			m_bFileOpen;
+};
+
+// Audio output statistics
+
+struct stAudioStats {
+	static const int JITTER_BUCKETS = 8;		// < 0.25, 0.5, 1, 2, 4, 8, 16 ms and above
+	static const int FILL_BUCKETS = 17;			// 0 - 16 blocks
+	static const int UNDERRUN_BUCKETS = 8;		// Bursts of 1, 2, 3-4, 5-8, 9-16, 17-32, 33-64 and more
+
+	unsigned int Blocks;						// Blocks written
+	unsigned int Underruns;
+	unsigned int AverageJitter;					// Deviation from the block period, in us
+	unsigned int MaxJitter;
+	unsigned int JitterHistogram[JITTER_BUCKETS];
+	unsigned int FillHistogram[FILL_BUCKETS];	// Blocks queued after each write
+	unsigned int UnderrunHistogram[UNDERRUN_BUCKETS];
+};
+
+// Collects timing of the block events from any audio sink, may be read from other threads
+class CAudioStats
+{
+public:
+	CAudioStats();
+
+	void Reset(int BlockSamples, int SampleRate);
+	void Restart();
+
+	void BlockReady();
+	void Underrun();
+	void BlockWritten(int FillLevel);
+
+	void GetStats(stAudioStats &Stats) const;
+
+private:
+	static int GetBucket(unsigned int Value, unsigned int First, int Buckets);
+
+private:
+	mutable CCriticalSection m_csLock;
+
+	stAudioStats	m_Stats;
+	LONGLONG		m_iJitterSum;
+	unsigned int	m_iJitterCount;
+	LARGE_INTEGER	m_iFrequency;
+	LARGE_INTEGER	m_iLastBlock;
+	LONGLONG		m_iBlockPeriod;				// in us
+	unsigned int	m_iUnderrunBurst;
+};
@@ -0,0 +1,338 @@
+/*
+** FamiTracker - NES/Famicom sound tracker
+** Copyright (C) 2005-2014  Jonathan Liss
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+*/
+
+#include <vector>
+#include "stdafx.h"
+#include "FamiTrackerDoc.h"
+#include "DocumentFile.h"
+#include "TrackSnapshot.h"
+#include "AutoSave.h"
+
+/*
+ * Auto save
+ *
+ * Saving a large module spends most of its time in the pattern block. The document
+ * writes all other blocks to memory on the main thread, which is cheap, and passes
+ * snapshots of all tracks to this class. The worker thread serialises the patterns
+ * from the snapshots and writes the file.
+ *
+ * Serialised patterns are kept between auto saves together with the snapshot they
+ * were made from. Pattern blocks held by a snapshot are copied by the document
+ * before they are edited, so a block that is still the same object has the same
+ * contents and its serialised data can be reused.
+ *
+ */
+
+// CMemoryDocumentFile
+
+void CMemoryDocumentFile::Write(const void *lpBuf, UINT nCount)
+{
+	const char *pData = static_cast<const char*>(lpBuf);
+	m_vData.insert(m_vData.end(), pData, pData + nCount);
+}
+
+// CAutoSave
+
+CAutoSave::CAutoSave() :
+	m_pThread(NULL),
+	m_iTracks(0),
+	m_iChannels(0),
+	m_pPatternBlockID(NULL),
+	m_iPatternBlockVersion(0),
+	m_bResult(false),
+	m_bSuccess(false),
+	m_iTime(0),
+	m_iUpdated(0),
+	m_iPatterns(0)
+{
+	memset(m_pSnapshots, 0, sizeof(CTrackSnapshot*) * MAX_TRACKS);
+
+	for (int i = 0; i < MAX_TRACKS; ++i) {
+		m_Cache[i].pSnapshot = NULL;
+		m_Cache[i].Channels = 0;
+	}
+}
+
+CAutoSave::~CAutoSave()
+{
+	Wait();
+	Reset();
+}
+
+bool CAutoSave::IsBusy() const
+{
+	if (m_pThread == NULL)
+		return false;
+
+	return ::WaitForSingleObject(m_pThread->m_hThread, 0) != WAIT_OBJECT_0;
+}
+
+void CAutoSave::Wait()
+{
+	// Wait for the worker thread to finish
+	if (m_pThread == NULL)
+		return;
+
+	::WaitForSingleObject(m_pThread->m_hThread, INFINITE);
+	delete m_pThread;
+	m_pThread = NULL;
+}
+
+void CAutoSave::Reset()
+{
+	// Release cached data, the next auto save writes everything
+	ASSERT(!IsBusy());
+
+	for (int i = 0; i < MAX_TRACKS; ++i) {
+		if (m_Cache[i].pSnapshot != NULL)
+			m_Cache[i].pSnapshot->Release();
+		m_Cache[i].pSnapshot = NULL;
+		m_Cache[i].Channels = 0;
+		std::vector<char>().swap(m_Cache[i].Data);
+		std::vector<unsigned int>().swap(m_Cache[i].Offsets);
+	}
+
+	m_bResult = false;
+}
+
+void CAutoSave::Start(const CString &File, std::vector<char> &Head, std::vector<char> &Tail,
+					  CTrackSnapshot **pSnapshots, unsigned int Tracks, unsigned int Channels,
+					  const char *pPatternBlockID, int PatternBlockVersion)
+{
+	ASSERT(Tracks <= MAX_TRACKS);
+	ASSERT(Channels <= MAX_CHANNELS);
+
+	Wait();
+
+	m_strFile = File;
+	m_vHead.swap(Head);
+	m_vTail.swap(Tail);
+	memcpy(m_pSnapshots, pSnapshots, sizeof(CTrackSnapshot*) * Tracks);
+	m_iTracks = Tracks;
+	m_iChannels = Channels;
+	m_pPatternBlockID = pPatternBlockID;
+	m_iPatternBlockVersion = PatternBlockVersion;
+	m_bResult = false;
+
+	m_pThread = AfxBeginThread(&ThreadProcFunc, (LPVOID)this, THREAD_PRIORITY_BELOW_NORMAL, 0, CREATE_SUSPENDED);
+
+	if (m_pThread == NULL) {
+		// Save on this thread instead
+		Run();
+		return;
+	}
+
+	m_pThread->m_bAutoDelete = FALSE;
+	m_pThread->ResumeThread();
+}
+
+bool CAutoSave::GetResult(bool &bSuccess, DWORD &Time, unsigned int &Updated, unsigned int &Patterns)
+{
+	if (IsBusy() || !m_bResult)
+		return false;
+
+	m_bResult = false;
+
+	bSuccess = m_bSuccess;
+	Time = m_iTime;
+	Updated = m_iUpdated;
+	Patterns = m_iPatterns;
+
+	return true;
+}
+
+UINT CAutoSave::ThreadProcFunc(LPVOID pParam)
+{
+	CAutoSave *pAutoSave = reinterpret_cast<CAutoSave*>(pParam);
+	pAutoSave->Run();
+	return 0;
+}
+
+void CAutoSave::Run()
+{
+	DWORD StartTime = GetTickCount();
+
+	m_iUpdated = 0;
+	m_iPatterns = 0;
+
+	for (unsigned int i = 0; i < MAX_TRACKS; ++i) {
+		if (i < m_iTracks) {
+			UpdateTrack(i, m_pSnapshots[i]);
+			m_pSnapshots[i] = NULL;
+		}
+		else if (m_Cache[i].pSnapshot != NULL) {
+			// Removed track
+			m_Cache[i].pSnapshot->Release();
+			m_Cache[i].pSnapshot = NULL;
+			m_Cache[i].Data.clear();
+			m_Cache[i].Offsets.clear();
+		}
+	}
+
+	CMemoryDocumentFile Patterns;
+	Patterns.CreateBlock(m_pPatternBlockID, m_iPatternBlockVersion);
+	for (unsigned int i = 0; i < m_iTracks; ++i) {
+		if (!m_Cache[i].Data.empty())
+			Patterns.WriteBlock(&m_Cache[i].Data[0], m_Cache[i].Data.size());
+	}
+	Patterns.FlushBlock();
+
+	m_bSuccess = WriteFile(Patterns.GetData());
+
+	std::vector<char>().swap(m_vHead);
+	std::vector<char>().swap(m_vTail);
+
+	m_iTime = GetTickCount() - StartTime;
+	m_bResult = true;
+}
+
+void CAutoSave::UpdateTrack(unsigned int Track, CTrackSnapshot *pSnapshot)
+{
+	// Serialise the patterns of one track, reusing unchanged patterns from the last auto save
+	stTrackCache &Cache = m_Cache[Track];
+
+	if (pSnapshot == NULL) {
+		// Should not happen, keep the cache but write nothing
+		if (Cache.pSnapshot != NULL)
+			Cache.pSnapshot->Release();
+		Cache.pSnapshot = NULL;
+		Cache.Data.clear();
+		Cache.Offsets.clear();
+		return;
+	}
+
+	const unsigned int Count = m_iChannels * MAX_PATTERN;
+
+	CTrackSnapshot *pOld = Cache.pSnapshot;
+
+	if (pOld == pSnapshot && Cache.Channels == m_iChannels) {
+		// Track was not edited
+		pSnapshot->Release();
+		return;
+	}
+
+	bool bReuse = pOld != NULL && Cache.Channels == m_iChannels;
+
+	std::vector<char> Data;
+	std::vector<unsigned int> Offsets(Count + 1);
+	Data.reserve(Cache.Data.size());
+
+	for (unsigned int i = 0; i < m_iChannels; ++i) {
+		int EffColumns = pSnapshot->GetEffColumns(i) + 1;
+		bool bSameColumns = bReuse && pOld->GetEffColumns(i) + 1 == EffColumns;
+		for (unsigned int j = 0; j < MAX_PATTERN; ++j) {
+			unsigned int Index = i * MAX_PATTERN + j;
+			const CPatternBlock *pBlock = pSnapshot->GetPatternBlock(i, j);
+			Offsets[Index] = Data.size();
+			if (pBlock == NULL)
+				continue;
+			if (bSameColumns && pOld->GetPatternBlock(i, j) == pBlock) {
+				unsigned int Start = Cache.Offsets[Index];
+				unsigned int End = Cache.Offsets[Index + 1];
+				if (End > Start)
+					Data.insert(Data.end(), Cache.Data.begin() + Start, Cache.Data.begin() + End);
+			}
+			else {
+				WritePattern(Data, Track, i, j, pBlock, EffColumns);
+				++m_iUpdated;
+			}
+			++m_iPatterns;
+		}
+	}
+
+	Offsets[Count] = Data.size();
+
+	Cache.Data.swap(Data);
+	Cache.Offsets.swap(Offsets);
+	Cache.Channels = m_iChannels;
+	Cache.pSnapshot = pSnapshot;
+
+	// Keep the new snapshot, this keeps the cached blocks from being modified
+	if (pOld != NULL)
+		pOld->Release();
+}
+
+void CAutoSave::WritePattern(std::vector<char> &Data, unsigned int Track, unsigned int Channel, unsigned int Pattern, 
+							 const CPatternBlock *pBlock, int EffColumns)
+{
+	// Same layout as CFamiTrackerDoc::WriteBlock_Patterns
+	int Items = 0;
+
+	for (unsigned int i = 0; i < MAX_PATTERN_LENGTH; ++i) {
+		if (!pBlock->IsRowFree(i))
+			++Items;
+	}
+
+	if (Items == 0)
+		return;
+
+	unsigned int Header[4] = {Track, Channel, Pattern, (unsigned int)Items};
+	Data.insert(Data.end(), (const char*)Header, (const char*)(Header + 4));
+
+	for (unsigned int i = 0; i < MAX_PATTERN_LENGTH; ++i) {
+		if (pBlock->IsRowFree(i))
+			continue;
+
+		const stChanNote *pNote = pBlock->GetRow(i);
+		int Row = i;
+		Data.insert(Data.end(), (const char*)&Row, (const char*)(&Row + 1));
+		Data.push_back(pNote->Note);
+		Data.push_back(pNote->Octave);
+		Data.push_back(pNote->Instrument);
+		Data.push_back(pNote->Vol);
+		for (int j = 0; j < EffColumns; ++j) {
+			Data.push_back(pNote->EffNumber[j]);
+			Data.push_back(pNote->EffParam[j]);
+		}
+	}
+}
+
+bool CAutoSave::WriteFile(const std::vector<char> &Patterns) const
+{
+	// Write to a new file and replace the old one, a crash during saving keeps the last file
+	CString TempFile = m_strFile + _T(".new");
+	CFile File;
+
+	if (!File.Open(TempFile, CFile::modeWrite | CFile::modeCreate))
+		return false;
+
+	try {
+		if (!m_vHead.empty())
+			File.Write(&m_vHead[0], m_vHead.size());
+		if (!Patterns.empty())
+			File.Write(&Patterns[0], Patterns.size());
+		if (!m_vTail.empty())
+			File.Write(&m_vTail[0], m_vTail.size());
+		File.Close();
+	}
+	catch (CFileException *e) {
+		e->Delete();
+		File.Abort();
+		DeleteFile(TempFile);
+		return false;
+	}
+
+	if (!MoveFileEx(TempFile, m_strFile, MOVEFILE_REPLACE_EXISTING)) {
+		DeleteFile(TempFile);
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,97 @@
+/*
+** FamiTracker - NES/Famicom sound tracker
+** Copyright (C) 2005-2014  Jonathan Liss
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+*/
+
+#pragma once
+
+class CTrackSnapshot;
+class CPatternBlock;
+
+// Document file that collects all written data in memory
+class CMemoryDocumentFile : public CDocumentFile
+{
+public:
+	virtual void Write(const void *lpBuf, UINT nCount);
+
+	std::vector<char> &GetData() { return m_vData; };
+
+private:
+	std::vector<char> m_vData;
+};
+
+// Writes auto save files on a worker thread. The document serialises the small blocks on
+// the main thread and hands over track snapshots, the pattern block is serialised from the
+// snapshots. Patterns are only serialised again when their block has changed.
+class CAutoSave
+{
+public:
+	CAutoSave();
+	~CAutoSave();
+
+	bool IsBusy() const;
+	void Wait();
+	void Reset();
+
+	// Takes over the snapshot references, the head and tail buffers are swapped out
+	void Start(const CString &File, std::vector<char> &Head, std::vector<char> &Tail,
+			   CTrackSnapshot **pSnapshots, unsigned int Tracks, unsigned int Channels,
+			   const char *pPatternBlockID, int PatternBlockVersion);
+
+	// Returns true once for each finished auto save
+	bool GetResult(bool &bSuccess, DWORD &Time, unsigned int &Updated, unsigned int &Patterns);
+
+private:
+	struct stTrackCache {
+		CTrackSnapshot *pSnapshot;
+		unsigned int Channels;
+		std::vector<char> Data;
+		std::vector<unsigned int> Offsets;		// Start of each pattern in Data, Channels * MAX_PATTERN + 1 entries
+	};
+
+	void Run();
+	void UpdateTrack(unsigned int Track, CTrackSnapshot *pSnapshot);
+	bool WriteFile(const std::vector<char> &Patterns) const;
+
+	static UINT ThreadProcFunc(LPVOID pParam);
+	static void WritePattern(std::vector<char> &Data, unsigned int Track, unsigned int Channel, unsigned int Pattern, 
+							 const CPatternBlock *pBlock, int EffColumns);
+
+private:
+	CWinThread		*m_pThread;
+
+	// Job
+	CString			m_strFile;
+	std::vector<char> m_vHead;
+	std::vector<char> m_vTail;
+	CTrackSnapshot	*m_pSnapshots[MAX_TRACKS];
+	unsigned int	m_iTracks;
+	unsigned int	m_iChannels;
+	const char		*m_pPatternBlockID;
+	int				m_iPatternBlockVersion;
+
+	// Serialised patterns from the last auto save
+	stTrackCache	m_Cache[MAX_TRACKS];
+
+	// Result
+	bool			m_bResult;
+	bool			m_bSuccess;
+	DWORD			m_iTime;
+	unsigned int	m_iUpdated;
+	unsigned int	m_iPatterns;
+};
@@ -13,6 +13,13 @@ typedef long blip_time_t;
 typedef short blip_sample_t;
 enum { blip_sample_max = 32767 };
 
+// Wide output samples are 24-bit signed and not clamped, leaving headroom above
+// full scale. Wide samples given to mix_samples() are 16-bit scaled and must stay
+// within blip_mix_sample_max.
+typedef long blip_wide_sample_t;
+enum { blip_wide_sample_max = 0x7FFFFF };
+enum { blip_mix_sample_max = 65534 };
+
 class Blip_Buffer {
 public:
 	typedef const char* blargg_err_t;
@@ -36,6 +43,9 @@ public:
 	// easy interleving of two channels into a stereo output buffer.
 	long read_samples( blip_sample_t* dest, long max_samples, int stereo = 0 );
 	
+	// Same as above for mono wide samples
+	long read_samples( blip_wide_sample_t* dest, long max_samples );
+	
 // Additional optional features
 
 	// Current output sample rate
@@ -70,6 +80,7 @@ public:
 	
 	// Mix 'count' samples from 'buf' into buffer.
 	void mix_samples( blip_sample_t const* buf, long count );
+	void mix_samples( blip_wide_sample_t const* buf, long count );
 	
 	// Count number of clocks needed until 'count' samples will be available.
 	// If buffer can't even hold 'count' samples, returns number of clocks until
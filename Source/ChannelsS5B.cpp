@@ -86,26 +86,17 @@ void CChannelHandlerS5B::SetNoiseFreq(int Freq)
 	m_bRegsDirty = true;
 }
 
-void CChannelHandlerS5B::UpdateRegs(CAPU *pAPU)
+void CChannelHandlerS5B::UpdateRegs()
 {
 	if (!m_bRegsDirty)
 		return;
 
 	// Done only once
-	pAPU->ExternalWrite(0xC000, 0x07);
-	pAPU->ExternalWrite(0xE000, m_iModes);
-
-	pAPU->ExternalWrite(0xC000, 0x06);
-	pAPU->ExternalWrite(0xE000, m_iNoiseFreq);
-
-	pAPU->ExternalWrite(0xC000, 0x0B);
-	pAPU->ExternalWrite(0xE000, m_iEnvFreqLo);
-
-	pAPU->ExternalWrite(0xC000, 0x0C);
-	pAPU->ExternalWrite(0xE000, m_iEnvFreqHi);
-
-	pAPU->ExternalWrite(0xC000, 0x0D);
-	pAPU->ExternalWrite(0xE000, m_iEnvType);
+	WriteReg(0x07, m_iModes);
+	WriteReg(0x06, m_iNoiseFreq);
+	WriteReg(0x0B, m_iEnvFreqLo);
+	WriteReg(0x0C, m_iEnvFreqHi);
+	WriteReg(0x0D, m_iEnvType);
 
 	m_bRegsDirty = false;
 }
@@ -223,8 +214,8 @@ void CChannelHandlerS5B::ProcessChannel()
 
 void CChannelHandlerS5B::WriteReg(int Reg, int Value)
 {
-	m_pAPU->ExternalWrite(0xC000, Reg);
-	m_pAPU->ExternalWrite(0xE000, Value);
+	WriteExternalRegister(0xC000, Reg);
+	WriteExternalRegister(0xE000, Value);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -258,7 +249,7 @@ void CS5BChannel1::RefreshChannel()
 	if (!Noise)
 		SetNoiseFreq(NoisePeriod);
 
-//	UpdateRegs(m_pAPU);
+//	UpdateRegs();
 }
 
 void CS5BChannel1::ClearRegisters()
@@ -331,7 +322,7 @@ void CS5BChannel3::RefreshChannel()
 	if (!Noise)
 		SetNoiseFreq(NoisePeriod);
 
-	UpdateRegs(m_pAPU);
+	UpdateRegs();
 }
 
 void CS5BChannel3::ClearRegisters()
@@ -40,6 +40,7 @@ protected:
 
 protected:
 	void WriteReg(int Reg, int Value);
+	void UpdateRegs();
 
 	// Static functions
 protected:	
@@ -48,7 +49,6 @@ protected:
 	static void SetEnvelopeType(int Val);
 	static void SetMode(int Chan, int Square, int Noise);
 	static void SetNoiseFreq(int Freq);
-	static void UpdateRegs(CAPU *pAPU);
 
 	// Static memebers
 protected:
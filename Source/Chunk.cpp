@@ -21,15 +21,126 @@
 #include <map>
 #include <vector>
 #include "stdafx.h"
+#include "FamiTrackerTypes.h"
 #include "chunk.h"
 
+/**
+ * CSymbolTable - Numbers label symbols by label kind and index
+ *
+ */
+
+// Assembly labels, indexed by symbol kind
+const char *const CSymbolTable::LABEL_NAMES[SYMBOL_KIND_COUNT] = {
+	"",
+	"ft_song_list",
+	"ft_instrument_list",
+	"ft_sample_list",
+	"ft_samples",
+	"ft_wave_table",
+	"ft_waves_%i",				// one argument
+	"ft_seq_2a03_%i",			// one argument
+	"ft_seq_vrc6_%i",			// one argument
+	"ft_seq_n163_%i",			// one argument
+	"ft_seq_fds_%i",			// one argument
+	"ft_inst_%i",				// one argument
+	"ft_song_%i",				// one argument
+	"ft_s%i_frames",			// one argument
+	"ft_s%if%i",				// two arguments
+	"ft_s%ip%ic%i"				// three arguments
+};
+
+CSymbolTable::CSymbolTable() : m_iTracks(0), m_iChannels(0)
+{
+	Setup(0, 0);
+}
+
+void CSymbolTable::Setup(int Tracks, int Channels)
+{
+	m_iTracks = Tracks;
+	m_iChannels = Channels;
+
+	int Size[SYMBOL_KIND_COUNT];
+
+	for (int i = 0; i < SYMBOL_KIND_COUNT; ++i)
+		Size[i] = 1;
+
+	Size[SYMBOL_WAVES]		 = MAX_INSTRUMENTS;
+	Size[SYMBOL_SEQ_2A03]	 = MAX_SEQUENCES * SEQ_COUNT;
+	Size[SYMBOL_SEQ_VRC6]	 = MAX_SEQUENCES * SEQ_COUNT;
+	Size[SYMBOL_SEQ_N163]	 = MAX_SEQUENCES * SEQ_COUNT;
+	Size[SYMBOL_SEQ_FDS]	 = MAX_INSTRUMENTS * SEQ_COUNT;
+	Size[SYMBOL_INSTRUMENT]	 = MAX_INSTRUMENTS;
+	Size[SYMBOL_SONG]		 = Tracks;
+	Size[SYMBOL_SONG_FRAMES] = Tracks;
+	Size[SYMBOL_SONG_FRAME]	 = Tracks * MAX_FRAMES;
+	Size[SYMBOL_PATTERN]	 = Tracks * MAX_PATTERN * Channels;
+
+	m_iFirstSymbol[0] = 0;
+
+	for (int i = 0; i < SYMBOL_KIND_COUNT; ++i)
+		m_iFirstSymbol[i + 1] = m_iFirstSymbol[i] + Size[i];
+}
+
+int CSymbolTable::GetSymbol(symbol_kind_t Kind, int Index) const
+{
+	ASSERT(Index >= 0 && m_iFirstSymbol[Kind] + Index < m_iFirstSymbol[Kind + 1]);
+	return m_iFirstSymbol[Kind] + Index;
+}
+
+int CSymbolTable::GetFrameSymbol(int Track, int Frame) const
+{
+	ASSERT(Frame < MAX_FRAMES);
+	return GetSymbol(SYMBOL_SONG_FRAME, Track * MAX_FRAMES + Frame);
+}
+
+int CSymbolTable::GetPatternSymbol(int Track, int Pattern, int Channel) const
+{
+	ASSERT(Pattern < MAX_PATTERN && Channel < m_iChannels);
+	return GetSymbol(SYMBOL_PATTERN, (Track * MAX_PATTERN + Pattern) * m_iChannels + Channel);
+}
+
+int CSymbolTable::GetCount() const
+{
+	return m_iFirstSymbol[SYMBOL_KIND_COUNT];
+}
+
+CStringA CSymbolTable::GetName(int Symbol) const
+{
+	ASSERT(Symbol >= 0 && Symbol < GetCount());
+
+	int Kind = SYMBOL_NONE;
+
+	while (Symbol >= m_iFirstSymbol[Kind + 1])
+		++Kind;
+
+	const int Index = Symbol - m_iFirstSymbol[Kind];
+
+	CStringA Name;
+
+	switch (Kind) {
+		case SYMBOL_SONG_FRAME:
+			Name.Format(LABEL_NAMES[Kind], Index / MAX_FRAMES, Index % MAX_FRAMES);
+			break;
+		case SYMBOL_PATTERN:
+			Name.Format(LABEL_NAMES[Kind], Index / (MAX_PATTERN * m_iChannels), (Index / m_iChannels) % MAX_PATTERN, Index % m_iChannels);
+			break;
+		default:
+			// Labels without arguments ignore the index
+			Name.Format(LABEL_NAMES[Kind], Index);
+			break;
+	}
+
+	return Name;
+}
+
 /**
  * CChunk - Stores NSF data
  *
  */
 
-CChunk::CChunk(chunk_type_t Type, CStringA label) : m_iType(Type), m_strLabel(label), m_iBank(0)
+CChunk::CChunk(chunk_type_t Type, int Label, CSymbolTable *pSymbols) : m_iType(Type), m_iLabel(Label), m_pSymbols(pSymbols), m_iBank(0)
 {
+	ASSERT(m_pSymbols != NULL);
 }
 
 CChunk::~CChunk()
@@ -51,9 +162,14 @@ chunk_type_t CChunk::GetType() const
 	return m_iType;
 }
 
-LPCSTR CChunk::GetLabel() const
+CStringA CChunk::GetLabel() const
 {
-	return m_strLabel;
+	return m_pSymbols->GetName(m_iLabel);
+}
+
+int CChunk::GetLabelSymbol() const
+{
+	return m_iLabel;
 }
 
 void CChunk::SetBank(unsigned char Bank)
@@ -92,14 +208,19 @@ void CChunk::StoreWord(unsigned short data)
 	m_vChunkData.push_back(new CChunkDataWord(data));
 }
 
-void CChunk::StoreReference(CStringA refName)
+void CChunk::StoreReference(int refSymbol)
+{
+	m_vChunkData.push_back(new CChunkDataReference(refSymbol));
+}
+
+void CChunk::StoreReference(symbol_kind_t Kind, int Index)
 {
-	m_vChunkData.push_back(new CChunkDataReference(refName));
+	m_vChunkData.push_back(new CChunkDataReference(m_pSymbols->GetSymbol(Kind, Index)));
 }
 
-void CChunk::StoreBankReference(CStringA refName, int bank)
+void CChunk::StoreBankReference(int refSymbol, int bank)
 {
-	m_vChunkData.push_back(new CChunkDataBank(refName, bank));
+	m_vChunkData.push_back(new CChunkDataBank(refSymbol, bank));
 }
 
 void CChunk::StoreString(const std::vector<char> &data)
@@ -129,22 +250,32 @@ const std::vector<char> &CChunk::GetStringData(int index) const
 	return (static_cast<CChunkDataString*>(m_vChunkData[index]))->m_vData;
 }
 
-LPCSTR CChunk::GetDataRefName(int index) const
+CStringA CChunk::GetDataRefName(int index) const
 {	
 	CChunkDataReference *pChunkData = dynamic_cast<CChunkDataReference*>(m_vChunkData[index]);
 
 	if (pChunkData != NULL)
-		return pChunkData->m_refName;
+		return m_pSymbols->GetName(pChunkData->m_iRefSymbol);
 
 	return "";
 }
 
-void CChunk::UpdateDataRefName(int index, CStringA &name)
+int CChunk::GetDataRefSymbol(int index) const
+{
+	CChunkDataReference *pChunkData = dynamic_cast<CChunkDataReference*>(m_vChunkData[index]);
+
+	if (pChunkData != NULL)
+		return pChunkData->m_iRefSymbol;
+
+	return -1;
+}
+
+void CChunk::UpdateDataRefSymbol(int index, int refSymbol)
 {
 	CChunkDataReference *pChunkData = dynamic_cast<CChunkDataReference*>(m_vChunkData[index]);
 
 	if (pChunkData != NULL)
-		pChunkData->m_refName = name;
+		pChunkData->m_iRefSymbol = refSymbol;
 }
 
 bool CChunk::IsDataReference(int index) const 
@@ -168,11 +299,12 @@ unsigned int CChunk::CountDataSize() const
 	return Size;
 }
 
-void CChunk::AssignLabels(CMap<CStringA, LPCSTR, int, int> &labelMap)
+void CChunk::AssignLabels(const std::vector<int> &Labels)
 {
+	// Labels is indexed by symbol
 	for (std::vector<CChunkData*>::iterator it = m_vChunkData.begin(); it != m_vChunkData.end(); ++it) {
 		CChunkDataReference *pChunkData = dynamic_cast<CChunkDataReference*>(*it);
 		if (pChunkData != NULL)
-			pChunkData->ref = labelMap[pChunkData->m_refName];
+			pChunkData->ref = Labels[pChunkData->m_iRefSymbol];
 	}
 }
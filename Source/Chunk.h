@@ -25,6 +25,51 @@
 
 // Helper classes/objects for NSF compiling
 
+//
+// Label symbols, each kind of label has a range of symbols numbered by its index
+//
+
+enum symbol_kind_t {
+	SYMBOL_NONE,				// Chunks without a label
+	SYMBOL_SONG_LIST,
+	SYMBOL_INSTRUMENT_LIST,
+	SYMBOL_SAMPLES_LIST,
+	SYMBOL_SAMPLES,
+	SYMBOL_WAVETABLE,
+	SYMBOL_WAVES,				// Instrument
+	SYMBOL_SEQ_2A03,			// Sequence * SEQ_COUNT + type
+	SYMBOL_SEQ_VRC6,			// Sequence * SEQ_COUNT + type
+	SYMBOL_SEQ_N163,			// Sequence * SEQ_COUNT + type
+	SYMBOL_SEQ_FDS,				// Instrument * SEQ_COUNT + type
+	SYMBOL_INSTRUMENT,			// Instrument list position
+	SYMBOL_SONG,				// Track
+	SYMBOL_SONG_FRAMES,			// Track
+	SYMBOL_SONG_FRAME,			// Track and frame
+	SYMBOL_PATTERN,				// Track, pattern and channel
+	SYMBOL_KIND_COUNT
+};
+
+class CSymbolTable
+{
+public:
+	CSymbolTable();
+
+	void	Setup(int Tracks, int Channels);	// Sets the number of symbols for songs and patterns
+	int		GetSymbol(symbol_kind_t Kind, int Index = 0) const;
+	int		GetFrameSymbol(int Track, int Frame) const;
+	int		GetPatternSymbol(int Track, int Pattern, int Channel) const;
+	int		GetCount() const;
+	CStringA GetName(int Symbol) const;		// Assembly label, only used for text export
+
+private:
+	static const char *const LABEL_NAMES[SYMBOL_KIND_COUNT];
+
+private:
+	int		m_iTracks;
+	int		m_iChannels;
+	int		m_iFirstSymbol[SYMBOL_KIND_COUNT + 1];
+};
+
 //
 // Chunk data classes
 //
@@ -59,20 +104,20 @@ public:
 class CChunkDataReference : public CChunkData
 {
 public:
-	CChunkDataReference(CStringA refName) : CChunkData(), m_refName(refName), ref(-1) {}
+	CChunkDataReference(int refSymbol) : CChunkData(), m_iRefSymbol(refSymbol), ref(-1) {}
 	int GetSize() const { return 2; }
 	unsigned short GetData() const { return ref; };
-	CStringA m_refName;
+	int m_iRefSymbol;
 	unsigned short ref;
 };
 
 class CChunkDataBank : public CChunkData
 {
 public:
-	CChunkDataBank(CStringA bankOf, int bank) : CChunkData(), m_bankOf(bankOf), m_bank(bank) {}
+	CChunkDataBank(int bankOf, int bank) : CChunkData(), m_iBankOf(bankOf), m_bank(bank) {}
 	int GetSize() const { return 1; }
 	unsigned short GetData() const { return m_bank; };
-	CStringA m_bankOf;	// Reference to a label which belongs to the bank this data should point to
+	int m_iBankOf;		// Symbol of a label which belongs to the bank this data should point to
 	unsigned int m_bank;
 };
 
@@ -111,13 +156,14 @@ enum chunk_type_t {
 class CChunk
 {
 public:
-	CChunk(chunk_type_t Type, CStringA label);
+	CChunk(chunk_type_t Type, int Label, CSymbolTable *pSymbols);
 	~CChunk();
 
 	void			Clear();
 
 	chunk_type_t	GetType() const;
-	LPCSTR			GetLabel() const;
+	CStringA		GetLabel() const;
+	int				GetLabelSymbol() const;
 	void			SetBank(unsigned char Bank);
 	unsigned char	GetBank() const;
 
@@ -127,31 +173,34 @@ public:
 
 	void			StoreByte(unsigned char data);
 	void			StoreWord(unsigned short data);
-	void			StoreReference(CStringA refName);
-	void			StoreBankReference(CStringA refName, int bank);
+	void			StoreReference(int refSymbol);
+	void			StoreReference(symbol_kind_t Kind, int Index);
+	void			StoreBankReference(int refSymbol, int bank);
 	void			StoreString(const std::vector<char> &data);
 
 	void			ChangeByte(int index, unsigned char data);
 	void			SetupBankData(int index, unsigned char bank);
 
 	unsigned char	GetStringData(int index, int pos) const;
-	LPCSTR			GetDataRefName(int index) const;
+	CStringA		GetDataRefName(int index) const;
+	int				GetDataRefSymbol(int index) const;
 	
 	bool			IsDataReference(int index) const;
 	bool			IsDataBank(int index) const;
 
 	const std::vector<char> &GetStringData(int index) const;
 
-	void			UpdateDataRefName(int index, CStringA &name);
+	void			UpdateDataRefSymbol(int index, int refSymbol);
 
 	unsigned int	CountDataSize() const;
 
-	void			AssignLabels(CMap<CStringA, LPCSTR, int, int> &labelMap);
+	void			AssignLabels(const std::vector<int> &Labels);
 
 private:
 	std::vector<CChunkData*> m_vChunkData;	// List of data stored in this chunk
 
-	CStringA m_strLabel;		// Label of this chunk
+	CSymbolTable *m_pSymbols;	// Symbol table for labels
+	int m_iLabel;				// Label symbol of this chunk
 	unsigned char m_iBank;		// The bank this chunk will be stored in
 	chunk_type_t m_iType;		// Chunk type
 };
@@ -185,6 +185,11 @@ int CChunkRenderNSF::GetBankCount() const
 	return GetBank() + 1;
 }
 
+const std::vector<unsigned int> &CChunkRenderNSF::GetChunkOffsets() const
+{
+	return m_vChunkOffsets;
+}
+
 void CChunkRenderNSF::StoreChunkBankswitched(const CChunk *pChunk)
 {
 	switch (pChunk->GetType()) {			
@@ -202,6 +207,8 @@ void CChunkRenderNSF::StoreChunkBankswitched(const CChunk *pChunk)
 
 void CChunkRenderNSF::StoreChunk(const CChunk *pChunk)
 {
+	m_vChunkOffsets.push_back(GetWritten());
+
 	for (int i = 0; i < pChunk->GetLength(); ++i) {
 		if (pChunk->GetType() == CHUNK_PATTERN) {
 			const std::vector<char> &vec = pChunk->GetStringData(CCompiler::PATTERN_CHUNK_INDEX);
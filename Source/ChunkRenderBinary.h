@@ -66,6 +66,7 @@ public:
 	void StoreSamples(const std::vector<const CDSample*> &Samples);
 	void StoreSamplesBankswitched(const std::vector<const CDSample*> &Samples);
 	int  GetBankCount() const;
+	const std::vector<unsigned int> &GetChunkOffsets() const;
 
 protected:
 	void StoreChunk(const CChunk *pChunk);
@@ -81,6 +82,7 @@ protected:
 protected:
 	unsigned int m_iStartAddr;
 	unsigned int m_iSampleAddr;
+	std::vector<unsigned int> m_vChunkOffsets;		// Data offset of each stored chunk
 };
 
 // NES render
@@ -155,13 +155,13 @@ void CChunkRenderText::StoreHeaderChunk(CChunk *pChunk, CFile *pFile)
 	int len = pChunk->GetLength();
 	int i = 0;
 
-	str.AppendFormat("\t.word %s\n", pChunk->GetDataRefName(i++));
-	str.AppendFormat("\t.word %s\n", pChunk->GetDataRefName(i++));
-	str.AppendFormat("\t.word %s\n", pChunk->GetDataRefName(i++));
-	str.AppendFormat("\t.word %s\n", pChunk->GetDataRefName(i++));
+	str.AppendFormat("\t.word %s\n", LPCSTR(pChunk->GetDataRefName(i++)));
+	str.AppendFormat("\t.word %s\n", LPCSTR(pChunk->GetDataRefName(i++)));
+	str.AppendFormat("\t.word %s\n", LPCSTR(pChunk->GetDataRefName(i++)));
+	str.AppendFormat("\t.word %s\n", LPCSTR(pChunk->GetDataRefName(i++)));
 	str.AppendFormat("\t.byte %i ; flags\n", pChunk->GetData(i++));
 	if (pChunk->IsDataReference(i))
-		str.AppendFormat("\t.word %s\n", pChunk->GetDataRefName(i++));	// FDS waves
+		str.AppendFormat("\t.word %s\n", LPCSTR(pChunk->GetDataRefName(i++)));	// FDS waves
 	str.AppendFormat("\t.word %i ; NTSC speed\n", pChunk->GetData(i++));
 	str.AppendFormat("\t.word %i ; PAL speed\n", pChunk->GetData(i++));
 	if (i < pChunk->GetLength())
@@ -175,10 +175,10 @@ void CChunkRenderText::StoreInstrumentListChunk(CChunk *pChunk, CFile *pFile)
 	CString str;
 
 	// Store instrument pointers
-	str.Format(_T("%s:\n"), pChunk->GetLabel());
+	str.Format(_T("%s:\n"), LPCSTR(pChunk->GetLabel()));
 
 	for (int i = 0; i < pChunk->GetLength(); ++i) {
-		str.AppendFormat(_T("\t.word %s\n"), pChunk->GetDataRefName(i));
+		str.AppendFormat(_T("\t.word %s\n"), LPCSTR(pChunk->GetDataRefName(i)));
 	}
 
 	m_instrumentListStrings.Add(str);
@@ -189,11 +189,11 @@ void CChunkRenderText::StoreInstrumentChunk(CChunk *pChunk, CFile *pFile)
 	CStringA str;
 	int len = pChunk->GetLength();
 
-	str.Format("%s:\n\t.byte %i\n", pChunk->GetLabel(), pChunk->GetData(0));
+	str.Format("%s:\n\t.byte %i\n", LPCSTR(pChunk->GetLabel()), pChunk->GetData(0));
 
 	for (int i = 1; i < len; ++i) {
 		if (pChunk->IsDataReference(i)) {
-			str.AppendFormat("\t.word %s\n", pChunk->GetDataRefName(i));
+			str.AppendFormat("\t.word %s\n", LPCSTR(pChunk->GetDataRefName(i)));
 		}
 		else {
 			if (pChunk->GetDataSize(i) == 1) {
@@ -214,7 +214,7 @@ void CChunkRenderText::StoreSequenceChunk(CChunk *pChunk, CFile *pFile)
 {
 	CStringA str;
 
-	str.Format("%s:\n", pChunk->GetLabel());
+	str.Format("%s:\n", LPCSTR(pChunk->GetLabel()));
 	StoreByteString(pChunk, str, DEFAULT_LINE_BREAK);
 
 	m_sequenceStrings.Add(str);
@@ -225,7 +225,7 @@ void CChunkRenderText::StoreSampleListChunk(CChunk *pChunk, CFile *pFile)
 	CStringA str;
 
 	// Store sample list
-	str.Format("%s:\n", pChunk->GetLabel());
+	str.Format("%s:\n", LPCSTR(pChunk->GetLabel()));
 
 	for (int i = 0; i < pChunk->GetLength(); i += 3) {
 		str.AppendFormat("\t.byte %i, %i, %i\n", pChunk->GetData(i + 0), pChunk->GetData(i + 1), pChunk->GetData(i + 2));
@@ -240,7 +240,7 @@ void CChunkRenderText::StoreSamplePointersChunk(CChunk *pChunk, CFile *pFile)
 	int len = pChunk->GetLength();
 
 	// Store sample pointer
-	str.Format("%s:\n", pChunk->GetLabel());
+	str.Format("%s:\n", LPCSTR(pChunk->GetLabel()));
 
 	if (len > 0) {
 		str.Append("\t.byte ");
@@ -262,10 +262,10 @@ void CChunkRenderText::StoreSongListChunk(CChunk *pChunk, CFile *pFile)
 {
 	CStringA str;
 
-	str.Format("%s:\n", pChunk->GetLabel());
+	str.Format("%s:\n", LPCSTR(pChunk->GetLabel()));
 
 	for (int i = 0; i < pChunk->GetLength(); ++i) {
-		str.AppendFormat("\t.word %s\n", pChunk->GetDataRefName(i));
+		str.AppendFormat("\t.word %s\n", LPCSTR(pChunk->GetDataRefName(i)));
 	}
 
 	m_songListStrings.Add(str);
@@ -275,10 +275,10 @@ void CChunkRenderText::StoreSongChunk(CChunk *pChunk, CFile *pFile)
 {
 	CStringA str;
 
-	str.Format("%s:\n", pChunk->GetLabel());
+	str.Format("%s:\n", LPCSTR(pChunk->GetLabel()));
 
 	for (int i = 0; i < pChunk->GetLength();) {
-		str.AppendFormat("\t.word %s\n", pChunk->GetDataRefName(i++));
+		str.AppendFormat("\t.word %s\n", LPCSTR(pChunk->GetDataRefName(i++)));
 		str.AppendFormat("\t.byte %i\t; frame count\n", pChunk->GetData(i++));
 		str.AppendFormat("\t.byte %i\t; pattern length\n", pChunk->GetData(i++));
 		str.AppendFormat("\t.byte %i\t; speed\n", pChunk->GetData(i++));
@@ -297,10 +297,10 @@ void CChunkRenderText::StoreFrameListChunk(CChunk *pChunk, CFile *pFile)
 
 	// Pointers to frames
 	str.Format("; Bank %i\n", pChunk->GetBank());
-	str.AppendFormat("%s:\n", pChunk->GetLabel());
+	str.AppendFormat("%s:\n", LPCSTR(pChunk->GetLabel()));
 
 	for (int i = 0; i < pChunk->GetLength(); ++i) {
-		str.AppendFormat("\t.word %s\n", pChunk->GetDataRefName(i));
+		str.AppendFormat("\t.word %s\n", LPCSTR(pChunk->GetDataRefName(i)));
 	}
 
 	m_songDataStrings.Add(str);
@@ -312,18 +312,18 @@ void CChunkRenderText::StoreFrameChunk(CChunk *pChunk, CFile *pFile)
 	int len = pChunk->GetLength();
 
 	// Frame list
-	str.Format("%s:\n\t.word ", pChunk->GetLabel());
+	str.Format("%s:\n\t.word ", LPCSTR(pChunk->GetLabel()));
 
 	for (int i = 0, j = 0; i < len; ++i) {
 		if (pChunk->IsDataReference(i))
-			str.AppendFormat("%s%s", (j++ > 0) ? _T(", ") : _T(""), pChunk->GetDataRefName(i));
+			str.AppendFormat("%s%s", (j++ > 0) ? _T(", ") : _T(""), LPCSTR(pChunk->GetDataRefName(i)));
 	}
 
 	// Bank values
 	for (int i = 0, j = 0; i < len; ++i) {
 		if (pChunk->IsDataBank(i)) {
 			if (j == 0) {
-				str.AppendFormat("\n\t.byte ", pChunk->GetLabel());
+				str.Append("\n\t.byte ");
 			}
 			str.AppendFormat("%s$%02X", (j++ > 0) ? _T(", ") : _T(""), pChunk->GetData(i));
 		}
@@ -341,7 +341,7 @@ void CChunkRenderText::StorePatternChunk(CChunk *pChunk, CFile *pFile)
 
 	// Patterns
 	str.Format("; Bank %i\n", pChunk->GetBank());
-	str.AppendFormat("%s:\n", pChunk->GetLabel());
+	str.AppendFormat("%s:\n", LPCSTR(pChunk->GetLabel()));
 
 	const std::vector<char> &vec = pChunk->GetStringData(0);
 	len = vec.size();
@@ -369,7 +369,7 @@ void CChunkRenderText::StoreWavetableChunk(CChunk *pChunk, CFile *pFile)
 	int len = pChunk->GetLength();
 
 	// FDS waves
-	str.Format("%s:\n", pChunk->GetLabel());
+	str.Format("%s:\n", LPCSTR(pChunk->GetLabel()));
 	str.Append("\t.byte ");
 
 	for (int i = 0; i < len; ++i) {
@@ -396,7 +396,7 @@ void CChunkRenderText::StoreWavesChunk(CChunk *pChunk, CFile *pFile)
 	int wave_len = 16;//(len - 1) / waves;
 
 	// Namco waves
-	str.Format("%s:\n", pChunk->GetLabel());
+	str.Format("%s:\n", LPCSTR(pChunk->GetLabel()));
 //				str.AppendFormat("\t.byte %i\n", waves);
 	
 	str.Append("\t.byte ");
@@ -0,0 +1,90 @@
+/*
+** FamiTracker - NES/Famicom sound tracker
+** Copyright (C) 2005-2014  Jonathan Liss
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+*/
+
+#include "stdafx.h"
+#include "FamiTrackerDoc.h"
+#include "SoundGen.h"
+#include "CommandQueue.h"
+
+// Slot sequence numbers:
+//  Sequence == Pos				slot is free and may be claimed by the writer at Pos
+//  Sequence == Pos + 1			slot holds the command written at Pos
+//  Sequence == Pos + QUEUE_SIZE	slot has been read and is free for the next lap
+
+CCommandQueue::CCommandQueue() : m_iWritePos(0), m_iReadPos(0)
+{
+	for (LONG i = 0; i < QUEUE_SIZE; ++i)
+		m_Slots[i].Sequence = i;
+}
+
+bool CCommandQueue::Push(const stPlayerCommand &Command)
+{
+	LONG Pos = m_iWritePos;
+	stSlot *pSlot;
+
+	// Claim a slot
+	for (;;) {
+		pSlot = &m_Slots[Pos & (QUEUE_SIZE - 1)];
+		LONG Diff = pSlot->Sequence - Pos;
+		if (Diff == 0) {
+			LONG Prev = InterlockedCompareExchange(&m_iWritePos, Pos + 1, Pos);
+			if (Prev == Pos)
+				break;
+			Pos = Prev;
+		}
+		else if (Diff < 0)
+			return false;	// Full
+		else
+			Pos = m_iWritePos;
+	}
+
+	pSlot->Command = Command;
+
+	// Publish, the interlocked write orders it after the command data
+	InterlockedExchange(&pSlot->Sequence, Pos + 1);
+
+	return true;
+}
+
+bool CCommandQueue::Pop(stPlayerCommand &Command)
+{
+	stSlot *pSlot = &m_Slots[m_iReadPos & (QUEUE_SIZE - 1)];
+
+	if (pSlot->Sequence - (m_iReadPos + 1) < 0)
+		return false;	// Empty
+
+	Command = pSlot->Command;
+
+	// Hand the slot back to the writers
+	InterlockedExchange(&pSlot->Sequence, m_iReadPos + QUEUE_SIZE);
+	++m_iReadPos;
+
+	return true;
+}
+
+const stPlayerCommand *CCommandQueue::Peek() const
+{
+	const stSlot *pSlot = &m_Slots[m_iReadPos & (QUEUE_SIZE - 1)];
+
+	if (pSlot->Sequence - (m_iReadPos + 1) < 0)
+		return NULL;
+
+	return &pSlot->Command;
+}
@@ -0,0 +1,58 @@
+/*
+** FamiTracker - NES/Famicom sound tracker
+** Copyright (C) 2005-2014  Jonathan Liss
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+*/
+
+#pragma once
+
+
+// Command posted to the sound player thread
+struct stPlayerCommand {
+	player_command_t Command;
+	WPARAM			 wParam;
+	LPARAM			 lParam;
+	stChanNote		 Note;				// CMD_QUEUE_NOTE only
+	LARGE_INTEGER	 Timestamp;			// Performance counter value when the command was posted
+};
+
+// Bounded lock-free command queue, any number of threads may post but only the player thread reads.
+// Each slot carries a sequence number telling whether it is free for writing or holds a command.
+class CCommandQueue {
+public:
+	CCommandQueue();
+
+	// Any thread, returns false if the queue is full
+	bool Push(const stPlayerCommand &Command);
+
+	// Player thread only
+	bool Pop(stPlayerCommand &Command);
+	const stPlayerCommand *Peek() const;
+
+public:
+	static const LONG QUEUE_SIZE = 256;		// Must be a power of two
+
+private:
+	struct stSlot {
+		volatile LONG	Sequence;
+		stPlayerCommand Command;
+	};
+
+	stSlot			m_Slots[QUEUE_SIZE];
+	volatile LONG	m_iWritePos;
+	LONG			m_iReadPos;
+};
@@ -47,7 +47,7 @@ struct stDPCMState {
 // Used to play the audio when the buffer is full
 class IAudioCallback {
 public:
-	virtual void FlushBuffer(int16 *Buffer, uint32 Size) = 0;
+	virtual void FlushBuffer(int32 *Buffer, uint32 Size) = 0;
 };
 
 
@@ -21,17 +21,24 @@
 #include <boost/scoped_array.hpp>
 #include <map>
 #include <vector>
+#include <algorithm>
 #include "stdafx.h"
 #include "FamiTracker.h"
 #include "FamiTrackerDoc.h"
 #include "PatternCompiler.h"
+#include "PatternMatcher.h"
 #include "Compiler.h"
+#include "DriverProfiler.h"
+#include "TrackSnapshot.h"
+#include "ControlPlayer.h"
 #include "Chunk.h"
 #include "ChunkRenderText.h"
 #include "ChunkRenderBinary.h"
 #include "Driver.h"
 #include "SoundGen.h"
 #include "APU/APU.h"
+#include "TrackerChannel.h"
+#include "Settings.h"
 
 //
 // This is the new NSF data compiler, music is compiled to an object list instead of a binary chunk
@@ -104,23 +111,12 @@ const int CCompiler::DPCM_SWITCH_ADDRESS		= 0xF000;	// Switch to new banks when
 
 const bool CCompiler::LAST_BANK_FIXED			= true;		// Fix for TNS carts
 
+// Content hash (64-bit FNV-1a)
+const ULONGLONG CCompiler::HASH_OFFSET			= 14695981039346656037ULL;
+const ULONGLONG CCompiler::HASH_PRIME			= 1099511628211ULL;
+
 // Assembly labels
-const char CCompiler::LABEL_SONG_LIST[]			= "ft_song_list";
-const char CCompiler::LABEL_INSTRUMENT_LIST[]	= "ft_instrument_list";
-const char CCompiler::LABEL_SAMPLES_LIST[]		= "ft_sample_list";
-const char CCompiler::LABEL_SAMPLES[]			= "ft_samples";
-const char CCompiler::LABEL_WAVETABLE[]			= "ft_wave_table";
 const char CCompiler::LABEL_SAMPLE[]			= "ft_sample_%i";			// one argument
-const char CCompiler::LABEL_WAVES[]				= "ft_waves_%i";			// one argument
-const char CCompiler::LABEL_SEQ_2A03[]			= "ft_seq_2a03_%i";			// one argument
-const char CCompiler::LABEL_SEQ_VRC6[]			= "ft_seq_vrc6_%i";			// one argument
-const char CCompiler::LABEL_SEQ_FDS[]			= "ft_seq_fds_%i";			// one argument
-const char CCompiler::LABEL_SEQ_N163[]			= "ft_seq_n163_%i";			// one argument
-const char CCompiler::LABEL_INSTRUMENT[]		= "ft_inst_%i";				// one argument
-const char CCompiler::LABEL_SONG[]				= "ft_song_%i";				// one argument
-const char CCompiler::LABEL_SONG_FRAMES[]		= "ft_s%i_frames";			// one argument
-const char CCompiler::LABEL_SONG_FRAME[]		= "ft_s%if%i";				// two arguments
-const char CCompiler::LABEL_PATTERN[]			= "ft_s%ip%ic%i";			// three arguments
 
 // Flag byte flags
 const int CCompiler::FLAG_BANKSWITCHED	= 1 << 0;
@@ -139,16 +135,54 @@ unsigned int CCompiler::AdjustSampleAddress(unsigned int Address)
 	return (0x40 - (Address & 0x3F)) & 0x3F;
 }
 
+ULONGLONG CCompiler::HashData(const std::vector<char> &Data)
+{
+	// Hash used to find duplicated data, equal hashes must still be verified
+	ULONGLONG Hash = HASH_OFFSET;
+
+	for (std::vector<char>::const_iterator it = Data.begin(); it != Data.end(); ++it)
+		Hash = (Hash ^ (unsigned char)*it) * HASH_PRIME;
+
+	return Hash;
+}
+
+// Compiled pattern data, all patterns are compiled in parallel before the songs are stored
+
+struct stCompiledPattern {
+	unsigned int Track;
+	int Pattern;
+	int Channel;
+	std::vector<char> Data;
+	std::vector<CPatternCompiler::stEntryPoint> Entries;
+	std::vector<unsigned int> Rows;
+	ULONGLONG Hash;
+	CString Log;			// Pattern compiler messages
+};
+
+// Collects messages from one pattern so they can be printed in the original order
+class CPatternLog : public CCompilerLog
+{
+public:
+	CPatternLog(CString &Text) : m_Text(Text) {}
+	void WriteLog(LPCTSTR text) { m_Text.Append(text); }
+	void Clear() { m_Text.Empty(); }
+private:
+	CString &m_Text;
+};
+
 // CCompiler
 
 CCompiler::CCompiler(CFamiTrackerDoc *pDoc, CCompilerLog *pLogger) : 
 	m_pDocument(pDoc), 
 	m_pLogger(pLogger),
+	m_pSymbols(new CSymbolTable()),
 	m_iWaveTables(0),
 	m_pSamplePointersChunk(NULL),
 	m_pHeaderChunk(NULL),
 	m_pDriverData(NULL),
 	m_iLastBank(0),
+	m_iNextCompiledPattern(0),
+	m_iNextStoredPattern(0),
 	m_iHashCollisions(0)
 {
 	ASSERT(CCompiler::pCompiler == NULL);
@@ -161,6 +195,7 @@ CCompiler::~CCompiler()
 
 	Cleanup();
 
+	SAFE_RELEASE(m_pSymbols);
 	SAFE_RELEASE(m_pLogger);
 }
 
@@ -334,11 +369,9 @@ void CCompiler::ExportNSF(LPCTSTR lpszFileName, int MachineType)
 	stNSFHeader Header;
 	CreateHeader(&Header, MachineType);
 
-	// Write header
-	OutputFile.Write(&Header, sizeof(stNSFHeader));
-
-	// Write NSF data
-	CChunkRenderNSF Render(&OutputFile, m_iLoadAddress);
+	// Render NSF data, it's kept in memory for the driver profiler
+	CMemFile NSFData;
+	CChunkRenderNSF Render(&NSFData, m_iLoadAddress);
 
 	if (m_bBankSwitched) {
 		Render.StoreDriver(pDriver, m_iDriverSize);
@@ -358,6 +391,14 @@ void CCompiler::ExportNSF(LPCTSTR lpszFileName, int MachineType)
 		}
 	}
 
+	std::vector<char> Data((unsigned int)NSFData.GetLength());
+	NSFData.SeekToBegin();
+	NSFData.Read(&Data.front(), Data.size());
+
+	// Write header and data
+	OutputFile.Write(&Header, sizeof(stNSFHeader));
+	OutputFile.Write(&Data.front(), Data.size());
+
 	// Writing done, print some stats
 	Print(_T(" * NSF load address: $%04X\n"), m_iLoadAddress);
 	Print(_T("Writing output file...\n"));
@@ -380,9 +421,76 @@ void CCompiler::ExportNSF(LPCTSTR lpszFileName, int MachineType)
 	// Done
 	OutputFile.Close();
 
+	// Measure driver CPU usage
+	if (theApp.GetSettings()->Export.bProfileDriver)
+		ProfileDriver(&Header, Data, Render.GetChunkOffsets());
+
 	Cleanup();
 }
 
+bool CCompiler::MeasureNSF(stNSFSize &Size)
+{
+	// Runs the NSF export without writing a file, the driver is not patched since only the size is needed
+
+	ClearLog();
+
+	if (!CompileData()) {
+		Cleanup();
+		return false;
+	}
+
+	if (m_bBankSwitched) {
+		AddBankswitching();
+		if (!ResolveLabelsBankswitched()) {
+			Cleanup();
+			return false;
+		}
+		UpdateFrameBanks();
+		UpdateSongBanks();
+	}
+	else {
+		ResolveLabels();
+		ClearSongBanks();
+	}
+
+	UpdateSamplePointers(m_iSampleStart);
+
+	// Same layout as ExportNSF
+	bool bCompressedMode = !((PAGE_SAMPLES - m_iDriverSize - m_iMusicDataSize) < 0x8000 || m_bBankSwitched);
+	m_iLoadAddress = bCompressedMode ? (PAGE_SAMPLES - m_iDriverSize - m_iMusicDataSize) : PAGE_START;
+
+	std::vector<char> Driver(m_iDriverSize);
+
+	CMemFile NSFData;
+	CChunkRenderNSF Render(&NSFData, m_iLoadAddress);
+
+	if (m_bBankSwitched) {
+		Render.StoreDriver(&Driver.front(), m_iDriverSize);
+		Render.StoreChunksBankswitched(m_vChunks);
+		Render.StoreSamplesBankswitched(m_vSamples);
+	}
+	else if (bCompressedMode) {
+		Render.StoreChunks(m_vChunks);
+		Render.StoreDriver(&Driver.front(), m_iDriverSize);
+		Render.StoreSamples(m_vSamples);
+	}
+	else {
+		Render.StoreDriver(&Driver.front(), m_iDriverSize);
+		Render.StoreChunks(m_vChunks);
+		Render.StoreSamples(m_vSamples);
+	}
+
+	Size.DriverSize = m_iDriverSize;
+	Size.MusicSize = m_iMusicDataSize;
+	Size.SamplesSize = m_iSamplesSize;
+	Size.FileSize = sizeof(stNSFHeader) + (unsigned int)NSFData.GetLength();
+	Size.bBankswitched = m_bBankSwitched;
+
+	Cleanup();
+
+	return true;
+}
+
 void CCompiler::ExportNES(LPCTSTR lpszFileName, bool EnablePAL)
 {
 	// 32kb NROM, no CHR
@@ -481,6 +589,9 @@ void CCompiler::ExportBIN(LPCTSTR lpszBIN_File, LPCTSTR lpszDPCM_File)
 	// Convert to binary
 	ResolveLabels();
 
+	// Rewrite DPCM sample pointers
+	UpdateSamplePointers(m_iSampleStart);
+
 	CFile OutputFileBIN;
 	if (!OpenFile(lpszBIN_File, OutputFileBIN)) {
 		return;
@@ -776,7 +887,9 @@ void CCompiler::UpdateSamplePointers(unsigned int Origin)
 
 	m_pSamplePointersChunk->Clear();
 
-	// The list is stored in the same order as the samples vector
+	// Locate the stored samples, they are written in the same order as the samples vector
+
+	std::vector<unsigned int> SampleAddress, SampleBank;
 
 	for (std::vector<const CDSample*>::iterator it = m_vSamples.begin(); it != m_vSamples.end(); ++it) {
 		const CDSample *pDSample = *it;
@@ -789,10 +902,8 @@ void CCompiler::UpdateSamplePointers(unsigned int Origin)
 			}
 		}
 
-		// Store
-		m_pSamplePointersChunk->StoreByte(Address >> 6);
-		m_pSamplePointersChunk->StoreByte(Size >> 4);
-		m_pSamplePointersChunk->StoreByte(Bank);
+		SampleAddress.push_back(Address);
+		SampleBank.push_back(Bank);
 
 #ifdef _DEBUG
 		Print(_T(" * DPCM sample %s: $%04X, bank %i (%i bytes)\n"), pDSample->GetName(), Address, Bank, Size);
@@ -800,6 +911,13 @@ void CCompiler::UpdateSamplePointers(unsigned int Origin)
 		Address += Size;
 		Address += AdjustSampleAddress(Address);
 	}
+
+	// Store pointers, shared samples point to the start of the stored sample
+	for (std::vector<stSamplePointer>::iterator it = m_vSamplePointers.begin(); it != m_vSamplePointers.end(); ++it) {
+		m_pSamplePointersChunk->StoreByte(SampleAddress[it->Sample] >> 6);
+		m_pSamplePointersChunk->StoreByte(it->Size >> 4);
+		m_pSamplePointersChunk->StoreByte(SampleBank[it->Sample]);
+	}
 #ifdef _DEBUG
 	Print(_T(" * DPCM sample banks: %i\n"), Bank - m_iFirstSampleBank + DPCM_PAGE_WINDOW);
 #endif
@@ -819,7 +937,7 @@ void CCompiler::UpdateFrameBanks()
 		if (pChunk->GetType() == CHUNK_FRAME) {
 			// Add bank data
 			for (int j = 0; j < Channels; ++j) {
-				unsigned char bank = GetObjectByRef(pChunk->GetDataRefName(j))->GetBank();
+				unsigned char bank = GetObjectByRef(pChunk->GetDataRefSymbol(j))->GetBank();
 				if (bank < PATTERN_SWITCH_BANK)
 					bank = PATTERN_SWITCH_BANK;
 				pChunk->SetupBankData(j + Channels, bank);
@@ -833,7 +951,7 @@ void CCompiler::UpdateSongBanks()
 	// Write bank numbers to song lists (can only be used when bankswitching is used)
 	for (std::vector<CChunk*>::iterator it = m_vSongChunks.begin(); it != m_vSongChunks.end(); ++it) {
 		CChunk *pChunk = *it;
-		int bank = GetObjectByRef(pChunk->GetDataRefName(0))->GetBank();
+		int bank = GetObjectByRef(pChunk->GetDataRefSymbol(0))->GetBank();
 		if (bank < PATTERN_SWITCH_BANK)
 			bank = PATTERN_SWITCH_BANK;
 		pChunk->SetupBankData(m_iSongBankReference, bank);
@@ -860,42 +978,42 @@ void CCompiler::EnableBankswitching()
 void CCompiler::ResolveLabels()
 {
 	// Resolve label addresses, no banks since bankswitching is disabled
-	CMap<CStringA, LPCSTR, int, int> labelMap;
+	std::vector<int> Labels(m_pSymbols->GetCount(), 0);
 
 	// Pass 1, collect labels
-	CollectLabels(labelMap);
+	CollectLabels(Labels);
 
 	// Pass 2
-	AssignLabels(labelMap);
+	AssignLabels(Labels);
 }
 
 bool CCompiler::ResolveLabelsBankswitched()
 {
 	// Resolve label addresses and banks
-	CMap<CStringA, LPCSTR, int, int> labelMap;
+	std::vector<int> Labels(m_pSymbols->GetCount(), 0);
 
 	// Pass 1, collect labels
-	if (!CollectLabelsBankswitched(labelMap))
+	if (!CollectLabelsBankswitched(Labels))
 		return false;
 
 	// Pass 2
-	AssignLabels(labelMap);
+	AssignLabels(Labels);
 
 	return true;
 }
 
-void CCompiler::CollectLabels(CMap<CStringA, LPCSTR, int, int> &labelMap) const
+void CCompiler::CollectLabels(std::vector<int> &Labels) const
 {
 	// Collect labels and assign offsets
 	int Offset = 0;
 	for (std::vector<CChunk*>::const_iterator it = m_vChunks.begin(); it != m_vChunks.end(); ++it) {
 		CChunk *pChunk = *it;
-		labelMap[pChunk->GetLabel()] = Offset;
+		Labels[pChunk->GetLabelSymbol()] = Offset;
 		Offset += pChunk->CountDataSize();
 	}
 }
 
-bool CCompiler::CollectLabelsBankswitched(CMap<CStringA, LPCSTR, int, int> &labelMap)
+bool CCompiler::CollectLabelsBankswitched(std::vector<int> &Labels)
 {
 	int Offset = 0;
 	int Bank = PATTERN_SWITCH_BANK;
@@ -911,7 +1029,7 @@ bool CCompiler::CollectLabelsBankswitched(CMap<CStringA, LPCSTR, int, int> &labe
 			case CHUNK_PATTERN:
 				break;
 			default:
-				labelMap[pChunk->GetLabel()] = Offset;
+				Labels[pChunk->GetLabelSymbol()] = Offset;
 				Offset += Size;
 		}
 	}
@@ -937,7 +1055,7 @@ bool CCompiler::CollectLabelsBankswitched(CMap<CStringA, LPCSTR, int, int> &labe
 					++Bank;
 				}
 			case CHUNK_FRAME:
-				labelMap[pChunk->GetLabel()] = Offset;
+				Labels[pChunk->GetLabelSymbol()] = Offset;
 				pChunk->SetBank(Bank < 4 ? ((Offset + m_iDriverSize) >> 12) : Bank);
 				Offset += Size;
 				break;
@@ -947,7 +1065,7 @@ bool CCompiler::CollectLabelsBankswitched(CMap<CStringA, LPCSTR, int, int> &labe
 					Offset = 0x3000 - m_iDriverSize;
 					++Bank;
 				}
-				labelMap[pChunk->GetLabel()] = Offset;
+				Labels[pChunk->GetLabelSymbol()] = Offset;
 				pChunk->SetBank(Bank < 4 ? ((Offset + m_iDriverSize) >> 12) : Bank);
 				Offset += Size;
 			default:
@@ -963,11 +1081,11 @@ bool CCompiler::CollectLabelsBankswitched(CMap<CStringA, LPCSTR, int, int> &labe
 	return true;
 }
 
-void CCompiler::AssignLabels(CMap<CStringA, LPCSTR, int, int> &labelMap)
+void CCompiler::AssignLabels(const std::vector<int> &Labels)
 {
 	// Pass 2: assign addresses to labels
 	for (std::vector<CChunk*>::iterator it = m_vChunks.begin(); it != m_vChunks.end(); ++it) {
-		(*it)->AssignLabels(labelMap);
+		(*it)->AssignLabels(Labels);
 	}
 }
 
@@ -1024,6 +1142,14 @@ bool CCompiler::CompileData()
 			return false;
 	}
 
+	// Songs longer than the driver supports can only be edited
+	for (unsigned int i = 0; i < m_pDocument->GetTrackCount(); ++i) {
+		if (m_pDocument->GetFrameCount(i) > MAX_DRIVER_FRAMES) {
+			Print(_T("Error: Song %i has more than %i frames\n"), i + 1, MAX_DRIVER_FRAMES);
+			return false;
+		}
+	}
+
 	// Driver size
 	m_iDriverSize = m_pDriverData->driver_size;
 
@@ -1032,6 +1158,9 @@ bool CCompiler::CompileData()
 
 	Print(_T("Building music data...\n"));
 
+	// Label symbols are numbered by the song and channel count
+	m_pSymbols->Setup(m_pDocument->GetTrackCount(), m_pDocument->GetAvailableChannels());
+
 	// Build music data
 	CreateMainHeader();
 	CreateSequenceList();
@@ -1083,14 +1212,18 @@ void CCompiler::Cleanup()
 	}
 
 	m_vChunks.clear();
+	m_vLabelChunks.clear();
 	m_vSequenceChunks.clear();
 	m_vInstrumentChunks.clear();
 	m_vSongChunks.clear();
 	m_vFrameChunks.clear();
 	m_vPatternChunks.clear();
+	m_vPatternRows.clear();
 
 	m_pSamplePointersChunk = NULL;	// This pointer is also stored in m_vChunks
 	m_pHeaderChunk = NULL;
+
+	ClearCompiledPatterns();
 }
 
 void CCompiler::AddBankswitching()
@@ -1104,7 +1237,7 @@ void CCompiler::AddBankswitching()
 			int Length = pChunk->GetLength();
 			// Bank data is located at end
 			for (int j = 0; j < Length; ++j) {
-				pChunk->StoreBankReference(pChunk->GetDataRefName(j), 0);
+				pChunk->StoreBankReference(pChunk->GetDataRefSymbol(j), 0);
 			}
 		}
 	}
@@ -1234,7 +1367,7 @@ void CCompiler::CreateMainHeader()
 
 	unsigned short DividerNTSC, DividerPAL;
 
-	CChunk *pChunk = CreateChunk(CHUNK_HEADER, "");
+	CChunk *pChunk = CreateChunk(CHUNK_HEADER, m_pSymbols->GetSymbol(SYMBOL_NONE));
 
 	if (TicksPerSec == 0) {
 		// Default
@@ -1251,17 +1384,17 @@ void CCompiler::CreateMainHeader()
 
 	// Write header
 
-	pChunk->StoreReference(LABEL_SONG_LIST);
-	pChunk->StoreReference(LABEL_INSTRUMENT_LIST);
-	pChunk->StoreReference(LABEL_SAMPLES_LIST);
-	pChunk->StoreReference(LABEL_SAMPLES);
+	pChunk->StoreReference(SYMBOL_SONG_LIST, 0);
+	pChunk->StoreReference(SYMBOL_INSTRUMENT_LIST, 0);
+	pChunk->StoreReference(SYMBOL_SAMPLES_LIST, 0);
+	pChunk->StoreReference(SYMBOL_SAMPLES, 0);
 	
 	m_iHeaderFlagOffset = pChunk->GetLength();		// Save the flags offset
 	pChunk->StoreByte(Flags);
 
 	// FDS table, only if FDS is enabled
 	if (m_pDocument->ExpansionEnabled(SNDCHIP_FDS))
-		pChunk->StoreReference(LABEL_WAVETABLE);
+		pChunk->StoreReference(SYMBOL_WAVETABLE, 0);
 
 	pChunk->StoreWord(DividerNTSC);
 	pChunk->StoreWord(DividerPAL);
@@ -1283,16 +1416,19 @@ void CCompiler::CreateSequenceList()
 
 	unsigned int Size = 0, StoredCount = 0;
 
+	m_iDuplicateSequences = 0;
+	m_iDuplicateSequenceSize = 0;
+
 	for (int i = 0; i < MAX_SEQUENCES; ++i) {
 		for (int j = 0; j < CInstrument2A03::SEQUENCE_COUNT; ++j) {
 			CSequence* pSeq = m_pDocument->GetSequence((unsigned)i, j);
 
 			if (m_bSequencesUsed2A03[i][j] && pSeq->GetItemCount() > 0) {
 				int Index = i * SEQ_COUNT + j;
-				CStringA label;
-				label.Format(LABEL_SEQ_2A03, Index);
-				Size += StoreSequence(pSeq, label);
-				++StoredCount;
+				int SeqSize = StoreSequence(pSeq, m_pSymbols->GetSymbol(SYMBOL_SEQ_2A03, Index));
+				Size += SeqSize;
+				if (SeqSize > 0)
+					++StoredCount;
 			}
 		}
 	}
@@ -1304,10 +1440,10 @@ void CCompiler::CreateSequenceList()
 
 				if (m_bSequencesUsedVRC6[i][j] && pSeq->GetItemCount() > 0) {
 					int Index = i * SEQ_COUNT + j;
-					CStringA label;
-					label.Format(LABEL_SEQ_VRC6, Index);
-					Size += StoreSequence(pSeq, label);
-					++StoredCount;
+					int SeqSize = StoreSequence(pSeq, m_pSymbols->GetSymbol(SYMBOL_SEQ_VRC6, Index));
+					Size += SeqSize;
+					if (SeqSize > 0)
+						++StoredCount;
 				}
 			}
 		}
@@ -1321,10 +1457,10 @@ void CCompiler::CreateSequenceList()
 
 				if (m_bSequencesUsedN163[i][j] && pSeq->GetItemCount() > 0) {
 					int Index = i * SEQ_COUNT + j;
-					CStringA label;
-					label.Format(LABEL_SEQ_N163, Index);
-					Size += StoreSequence(pSeq, label);
-					++StoredCount;
+					int SeqSize = StoreSequence(pSeq, m_pSymbols->GetSymbol(SYMBOL_SEQ_N163, Index));
+					Size += SeqSize;
+					if (SeqSize > 0)
+						++StoredCount;
 				}
 			}
 		}
@@ -1348,10 +1484,10 @@ void CCompiler::CreateSequenceList()
 					}
 					if (pSeq->GetItemCount() > 0) {
 						int Index = i * SEQ_COUNT + j;
-						CStringA label;
-						label.Format(LABEL_SEQ_FDS, Index);
-						Size += StoreSequence(pSeq, label);
-						++StoredCount;
+						int SeqSize = StoreSequence(pSeq, m_pSymbols->GetSymbol(SYMBOL_SEQ_FDS, Index));
+						Size += SeqSize;
+						if (SeqSize > 0)
+							++StoredCount;
 					}
 				}
 			}
@@ -1359,14 +1495,14 @@ void CCompiler::CreateSequenceList()
 	}
 
 	Print(_T(" * Sequences used: %i (%i bytes)\n"), StoredCount, Size);
+
+	if (m_iDuplicateSequences > 0)
+		Print(_T(" * %i duplicated sequence(s) removed (%i bytes saved)\n"), m_iDuplicateSequences, m_iDuplicateSequenceSize);
 }
 
-int CCompiler::StoreSequence(CSequence *pSeq, CStringA &label)
+int CCompiler::StoreSequence(CSequence *pSeq, int Symbol)
 {
-	CChunk *pChunk = CreateChunk(CHUNK_SEQUENCE, label);
-	m_vSequenceChunks.push_back(pChunk);
-
-	// Store the sequence
+	// Store the sequence, returns the number of bytes added or 0 for a duplicate
 	int iItemCount	  = pSeq->GetItemCount();
 	int iLoopPoint	  = pSeq->GetLoopPoint();
 	int iReleasePoint = pSeq->GetReleasePoint();
@@ -1380,15 +1516,43 @@ int CCompiler::StoreSequence(CSequence *pSeq, CStringA &label)
 	if (iLoopPoint > iItemCount)
 		iLoopPoint = -1;
 
-	pChunk->StoreByte((unsigned char)iItemCount);
-	pChunk->StoreByte((unsigned char)iLoopPoint);
-	pChunk->StoreByte((unsigned char)iReleasePoint);
-	pChunk->StoreByte((unsigned char)iSetting);
+	std::vector<char> Data;
+	Data.push_back((unsigned char)iItemCount);
+	Data.push_back((unsigned char)iLoopPoint);
+	Data.push_back((unsigned char)iReleasePoint);
+	Data.push_back((unsigned char)iSetting);
 
 	for (int i = 0; i < iItemCount; ++i) {
-		pChunk->StoreByte(pSeq->GetItem(i));
+		Data.push_back(pSeq->GetItem(i));
+	}
+
+	// Check for duplicate sequences
+	std::vector<CChunk*> &Bucket = m_SequenceMap[HashData(Data)];
+
+	for (std::vector<CChunk*>::const_iterator it = Bucket.begin(); it != Bucket.end(); ++it) {
+		CChunk *pDuplicate = *it;
+		bool Equal = (pDuplicate->GetLength() == (int)Data.size());
+		for (int i = 0; Equal && i < pDuplicate->GetLength(); ++i)
+			Equal = (pDuplicate->GetData(i) == (unsigned char)Data[i]);
+		if (Equal) {
+			// Reference the existing sequence instead
+			m_DuplicateMap[Symbol] = pDuplicate->GetLabelSymbol();
+			++m_iDuplicateSequences;
+			m_iDuplicateSequenceSize += Data.size();
+			return 0;
+		}
 	}
 
+	if (!Bucket.empty())
+		++m_iHashCollisions;
+
+	CChunk *pChunk = CreateChunk(CHUNK_SEQUENCE, Symbol);
+	m_vSequenceChunks.push_back(pChunk);
+	Bucket.push_back(pChunk);
+
+	for (std::vector<char>::const_iterator it = Data.begin(); it != Data.end(); ++it)
+		pChunk->StoreByte(*it);
+
 	// Return size of this chunk
 	return iItemCount + 4;
 }
@@ -1409,38 +1573,57 @@ void CCompiler::CreateInstrumentList()
 	CChunk *pWavesChunk = NULL;		// N163
 	int iWaveSize = 0;				// N163 waves size
 
-	CChunk *pInstListChunk = CreateChunk(CHUNK_INSTRUMENT_LIST, LABEL_INSTRUMENT_LIST);
+	CChunk *pInstListChunk = CreateChunk(CHUNK_INSTRUMENT_LIST, m_pSymbols->GetSymbol(SYMBOL_INSTRUMENT_LIST));
 	
 	if (m_pDocument->ExpansionEnabled(SNDCHIP_FDS)) {
-		pWavetableChunk = CreateChunk(CHUNK_WAVETABLE, LABEL_WAVETABLE);
+		pWavetableChunk = CreateChunk(CHUNK_WAVETABLE, m_pSymbols->GetSymbol(SYMBOL_WAVETABLE));
 	}
 
 	memset(m_iWaveBanks, -1, MAX_INSTRUMENTS * sizeof(int));
 
-	// Collect N163 waves
+	m_iDuplicateWaves = 0;
+	m_iDuplicateWaveSize = 0;
+
+	// Collect N163 waves, instruments with equal waves share the first stored wave
+	CMap<ULONGLONG, ULONGLONG, std::vector<int>, const std::vector<int>&> WaveMap;
+
 	for (unsigned int i = 0; i < m_iInstruments; ++i) {
 		int iIndex = m_iAssignedInstruments[i];
-		if (m_pDocument->GetInstrumentType(iIndex) == INST_N163 && m_iWaveBanks[i] == -1) {
+		if (m_pDocument->GetInstrumentType(iIndex) == INST_N163) {
 
 			CInstrumentContainer<CInstrumentN163> instContainer(m_pDocument, iIndex);
 			CInstrumentN163 *pInstrument = instContainer();
 
-			for (unsigned int j = i + 1; j < m_iInstruments; ++j) {
-				int inst = m_iAssignedInstruments[j];
-				if (m_pDocument->GetInstrumentType(inst) == INST_N163 && m_iWaveBanks[j] == -1) {
-					CInstrumentContainer<CInstrumentN163> instContainer(m_pDocument, inst);
-					CInstrumentN163 *pNewInst = instContainer();
-					if (pInstrument->IsWaveEqual(pNewInst)) {
-						m_iWaveBanks[j] = iIndex;
-					}
+			const int WaveCount = pInstrument->GetWaveCount();
+			const int WaveSize = pInstrument->GetWaveSize();
+
+			std::vector<char> Data;
+			Data.push_back(WaveCount);
+			Data.push_back(WaveSize);
+			for (int j = 0; j < WaveCount; ++j) {
+				for (int k = 0; k < WaveSize; ++k)
+					Data.push_back(pInstrument->GetSample(j, k));
+			}
+
+			std::vector<int> &Bucket = WaveMap[HashData(Data)];
+
+			for (std::vector<int>::const_iterator it = Bucket.begin(); it != Bucket.end(); ++it) {
+				CInstrumentContainer<CInstrumentN163> dupContainer(m_pDocument, *it);
+				if (pInstrument->IsWaveEqual(dupContainer())) {
+					m_iWaveBanks[i] = *it;
+					++m_iDuplicateWaves;
+					m_iDuplicateWaveSize += WaveCount * (WaveSize >> 1);
+					break;
 				}
 			}
+
 			if (m_iWaveBanks[i] == -1) {
+				if (!Bucket.empty())
+					++m_iHashCollisions;
+				Bucket.push_back(iIndex);
 				m_iWaveBanks[i] = iIndex;
 				// Store wave
-				CStringA label;
-				label.Format(LABEL_WAVES, iIndex);
-				pWavesChunk = CreateChunk(CHUNK_WAVES, label);
+				pWavesChunk = CreateChunk(CHUNK_WAVES, m_pSymbols->GetSymbol(SYMBOL_WAVES, iIndex));
 				// Store waves
 				iWaveSize += pInstrument->StoreWave(pWavesChunk);
 			}
@@ -1450,13 +1633,12 @@ void CCompiler::CreateInstrumentList()
 	// Store instruments
 	for (unsigned int i = 0; i < m_iInstruments; ++i) {
 		// Add reference to instrument list
-		CStringA label;
-		label.Format(LABEL_INSTRUMENT, i);
-		pInstListChunk->StoreReference(label);
+		int Symbol = m_pSymbols->GetSymbol(SYMBOL_INSTRUMENT, i);
+		pInstListChunk->StoreReference(Symbol);
 		iTotalSize += 2;
 
 		// Actual instrument
-		CChunk *pChunk = CreateChunk(CHUNK_INSTRUMENT, label);
+		CChunk *pChunk = CreateChunk(CHUNK_INSTRUMENT, Symbol);
 		m_vInstrumentChunks.push_back(pChunk);
 
 		int iIndex = m_iAssignedInstruments[i];
@@ -1466,8 +1648,7 @@ void CCompiler::CreateInstrumentList()
 		// Check if FDS
 		if (pInstrument->GetType() == INST_FDS && pWavetableChunk != NULL) {
 			// Store wave
-			AddWavetable(static_cast<CInstrumentFDS*>(pInstrument), pWavetableChunk);
-			pChunk->StoreByte(m_iWaveTables - 1);
+			pChunk->StoreByte(AddWavetable(static_cast<CInstrumentFDS*>(pInstrument), pWavetableChunk));
 		}
 /*
 		if (pInstrument->GetType() == INST_N163) {
@@ -1488,10 +1669,16 @@ void CCompiler::CreateInstrumentList()
 		iTotalSize += pInstrument->Compile(m_pDocument, pChunk, iIndex);
 	}
 
+	// Point instruments to the remaining copies of duplicated sequences
+	UpdateDuplicateReferences(m_vInstrumentChunks);
+
 	Print(_T(" * Instruments used: %i (%i bytes)\n"), m_iInstruments, iTotalSize);
 
 	if (iWaveSize > 0)
 		Print(_T(" * N163 waves size: %i bytes\n"), iWaveSize);
+
+	if (m_iDuplicateWaves > 0)
+		Print(_T(" * %i duplicated wave(s) removed (%i bytes saved)\n"), m_iDuplicateWaves, m_iDuplicateWaveSize);
 }
 
 // Samples
@@ -1510,7 +1697,7 @@ void CCompiler::CreateSampleList()
 	// Clear the sample list
 	memset(m_iSampleBank, 0xFF, MAX_DSAMPLES);
 	
-	CChunk *pChunk = CreateChunk(CHUNK_SAMPLE_LIST, LABEL_SAMPLES_LIST);
+	CChunk *pChunk = CreateChunk(CHUNK_SAMPLE_LIST, m_pSymbols->GetSymbol(SYMBOL_SAMPLES_LIST));
 
 	// Store sample instruments
 	unsigned int Item = 0;
@@ -1546,6 +1733,18 @@ void CCompiler::CreateSampleList()
 	}
 }
 
+// Orders sample indices by decreasing sample size
+class CSampleSizeCompare
+{
+public:
+	CSampleSizeCompare(const std::vector<const CDSample*> &Samples) : m_Samples(Samples) {}
+	bool operator()(unsigned int a, unsigned int b) const {
+		return m_Samples[a]->GetSize() > m_Samples[b]->GetSize();
+	}
+private:
+	const std::vector<const CDSample*> &m_Samples;
+};
+
 void CCompiler::StoreSamples()
 {
 	/*
@@ -1555,47 +1754,107 @@ void CCompiler::StoreSamples()
 	 *
 	 */
 
-	unsigned int iAddedSamples = 0;
 	unsigned int iSampleAddress = 0x0000;
 
 	// Get sample start address
 	m_iSamplesSize = 0;
+	m_iSharedSamples = 0;
+	m_iSharedSampleSize = 0;
 
-	CChunk *pChunk = CreateChunk(CHUNK_SAMPLE_POINTERS, LABEL_SAMPLES);
+	CChunk *pChunk = CreateChunk(CHUNK_SAMPLE_POINTERS, m_pSymbols->GetSymbol(SYMBOL_SAMPLES));
 	m_pSamplePointersChunk = pChunk;
 
-	// Store DPCM samples in a separate array
-	for (unsigned int i = 0; i < m_iSamplesUsed; ++i) {
+	// Collect samples with data, in sample list order
+	std::vector<const CDSample*> Samples;
 
+	for (unsigned int i = 0; i < m_iSamplesUsed; ++i) {
 		unsigned int iIndex = m_iSampleBank[i];
 		ASSERT(iIndex != 0xFF);
 		const CDSample *pDSample = m_pDocument->GetSample(iIndex);
-		unsigned int iSize = pDSample->GetSize();
+		if (pDSample->GetSize() > 0)
+			Samples.push_back(pDSample);
+	}
 
-		if (iSize > 0) {
-			// Fill sample list
-			unsigned char iSampleAddr = iSampleAddress >> 6;
-			unsigned char iSampleSize = iSize >> 4;
-			unsigned char iSampleBank = 0;
+	// Find samples that are equal to the start of a longer sample, the longest samples are checked first
+	std::vector<unsigned int> Order(Samples.size());
+	for (unsigned int i = 0; i < Samples.size(); ++i)
+		Order[i] = i;
 
-			// Update SAMPLE_ITEM_WIDTH here
-			pChunk->StoreByte(iSampleAddr);
-			pChunk->StoreByte(iSampleSize);
-			pChunk->StoreByte(iSampleBank);
+	std::stable_sort(Order.begin(), Order.end(), CSampleSizeCompare(Samples));
+
+	std::vector<int> Host(Samples.size(), -1);
+
+	for (unsigned int i = 0; i < Order.size(); ++i) {
+		for (unsigned int j = 0; j < i; ++j) {
+			if (Host[Order[j]] == -1 && IsSamplePrefix(Samples[Order[i]], Samples[Order[j]])) {
+				Host[Order[i]] = Order[j];
+				break;
+			}
+		}
+	}
+
+	// Store DPCM samples in a separate array, shared samples are only stored once
+	std::vector<unsigned int> StoredIndex(Samples.size());
+
+	for (unsigned int i = 0; i < Samples.size(); ++i) {
+		if (Host[i] == -1) {
+			StoredIndex[i] = m_vSamples.size();
 
 			// Add this sample to storage
-			m_vSamples.push_back(pDSample);
+			m_vSamples.push_back(Samples[i]);
 
 			// Pad end of samples
+			unsigned int iSize = Samples[i]->GetSize();
 			unsigned int iAdjust = AdjustSampleAddress(iSampleAddress + iSize);
 
-			iAddedSamples++;
 			iSampleAddress += iSize + iAdjust;
 			m_iSamplesSize += iSize + iAdjust;
 		}
+		else {
+			++m_iSharedSamples;
+			m_iSharedSampleSize += Samples[i]->GetSize();
+		}
+	}
+
+	// Fill sample list, addresses are updated when the sample location is known
+	for (unsigned int i = 0; i < Samples.size(); ++i) {
+		stSamplePointer Pointer;
+		Pointer.Sample = StoredIndex[(Host[i] == -1) ? i : Host[i]];
+		Pointer.Size = Samples[i]->GetSize();
+		m_vSamplePointers.push_back(Pointer);
+
+		// Update SAMPLE_ITEM_WIDTH here
+		pChunk->StoreByte(0);
+		pChunk->StoreByte(Pointer.Size >> 4);
+		pChunk->StoreByte(0);
 	}
 
 	Print(_T(" * DPCM samples used: %i (%i bytes)\n"), m_iSamplesUsed, m_iSamplesSize);
+
+	if (m_iSharedSamples > 0)
+		Print(_T(" * %i DPCM sample(s) shared with other samples (%i bytes saved)\n"), m_iSharedSamples, m_iSharedSampleSize);
+}
+
+bool CCompiler::IsSamplePrefix(const CDSample *pSample, const CDSample *pHost)
+{
+	// Returns true if pSample plays the same data as the start of pHost
+	//
+	// The played length is (Size / 16) * 16 + 1 bytes which can be one byte
+	// past the sample, the area after a sample is filled with zeros
+
+	const unsigned int Length = (pSample->GetSize() & ~0x0F) + 1;
+
+	if (pSample->GetSize() > pHost->GetSize())
+		return false;
+
+	for (unsigned int i = 0; i < Length; ++i) {
+		char Value = (i < pSample->GetSize()) ? pSample->GetData()[i] : 0;
+		char HostValue = (i < pHost->GetSize()) ? pHost->GetData()[i] : 0;
+		if (Value != HostValue)
+			return false;
+	}
+
+	return true;
 }
 
 int CCompiler::GetSampleIndex(int SampleNumber)
@@ -1626,33 +1885,36 @@ void CCompiler::StoreSongs()
 
 	const int TrackCount = m_pDocument->GetTrackCount();
 
-	CChunk *pSongListChunk = CreateChunk(CHUNK_SONG_LIST, LABEL_SONG_LIST);
+	CChunk *pSongListChunk = CreateChunk(CHUNK_SONG_LIST, m_pSymbols->GetSymbol(SYMBOL_SONG_LIST));
 
 	m_iDuplicatePatterns = 0;
+	m_iDuplicatePatternSize = 0;
 
 	// Store song info
 	for (int i = 0; i < TrackCount; ++i) {
 		// Add reference to song list
-		CStringA label;
-		label.Format(LABEL_SONG, i);
-		pSongListChunk->StoreReference(label);
+		int Symbol = m_pSymbols->GetSymbol(SYMBOL_SONG, i);
+		pSongListChunk->StoreReference(Symbol);
 
 		// Create song
-		CChunk *pChunk = CreateChunk(CHUNK_SONG, label);
+		CChunk *pChunk = CreateChunk(CHUNK_SONG, Symbol);
 		m_vSongChunks.push_back(pChunk);
 
 		// Store reference to song
-		label.Format(LABEL_SONG_FRAMES, i);
-		pChunk->StoreReference(label);
+		int FramesSymbol = m_pSymbols->GetSymbol(SYMBOL_SONG_FRAMES, i);
+		pChunk->StoreReference(FramesSymbol);
 		pChunk->StoreByte(m_pDocument->GetFrameCount(i));
 		pChunk->StoreByte(m_pDocument->GetPatternLength(i));
 		pChunk->StoreByte(m_pDocument->GetSongSpeed(i));
 		pChunk->StoreByte(m_pDocument->GetSongTempo(i));
-		pChunk->StoreBankReference(label, 0);
+		pChunk->StoreBankReference(FramesSymbol, 0);
 	}
 
 	m_iSongBankReference = m_vSongChunks[0]->GetLength() - 1;	// Save bank value position (all songs are equal)
 
+	// Compile pattern data for all songs
+	CompilePatterns();
+
 	// Store actual songs
 	for (int i = 0; i < TrackCount; ++i) {
 		Print(_T(" * Song %i: "), i);
@@ -1662,8 +1924,10 @@ void CCompiler::StoreSongs()
 		StorePatterns(i);
 	}
 
+	ClearCompiledPatterns();
+
 	if (m_iDuplicatePatterns > 0)
-		Print(_T(" * %i duplicated pattern(s) removed\n"), m_iDuplicatePatterns);
+		Print(_T(" * %i duplicated pattern(s) removed (%i bytes saved)\n"), m_iDuplicatePatterns, m_iDuplicatePatternSize);
 	
 #ifdef _DEBUG
 	Print(_T("Hash collisions: %i (of %i items)\r\n"), m_iHashCollisions, m_PatternMap.GetCount());
@@ -1697,29 +1961,26 @@ void CCompiler::CreateFrameList(unsigned int Track)
 	const int ChannelCount = m_pDocument->GetAvailableChannels();
 
 	// Create frame list
-	CStringA label;
-	label.Format(LABEL_SONG_FRAMES, Track);
-	CChunk *pFrameListChunk = CreateChunk(CHUNK_FRAME_LIST, label);
+	CChunk *pFrameListChunk = CreateChunk(CHUNK_FRAME_LIST, m_pSymbols->GetSymbol(SYMBOL_SONG_FRAMES, Track));
 
 	unsigned int TotalSize = 0;
 
 	// Store addresses to patterns
 	for (int i = 0; i < FrameCount; ++i) {
 		// Add reference to frame list
-		label.Format(LABEL_SONG_FRAME, Track, i);
-		pFrameListChunk->StoreReference(label);
+		int Symbol = m_pSymbols->GetFrameSymbol(Track, i);
+		pFrameListChunk->StoreReference(Symbol);
 		TotalSize += 2;
 
 		// Store frame item
-		CChunk *pChunk = CreateChunk(CHUNK_FRAME, label);
+		CChunk *pChunk = CreateChunk(CHUNK_FRAME, Symbol);
 		m_vFrameChunks.push_back(pChunk);
 
 		// Pattern pointers
 		for (int j = 0; j < ChannelCount; ++j) {
 			int Chan = m_vChanOrder[j];
 			int Pattern = m_pDocument->GetPatternAtFrame(Track, i, Chan);
-			label.Format(LABEL_PATTERN, Track, Pattern, Chan);
-			pChunk->StoreReference(label);
+			pChunk->StoreReference(m_pSymbols->GetPatternSymbol(Track, Pattern, Chan));
 			TotalSize += 2;
 		}
 	}
@@ -1740,7 +2001,7 @@ void CCompiler::StorePatterns(unsigned int Track)
 
 	const int iChannels = m_pDocument->GetAvailableChannels();
 
-	CPatternCompiler PatternCompiler(m_pDocument, m_iAssignedInstruments, (DPCM_List_t*)&m_iSamplesLookUp, m_pLogger);
+	CPatternMatcher PatternMatcher;
 
 	int PatternCount = 0;
 	int PatternSize = 0;
@@ -1751,47 +2012,54 @@ void CCompiler::StorePatterns(unsigned int Track)
 			// And store only used ones
 			if (IsPatternAddressed(Track, i, j)) {
 
-				// Compile pattern data
-				PatternCompiler.CompileData(Track, i, j);
+				// Get compiled pattern data
+				const stCompiledPattern *pPattern = m_vCompiledPatterns[m_iNextStoredPattern++];
+				ASSERT(pPattern->Track == Track && pPattern->Pattern == i && pPattern->Channel == j);
+
+				if (!pPattern->Log.IsEmpty() && m_pLogger != NULL)
+					m_pLogger->WriteLog(pPattern->Log);
 
-				CStringA label;
-				label.Format(LABEL_PATTERN, Track, i, j);
+				int Symbol = m_pSymbols->GetPatternSymbol(Track, i, j);
 
 				bool StoreNew = true;
 
 #ifdef REMOVE_DUPLICATE_PATTERNS
-				unsigned int Hash = PatternCompiler.GetHash();
-				
 				// Check for duplicate patterns
-				CChunk *pDuplicate = m_PatternMap[Hash];
+				std::vector<CChunk*> &Bucket = m_PatternMap[pPattern->Hash];
 
-				if (pDuplicate != NULL) {
+				for (std::vector<CChunk*>::const_iterator it = Bucket.begin(); it != Bucket.end(); ++it) {
 					// Hash only indicates that patterns may be equal, check exact data
-					if (PatternCompiler.CompareData(pDuplicate->GetStringData(PATTERN_CHUNK_INDEX))) {
+					if (pPattern->Data == (*it)->GetStringData(PATTERN_CHUNK_INDEX)) {
 						// Duplicate was found, store a reference to existing pattern
-						m_DuplicateMap[label] = pDuplicate->GetLabel();
+						m_DuplicateMap[Symbol] = (*it)->GetLabelSymbol();
 						++m_iDuplicatePatterns;
+						m_iDuplicatePatternSize += pPattern->Data.size();
 						StoreNew = false;
+						break;
 					}
 				}
 #endif /* REMOVE_DUPLICATE_PATTERNS */
 
 				if (StoreNew) {
 					// Store new pattern
-					CChunk *pChunk = CreateChunk(CHUNK_PATTERN, label);
+					CChunk *pChunk = CreateChunk(CHUNK_PATTERN, Symbol);
 					m_vPatternChunks.push_back(pChunk);
+					m_vPatternRows.push_back(pPattern->Rows);
 
 #ifdef REMOVE_DUPLICATE_PATTERNS
-					if (m_PatternMap[Hash] != NULL)
+					if (!Bucket.empty())
 						m_iHashCollisions++;
-					m_PatternMap[Hash] = pChunk;
+					Bucket.push_back(pChunk);
 #endif /* REMOVE_DUPLICATE_PATTERNS */
 					
 					// Store pattern data as string
-					pChunk->StoreString(PatternCompiler.GetData());
+					pChunk->StoreString(pPattern->Data);
 
-					PatternSize += PatternCompiler.GetDataSize();
+					PatternSize += pPattern->Data.size();
 					++PatternCount;
+
+					// Check how much calls to repeated data would save
+					PatternMatcher.AddPattern(pPattern->Data, pPattern->Entries);
 				}
 			}
 		}
@@ -1799,15 +2067,7 @@ void CCompiler::StorePatterns(unsigned int Track)
 
 #ifdef REMOVE_DUPLICATE_PATTERNS
 	// Update references to duplicates
-	for (std::vector<CChunk*>::const_iterator it = m_vFrameChunks.begin(); it != m_vFrameChunks.end(); ++it) {
-		for (int j = 0; j < (*it)->GetLength(); ++j) {
-			CStringA str = m_DuplicateMap[(*it)->GetDataRefName(j)];
-			if (str.GetLength() != 0) {
-				// Update reference
-				(*it)->UpdateDataRefName(j, str);
-			}
-		}
-	}
+	UpdateDuplicateReferences(m_vFrameChunks);
 #endif /* REMOVE_DUPLICATE_PATTERNS */
 
 #ifdef LOCAL_DUPLICATE_PATTERN_REMOVAL
@@ -1817,6 +2077,111 @@ void CCompiler::StorePatterns(unsigned int Track)
 #endif /* LOCAL_DUPLICATE_PATTERN_REMOVAL */
 
 	Print(_T("%i patterns (%i bytes)\r\n"), PatternCount, PatternSize);
+
+	if (PatternMatcher.GetReferenceCount() > 0) {
+		// The driver does not support pattern calls, nothing is changed in the output
+		int Saved = PatternMatcher.GetInputSize() - PatternMatcher.GetOutputSize();
+		Print(_T(" * Pattern calls (estimate, not applied): about %i bytes (%i%%) with %i calls, driver support not included\n"), Saved, (100 * Saved) / PatternMatcher.GetInputSize(), PatternMatcher.GetReferenceCount());
+	}
+}
+
+void CCompiler::CompilePatterns()
+{
+	/*
+	 * Compile all used patterns in all songs
+	 *
+	 * Each pattern only depends on the document and the instrument and sample tables,
+	 * patterns are split between worker threads and stored in the same order as 
+	 * StorePatterns reads them so the result does not depend on the number of threads
+	 *
+	 */
+
+	const int TrackCount = m_pDocument->GetTrackCount();
+	const int iChannels = m_pDocument->GetAvailableChannels();
+
+	ClearCompiledPatterns();
+
+	for (int Track = 0; Track < TrackCount; ++Track) {
+		for (int i = 0; i < MAX_PATTERN; ++i) {
+			for (int j = 0; j < iChannels; ++j) {
+				if (IsPatternAddressed(Track, i, j)) {
+					stCompiledPattern *pPattern = new stCompiledPattern();
+					pPattern->Track = Track;
+					pPattern->Pattern = i;
+					pPattern->Channel = j;
+					pPattern->Hash = 0;
+					m_vCompiledPatterns.push_back(pPattern);
+				}
+			}
+		}
+	}
+
+	m_iNextCompiledPattern = 0;
+
+	SYSTEM_INFO SystemInfo;
+	GetSystemInfo(&SystemInfo);
+
+	int Threads = min((int)SystemInfo.dwNumberOfProcessors, (int)m_vCompiledPatterns.size());
+	Threads = min(Threads, MAXIMUM_WAIT_OBJECTS);
+
+	std::vector<CWinThread*> Workers;
+	std::vector<HANDLE> Handles;
+
+	// This thread is also used
+	for (int i = 1; i < Threads; ++i) {
+		CWinThread *pThread = AfxBeginThread(&ThreadProcFunc, (LPVOID)this, THREAD_PRIORITY_NORMAL, 0, CREATE_SUSPENDED);
+		if (pThread == NULL)
+			break;
+		pThread->m_bAutoDelete = FALSE;
+		pThread->ResumeThread();
+		Workers.push_back(pThread);
+		Handles.push_back(pThread->m_hThread);
+	}
+
+	CompilePatternsWorker();
+
+	if (!Handles.empty())
+		::WaitForMultipleObjects(Handles.size(), &Handles[0], TRUE, INFINITE);
+
+	for (std::vector<CWinThread*>::iterator it = Workers.begin(); it != Workers.end(); ++it)
+		delete *it;
+
+	m_iNextStoredPattern = 0;
+}
+
+void CCompiler::CompilePatternsWorker()
+{
+	// Compile patterns until all are done, may run on several threads
+	LONG Index;
+
+	while ((Index = InterlockedIncrement(&m_iNextCompiledPattern) - 1) < (LONG)m_vCompiledPatterns.size()) {
+		stCompiledPattern *pPattern = m_vCompiledPatterns[Index];
+
+		CPatternLog Log(pPattern->Log);
+		CPatternCompiler PatternCompiler(m_pDocument, m_iAssignedInstruments, (DPCM_List_t*)&m_iSamplesLookUp, &Log);
+
+		PatternCompiler.CompileData(pPattern->Track, pPattern->Pattern, pPattern->Channel);
+
+		pPattern->Data = PatternCompiler.GetData();
+		pPattern->Entries = PatternCompiler.GetEntryPoints();
+		pPattern->Rows = PatternCompiler.GetRowPositions();
+		pPattern->Hash = PatternCompiler.GetHash();
+	}
+}
+
+void CCompiler::ClearCompiledPatterns()
+{
+	for (std::vector<stCompiledPattern*>::iterator it = m_vCompiledPatterns.begin(); it != m_vCompiledPatterns.end(); ++it)
+		delete *it;
+
+	m_vCompiledPatterns.clear();
+}
+
+UINT CCompiler::ThreadProcFunc(LPVOID pParam)
+{
+	CCompiler *pCompiler = reinterpret_cast<CCompiler*>(pParam);
+	pCompiler->CompilePatternsWorker();
+	return 0;
 }
 
 bool CCompiler::IsPatternAddressed(unsigned int Track, int Pattern, int Channel) const
@@ -1832,21 +2197,53 @@ bool CCompiler::IsPatternAddressed(unsigned int Track, int Pattern, int Channel)
 	return false;
 }
 
-void CCompiler::AddWavetable(CInstrumentFDS *pInstrument, CChunk *pChunk)
+int CCompiler::AddWavetable(CInstrumentFDS *pInstrument, CChunk *pChunk)
 {
-	// TODO Find equal existing waves
-	/*
-	for (int i = 0; i < m_iWaveTables; ++i) {
-		if (!memcmp(Wave, m_iWaveTable[i], 64))
-			return i;
+	// Returns the wave index, equal waves are only stored once
+
+	std::vector<char> Wave(64);
+	for (int i = 0; i < 64; ++i)
+		Wave[i] = pInstrument->GetSample(i);
+
+	std::vector<int> &Bucket = m_WavetableMap[HashData(Wave)];
+
+	for (std::vector<int>::const_iterator it = Bucket.begin(); it != Bucket.end(); ++it) {
+		bool Equal = true;
+		for (int i = 0; Equal && i < 64; ++i)
+			Equal = (pChunk->GetData(*it * 64 + i) == (unsigned char)Wave[i]);
+		if (Equal) {
+			++m_iDuplicateWaves;
+			m_iDuplicateWaveSize += 64;
+			return *it;
+		}
 	}
-	*/
+
+	if (!Bucket.empty())
+		++m_iHashCollisions;
 
 	// Allocate new wave
 	for (int i = 0; i < 64; ++i)
-		pChunk->StoreByte(pInstrument->GetSample(i));
+		pChunk->StoreByte(Wave[i]);
 
-	m_iWaveTables++;
+	Bucket.push_back(m_iWaveTables);
+
+	return m_iWaveTables++;
+}
+
+void CCompiler::UpdateDuplicateReferences(const std::vector<CChunk*> &Chunks)
+{
+	// Replace references to removed duplicates with the stored copy
+	for (std::vector<CChunk*>::const_iterator it = Chunks.begin(); it != Chunks.end(); ++it) {
+		for (int j = 0; j < (*it)->GetLength(); ++j) {
+			if (!(*it)->IsDataReference(j))
+				continue;
+			int Symbol;
+			if (m_DuplicateMap.Lookup((*it)->GetDataRefSymbol(j), Symbol)) {
+				// Update reference
+				(*it)->UpdateDataRefSymbol(j, Symbol);
+			}
+		}
+	}
 }
 
 void CCompiler::WriteAssembly(CFile *pFile)
@@ -1875,12 +2272,124 @@ void CCompiler::WriteSamplesBinary(CFile *pFile)
 	Print(_T(" * DPCM samples size: %i bytes\n"), m_iSamplesSize);
 }
 
+void CCompiler::ProfileDriver(const stNSFHeader *pHeader, const std::vector<char> &Data, const std::vector<unsigned int> &ChunkOffsets) const
+{
+	// Run the exported NSF and report the number of CPU cycles used by the driver in each frame
+
+	if (m_pLogger == NULL)
+		return;
+
+	ASSERT(ChunkOffsets.size() == m_vChunks.size());
+
+	const int TrackCount = m_pDocument->GetTrackCount();
+	const int ChannelCount = m_pDocument->GetAvailableChannels();
+	const int WarningLevel = theApp.GetSettings()->Export.iCycleWarning;
+
+	CDriverProfiler Profiler(ChannelCount);
+
+	if (!Profiler.Load(pHeader, Data)) {
+		Print(_T("Warning: Could not profile driver\n"));
+		return;
+	}
+
+	// Locate stored chunks
+	CMap<const CChunk*, const CChunk*, unsigned int, unsigned int> OffsetMap;
+	for (unsigned int i = 0; i < m_vChunks.size(); ++i)
+		OffsetMap[m_vChunks[i]] = ChunkOffsets[i];
+
+	CMap<const CChunk*, const CChunk*, int, int> PatternMap;
+	for (unsigned int i = 0; i < m_vPatternChunks.size(); ++i) {
+		const CChunk *pChunk = m_vPatternChunks[i];
+		PatternMap[pChunk] = Profiler.AddPattern(OffsetMap[pChunk], pChunk->CountDataSize(), m_vPatternRows[i]);
+	}
+
+	// PAL is only used when the NSF is PAL only
+	bool bPAL = (pHeader->Flags & 0x03) == 0x01;
+	unsigned int Period = bPAL ? pHeader->Speed_PAL : pHeader->Speed_NTSC;
+	unsigned int Clock = bPAL ? CAPU::BASE_FREQ_PAL : CAPU::BASE_FREQ_NTSC;
+	int FrameCycles = (int)(((ULONGLONG)Clock * Period) / 1000000);
+	int WarningCycles = (FrameCycles * WarningLevel) / 100;
+
+	Print(_T("Driver profile (%i cycles per frame):\n"), FrameCycles);
+
+	// Song lengths are found from the player snapshots
+	m_pDocument->PublishSnapshots();
+
+	std::vector<CChunk*>::const_iterator itFrame = m_vFrameChunks.begin();
+
+	for (int i = 0; i < TrackCount; ++i) {
+		const int FrameCount = m_pDocument->GetFrameCount(i);
+
+		// Frame data of this song
+		for (int j = 0; j < FrameCount && itFrame != m_vFrameChunks.end(); ++j, ++itFrame) {
+			const CChunk *pChunk = *itFrame;
+			std::vector<int> Patterns(ChannelCount, -1);
+			for (int k = 0; k < ChannelCount && k < pChunk->GetLength(); ++k) {
+				CChunk *pPattern = GetObjectByRef(pChunk->GetDataRefSymbol(k));
+				int Index;
+				if (pPattern != NULL && PatternMap.Lookup(pPattern, Index))
+					Patterns[k] = Index;
+			}
+			Profiler.AddFrame(OffsetMap[pChunk], pChunk->CountDataSize(), j, Patterns);
+		}
+
+		// Play the song with two loops
+		int PlayCalls = 0;
+		CTrackSnapshot *pSnapshot = m_pDocument->AcquireSnapshot(i);
+		if (pSnapshot != NULL) {
+			CControlPlayer Player(pSnapshot, m_pDocument->GetFrameRate(), m_pDocument->GetSpeedSplitPoint());
+			Player.Run(2);
+			PlayCalls = Player.GetIntroTicks();
+			for (int j = 0; j < Player.GetLoopCount(); ++j)
+				PlayCalls += Player.GetLoopTicks(j);
+			pSnapshot->Release();
+		}
+
+		if (!Profiler.Run(i, PlayCalls)) {
+			Print(_T(" * Song %i: Driver halted after %i calls\n"), i, Profiler.GetCallCount());
+			continue;
+		}
+
+		int Peak = (Profiler.GetPeakCount() > 0) ? Profiler.GetPeak(0).Cycles : 0;
+
+		Print(_T(" * Song %i: %i calls, max %i cycles (%i%%), median %i, 90%% %i, 99%% %i\n"), i, Profiler.GetCallCount(), 
+			Peak, (Peak * 100) / FrameCycles, Profiler.GetPercentile(50), Profiler.GetPercentile(90), Profiler.GetPercentile(99));
+
+		for (int j = 0; j < Profiler.GetPeakCount(); ++j) {
+			const stProfileState &State = Profiler.GetPeak(j);
+			int Time = (int)(((ULONGLONG)State.Call * Period) / 1000);		// ms
+			CString Text;
+			Text.Format(_T("   %i cycles at %i:%02i.%03i"), State.Cycles, Time / 60000, (Time / 1000) % 60, Time % 1000);
+			if (State.Frame != -1)
+				Text.AppendFormat(_T(", frame %02X"), State.Frame);
+			else
+				Text.Append(_T(", frame unknown"));
+			for (int k = 0; k < ChannelCount; ++k) {
+				if (State.Rows[k] != -1)
+					Text.AppendFormat(_T(", %s row %02X"), m_pDocument->GetChannel(m_vChanOrder[k])->GetChannelName(), State.Rows[k]);
+			}
+			Print(_T("%s\n"), (LPCTSTR)Text);
+		}
+
+		int Count = Profiler.CountOverLimit(WarningCycles);
+		if (Count > 0)
+			Print(_T("Warning: Song %i exceeds %i%% of a frame in %i calls\n"), i, WarningLevel, Count);
+	}
+}
+
 // Object list functions
 
-CChunk *CCompiler::CreateChunk(chunk_type_t Type, CStringA label)
+CChunk *CCompiler::CreateChunk(chunk_type_t Type, int Symbol)
 {
-	CChunk *pChunk = new CChunk(Type, label);
+	CChunk *pChunk = new CChunk(Type, Symbol, m_pSymbols);
 	m_vChunks.push_back(pChunk);
+
+	// The first chunk with a label owns it
+	if (Symbol >= (int)m_vLabelChunks.size())
+		m_vLabelChunks.resize(Symbol + 1, NULL);
+	if (m_vLabelChunks[Symbol] == NULL)
+		m_vLabelChunks[Symbol] = pChunk;
+
 	return pChunk;
 }
 
@@ -1896,22 +2405,19 @@ int CCompiler::CountData() const
 	return Offset;
 }
 
-CChunk *CCompiler::GetObjectByRef(CStringA label) const
+CChunk *CCompiler::GetObjectByRef(int Symbol) const
 {
-	for (std::vector<CChunk*>::const_iterator it = m_vChunks.begin(); it != m_vChunks.end(); ++it) {
-		CChunk *pChunk = *it;
-		if (!label.Compare(pChunk->GetLabel()))
-			return pChunk;
-	}
+	if (Symbol < 0 || Symbol >= (int)m_vLabelChunks.size())
+		return NULL;
 
-	return NULL;
+	return m_vLabelChunks[Symbol];
 }
 
 #if 0
 
 void CCompiler::WriteChannelMap()
 {
-	CChunk *pChunk = CreateChunk(CHUNK_CHANNEL_MAP, "");
+	CChunk *pChunk = CreateChunk(CHUNK_CHANNEL_MAP, m_pSymbols->GetSymbol(SYMBOL_NONE));
 	
 	pChunk->StoreByte(CHANID_SQUARE1 + 1);
 	pChunk->StoreByte(CHANID_SQUARE2 + 1);
@@ -1961,7 +2467,7 @@ void CCompiler::WriteChannelTypes()
 	const int TYPE_N163 = 10;
 	const int TYPE_S5B	= 12;
 
-	CChunk *pChunk = CreateChunk(CHUNK_CHANNEL_TYPES, "");
+	CChunk *pChunk = CreateChunk(CHUNK_CHANNEL_TYPES, m_pSymbols->GetSymbol(SYMBOL_NONE));
 	
 	for (int i = 0; i < 4; ++i)
 		pChunk->StoreByte(TYPE_2A03);
@@ -40,8 +40,19 @@ struct stNSFHeader {
 	unsigned char	Reserved[4];
 };
 
+// Sizes from a dry run of the NSF export, see CCompiler::MeasureNSF
+struct stNSFSize {
+	unsigned int DriverSize;
+	unsigned int MusicSize;
+	unsigned int SamplesSize;
+	unsigned int FileSize;			// Header included
+	bool		 bBankswitched;
+};
+
 struct driver_t;
+struct stCompiledPattern;
 class CChunk;
+class CSymbolTable;
 enum chunk_type_t;
 
 /*
@@ -70,6 +81,8 @@ public:
 	void	ExportPRG(LPCTSTR lpszFileName, bool EnablePAL);
 	void	ExportASM(LPCTSTR lpszFileName);
 
+	bool	MeasureNSF(stNSFSize &Size);
+
 private:
 	bool	OpenFile(LPCTSTR lpszFileName, CFile &file) const;
 
@@ -88,14 +101,15 @@ private:
 	bool	CompileData();
 	void	ResolveLabels();
 	bool	ResolveLabelsBankswitched();
-	void	CollectLabels(CMap<CStringA, LPCSTR, int, int> &labelMap) const;
-	bool	CollectLabelsBankswitched(CMap<CStringA, LPCSTR, int, int> &labelMap);
-	void	AssignLabels(CMap<CStringA, LPCSTR, int, int> &labelMap);
+	void	CollectLabels(std::vector<int> &Labels) const;
+	bool	CollectLabelsBankswitched(std::vector<int> &Labels);
+	void	AssignLabels(const std::vector<int> &Labels);
 	void	AddBankswitching();
 	void	Cleanup();
 
 	void	ScanSong();
 	int		GetSampleIndex(int SampleNumber);
+	static bool IsSamplePrefix(const CDSample *pSample, const CDSample *pHost);
 	bool	IsPatternAddressed(unsigned int Track, int Pattern, int Channel) const;
 	bool	IsInstrumentInPattern(int index) const;
 
@@ -105,11 +119,17 @@ private:
 	void	CreateSampleList();
 	void	CreateFrameList(unsigned int Track);
 
-	int		StoreSequence(CSequence *pSeq, CStringA &label);
+	int		StoreSequence(CSequence *pSeq, int Symbol);
 	void	StoreSamples();
 	void	StoreSongs();
 	void	StorePatterns(unsigned int Track);
 
+	// Pattern compiling, runs on all processors
+	void	CompilePatterns();
+	void	CompilePatternsWorker();
+	void	ClearCompiledPatterns();
+	static UINT ThreadProcFunc(LPVOID pParam);
+
 	// Bankswitching functions
 	void	UpdateSamplePointers(unsigned int Origin);
 	void	UpdateFrameBanks();
@@ -118,16 +138,22 @@ private:
 	void	EnableBankswitching();
 
 	// FDS
-	void	AddWavetable(CInstrumentFDS *pInstrument, CChunk *pChunk);
+	int		AddWavetable(CInstrumentFDS *pInstrument, CChunk *pChunk);
+
+	// Duplicate removal
+	void	UpdateDuplicateReferences(const std::vector<CChunk*> &Chunks);
 
 	// File writing
 	void	WriteAssembly(CFile *pFile);
 	void	WriteBinary(CFile *pFile);
 	void	WriteSamplesBinary(CFile *pFile);
 
+	// Driver profiling
+	void	ProfileDriver(const stNSFHeader *pHeader, const std::vector<char> &Data, const std::vector<unsigned int> &ChunkOffsets) const;
+
 	// Object list functions
-	CChunk	*CreateChunk(chunk_type_t Type, CStringA label);
-	CChunk	*GetObjectByRef(CStringA label) const;
+	CChunk	*CreateChunk(chunk_type_t Type, int Symbol);
+	CChunk	*GetObjectByRef(int Symbol) const;
 	int		CountData() const;
 
 	// Debugging
@@ -149,23 +175,11 @@ public:
 
 	static const bool LAST_BANK_FIXED;
 
-	// Labels
-	static const char LABEL_SONG_LIST[];
-	static const char LABEL_INSTRUMENT_LIST[];
-	static const char LABEL_SAMPLES_LIST[];
-	static const char LABEL_SAMPLES[];
-	static const char LABEL_WAVETABLE[];
+	static const ULONGLONG HASH_OFFSET;
+	static const ULONGLONG HASH_PRIME;
+
+	// Labels, chunk labels are made from symbols (see CSymbolTable)
 	static const char LABEL_SAMPLE[];
-	static const char LABEL_WAVES[];
-	static const char LABEL_SEQ_2A03[];
-	static const char LABEL_SEQ_VRC6[];
-	static const char LABEL_SEQ_FDS[];
-	static const char LABEL_SEQ_N163[];
-	static const char LABEL_INSTRUMENT[];
-	static const char LABEL_SONG[];
-	static const char LABEL_SONG_FRAMES[];
-	static const char LABEL_SONG_FRAME[];
-	static const char LABEL_PATTERN[];
 
 	// Flags
 	static const int FLAG_BANKSWITCHED;
@@ -179,16 +193,30 @@ public:
 
 	static unsigned int AdjustSampleAddress(unsigned int Address);
 
+	static ULONGLONG HashData(const std::vector<char> &Data);
+
+private:
+	// DPCM sample pointer, samples that are equal to the start of another sample share its data
+	struct stSamplePointer {
+		unsigned int Sample;	// Index in the stored samples list
+		unsigned int Size;		// Size of this sample
+	};
+
 private:
 	CFamiTrackerDoc *m_pDocument;
 
+	// Label names
+	CSymbolTable	*m_pSymbols;
+
 	// Object lists
 	std::vector<CChunk*> m_vChunks;
+	std::vector<CChunk*> m_vLabelChunks;	// Chunks indexed by label symbol
 	std::vector<CChunk*> m_vSequenceChunks;
 	std::vector<CChunk*> m_vInstrumentChunks;
 	std::vector<CChunk*> m_vSongChunks;	
 	std::vector<CChunk*> m_vFrameChunks;
 	std::vector<CChunk*> m_vPatternChunks;
+	std::vector<std::vector<unsigned int> > m_vPatternRows;	// Row positions for each pattern chunk
 	//std::vector<CChunk*> m_vWaveChunks;
 
 	// Special objects
@@ -196,7 +224,8 @@ private:
 	CChunk			*m_pHeaderChunk;
 
 	// Samples
-	std::vector<const CDSample*> m_vSamples;
+	std::vector<const CDSample*> m_vSamples;			// Stored sample data
+	std::vector<stSamplePointer> m_vSamplePointers;	// One for each sample in the sample pointer list
 
 	// Flags
 	bool			m_bBankSwitched;
@@ -220,6 +249,8 @@ private:
 	unsigned char	m_iSampleBank[MAX_DSAMPLES];
 	unsigned int	m_iSampleStart;
 	unsigned int	m_iSamplesUsed;
+	unsigned int	m_iSharedSamples;		// Number of samples stored inside other samples
+	unsigned int	m_iSharedSampleSize;
 
 	// General
 	unsigned int	m_iMusicDataSize;		// All music data
@@ -236,6 +267,11 @@ private:
 	unsigned int	m_iSongBankReference;	// Offset to bank value in song header
 
 	unsigned int	m_iDuplicatePatterns;	// Number of duplicated patterns removed
+	unsigned int	m_iDuplicatePatternSize;
+	unsigned int	m_iDuplicateSequences;	// Number of duplicated sequences removed
+	unsigned int	m_iDuplicateSequenceSize;
+	unsigned int	m_iDuplicateWaves;		// Number of duplicated FDS and N163 waves removed
+	unsigned int	m_iDuplicateWaveSize;
 
 	std::vector<int> m_vChanOrder;			// Channel order list
 
@@ -249,9 +285,16 @@ private:
 	// FDS
 	unsigned int	m_iWaveTables;
 
-	// Optimization
-	CMap<UINT, UINT, CChunk*, CChunk*> m_PatternMap;
-	CMap<CStringA, LPCSTR, CStringA, LPCSTR> m_DuplicateMap;
+	// Optimization, items are stored by content hash and each bucket holds all items with the same hash
+	CMap<ULONGLONG, ULONGLONG, std::vector<CChunk*>, const std::vector<CChunk*>&> m_PatternMap;
+	CMap<ULONGLONG, ULONGLONG, std::vector<CChunk*>, const std::vector<CChunk*>&> m_SequenceMap;
+	CMap<ULONGLONG, ULONGLONG, std::vector<int>, const std::vector<int>&> m_WavetableMap;		// FDS wave indices
+	CMap<int, int, int, int> m_DuplicateMap;		// Label symbols of removed duplicates
+
+	// Compiled patterns in the order they are stored
+	std::vector<stCompiledPattern*> m_vCompiledPatterns;
+	volatile LONG	m_iNextCompiledPattern;	// Next pattern for the worker threads
+	unsigned int	m_iNextStoredPattern;
 
 	// Debugging
 	CCompilerLog	*m_pLogger;
@@ -62,6 +62,11 @@ BEGIN_MESSAGE_MAP(CConfigGeneral, CPropertyPage)
 	ON_BN_CLICKED(IDC_OPT_SINGLEINSTANCE, OnBnClickedOptSingleInstance)
 	ON_BN_CLICKED(IDC_OPT_PREVIEWFULLROW, OnBnClickedOptPreviewFullRow)
 	ON_BN_CLICKED(IDC_OPT_DOUBLECLICK, OnBnClickedOptDisableDoubleClick)
+	ON_BN_CLICKED(IDC_OPT_COMPRESS, OnBnClickedOptCompress)
+	ON_BN_CLICKED(IDC_OPT_AUTOSAVE, OnBnClickedOptAutoSave)
+	ON_BN_CLICKED(IDC_OPT_PROFILEDRIVER, OnBnClickedOptProfileDriver)
+	ON_CBN_EDITUPDATE(IDC_CYCLE_WARNING, OnCbnEditupdateCycleWarning)
+	ON_CBN_SELENDOK(IDC_CYCLE_WARNING, OnCbnSelendokCycleWarning)
 END_MESSAGE_MAP()
 
 
@@ -86,8 +91,12 @@ BOOL CConfigGeneral::OnSetActive()
 	CheckDlgButton(IDC_OPT_SINGLEINSTANCE, m_bSingleInstance);
 	CheckDlgButton(IDC_OPT_PREVIEWFULLROW, m_bPreviewFullRow);
 	CheckDlgButton(IDC_OPT_DOUBLECLICK, m_bDisableDblClick);
+	CheckDlgButton(IDC_OPT_COMPRESS, m_bCompressModules);
+	CheckDlgButton(IDC_OPT_AUTOSAVE, m_bAutoSave);
+	CheckDlgButton(IDC_OPT_PROFILEDRIVER, m_bProfileDriver);
 	
 	SetDlgItemInt(IDC_PAGELENGTH, m_iPageStepSize, FALSE);
+	SetDlgItemInt(IDC_CYCLE_WARNING, m_iCycleWarning, FALSE);
 	return CPropertyPage::OnSetActive();
 }
 
@@ -138,6 +147,14 @@ BOOL CConfigGeneral::OnApply()
 	else if (m_iPageStepSize > MAX_PATTERN_LENGTH)
 		m_iPageStepSize = MAX_PATTERN_LENGTH;
 
+	// Driver profile warning level, percent of a frame
+	m_iCycleWarning = GetDlgItemInt(IDC_CYCLE_WARNING, &Trans, FALSE);
+
+	if (Trans == FALSE || m_iCycleWarning < 1)
+		m_iCycleWarning = 100;
+	else if (m_iCycleWarning > 100)
+		m_iCycleWarning = 100;
+
 	theApp.GetSettings()->General.bWrapCursor		= m_bWrapCursor;
 	theApp.GetSettings()->General.bWrapFrames		= m_bWrapFrames;
 	theApp.GetSettings()->General.bFreeCursorEdit	= m_bFreeCursorEdit;
@@ -154,6 +171,11 @@ BOOL CConfigGeneral::OnApply()
 	theApp.GetSettings()->General.bSingleInstance	= m_bSingleInstance;
 	theApp.GetSettings()->General.bPreviewFullRow	= m_bPreviewFullRow;
 	theApp.GetSettings()->General.bDblClickSelect	= m_bDisableDblClick;
+	theApp.GetSettings()->General.bCompressModules	= m_bCompressModules;
+	theApp.GetSettings()->General.bAutoSave			= m_bAutoSave;
+
+	theApp.GetSettings()->Export.bProfileDriver		= m_bProfileDriver;
+	theApp.GetSettings()->Export.iCycleWarning		= m_iCycleWarning;
 
 	theApp.GetSettings()->Keys.iKeyNoteCut			= m_iKeyNoteCut;
 	theApp.GetSettings()->Keys.iKeyNoteRelease		= m_iKeyNoteRelease;
@@ -185,6 +207,11 @@ BOOL CConfigGeneral::OnInitDialog()
 	m_bSingleInstance	= theApp.GetSettings()->General.bSingleInstance;
 	m_bPreviewFullRow	= theApp.GetSettings()->General.bPreviewFullRow;
 	m_bDisableDblClick	= theApp.GetSettings()->General.bDblClickSelect;
+	m_bCompressModules	= theApp.GetSettings()->General.bCompressModules;
+	m_bAutoSave			= theApp.GetSettings()->General.bAutoSave;
+
+	m_bProfileDriver	= theApp.GetSettings()->Export.bProfileDriver;
+	m_iCycleWarning		= theApp.GetSettings()->Export.iCycleWarning;
 
 	m_iKeyNoteCut		= theApp.GetSettings()->Keys.iKeyNoteCut; 
 	m_iKeyNoteRelease	= theApp.GetSettings()->Keys.iKeyNoteRelease; 
@@ -292,6 +319,18 @@ void CConfigGeneral::OnBnClickedOptDisableDoubleClick()
 	SetModified();
 }
 
+void CConfigGeneral::OnBnClickedOptCompress()
+{
+	m_bCompressModules = IsDlgButtonChecked(IDC_OPT_COMPRESS) != 0;
+	SetModified();
+}
+
+void CConfigGeneral::OnBnClickedOptAutoSave()
+{
+	m_bAutoSave = IsDlgButtonChecked(IDC_OPT_AUTOSAVE) != 0;
+	SetModified();
+}
+
 void CConfigGeneral::OnCbnEditupdatePagelength()
 {
 	SetModified();
@@ -302,6 +341,22 @@ void CConfigGeneral::OnCbnSelendokPagelength()
 	SetModified();
 }
 
+void CConfigGeneral::OnBnClickedOptProfileDriver()
+{
+	m_bProfileDriver = IsDlgButtonChecked(IDC_OPT_PROFILEDRIVER) != 0;
+	SetModified();
+}
+
+void CConfigGeneral::OnCbnEditupdateCycleWarning()
+{
+	SetModified();
+}
+
+void CConfigGeneral::OnCbnSelendokCycleWarning()
+{
+	SetModified();
+}
+
 BOOL CConfigGeneral::PreTranslateMessage(MSG* pMsg)
 {
 	if (pMsg->message == WM_KEYDOWN) {
@@ -53,6 +53,10 @@ protected:
 	bool	m_bSingleInstance;
 	bool	m_bPreviewFullRow;
 	bool	m_bDisableDblClick;
+	bool	m_bCompressModules;
+	bool	m_bAutoSave;
+	bool	m_bProfileDriver;
+	int		m_iCycleWarning;
 	int		m_iKeyNoteCut;
 	int		m_iKeyNoteRelease;
 	int		m_iKeyClear;
@@ -86,6 +90,11 @@ public:
 	afx_msg void OnBnClickedOptSingleInstance();
 	afx_msg void OnBnClickedOptPreviewFullRow();
 	afx_msg void OnBnClickedOptDisableDoubleClick();
+	afx_msg void OnBnClickedOptCompress();
+	afx_msg void OnBnClickedOptAutoSave();
+	afx_msg void OnBnClickedOptProfileDriver();
+	afx_msg void OnCbnEditupdateCycleWarning();
+	afx_msg void OnCbnSelendokCycleWarning();
 	virtual BOOL PreTranslateMessage(MSG* pMsg);
 
 };
@@ -90,6 +90,8 @@ BOOL CConfigSound::OnInitDialog()
 	switch (pSettings->Sound.iSampleSize) {
 		case 16: pSampleSize->SelectString(0, _T("16 bit")); break;
 		case 8:	 pSampleSize->SelectString(0, _T("8 bit")); break;
+		case 24: pSampleSize->SelectString(0, _T("24 bit")); break;
+		case 32: pSampleSize->SelectString(0, _T("32 bit float")); break;
 	}
 
 	pBufSlider->SetPos(pSettings->Sound.iBufferLength);
@@ -136,7 +138,9 @@ BOOL CConfigSound::OnApply()
 
 	switch (pSampleSize->GetCurSel()) {
 		case 0: theApp.GetSettings()->Sound.iSampleSize = 16; break;
-		case 1: theApp.GetSettings()->Sound.iSampleSize = 8; break;
+		case 1: theApp.GetSettings()->Sound.iSampleSize = 24; break;
+		case 2: theApp.GetSettings()->Sound.iSampleSize = 32; break;
+		case 3: theApp.GetSettings()->Sound.iSampleSize = 8; break;
 	}
 
 	theApp.GetSettings()->Sound.iBufferLength = pBufSlider->GetPos();
@@ -0,0 +1,385 @@
+/*
+** FamiTracker - NES/Famicom sound tracker
+** Copyright (C) 2005-2014  Jonathan Liss
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+*/
+
+#include <vector>
+#include "stdafx.h"
+#include "FamiTrackerDoc.h"
+#include "TrackSnapshot.h"
+#include "ControlPlayer.h"
+
+/*
+ * Control player
+ *
+ * Finds the exact length of a song without running the sound generator. Each tick runs
+ * the same steps as CSoundGen::OnIdle: the row is read when the tempo accumulator runs
+ * out, then jumps and skips are applied, the accumulator is updated and delayed rows are
+ * counted down.
+ *
+ * A loop is found when the player enters a frame at the same row as before. The frame
+ * order does not depend on tempo, following loops will repeat the same frames.
+ *
+ * The cached flow summaries of the pattern blocks tell where the first Bxx, Cxx, Dxx, Fxx 
+ * or Gxx of a frame is, rows before it are counted without reading the pattern data.
+ *
+ */
+
+CControlPlayer::CControlPlayer(const CTrackSnapshot *pSnapshot, unsigned int FrameRate, unsigned int SpeedSplit) :
+	m_pSnapshot(pSnapshot),
+	m_iFrameRate(FrameRate),
+	m_iSpeedSplit(SpeedSplit),
+	m_iChannels(pSnapshot->GetChannelCount())
+{
+	ASSERT(m_pSnapshot != NULL);
+	m_pSnapshot->Retain();
+}
+
+CControlPlayer::~CControlPlayer()
+{
+	m_pSnapshot->Release();
+}
+
+bool CControlPlayer::Run(int Loops)
+{
+	Reset();
+
+	while (m_iTicks < MAX_TICKS) {
+		m_bEntered = false;
+
+		RunTick();
+
+		if (m_bHalted) {
+			// Song has ended with Cxx
+			m_iIntroTicks = m_iTicks;
+			return true;
+		}
+
+		if (!m_bEntered)
+			continue;
+
+		const int Entries = m_vEntries.size();
+		const stFrameEntry &Entry = m_vEntries.back();
+
+		if (m_iLoopStart == -1) {
+			// Check if this frame and row has been entered before
+			int Index = m_vEntryIndex[Entry.Frame * MAX_PATTERN_LENGTH + Entry.Row];
+			if (Index != Entries) {
+				m_iLoopStart = Index - 1;
+				m_iLoopLength = Entries - Index;
+				m_iIntroTicks = m_vEntries[m_iLoopStart].Tick;
+				m_iLoopRows = Entry.Rows - m_vEntries[m_iLoopStart].Rows;
+				m_vLoopTicks.push_back(Entry.Tick - m_iIntroTicks);
+			}
+		}
+		else if ((Entries - 1 - m_iLoopStart) % m_iLoopLength == 0) {
+			m_vLoopTicks.push_back(Entry.Tick - m_vEntries[Entries - 1 - m_iLoopLength].Tick);
+		}
+
+		if ((int)m_vLoopTicks.size() >= Loops)
+			return true;
+	}
+
+	return false;
+}
+
+void CControlPlayer::Reset()
+{
+	m_iTicks = 0;
+	m_iRows = 0;
+	m_iPlayFrame = 0;
+	m_iPlayRow = 0;
+	m_iJumpToPattern = -1;
+	m_iSkipToRow = -1;
+	m_bHalted = false;
+	m_bNewFrame = true;
+
+	memset(m_Delays, 0, sizeof(stDelay) * MAX_CHANNELS);
+
+	m_iSpeed = m_pSnapshot->GetSongSpeed();
+	m_iTempo = m_pSnapshot->GetSongTempo();
+	m_iTempoAccum = 0;
+	SetupSpeed();
+
+	m_vEntries.clear();
+	m_vEntryIndex.assign(MAX_FRAMES * MAX_PATTERN_LENGTH, 0);
+	m_iLoopStart = -1;
+	m_iLoopLength = 0;
+	m_iLoopRows = 0;
+
+	m_iIntroTicks = 0;
+	m_vLoopTicks.clear();
+
+	FindQuietRows();
+}
+
+void CControlPlayer::RunTick()
+{
+	// CSoundGen::RunFrame, the row is read when the accumulator has run out
+	bool bUpdateRow = false;
+
+	++m_iTicks;
+
+	if (m_iTempoAccum <= 0) {
+		if (m_bNewFrame)
+			AddEntry();
+		bUpdateRow = true;
+		++m_iRows;
+		PlayRow();
+	}
+
+	// CSoundGen::UpdatePlayer
+	if (bUpdateRow && !m_bHalted)
+		StepRow();
+
+	if (m_iTempoAccum <= 0)
+		m_iTempoAccum += (60 * m_iFrameRate) - m_iTempoRemainder;
+	m_iTempoAccum -= m_iTempoDecrement;
+
+	// CSoundGen::UpdateChannels
+	UpdateDelays();
+}
+
+void CControlPlayer::PlayRow()
+{
+	// Same as CChannelHandler::PlayNote for each channel
+
+	if (m_iPlayRow < m_iQuietEnd) {
+		// Nothing to play, reading a row only cancels waiting rows
+		for (int i = 0; i < m_iChannels; ++i)
+			m_Delays[i].Enabled = false;
+		return;
+	}
+
+	for (int i = 0; i < m_iChannels; ++i) {
+		const stChanNote *pNote = m_pSnapshot->ReadNoteData(m_iPlayFrame, i, m_iPlayRow);
+		const int Columns = m_pSnapshot->GetEffColumns(i) + 1;
+		stDelay &Delay = m_Delays[i];
+
+		// A waiting row is played without global effects
+		Delay.Enabled = false;
+
+		bool bDelay = false;
+
+		for (int j = 0; j < Columns; ++j) {
+			if (pNote->EffNumber[j] == EF_DELAY && pNote->EffParam[j] > 0) {
+				bDelay = true;
+				Delay.Enabled = true;
+				Delay.Counter = pNote->EffParam[j];
+				Delay.Columns = Columns;
+				break;
+			}
+		}
+
+		if (!bDelay) {
+			PlayEffects(pNote->EffNumber, pNote->EffParam, Columns);
+			continue;
+		}
+
+		// Jumps and skips are applied directly, other global effects wait for the delay
+		for (int j = 0; j < Columns; ++j) {
+			Delay.EffNumber[j] = pNote->EffNumber[j];
+			Delay.EffParam[j] = pNote->EffParam[j];
+			switch (pNote->EffNumber[j]) {
+				case EF_JUMP:
+					m_iJumpToPattern = pNote->EffParam[j];
+					Delay.EffNumber[j] = EF_NONE;
+					break;
+				case EF_SKIP:
+					m_iSkipToRow = pNote->EffParam[j];
+					Delay.EffNumber[j] = EF_NONE;
+					break;
+				case EF_DELAY:
+					Delay.EffNumber[j] = EF_NONE;
+					break;
+			}
+		}
+	}
+}
+
+void CControlPlayer::PlayEffects(const unsigned char *pEffNumber, const unsigned char *pEffParam, int Columns)
+{
+	// Same as CSoundGen::EvaluateGlobalEffects
+	for (int i = 0; i < Columns; ++i) {
+		unsigned char EffParam = pEffParam[i];
+		switch (pEffNumber[i]) {
+			case EF_SPEED:
+				if (!EffParam)
+					++EffParam;
+				if (EffParam >= m_iSpeedSplit)
+					m_iTempo = EffParam;
+				else
+					m_iSpeed = EffParam;
+				SetupSpeed();
+				break;
+			case EF_JUMP:
+				m_iJumpToPattern = EffParam;
+				break;
+			case EF_SKIP:
+				m_iSkipToRow = EffParam;
+				break;
+			case EF_HALT:
+				m_bHalted = true;
+				break;
+		}
+	}
+}
+
+void CControlPlayer::UpdateDelays()
+{
+	// Same as CChannelHandler::UpdateDelay, channels are reset when halted
+	for (int i = 0; i < m_iChannels; ++i) {
+		stDelay &Delay = m_Delays[i];
+		if (m_bHalted)
+			Delay.Enabled = false;
+		else if (Delay.Enabled) {
+			if (!Delay.Counter) {
+				Delay.Enabled = false;
+				PlayEffects(Delay.EffNumber, Delay.EffParam, Delay.Columns);
+			}
+			else
+				--Delay.Counter;
+		}
+	}
+}
+
+void CControlPlayer::StepRow()
+{
+	// Same as CSoundGen::CheckControl when not looping a pattern
+	const unsigned int Frames = m_pSnapshot->GetFrameCount();
+	const unsigned int Rows = m_pSnapshot->GetPatternLength();
+
+	if (m_iJumpToPattern != -1) {
+		EnterFrame(min((unsigned int)m_iJumpToPattern, Frames - 1), 0);
+	}
+	else if (m_iSkipToRow != -1) {
+		EnterFrame((m_iPlayFrame + 1 >= Frames) ? 0 : m_iPlayFrame + 1, min((unsigned int)m_iSkipToRow, Rows - 1));
+	}
+	else if (++m_iPlayRow >= Rows) {
+		EnterFrame((m_iPlayFrame + 1 >= Frames) ? 0 : m_iPlayFrame + 1, 0);
+	}
+
+	m_iJumpToPattern = -1;
+	m_iSkipToRow = -1;
+}
+
+void CControlPlayer::EnterFrame(unsigned int Frame, unsigned int Row)
+{
+	m_iPlayFrame = Frame;
+	m_iPlayRow = Row;
+	m_bNewFrame = true;
+
+	FindQuietRows();
+}
+
+void CControlPlayer::FindQuietRows()
+{
+	// Find the first row from the play position where any channel has an effect the player handles
+	const unsigned int Rows = m_pSnapshot->GetPatternLength();
+
+	m_iQuietEnd = Rows;
+
+	for (int i = 0; i < m_iChannels && m_iQuietEnd > m_iPlayRow; ++i) {
+		const CPatternBlock *pBlock = m_pSnapshot->GetPatternBlock(i, m_pSnapshot->GetPatternAtFrame(m_iPlayFrame, i));
+		if (pBlock == NULL)
+			continue;
+		stPatternFlow Flow = pBlock->GetFlow(m_iPlayRow, Rows, m_pSnapshot->GetEffColumns(i) + 1);
+		if (Flow.Row != -1 && (unsigned)Flow.Row < m_iQuietEnd)
+			m_iQuietEnd = Flow.Row;
+		if (Flow.TimingRow != -1 && (unsigned)Flow.TimingRow < m_iQuietEnd)
+			m_iQuietEnd = Flow.TimingRow;
+	}
+}
+
+void CControlPlayer::AddEntry()
+{
+	// The new frame starts when its first row is read, count the ticks before this one
+	stFrameEntry Entry;
+	Entry.Tick = m_iTicks - 1;
+	Entry.Rows = m_iRows;
+	Entry.Frame = m_iPlayFrame;
+	Entry.Row = m_iPlayRow;
+	m_vEntries.push_back(Entry);
+
+	int &Index = m_vEntryIndex[Entry.Frame * MAX_PATTERN_LENGTH + Entry.Row];
+	if (Index == 0)
+		Index = m_vEntries.size();
+
+	m_bNewFrame = false;
+	m_bEntered = true;
+}
+
+void CControlPlayer::SetupSpeed()
+{
+	// Same as CSoundGen::SetupSpeed
+	m_iTempoDecrement = (m_iTempo * 24) / m_iSpeed;
+	m_iTempoRemainder = (m_iTempo * 24) % m_iSpeed;
+}
+
+bool CControlPlayer::IsHalted() const
+{
+	return m_bHalted;
+}
+
+unsigned int CControlPlayer::GetIntroTicks() const
+{
+	// Ticks before the loop point, or the full song if it was halted
+	return m_iIntroTicks;
+}
+
+int CControlPlayer::GetLoopCount() const
+{
+	return m_vLoopTicks.size();
+}
+
+unsigned int CControlPlayer::GetLoopTicks(int Loop) const
+{
+	ASSERT(Loop < (int)m_vLoopTicks.size());
+	return m_vLoopTicks[Loop];
+}
+
+int CControlPlayer::GetLoopPoint() const
+{
+	// Frame the loop starts at, -1 if no loop was found
+	return m_iLoopStart == -1 ? -1 : m_vEntries[m_iLoopStart].Frame;
+}
+
+double CControlPlayer::GetSeconds(unsigned int Ticks) const
+{
+	return double(Ticks) / m_iFrameRate;
+}
+
+unsigned int CControlPlayer::GetIntroFrames() const
+{
+	return m_iLoopStart == -1 ? m_vEntries.size() : m_iLoopStart;
+}
+
+unsigned int CControlPlayer::GetIntroRows() const
+{
+	return m_iLoopStart == -1 ? m_iRows : m_vEntries[m_iLoopStart].Rows;
+}
+
+unsigned int CControlPlayer::GetLoopFrames() const
+{
+	return m_iLoopStart == -1 ? 0 : m_iLoopLength;
+}
+
+unsigned int CControlPlayer::GetLoopRows() const
+{
+	return m_iLoopRows;
+}
@@ -0,0 +1,123 @@
+/*
+** FamiTracker - NES/Famicom sound tracker
+** Copyright (C) 2005-2014  Jonathan Liss
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+*/
+
+#pragma once
+
+// std::vector is required by this header file
+
+class CTrackSnapshot;
+
+//
+// Plays only the parts of a track that control timing, no channels or sound chips are emulated.
+// Follows the tempo accumulator, Fxx, Bxx, Cxx, Dxx and Gxx handling of CSoundGen.
+//
+
+class CControlPlayer
+{
+public:
+	CControlPlayer(const CTrackSnapshot *pSnapshot, unsigned int FrameRate, unsigned int SpeedSplit);
+	~CControlPlayer();
+
+	// Play the song until it has looped a number of times or halted, returns false if neither happened
+	bool Run(int Loops);
+
+	// Results in ticks (player frames)
+	bool IsHalted() const;
+	unsigned int GetIntroTicks() const;
+	int GetLoopCount() const;
+	unsigned int GetLoopTicks(int Loop) const;
+	int GetLoopPoint() const;
+	double GetSeconds(unsigned int Ticks) const;
+
+	// Results in frames and rows, the intro is the full song if it was halted
+	unsigned int GetIntroFrames() const;
+	unsigned int GetIntroRows() const;
+	unsigned int GetLoopFrames() const;
+	unsigned int GetLoopRows() const;
+
+public:
+	static const unsigned int MAX_TICKS = 0x4000000;	// Give up after this many ticks
+
+private:
+	void Reset();
+	void RunTick();
+	void PlayRow();
+	void PlayEffects(const unsigned char *pEffNumber, const unsigned char *pEffParam, int Columns);
+	void UpdateDelays();
+	void StepRow();
+	void EnterFrame(unsigned int Frame, unsigned int Row);
+	void FindQuietRows();
+	void AddEntry();
+	void SetupSpeed();
+
+private:
+	// Delayed row, Gxx
+	struct stDelay {
+		bool Enabled;
+		int Counter;
+		int Columns;
+		unsigned char EffNumber[MAX_EFFECT_COLUMNS];
+		unsigned char EffParam[MAX_EFFECT_COLUMNS];
+	};
+
+	// Frame entered by the player
+	struct stFrameEntry {
+		unsigned int Tick;
+		unsigned int Rows;						// Rows read before the frame was entered
+		unsigned int Frame;
+		unsigned int Row;
+	};
+
+	const CTrackSnapshot *m_pSnapshot;
+	unsigned int m_iFrameRate;
+	unsigned int m_iSpeedSplit;
+	int			 m_iChannels;
+
+	// Player state
+	unsigned int m_iTicks;
+	unsigned int m_iRows;
+	unsigned int m_iPlayFrame;
+	unsigned int m_iPlayRow;
+	unsigned int m_iQuietEnd;					// Rows before this one in the frame have no timing or control effects
+	int			 m_iJumpToPattern;
+	int			 m_iSkipToRow;
+	bool		 m_bHalted;
+	stDelay		 m_Delays[MAX_CHANNELS];
+
+	// Tempo
+	int			 m_iSpeed;
+	int			 m_iTempo;
+	int			 m_iTempoAccum;
+	int			 m_iTempoDecrement;
+	int			 m_iTempoRemainder;
+
+	// Loop detection
+	std::vector<stFrameEntry> m_vEntries;
+	std::vector<int> m_vEntryIndex;				// Index in m_vEntries + 1 for each frame and row, 0 if not entered
+	bool		 m_bNewFrame;					// A frame has been entered and its first row is not yet read
+	bool		 m_bEntered;
+	int			 m_iLoopStart;					// First entry of the loop, -1 if not found
+	int			 m_iLoopLength;					// Number of entries in one loop
+	unsigned int m_iLoopRows;
+
+	// Results
+	unsigned int m_iIntroTicks;
+	std::vector<unsigned int> m_vLoopTicks;
+};
@@ -3,14 +3,14 @@
 
 CCustomExporter::CCustomExporter( void )
 : m_name( "CustomExporter" ), m_ext( ".asm" ), m_dllFilePath( "" ), m_dllHandle( NULL ), m_referenceCount( NULL ),
-  m_GetName( NULL ), m_Export( NULL )
+  m_GetName( NULL ), m_Export( NULL ), m_ExportBulk( NULL )
 {
 
 }
 
 CCustomExporter::CCustomExporter( CCustomExporter const& other )
 : m_name( "CustomExporter" ), m_ext( ".asm" ), m_dllFilePath( "" ), m_dllHandle( NULL ), m_referenceCount( NULL ),
-  m_GetName( NULL ), m_Export( NULL )
+  m_GetName( NULL ), m_Export( NULL ), m_ExportBulk( NULL )
 {
 	//copy everything over
 	m_referenceCount = other.m_referenceCount;
@@ -20,6 +20,7 @@ CCustomExporter::CCustomExporter( CCustomExporter const& other )
 	m_dllFilePath = other.m_dllFilePath;
 	m_GetName = other.m_GetName;
 	m_Export = other.m_Export;
+	m_ExportBulk = other.m_ExportBulk;
 
 	//increment reference count of dll being copied
 	incReferenceCount();
@@ -41,6 +42,7 @@ CCustomExporter& CCustomExporter::operator=( CCustomExporter const& other )
 	m_dllFilePath = other.m_dllFilePath;
 	m_GetName = other.m_GetName;
 	m_Export = other.m_Export;
+	m_ExportBulk = other.m_ExportBulk;
 
 	//increment reference count of dll being copied
 	incReferenceCount();
@@ -140,6 +142,9 @@ bool CCustomExporter::load( CString FileName )
 			decReferenceCount();
 			return false;
 		}
+
+		//optional, exporters built against the bulk interface
+		m_ExportBulk = (bool (__cdecl *)( FamitrackerDocInterface const* iface, FamitrackerDocBulkInterface const* bulk, const char* fileName ))GetProcAddress( m_dllHandle, "ExportBulk" );
 	}
 
 	return true;
@@ -153,6 +158,14 @@ bool CCustomExporter::Export( CFamiTrackerDocInterface const* doc, const char* f
 		SetDoc(const_cast<CFamiTrackerDocInterface*>(doc));
 		GetInterface(&iface);
 
+		if( NULL != m_ExportBulk )
+		{
+			FamitrackerDocBulkInterface bulk;
+			GetBulkInterface(&bulk);
+
+			return m_ExportBulk( &iface, &bulk, fileName );
+		}
+
 		return m_Export( &iface, fileName );
 	}
 	else
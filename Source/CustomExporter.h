@@ -25,6 +25,7 @@ private:
 	const char* (__cdecl *m_GetExt)( void );
 	const char* (__cdecl *m_GetName)( void );
 	bool (__cdecl *m_Export)( FamitrackerDocInterface const* iface, const char* fileName );
+	bool (__cdecl *m_ExportBulk)( FamitrackerDocInterface const* iface, FamitrackerDocBulkInterface const* bulk, const char* fileName );
 	void incReferenceCount( void );
 	void decReferenceCount( void );
 };
@@ -72,6 +72,15 @@ public:
 	virtual void			GetSampleName(unsigned int Index, char *Name) const = 0;
 	virtual int				GetSampleSize(unsigned int Sample) const = 0;
 	virtual char			GetSampleData(unsigned int Sample, unsigned int Offset) const = 0;
+
+	// Bulk access, returns read-only views into the document which are valid until the export returns
+	virtual unsigned int	GetChannelCount() const = 0;
+	virtual unsigned int	GetEffectColumnCount(unsigned int Channel) const = 0;
+	virtual const unsigned char *GetFrameList(unsigned int &Channels) const = 0;
+	virtual const stChanNote *GetPatternRows(unsigned int Channel, unsigned int Pattern) const = 0;
+	virtual const stChanNote *GetFramePatternRows(unsigned int Frame, unsigned int Channel) const = 0;
+	virtual const signed char *GetSequenceItems(CSequenceInterface const *pSequence, unsigned int &Count) const = 0;
+	virtual const char		*GetSampleBuffer(unsigned int Sample, unsigned int &Size) const = 0;
 };
 
 //
@@ -121,3 +130,36 @@ struct FamitrackerDocInterface
 	char (__cdecl *GetSamplePitch)(Instrument2A03Handle instrument, int Octave, int Note);
 	char (__cdecl *GetSampleLoopOffset)(Instrument2A03Handle instrument, int Octave, int Note);
 };
+
+//
+// Bulk access for exporters, passed to the optional ExportBulk function of an exporter DLL:
+//   bool __cdecl ExportBulk(FamitrackerDocInterface const* iface, FamitrackerDocBulkInterface const* bulk, const char* fileName);
+// Exporters without ExportBulk are called through Export as before. Functions are only added at the
+// end of the struct, check Version before using functions added after version 1.
+// All pointers point directly into the document, they are read-only and valid until the export returns.
+//
+
+#define FT_BULK_INTERFACE_VERSION 1
+
+struct FamitrackerDocBulkInterface
+{
+	unsigned int Version;			// FT_BULK_INTERFACE_VERSION
+	unsigned int Size;				// sizeof(FamitrackerDocBulkInterface)
+
+	//track functions
+	unsigned int (__cdecl *GetChannelCount)();
+	unsigned int (__cdecl *GetEffectColumnCount)(unsigned int Channel);
+
+	//frame list, GetFrameCount() frames of Channels pattern numbers each
+	const unsigned char *(__cdecl *GetFrameList)(unsigned int *Channels);
+
+	//patterns, GetPatternLength() rows each
+	const stChanNote *(__cdecl *GetPatternRows)(unsigned int Channel, unsigned int Pattern);
+	const stChanNote *(__cdecl *GetFramePatternRows)(unsigned int Frame, unsigned int Channel);
+
+	//sequence functions
+	const signed char *(__cdecl *GetSequenceItems)(SequenceHandle sequence, unsigned int *Count);
+
+	//DPCM functions
+	const char *(__cdecl *GetSampleBuffer)(unsigned int Sample, unsigned int *Size);
+};
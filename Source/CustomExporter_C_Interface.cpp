@@ -50,6 +50,26 @@ void GetInterface(FamitrackerDocInterface* iface)
 	iface->GetSampleLoopOffset = GetSampleLoopOffset;
 }
 
+//function to fill FamitrackerDocBulkInterface object with pointers to the bulk access functions
+void GetBulkInterface(FamitrackerDocBulkInterface* iface)
+{
+	iface->Version = FT_BULK_INTERFACE_VERSION;
+	iface->Size = sizeof(FamitrackerDocBulkInterface);
+
+	//track functions
+	iface->GetChannelCount = GetChannelCount;
+	iface->GetEffectColumnCount = GetEffectColumnCount;
+	iface->GetFrameList = GetFrameList;
+	iface->GetPatternRows = GetPatternRows;
+	iface->GetFramePatternRows = GetFramePatternRows;
+
+	//sequence functions
+	iface->GetSequenceItems = GetSequenceItems;
+
+	//DPCM functions
+	iface->GetSampleBuffer = GetSampleBuffer;
+}
+
 //overall document functions
 void GetNoteData(unsigned int Frame, unsigned int Channel, unsigned int Row, stChanNote *Data)
 {
@@ -291,3 +311,79 @@ char GetSampleLoopOffset(Instrument2A03Handle instrument, int Octave, int Note)
 
 	return instrumentInterface->GetSampleLoopOffset(Octave, Note);
 }
+
+
+//bulk track functions
+unsigned int GetChannelCount()
+{
+	if (NULL == _doc)
+	{
+		return 0;
+	}
+
+	return _doc->GetChannelCount();
+}
+
+unsigned int GetEffectColumnCount(unsigned int Channel)
+{
+	if (NULL == _doc)
+	{
+		return 0;
+	}
+
+	return _doc->GetEffectColumnCount(Channel);
+}
+
+const unsigned char *GetFrameList(unsigned int *Channels)
+{
+	if (NULL == _doc || NULL == Channels)
+	{
+		return NULL;
+	}
+
+	return _doc->GetFrameList(*Channels);
+}
+
+const stChanNote *GetPatternRows(unsigned int Channel, unsigned int Pattern)
+{
+	if (NULL == _doc)
+	{
+		return NULL;
+	}
+
+	return _doc->GetPatternRows(Channel, Pattern);
+}
+
+const stChanNote *GetFramePatternRows(unsigned int Frame, unsigned int Channel)
+{
+	if (NULL == _doc)
+	{
+		return NULL;
+	}
+
+	return _doc->GetFramePatternRows(Frame, Channel);
+}
+
+//bulk sequence functions
+const signed char *GetSequenceItems(SequenceHandle sequence, unsigned int *Count)
+{
+	if (NULL == _doc || NULL == sequence || NULL == Count)
+	{
+		return NULL;
+	}
+
+	CSequenceInterface const* sequenceInterface = static_cast<CSequenceInterface const*>(sequence);
+
+	return _doc->GetSequenceItems(sequenceInterface, *Count);
+}
+
+//bulk DPCM functions
+const char *GetSampleBuffer(unsigned int Sample, unsigned int *Size)
+{
+	if (NULL == _doc || NULL == Size)
+	{
+		return NULL;
+	}
+
+	return _doc->GetSampleBuffer(Sample, *Size);
+}
\ No newline at end of file
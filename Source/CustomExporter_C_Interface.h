@@ -8,6 +8,9 @@ void SetDoc(CFamiTrackerDocInterface* doc);
 //function to fill FamitrackerDocInterface object with pointers to all the C interface functions
 void GetInterface(FamitrackerDocInterface* iface);
 
+//function to fill FamitrackerDocBulkInterface object with pointers to the bulk access functions
+void GetBulkInterface(FamitrackerDocBulkInterface* iface);
+
 //overall document functions
 void GetNoteData(unsigned int Frame, unsigned int Channel, unsigned int Row, stChanNote *Data);
 unsigned int GetFrameCount();
@@ -42,4 +45,17 @@ char GetSampleData(unsigned int Sample, unsigned int Offset);
 //DPCM instrument functions
 char GetSample(Instrument2A03Handle instrument, int Octave, int Note);
 char GetSamplePitch(Instrument2A03Handle instrument, int Octave, int Note);
-char GetSampleLoopOffset(Instrument2A03Handle instrument, int Octave, int Note);
\ No newline at end of file
+char GetSampleLoopOffset(Instrument2A03Handle instrument, int Octave, int Note);
+
+//bulk track functions
+unsigned int GetChannelCount();
+unsigned int GetEffectColumnCount(unsigned int Channel);
+const unsigned char *GetFrameList(unsigned int *Channels);
+const stChanNote *GetPatternRows(unsigned int Channel, unsigned int Pattern);
+const stChanNote *GetFramePatternRows(unsigned int Frame, unsigned int Channel);
+
+//bulk sequence functions
+const signed char *GetSequenceItems(SequenceHandle sequence, unsigned int *Count);
+
+//bulk DPCM functions
+const char *GetSampleBuffer(unsigned int Sample, unsigned int *Size);
\ No newline at end of file
@@ -173,7 +173,7 @@ CDSoundChannel *CDSound::OpenChannel(int SampleRate, int SampleSize, int Channel
 	//
 
 	DSBPOSITIONNOTIFY	dspn[MAX_BLOCKS];
-	WAVEFORMATEX		wfx;
+	WAVEFORMATEXTENSIBLE	wfx;
 	DSBUFFERDESC		dsbd;
 
 	ASSERT(Blocks > 1);
@@ -205,20 +205,29 @@ CDSoundChannel *CDSound::OpenChannel(int SampleRate, int SampleSize, int Channel
 	pChannel->m_hEventList[0]		= m_hNotificationHandle;
 	pChannel->m_hEventList[1]		= hBufferEvent;
 
-	memset(&wfx, 0x00, sizeof(WAVEFORMATEX));
-	wfx.cbSize				= sizeof(WAVEFORMATEX);
-	wfx.nChannels			= Channels;
-	wfx.nSamplesPerSec		= SampleRate;
-	wfx.wBitsPerSample		= SampleSize;
-	wfx.nBlockAlign			= wfx.nChannels * (wfx.wBitsPerSample / 8);
-	wfx.nAvgBytesPerSec		= wfx.nSamplesPerSec * wfx.nBlockAlign;
-	wfx.wFormatTag			= WAVE_FORMAT_PCM;
+	memset(&wfx, 0x00, sizeof(WAVEFORMATEXTENSIBLE));
+	wfx.Format.cbSize			= sizeof(WAVEFORMATEX);
+	wfx.Format.nChannels		= Channels;
+	wfx.Format.nSamplesPerSec	= SampleRate;
+	wfx.Format.wBitsPerSample	= SampleSize;
+	wfx.Format.nBlockAlign		= wfx.Format.nChannels * (wfx.Format.wBitsPerSample / 8);
+	wfx.Format.nAvgBytesPerSec	= wfx.Format.nSamplesPerSec * wfx.Format.nBlockAlign;
+	wfx.Format.wFormatTag		= (SampleSize == 32) ? WAVE_FORMAT_IEEE_FLOAT : WAVE_FORMAT_PCM;
+
+	if (SampleSize == 24) {
+		// PCM above 16 bits must use the extensible format
+		wfx.Format.wFormatTag			= WAVE_FORMAT_EXTENSIBLE;
+		wfx.Format.cbSize				= sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX);
+		wfx.Samples.wValidBitsPerSample	= SampleSize;
+		wfx.dwChannelMask				= (Channels == 2) ? (SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT) : SPEAKER_FRONT_CENTER;
+		wfx.SubFormat					= KSDATAFORMAT_SUBTYPE_PCM;
+	}
 
 	memset(&dsbd, 0x00, sizeof(DSBUFFERDESC));
 	dsbd.dwSize			= sizeof(DSBUFFERDESC);
 	dsbd.dwBufferBytes	= SoundBufferSize;
 	dsbd.dwFlags		= DSBCAPS_LOCSOFTWARE | DSBCAPS_GLOBALFOCUS | DSBCAPS_CTRLPOSITIONNOTIFY | DSBCAPS_GETCURRENTPOSITION2;
-	dsbd.lpwfxFormat	= &wfx;
+	dsbd.lpwfxFormat	= &wfx.Format;
 
 	if (FAILED(m_lpDirectSound->CreateSoundBuffer(&dsbd, &pChannel->m_lpDirectSoundBuffer, NULL))) {
 		delete pChannel;
@@ -251,9 +260,6 @@ void CDSound::CloseChannel(CDSoundChannel *pChannel)
 	if (pChannel == NULL)
 		return;
 
-	pChannel->m_lpDirectSoundBuffer->Release();
-	pChannel->m_lpDirectSoundNotify->Release();
-
 	delete pChannel;
 }
 
@@ -261,6 +267,9 @@ void CDSound::CloseChannel(CDSoundChannel *pChannel)
 
 CDSoundChannel::CDSoundChannel()
 {
+	m_lpDirectSoundBuffer = NULL;
+	m_lpDirectSoundNotify = NULL;
+
 	m_iCurrentWriteBlock = 0;
 
 	m_hEventList[0] = NULL;
@@ -270,6 +279,12 @@ CDSoundChannel::CDSoundChannel()
 
 CDSoundChannel::~CDSoundChannel()
 {
+	if (m_lpDirectSoundNotify)
+		m_lpDirectSoundNotify->Release();
+
+	if (m_lpDirectSoundBuffer)
+		m_lpDirectSoundBuffer->Release();
+
 	// Kill buffer event
 	if (m_hEventList[1])
 		CloseHandle(m_hEventList[1]);
@@ -281,7 +296,7 @@ bool CDSoundChannel::Play() const
 	return FAILED(m_lpDirectSoundBuffer->Play(NULL, NULL, DSBPLAY_LOOPING)) ? false : true;
 }
 
-bool CDSoundChannel::Stop() const
+bool CDSoundChannel::Stop()
 {
 	// Stop playback
 	return FAILED(m_lpDirectSoundBuffer->Stop()) ? false : true;
@@ -356,7 +371,7 @@ bool CDSoundChannel::WriteBuffer(char *pBuffer, unsigned int Samples)
 	return true;
 }
 
-buffer_event_t CDSoundChannel::WaitForSyncEvent(DWORD dwTimeout) const
+buffer_event_t CDSoundChannel::WaitForSyncEvent(DWORD dwTimeout)
 {
 	// Wait for a DirectSound event
 	if (!IsPlaying()) {
@@ -378,6 +393,12 @@ buffer_event_t CDSoundChannel::WaitForSyncEvent(DWORD dwTimeout) const
 	return BUFFER_NONE;
 }
 
+int CDSoundChannel::GetFillLevel() const
+{
+	// Number of written blocks waiting to be played
+	return (m_iCurrentWriteBlock + m_iBlocks - GetPlayBlock() - 1) % m_iBlocks;
+}
+
 int CDSoundChannel::GetPlayBlock() const
 {
 	// Return the block where the play pos is
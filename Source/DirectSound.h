@@ -23,19 +23,14 @@
 
 #include <windows.h>
 #include <mmsystem.h>
+#include <mmreg.h>
+#include <ks.h>
+#include <ksmedia.h>
 #include <dsound.h>
-
-// Return values from WaitForDirectSoundEvent()
-enum buffer_event_t {
-	BUFFER_NONE = 0,
-	BUFFER_CUSTOM_EVENT = 1, 
-	BUFFER_TIMEOUT, 
-	BUFFER_IN_SYNC, 
-	BUFFER_OUT_OF_SYNC
-};
+#include "AudioSink.h"
 
 // DirectSound channel
-class CDSoundChannel 
+class CDSoundChannel : public IAudioSink
 {
 	friend class CDSound;
 
@@ -44,15 +39,17 @@ public:
 	~CDSoundChannel();
 
 	bool Play() const;
-	bool Stop() const;
+	bool Stop();
 	bool IsPlaying() const;
 	bool ClearBuffer();
 	bool WriteBuffer(char *pBuffer, unsigned int Samples);
 
-	buffer_event_t WaitForSyncEvent(DWORD dwTimeout) const;
+	buffer_event_t WaitForSyncEvent(DWORD dwTimeout);
+
+	int GetFillLevel() const;
 
 	int GetBlockSize() const	{ return m_iBlockSize; };
-	int GetBlockSamples() const	{ return m_iBlockSize >> ((m_iSampleSize >> 3) - 1); };
+	int GetBlockSamples() const	{ return m_iBlockSize / (m_iSampleSize >> 3); };
 	int GetBlocks()	const		{ return m_iBlocks; };
 	int	GetBufferLength() const	{ return m_iBufferLength; };
 	int GetSampleSize()	const	{ return m_iSampleSize;	};
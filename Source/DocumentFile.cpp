@@ -18,6 +18,7 @@
 ** must bear this legend.
 */
 
+#include <vector>
 #include "stdafx.h"
 #include "DocumentFile.h"
 
@@ -29,6 +30,7 @@
 
 // Class constants
 const unsigned int CDocumentFile::FILE_VER		 = 0x0440;			// Current file version (4.40)
+const unsigned int CDocumentFile::FILE_VER_COMPRESSED = 0x0450;	// Files that may contain compressed blocks
 const unsigned int CDocumentFile::COMPATIBLE_VER = 0x0100;			// Compatible file version (1.0)
 
 const char *CDocumentFile::FILE_HEADER_ID = "FamiTracker Module";
@@ -37,11 +39,211 @@ const char *CDocumentFile::FILE_END_ID	  = "END";
 const unsigned int CDocumentFile::MAX_BLOCK_SIZE = 0x80000;
 const unsigned int CDocumentFile::BLOCK_SIZE = 0x10000;
 
+const unsigned int CDocumentFile::BLOCK_COMPRESSED = 0x10000;		// Set in the block version field
+const unsigned int CDocumentFile::COMPRESS_THRESHOLD = 0x1000;		// Smaller blocks are always stored
+
+//
+// Block compression
+//
+// A simple LZ77 byte codec. Each sequence starts with a token byte, the high nibble is
+// the number of literals and the low nibble the match length minus LZ_MIN_MATCH, a nibble
+// of 15 is followed by extra length bytes (255 means more bytes follow). Literals come
+// next, then a 16 bit match offset and the extra match length bytes. The last sequence
+// contains only literals and ends where the decompressed size is reached.
+//
+
+static const unsigned int LZ_MIN_MATCH	= 4;
+static const unsigned int LZ_MAX_OFFSET = 0xFFFF;
+static const int LZ_HASH_BITS			= 14;
+
+static inline unsigned int ReadSequence(const unsigned char *pData)
+{
+	return pData[0] | (pData[1] << 8) | (pData[2] << 16) | (pData[3] << 24);
+}
+
+static bool WriteLength(unsigned char *pDest, unsigned int &Pos, unsigned int MaxSize, unsigned int Length)
+{
+	// Extra bytes for lengths that does not fit in the token
+	while (Length >= 255) {
+		if (Pos >= MaxSize)
+			return false;
+		pDest[Pos++] = 255;
+		Length -= 255;
+	}
+	if (Pos >= MaxSize)
+		return false;
+	pDest[Pos++] = Length;
+	return true;
+}
+
+static bool WriteSequence(unsigned char *pDest, unsigned int &Pos, unsigned int MaxSize, const unsigned char *pLiterals, unsigned int Literals, unsigned int Offset, unsigned int Match)
+{
+	// Match is zero for the last sequence
+	unsigned int MatchCode = Match > 0 ? Match - LZ_MIN_MATCH : 0;
+
+	if (Pos >= MaxSize)
+		return false;
+	pDest[Pos++] = (min(Literals, 15u) << 4) | min(MatchCode, 15u);
+
+	if (Literals >= 15 && !WriteLength(pDest, Pos, MaxSize, Literals - 15))
+		return false;
+
+	if (Pos + Literals > MaxSize)
+		return false;
+	memcpy(pDest + Pos, pLiterals, Literals);
+	Pos += Literals;
+
+	if (Match == 0)
+		return true;
+
+	if (Pos + 2 > MaxSize)
+		return false;
+	pDest[Pos++] = Offset & 0xFF;
+	pDest[Pos++] = Offset >> 8;
+
+	if (MatchCode >= 15 && !WriteLength(pDest, Pos, MaxSize, MatchCode - 15))
+		return false;
+
+	return true;
+}
+
+static unsigned int CompressData(const unsigned char *pSrc, unsigned int Size, unsigned char *pDest, unsigned int MaxSize)
+{
+	// Returns compressed size or 0 if it would not fit in MaxSize bytes
+	std::vector<int> Table(1 << LZ_HASH_BITS, -1);
+
+	unsigned int Pos = 0;
+	unsigned int Anchor = 0;
+	unsigned int i = 0;
+
+	while (i + LZ_MIN_MATCH <= Size) {
+		unsigned int Sequence = ReadSequence(pSrc + i);
+		unsigned int Hash = (Sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+		int Ref = Table[Hash];
+		Table[Hash] = i;
+
+		if (Ref >= 0 && i - Ref <= LZ_MAX_OFFSET && ReadSequence(pSrc + Ref) == Sequence) {
+			unsigned int Match = LZ_MIN_MATCH;
+			while (i + Match < Size && pSrc[Ref + Match] == pSrc[i + Match])
+				++Match;
+			if (!WriteSequence(pDest, Pos, MaxSize, pSrc + Anchor, i - Anchor, i - Ref, Match))
+				return 0;
+			i += Match;
+			Anchor = i;
+		}
+		else
+			++i;
+	}
+
+	if (Anchor < Size) {
+		if (!WriteSequence(pDest, Pos, MaxSize, pSrc + Anchor, Size - Anchor, 0, 0))
+			return 0;
+	}
+
+	return Pos;
+}
+
+// Reads compressed block data from the file in small chunks
+class CBlockStream
+{
+public:
+	CBlockStream(CFile *pFile, unsigned int Size) : m_pFile(pFile), m_iRemaining(Size), m_iPos(0), m_iCount(0) {
+	}
+
+	bool GetByte(unsigned int &Value) {
+		if (m_iPos == m_iCount) {
+			if (m_iRemaining == 0)
+				return false;
+			m_iCount = m_pFile->Read(m_pBuffer, min(m_iRemaining, (unsigned int)sizeof(m_pBuffer)));
+			m_iRemaining -= m_iCount;
+			m_iPos = 0;
+			if (m_iCount == 0) {
+				m_iRemaining = 0;
+				return false;
+			}
+		}
+		Value = m_pBuffer[m_iPos++];
+		return true;
+	}
+
+	bool GetLength(unsigned int &Length) {
+		unsigned int Value;
+		do {
+			if (!GetByte(Value))
+				return false;
+			Length += Value;
+		} while (Value == 255);
+		return true;
+	}
+
+	void Skip() {
+		// Move to the end of the block
+		if (m_iRemaining > 0)
+			m_pFile->Seek(m_iRemaining, CFile::current);
+		m_iRemaining = 0;
+	}
+
+private:
+	CFile *m_pFile;
+	unsigned int m_iRemaining;
+	unsigned int m_iPos;
+	unsigned int m_iCount;
+	unsigned char m_pBuffer[0x1000];
+};
+
+static bool DecompressData(CBlockStream &Stream, unsigned char *pDest, unsigned int Size)
+{
+	unsigned int Pos = 0;
+
+	while (Pos < Size) {
+		unsigned int Token;
+		if (!Stream.GetByte(Token))
+			return false;
+
+		unsigned int Literals = Token >> 4;
+		if (Literals == 15 && !Stream.GetLength(Literals))
+			return false;
+		if (Literals > Size - Pos)
+			return false;
+
+		for (unsigned int i = 0; i < Literals; ++i) {
+			unsigned int Value;
+			if (!Stream.GetByte(Value))
+				return false;
+			pDest[Pos++] = Value;
+		}
+
+		if (Pos == Size)
+			break;
+
+		unsigned int Low, High;
+		if (!Stream.GetByte(Low) || !Stream.GetByte(High))
+			return false;
+		unsigned int Offset = Low | (High << 8);
+
+		unsigned int Match = Token & 0x0F;
+		if (Match == 15 && !Stream.GetLength(Match))
+			return false;
+		Match += LZ_MIN_MATCH;
+
+		if (Offset == 0 || Offset > Pos || Match > Size - Pos)
+			return false;
+
+		// Matches may overlap the output
+		for (unsigned int i = 0; i < Match; ++i, ++Pos)
+			pDest[Pos] = pDest[Pos - Offset];
+	}
+
+	return true;
+}
+
 // CDocumentFile
 
 CDocumentFile::CDocumentFile() : 
 	m_pBlockData(NULL),
-	m_cBlockID(new char[16])
+	m_cBlockID(new char[16]),
+	m_bCompression(false),
+	m_bCompressBlock(false)
 {
 }
 
@@ -56,11 +258,17 @@ bool CDocumentFile::Finished() const
 	return m_bFileDone;
 }
 
+void CDocumentFile::SetCompression(bool Enable)
+{
+	// Must be selected before BeginDocument
+	m_bCompression = Enable;
+}
+
 bool CDocumentFile::BeginDocument()
 {
 	try {
 		Write(FILE_HEADER_ID, int(strlen(FILE_HEADER_ID)));
-		Write(&FILE_VER, sizeof(int));
+		Write(m_bCompression ? &FILE_VER_COMPRESSED : &FILE_VER, sizeof(int));
 	}
 	catch (CFileException *e) {
 		e->Delete();
@@ -83,7 +291,7 @@ bool CDocumentFile::EndDocument()
 	return true;
 }
 
-void CDocumentFile::CreateBlock(const char *ID, int Version)
+void CDocumentFile::CreateBlock(const char *ID, int Version, bool Compress)
 {
 	memset(m_cBlockID, 0, 16);
 	strcpy(m_cBlockID, ID);
@@ -91,6 +299,7 @@ void CDocumentFile::CreateBlock(const char *ID, int Version)
 	m_iBlockPointer = 0;
 	m_iBlockSize	= 0;
 	m_iBlockVersion = Version & 0xFFFF;
+	m_bCompressBlock = Compress;
 
 	m_iMaxBlockSize = BLOCK_SIZE;
 
@@ -161,17 +370,41 @@ bool CDocumentFile::FlushBlock()
 	if (!m_pBlockData)
 		return false;
 
+	// Large blocks are compressed if that makes them smaller, the uncompressed size is stored first
+	char *pCompressed = NULL;
+	unsigned int CompressedSize = 0;
+
+	if (m_bCompression && m_bCompressBlock && m_iBlockPointer >= COMPRESS_THRESHOLD) {
+		pCompressed = new char[m_iBlockPointer];
+		memcpy(pCompressed, &m_iBlockPointer, sizeof(m_iBlockPointer));
+		CompressedSize = CompressData((const unsigned char*)m_pBlockData, m_iBlockPointer, 
+			(unsigned char*)pCompressed + sizeof(m_iBlockPointer), m_iBlockPointer - sizeof(m_iBlockPointer));
+		if (CompressedSize > 0)
+			CompressedSize += sizeof(m_iBlockPointer);
+	}
+
 	try {
-		Write(m_cBlockID, 16);
-		Write(&m_iBlockVersion, sizeof(m_iBlockVersion));
-		Write(&m_iBlockPointer, sizeof(m_iBlockPointer));
-		Write(m_pBlockData, m_iBlockPointer);
+		if (CompressedSize > 0) {
+			unsigned int Version = m_iBlockVersion | BLOCK_COMPRESSED;
+			Write(m_cBlockID, 16);
+			Write(&Version, sizeof(Version));
+			Write(&CompressedSize, sizeof(CompressedSize));
+			Write(pCompressed, CompressedSize);
+		}
+		else {
+			Write(m_cBlockID, 16);
+			Write(&m_iBlockVersion, sizeof(m_iBlockVersion));
+			Write(&m_iBlockPointer, sizeof(m_iBlockPointer));
+			Write(m_pBlockData, m_iBlockPointer);
+		}
 	}
 	catch (CFileException *e) {
 		e->Delete();
+		SAFE_RELEASE_ARRAY(pCompressed);
 		return false;
 	}
 
+	SAFE_RELEASE_ARRAY(pCompressed);
 	SAFE_RELEASE_ARRAY(m_pBlockData);
 
 	return true;
@@ -222,14 +455,22 @@ bool CDocumentFile::ReadBlock()
 		return true;
 	}
 
+	if (strcmp(m_cBlockID, FILE_END_ID) == 0)
+		m_bFileDone = true;
+	else if (m_iBlockVersion & BLOCK_COMPRESSED) {
+		m_iBlockVersion &= ~BLOCK_COMPRESSED;
+		if (!ReadCompressedBlock()) {
+			memset(m_cBlockID, 0, 16);
+			return true;
+		}
+		return false;
+	}
+
 	SAFE_RELEASE_ARRAY(m_pBlockData);
 	m_pBlockData = new char[m_iBlockSize];
 
 	Read(m_pBlockData, m_iBlockSize);
 
-	if (strcmp(m_cBlockID, FILE_END_ID) == 0)
-		m_bFileDone = true;
-
 	if (BytesRead == 0)
 		m_bFileDone = true;
 /*
@@ -243,6 +484,31 @@ bool CDocumentFile::ReadBlock()
 	return false;
 }
 
+bool CDocumentFile::ReadCompressedBlock()
+{
+	// Decompress block data directly from the file
+	unsigned int Size;
+
+	if (m_iBlockSize < sizeof(Size))
+		return false;
+
+	Read(&Size, sizeof(Size));
+
+	if (Size > 50000000)
+		return false;
+
+	SAFE_RELEASE_ARRAY(m_pBlockData);
+	m_pBlockData = new char[Size];
+
+	CBlockStream Stream(this, m_iBlockSize - sizeof(Size));
+	bool Result = DecompressData(Stream, (unsigned char*)m_pBlockData, Size);
+	Stream.Skip();
+
+	m_iBlockSize = Size;
+
+	return Result;
+}
+
 char *CDocumentFile::GetBlockHeaderID() const
 {
 	return m_cBlockID;
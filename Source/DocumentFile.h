@@ -32,10 +32,11 @@ public:
 	bool		Finished() const;
 
 	// Write functions
+	void		SetCompression(bool Enable);
 	bool		BeginDocument();
 	bool		EndDocument();
 
-	void		CreateBlock(const char *ID, int Version);
+	void		CreateBlock(const char *ID, int Version, bool Compress = false);
 	void		WriteBlock(const char *pData, unsigned int Size);
 	void		WriteBlockInt(int Value);
 	void		WriteBlockChar(char Value);
@@ -66,6 +67,7 @@ public:
 public:
 	// Constants
 	static const unsigned int FILE_VER;
+	static const unsigned int FILE_VER_COMPRESSED;
 	static const unsigned int COMPATIBLE_VER;
 
 	static const char *FILE_HEADER_ID;
@@ -74,11 +76,15 @@ public:
 	static const unsigned int MAX_BLOCK_SIZE;
 	static const unsigned int BLOCK_SIZE;
 
+	static const unsigned int BLOCK_COMPRESSED;
+	static const unsigned int COMPRESS_THRESHOLD;
+
 private:
 	template<class T> void WriteBlockData(T Value);
 
 protected:
 	void ReallocateBlock();
+	bool ReadCompressedBlock();
 
 protected:
 	unsigned int	m_iFileVersion;
@@ -93,4 +99,7 @@ protected:
 	unsigned int	m_iMaxBlockSize;
 
 	unsigned int	m_iBlockPointer;	
+
+	bool			m_bCompression;
+	bool			m_bCompressBlock;
 };
@@ -104,3 +104,88 @@ char CFamiTrackerDocWrapper::GetSampleData(unsigned int Sample, unsigned int Off
 {
 	return *(m_pDocument->GetSample(Sample)->GetData() + Offset);
 }
+
+
+unsigned int CFamiTrackerDocWrapper::GetChannelCount() const
+{
+	return m_pDocument->GetAvailableChannels();
+}
+
+unsigned int CFamiTrackerDocWrapper::GetEffectColumnCount(unsigned int Channel) const
+{
+	if (Channel >= m_pDocument->GetAvailableChannels())
+		return 0;
+
+	return m_pDocument->GetEffColumns(m_iTrack, Channel) + 1;
+}
+
+const unsigned char *CFamiTrackerDocWrapper::GetFrameList(unsigned int &Channels) const
+{
+	// The track stores MAX_CHANNELS entries per frame and may not have allocated all frames,
+	// the list is packed once per export
+	const unsigned int Frames = m_pDocument->GetFrameCount(m_iTrack);
+
+	Channels = m_pDocument->GetAvailableChannels();
+
+	if (m_vFrameList.empty()) {
+		m_vFrameList.resize(Frames * Channels + 1);
+		for (unsigned int i = 0; i < Frames; ++i) {
+			for (unsigned int j = 0; j < Channels; ++j)
+				m_vFrameList[i * Channels + j] = m_pDocument->GetPatternAtFrame(m_iTrack, i, j);
+		}
+	}
+
+	return &m_vFrameList.front();
+}
+
+const stChanNote *CFamiTrackerDocWrapper::GetPatternRows(unsigned int Channel, unsigned int Pattern) const
+{
+	if (Channel >= m_pDocument->GetAvailableChannels() || Pattern >= MAX_PATTERN)
+		return NULL;
+
+	return m_pDocument->GetPatternRows(m_iTrack, Pattern, Channel);
+}
+
+const stChanNote *CFamiTrackerDocWrapper::GetFramePatternRows(unsigned int Frame, unsigned int Channel) const
+{
+	if (Frame >= m_pDocument->GetFrameCount(m_iTrack) || Channel >= m_pDocument->GetAvailableChannels())
+		return NULL;
+
+	return m_pDocument->GetPatternRows(m_iTrack, m_pDocument->GetPatternAtFrame(m_iTrack, Frame, Channel), Channel);
+}
+
+const signed char *CFamiTrackerDocWrapper::GetSequenceItems(CSequenceInterface const *pSequence, unsigned int &Count) const
+{
+	// All sequences in the document are CSequence objects
+	const CSequence *pSeq = static_cast<const CSequence*>(pSequence);
+	unsigned int Stored;
+	const signed char *pItems = pSeq->ReadItems(Stored);
+
+	Count = pSeq->GetItemCount();
+
+	if (Stored >= Count)
+		return pItems;
+
+	// Items that were never written are zero, exporters get a padded copy
+	m_vSequenceCopies.push_back(std::vector<signed char>(Count, 0));
+	std::vector<signed char> &Copy = m_vSequenceCopies.back();
+
+	if (Stored > 0)
+		memcpy(&Copy.front(), pItems, Stored);
+
+	return &Copy.front();
+}
+
+const char *CFamiTrackerDocWrapper::GetSampleBuffer(unsigned int Sample, unsigned int &Size) const
+{
+	if (Sample >= MAX_DSAMPLES) {
+		Size = 0;
+		return NULL;
+	}
+
+	const CDSample *pSample = m_pDocument->GetSample(Sample);
+
+	Size = pSample->GetSize();
+
+	return pSample->GetData();
+}
\ No newline at end of file
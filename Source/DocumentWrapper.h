@@ -22,6 +22,7 @@
 
 // Document wrapper class for custom exporters
 
+#include <list>
 #include "FamiTrackerDoc.h"
 
 class CFamiTrackerDocWrapper : public CFamiTrackerDocInterface
@@ -46,8 +47,21 @@ public:
 	virtual int				GetSampleSize(unsigned int Sample) const;
 	virtual char			GetSampleData(unsigned int Sample, unsigned int Offset) const;
 
+	// Bulk access
+	virtual unsigned int	GetChannelCount() const;
+	virtual unsigned int	GetEffectColumnCount(unsigned int Channel) const;
+	virtual const unsigned char *GetFrameList(unsigned int &Channels) const;
+	virtual const stChanNote *GetPatternRows(unsigned int Channel, unsigned int Pattern) const;
+	virtual const stChanNote *GetFramePatternRows(unsigned int Frame, unsigned int Channel) const;
+	virtual const signed char *GetSequenceItems(CSequenceInterface const *pSequence, unsigned int &Count) const;
+	virtual const char		*GetSampleBuffer(unsigned int Sample, unsigned int &Size) const;
+
 	// Attributes
 private:
 	CFamiTrackerDoc *m_pDocument;
 	int m_iTrack;
+
+	// Copies made when the document has no contiguous data, kept until the export is done
+	mutable std::vector<unsigned char> m_vFrameList;
+	mutable std::list<std::vector<signed char> > m_vSequenceCopies;
 };
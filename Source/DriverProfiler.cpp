@@ -0,0 +1,190 @@
+/*
+** FamiTracker - NES/Famicom sound tracker
+** Copyright (C) 2005-2014  Jonathan Liss
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+*/
+
+#include <vector>
+#include <algorithm>
+#include "stdafx.h"
+#include "FamiTrackerDoc.h"
+#include "Compiler.h"
+#include "DriverProfiler.h"
+
+/*
+ * Driver profiler
+ *
+ * Runs the exported NSF and counts CPU cycles for each PLAY call. Reads from
+ * frame and pattern data are used to find the player position during a call.
+ *
+ */
+
+CDriverProfiler::CDriverProfiler(int Channels) : m_iChannels(Channels), m_pCurrentFrame(NULL)
+{
+	m_Emulator.SetReadObserver(this);
+}
+
+bool CDriverProfiler::Load(const stNSFHeader *pHeader, const std::vector<char> &Data)
+{
+	if (Data.empty())
+		return false;
+
+	m_vOffsetMap.assign(Data.size(), -1);
+
+	return m_Emulator.Load(pHeader, &Data.front(), Data.size());
+}
+
+int CDriverProfiler::AddPattern(unsigned int Offset, unsigned int Size, const std::vector<unsigned int> &Rows)
+{
+	stPatternRange Range;
+	Range.Offset = Offset;
+	Range.Rows = Rows;
+	m_vPatterns.push_back(Range);
+
+	int Index = m_vPatterns.size() - 1;
+	MapRange(Offset, Size, Index);
+
+	return Index;
+}
+
+void CDriverProfiler::AddFrame(unsigned int Offset, unsigned int Size, int Frame, const std::vector<int> &Patterns)
+{
+	stFrameRange Range;
+	Range.Frame = Frame;
+	Range.Patterns = Patterns;
+	m_vFrames.push_back(Range);
+
+	MapRange(Offset, Size, FRAME_FLAG | (m_vFrames.size() - 1));
+}
+
+void CDriverProfiler::MapRange(unsigned int Offset, unsigned int Size, int Index)
+{
+	unsigned int End = min(Offset + Size, (unsigned int)m_vOffsetMap.size());
+
+	for (unsigned int i = Offset; i < End; ++i)
+		m_vOffsetMap[i] = Index;
+}
+
+bool CDriverProfiler::Run(int Track, int PlayCalls)
+{
+	// Profile one song, returns false if the driver failed to run
+	m_vCycles.clear();
+	m_vPeaks.clear();
+
+	m_pCurrentFrame = NULL;
+	m_State.Frame = -1;
+	m_State.Rows.assign(m_iChannels, -1);
+
+	m_Emulator.RunInit(Track);
+
+	for (int i = 0; i < PlayCalls && !m_Emulator.IsHalted(); ++i) {
+		m_State.Call = i;
+		std::fill(m_State.Rows.begin(), m_State.Rows.end(), -1);
+		m_State.Cycles = m_Emulator.RunPlay();
+		m_vCycles.push_back(m_State.Cycles);
+		StorePeak();
+	}
+
+	return !m_Emulator.IsHalted();
+}
+
+void CDriverProfiler::StorePeak()
+{
+	// Keep the calls with most cycles, sorted
+	if ((int)m_vPeaks.size() == PEAK_COUNT && m_State.Cycles <= m_vPeaks.back().Cycles)
+		return;
+
+	std::vector<stProfileState>::iterator it = m_vPeaks.begin();
+	while (it != m_vPeaks.end() && it->Cycles >= m_State.Cycles)
+		++it;
+
+	m_vPeaks.insert(it, m_State);
+
+	if ((int)m_vPeaks.size() > PEAK_COUNT)
+		m_vPeaks.pop_back();
+}
+
+int CDriverProfiler::GetCallCount() const
+{
+	return m_vCycles.size();
+}
+
+int CDriverProfiler::GetPercentile(int Percent) const
+{
+	if (m_vCycles.empty())
+		return 0;
+
+	std::vector<int> Sorted(m_vCycles);
+	std::vector<int>::iterator it = Sorted.begin() + ((Sorted.size() - 1) * Percent) / 100;
+	std::nth_element(Sorted.begin(), it, Sorted.end());
+
+	return *it;
+}
+
+int CDriverProfiler::CountOverLimit(int Cycles) const
+{
+	int Count = 0;
+
+	for (std::vector<int>::const_iterator it = m_vCycles.begin(); it != m_vCycles.end(); ++it) {
+		if (*it > Cycles)
+			++Count;
+	}
+
+	return Count;
+}
+
+int CDriverProfiler::GetPeakCount() const
+{
+	return m_vPeaks.size();
+}
+
+const stProfileState &CDriverProfiler::GetPeak(int Index) const
+{
+	return m_vPeaks[Index];
+}
+
+void CDriverProfiler::OnRead(unsigned int Offset)
+{
+	if (Offset >= m_vOffsetMap.size())
+		return;
+
+	int Index = m_vOffsetMap[Offset];
+
+	if (Index == -1)
+		return;
+
+	if (Index & FRAME_FLAG) {
+		// Driver entered a new frame
+		m_pCurrentFrame = &m_vFrames[Index & ~FRAME_FLAG];
+		m_State.Frame = m_pCurrentFrame->Frame;
+		return;
+	}
+
+	if (m_pCurrentFrame == NULL)
+		return;
+
+	// Find the channel playing this pattern, patterns shared between channels are counted for the first one
+	const stPatternRange &Pattern = m_vPatterns[Index];
+
+	for (int i = 0; i < (int)m_pCurrentFrame->Patterns.size() && i < m_iChannels; ++i) {
+		if (m_pCurrentFrame->Patterns[i] == Index) {
+			std::vector<unsigned int>::const_iterator it = std::upper_bound(Pattern.Rows.begin(), Pattern.Rows.end(), Offset - Pattern.Offset);
+			m_State.Rows[i] = (it - Pattern.Rows.begin()) - 1;
+			break;
+		}
+	}
+}
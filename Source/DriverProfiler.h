@@ -0,0 +1,95 @@
+/*
+** FamiTracker - NES/Famicom sound tracker
+** Copyright (C) 2005-2014  Jonathan Liss
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+*/
+
+#pragma once
+
+// std::vector is required by this header file
+
+#include "ExportTest/NSFEmulator.h"
+
+// Driver state during one PLAY call
+struct stProfileState {
+	int Call;					// PLAY call number
+	int Cycles;
+	int Frame;					// Last frame entered by the driver, -1 if unknown
+	std::vector<int> Rows;		// Row read by each channel, -1 if the channel did not read pattern data
+};
+
+//
+// Measures the CPU time used by the NSF driver for each PLAY call
+//
+
+class CDriverProfiler : public CNSFReadObserver
+{
+public:
+	CDriverProfiler(int Channels);
+
+	bool Load(const stNSFHeader *pHeader, const std::vector<char> &Data);
+
+	// Data to track, offsets are relative to the NSF data
+	int  AddPattern(unsigned int Offset, unsigned int Size, const std::vector<unsigned int> &Rows);
+	void AddFrame(unsigned int Offset, unsigned int Size, int Frame, const std::vector<int> &Patterns);
+
+	bool Run(int Track, int PlayCalls);
+
+	int  GetCallCount() const;
+	int  GetPercentile(int Percent) const;
+	int  CountOverLimit(int Cycles) const;
+	int  GetPeakCount() const;
+	const stProfileState &GetPeak(int Index) const;
+
+	// CNSFReadObserver
+	void OnRead(unsigned int Offset);
+
+public:
+	static const int PEAK_COUNT = 3;			// Number of peaks to keep for each song
+
+private:
+	void MapRange(unsigned int Offset, unsigned int Size, int Index);
+	void StorePeak();
+
+private:
+	struct stPatternRange {
+		unsigned int Offset;
+		std::vector<unsigned int> Rows;
+	};
+
+	struct stFrameRange {
+		int Frame;
+		std::vector<int> Patterns;				// Pattern range for each channel
+	};
+
+	static const int FRAME_FLAG = 0x40000000;	// Marks frame ranges in the offset map
+
+	CNSFEmulator m_Emulator;
+	int m_iChannels;
+
+	std::vector<stPatternRange> m_vPatterns;
+	std::vector<stFrameRange> m_vFrames;
+	std::vector<int> m_vOffsetMap;				// Range index for each byte of the data, -1 for other data
+
+	// Results
+	std::vector<int> m_vCycles;
+	std::vector<stProfileState> m_vPeaks;
+
+	// State of the current PLAY call
+	stProfileState m_State;
+	const stFrameRange *m_pCurrentFrame;
+};
@@ -36,41 +36,61 @@
 
 #ifdef EXPORT_TEST
 
-CExportTest::CExportTest() : m_pHeader(new stNSFHeader), m_hModule(NULL), m_bErrors(false)
+// Registers that are compared for each chip
+struct stChipRegs {
+	int		Chip;
+	LPCTSTR	Name;
+	size_t	Offset;		// Offset in stRegs
+	int		Count;
+};
+
+static const stChipRegs CHIP_REGS[] = {
+	{SNDCHIP_NONE, _T("2A03"), offsetof(stRegs, R_2A03), 0x14},
+	{SNDCHIP_VRC6, _T("VRC6"), offsetof(stRegs, R_VRC6), 0x09},
+	{SNDCHIP_VRC7, _T("VRC7"), offsetof(stRegs, R_VRC7), 0x40},
+	{SNDCHIP_FDS,  _T("FDS"),  offsetof(stRegs, R_FDS),  0x0B},
+	{SNDCHIP_MMC5, _T("MMC5"), offsetof(stRegs, R_MMC5), 0x08},
+	{SNDCHIP_N163, _T("N163"), offsetof(stRegs, R_N163), 0x80},
+	{SNDCHIP_S5B,  _T("5B"),   offsetof(stRegs, R_S5B),  0x0E},
+};
+
+static const int CHIP_REGS_COUNT = sizeof(CHIP_REGS) / sizeof(stChipRegs);
+
+static bool IsChipEnabled(const stChipRegs &ChipRegs, int Chip)
 {
+	return ChipRegs.Chip == SNDCHIP_NONE || (ChipRegs.Chip & Chip) != 0;
 }
 
-CExportTest::~CExportTest()
+static unsigned char GetReg(const stRegs *pRegs, const stChipRegs &ChipRegs, int Reg)
 {
-	SAFE_RELEASE(m_pHeader);
-	if (m_hModule != NULL) {
-		::FreeLibrary(m_hModule);
-	}
+	return reinterpret_cast<const unsigned char*>(pRegs)[ChipRegs.Offset + Reg];
 }
 
-bool CExportTest::Setup(LPCTSTR lpszFile)
+static bool IsRegEqual(const stRegs *pInternalRegs, const stRegs *pExternalRegs, const stChipRegs &ChipRegs, int Reg)
 {
-	if (m_hModule == NULL)
-		m_hModule = ::LoadLibrary(_T("ExportTest.dll"));
-
-	if (m_hModule == NULL) {
-		AfxMessageBox(_T("Could not load ExportTest.dll"));
-		return false;
+	unsigned char Internal = GetReg(pInternalRegs, ChipRegs, Reg);
+	unsigned char External = GetReg(pExternalRegs, ChipRegs, Reg);
+
+	if (ChipRegs.Chip == SNDCHIP_NONE) {
+		if (Reg == 0x11)
+			return (Internal & 0x7F) == (External & 0x7F);
+		else if (Reg == 0x12)	// Ignore DPCM start address
+			return true;
 	}
 
-	ImportFuncs.LoadFileFunc = (LoadFile_t)GetProcAddress(m_hModule, "LoadFile");
-	ImportFuncs.RunFrameFunc = (RunFrame_t)GetProcAddress(m_hModule, "RunFrame");
-	ImportFuncs.ReadResultFunc = (ReadResult_t)GetProcAddress(m_hModule, "ReadResult");
-
-	if (ImportFuncs.LoadFileFunc == NULL)
-		return false;
+	return Internal == External;
+}
 
-	if (ImportFuncs.RunFrameFunc == NULL)
-		return false;
+CExportTest::CExportTest() : m_iFileSize(0), m_bErrors(false)
+{
+}
 
-	if (ImportFuncs.ReadResultFunc == NULL)
-		return false;
+CExportTest::~CExportTest()
+{
+}
 
+bool CExportTest::Setup(LPCTSTR lpszFile)
+{
 	TCHAR TempPath[MAX_PATH];
 	TCHAR TempFile[MAX_PATH];
 
@@ -92,9 +112,10 @@ bool CExportTest::Setup(LPCTSTR lpszFile)
 
 	int size = (int)inFile.GetLength() - sizeof(stNSFHeader);
 
+	stNSFHeader Header;
 	char *pMemory = new char[size];
 
-	inFile.Read(m_pHeader, sizeof(stNSFHeader));
+	inFile.Read(&Header, sizeof(stNSFHeader));
 	inFile.Read(pMemory, size);
 	inFile.Close();
 
@@ -106,26 +127,49 @@ bool CExportTest::Setup(LPCTSTR lpszFile)
 	m_iFileSize = size;
 
 	// Setup memory
-	ImportFuncs.LoadFileFunc(pMemory, size, m_pHeader);
+	bool Result = m_Emulator.Load(&Header, pMemory, size);
 
 	SAFE_RELEASE_ARRAY(pMemory);
 
-	return true;
+	if (!Result)
+		AfxMessageBox(_T("Could not load the exported NSF"));
+
+	return Result;
 }
 
 void CExportTest::RunInit(int Song)
 {
-	int cycles = ImportFuncs.RunFrameFunc(m_pHeader->InitAddr, Song);
+	int cycles = m_Emulator.RunInit(Song);
 }
 
 void CExportTest::RunPlay()
 {
-	int cycles = ImportFuncs.RunFrameFunc(m_pHeader->PlayAddr, 0);
+	int cycles = m_Emulator.RunPlay();
 }
 
-unsigned char CExportTest::ReadReg(int Reg, int Chip)
+bool CExportTest::CompareRegisters(const stRegs *pInternalRegs, int Chip) const
 {
-	return ImportFuncs.ReadResultFunc(Reg, Chip);
+	// Returns false if any register of the enabled chips differs
+	if (m_Emulator.IsHalted())
+		return false;
+
+	const stRegs *pExternalRegs = m_Emulator.GetRegisters();
+
+	for (int i = 0; i < CHIP_REGS_COUNT; ++i) {
+		if (!IsChipEnabled(CHIP_REGS[i], Chip))
+			continue;
+		for (int j = 0; j < CHIP_REGS[i].Count; ++j) {
+			if (!IsRegEqual(pInternalRegs, pExternalRegs, CHIP_REGS[i], j))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+const stRegs *CExportTest::GetRegisters() const
+{
+	return m_Emulator.GetRegisters();
 }
 
 class CExportTestDlg : public CDHtmlDialog
@@ -136,56 +180,11 @@ public:
 		CString str;
 
 		str = _T("<b>Internal:</b><br>");
-		for (int i = 0; i < 0x14; ++i) {
-			if ((i & 3) == 0)
-				str.AppendFormat(_T("<tt>$%X: </tt>"), i + 0x4000);
-			
-			str.Append(_T("<tt style=\"color:green\">"));
-			str.AppendFormat(_T("$%02X "), m_pInternalRegs->R_2A03[i]);
-			str.Append(_T("</tt>"));
-
-			str.Append((i & 3) == 3 ? _T("<br>") : _T(""));
-		}
-		if (m_iChip & SNDCHIP_VRC6) {
-			str.Append(_T("<br>"));
-			for (int i = 0; i < 9; ++i) {
-				if ((i % 3) == 0)
-					str.AppendFormat(_T("<tt>$%X: </tt>"), (i / 3) * 0x1000 + 0x9000);
-				str.Append(_T("<tt style=\"color:green\">"));
-				str.AppendFormat(_T("$%02X "), m_pInternalRegs->R_VRC6[i]);
-				str.Append(_T("</tt>"));
-
-				str.Append((i % 3) == 2 ? _T("<br>") : _T(""));
-			}
-		}
-
+		AppendRegs(str, m_pInternalRegs, false);
 		SetElementHtml(_T("resultInternal"), str.AllocSysString());
 
 		str = _T("<b>Exported:</b><br>");
-		for (int i = 0; i < 0x14; ++i) {
-			if ((i & 3) == 0)
-				str.AppendFormat(_T("<tt>$%X: </tt>"), i + 0x4000);
-
-			str.AppendFormat(_T("<tt style=\"color:%s\">"), (m_pExternalRegs->R_2A03[i] == m_pInternalRegs->R_2A03[i]) ? _T("green") : _T("red"));
-			str.AppendFormat("$%02X ", m_pExternalRegs->R_2A03[i]);
-			str.Append(_T("</tt>"));
-
-			str.AppendFormat((i & 3) == 3 ? _T("<br>") : _T(""));
-		}
-		if (m_iChip & SNDCHIP_VRC6) {
-			str.Append(_T("<br>"));
-			for (int i = 0; i < 9; ++i) {
-				if ((i % 3) == 0)
-					str.AppendFormat(_T("<tt>$%X: </tt>"), (i / 3) * 0x1000 + 0x9000);
-
-				str.AppendFormat(_T("<tt style=\"color:%s\">"), (m_pExternalRegs->R_VRC6[i] == m_pInternalRegs->R_VRC6[i]) ? _T("green") : _T("red"));
-				str.AppendFormat(_T("$%02X "), m_pExternalRegs->R_VRC6[i]);
-				str.Append(_T("</tt>"));
-
-				str.Append((i % 3) == 2 ? _T("<br>") : _T(""));
-			}
-		}
-
+		AppendRegs(str, m_pExternalRegs, true);
 		SetElementHtml(_T("resultExternal"), str.AllocSysString());
 
 		str.Format(_T("APU frames since last row: %i<br><br>"), m_iUpdateFrames);
@@ -193,6 +192,24 @@ public:
 		SetElementHtml(_T("other"), str.AllocSysString());
 	}
 
+	void AppendRegs(CString &str, const stRegs *pRegs, bool Compare) const {
+		for (int i = 0; i < CHIP_REGS_COUNT; ++i) {
+			const stChipRegs &ChipRegs = CHIP_REGS[i];
+			if (!IsChipEnabled(ChipRegs, m_iChip))
+				continue;
+			str.AppendFormat(_T("<br><tt>%s</tt><br>"), ChipRegs.Name);
+			for (int j = 0; j < ChipRegs.Count; ++j) {
+				if ((j & 7) == 0)
+					str.AppendFormat(_T("<tt>$%02X: </tt>"), j);
+				bool Equal = !Compare || IsRegEqual(m_pInternalRegs, m_pExternalRegs, ChipRegs, j);
+				str.AppendFormat(_T("<tt style=\"color:%s\">"), Equal ? _T("green") : _T("red"));
+				str.AppendFormat(_T("$%02X "), GetReg(pRegs, ChipRegs, j));
+				str.Append(_T("</tt>"));
+				str.Append(((j & 7) == 7 || j == ChipRegs.Count - 1) ? _T("<br>") : _T(""));
+			}
+		}
+	}
+
 	BOOL OnInitDialog() {
 		SetHostFlags(DOCHOSTUIFLAG_NO3DBORDER);
 		CDHtmlDialog::OnInitDialog();
@@ -204,8 +221,8 @@ public:
 
 	unsigned char m_iChip;
 
-	stRegs *m_pInternalRegs;
-	stRegs *m_pExternalRegs;
+	const stRegs *m_pInternalRegs;
+	const stRegs *m_pExternalRegs;
 
 	DECLARE_MESSAGE_MAP()
 
@@ -239,7 +256,7 @@ void CExportTest::ReportSuccess()
 	}
 }
 
-bool CExportTest::ReportError(stRegs *pInternalRegs, stRegs *pExternalRegs, int UpdateFrames, int Chip)
+bool CExportTest::ReportError(const stRegs *pInternalRegs, const stRegs *pExternalRegs, int UpdateFrames, int Chip)
 {
 	m_bErrors = true;
 
@@ -271,48 +288,41 @@ static void SetConsoleColor(WORD Color)
 	SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), Color);
 }
 
-void CExportTest::PrintErrorReport(stRegs *pInternalRegs, stRegs *pExternalRegs, int UpdateFrames, int Chip)
+void CExportTest::PrintErrorReport(const stRegs *pInternalRegs, const stRegs *pExternalRegs, int UpdateFrames, int Chip)
 {
 	// Print error report to the console
 	SetConsoleColor(CON_COLOR_RED);
-	printf("\nExport verification failed\n\n");
+	printf("\nExport verification failed\n");
 
-	CSoundGen *pSoundGen = theApp.GetSoundGenerator();
+	if (m_Emulator.IsHalted())
+		printf("The NSF driver stopped on an invalid instruction or did not return\n");
 
-	SetConsoleColor(CON_COLOR_WHITE);
-	printf("Internal:\n");
+	CSoundGen *pSoundGen = theApp.GetSoundGenerator();
 
-	for (int i = 0; i < 0x14; ++i) {
-		if ((i & 3) == 0) {
-			SetConsoleColor(CON_COLOR_WHITE);
-			printf("$%X: ", i + 0x4000);
-		}
-		
-		SetConsoleColor(CON_COLOR_GREEN);
-		printf("$%02X ", pInternalRegs->R_2A03[i]);
+	for (int i = 0; i < CHIP_REGS_COUNT; ++i) {
+		const stChipRegs &ChipRegs = CHIP_REGS[i];
+		if (!IsChipEnabled(ChipRegs, Chip))
+			continue;
 
-		if ((i & 3) == 3)
-			printf("\n");
-	}
+		SetConsoleColor(CON_COLOR_WHITE);
+		printf("\n%s (internal / external):\n", ChipRegs.Name);
 
-	SetConsoleColor(CON_COLOR_WHITE);
-	printf("\nExternal:\n");
+		for (int j = 0; j < ChipRegs.Count; ++j) {
+			if ((j & 7) == 0) {
+				SetConsoleColor(CON_COLOR_WHITE);
+				printf("$%02X: ", j);
+			}
 
-	for (int i = 0; i < 0x14; ++i) {
-		if ((i & 3) == 0) {
-			SetConsoleColor(CON_COLOR_WHITE);
-			printf("$%X: ", i + 0x4000);
-		}
-		
-		if (pInternalRegs->R_2A03[i] == pExternalRegs->R_2A03[i])
-			SetConsoleColor(CON_COLOR_GREEN);
-		else
-			SetConsoleColor(CON_COLOR_RED);
+			if (IsRegEqual(pInternalRegs, pExternalRegs, ChipRegs, j))
+				SetConsoleColor(CON_COLOR_GREEN);
+			else
+				SetConsoleColor(CON_COLOR_RED);
 
-		printf("$%02X ", pExternalRegs->R_2A03[i]);
+			printf("$%02X/$%02X ", GetReg(pInternalRegs, ChipRegs, j), GetReg(pExternalRegs, ChipRegs, j));
 
-		if ((i & 3) == 3)
-			printf("\n");
+			if ((j & 7) == 7 || j == ChipRegs.Count - 1)
+				printf("\n");
+		}
 	}
 
 	SetConsoleColor(CON_COLOR_WHITE);
@@ -22,21 +22,7 @@
 
 #ifdef EXPORT_TEST
 
-struct stRegs {
-	unsigned char R_2A03[0x20];
-	unsigned char R_VRC6[0x10];
-	unsigned char R_VRC7[0x40];
-	unsigned char R_FDS[0x10];
-	unsigned char R_MMC5[0x08];
-	unsigned char R_N163[0x100];
-};
-
-// DLL imports
-typedef void (*LoadFile_t)(char*, int, void*);
-typedef int (*RunFrame_t)(unsigned int, int);
-typedef unsigned char (*ReadResult_t)(unsigned int, int);
-
-struct stNSFHeader;
+#include "NSFEmulator.h"
 
 // Test class
 class CExportTest
@@ -49,24 +35,19 @@ public:
 	void RunInit(int Song);
 	void RunPlay();
 
-	void ReportSuccess();
-	bool ReportError(stRegs *pInternalRegs, stRegs *pExternalRegs, int UpdateFrames, int Chip);
+	bool CompareRegisters(const stRegs *pInternalRegs, int Chip) const;
+	const stRegs *GetRegisters() const;
 
-	unsigned char ReadReg(int Reg, int Chip);
+	void ReportSuccess();
+	bool ReportError(const stRegs *pInternalRegs, const stRegs *pExternalRegs, int UpdateFrames, int Chip);
 
 private:
-	void PrintErrorReport(stRegs *pInternalRegs, stRegs *pExternalRegs, int UpdateFrames, int Chip);
+	void PrintErrorReport(const stRegs *pInternalRegs, const stRegs *pExternalRegs, int UpdateFrames, int Chip);
 
 private:
-	struct {
-		LoadFile_t		LoadFileFunc;
-		RunFrame_t		RunFrameFunc;
-		ReadResult_t	ReadResultFunc;
-	} ImportFuncs;
+	CNSFEmulator m_Emulator;
 
-	stNSFHeader *m_pHeader;
 	int m_iFileSize;
-	HMODULE m_hModule;
 	bool m_bErrors;
 };
 
@@ -0,0 +1,701 @@
+/*
+** FamiTracker - NES/Famicom sound tracker
+** Copyright (C) 2005-2014  Jonathan Liss
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+*/
+
+#include <vector>
+#include "../stdafx.h"
+#include "../FamiTrackerDoc.h"
+#include "../Compiler.h"
+#include "NSFEmulator.h"
+
+/*
+ * An NSF player used for export verification and driver profiling, it runs the
+ * exported driver and captures the register writes to all sound chips.
+ *
+ * Only the official 6502 instructions are supported (the driver does not use any
+ * other) and the CPU stops on an unknown opcode. APU reads are not emulated.
+ *
+ */
+
+// CRegisterState
+
+CRegisterState::CRegisterState()
+{
+	Reset();
+}
+
+void CRegisterState::Reset()
+{
+	memset(&m_Regs, 0, sizeof(stRegs));
+	m_iVRC7Address = 0;
+	m_iN163Address = 0;
+	m_iS5BAddress = 0;
+}
+
+void CRegisterState::Write(unsigned short Address, unsigned char Value)
+{
+	// 2A03
+	if (Address >= 0x4000 && Address < 0x4020)
+		m_Regs.R_2A03[Address & 0x1F] = Value;
+	// VRC6
+	else if (Address >= 0x9000 && Address < 0x9003)
+		m_Regs.R_VRC6[Address & 0x03] = Value;
+	else if (Address >= 0xA000 && Address < 0xA003)
+		m_Regs.R_VRC6[(Address & 0x03) + 3] = Value;
+	else if (Address >= 0xB000 && Address < 0xB003)
+		m_Regs.R_VRC6[(Address & 0x03) + 6] = Value;
+	// VRC7
+	else if (Address == 0x9010)
+		m_iVRC7Address = Value & 0x3F;
+	else if (Address == 0x9030)
+		m_Regs.R_VRC7[m_iVRC7Address] = Value;
+	// FDS, wave RAM is not included
+	else if (Address >= 0x4080 && Address < 0x4090)
+		m_Regs.R_FDS[Address & 0x0F] = Value;
+	// MMC5
+	else if (Address >= 0x5000 && Address < 0x5008)
+		m_Regs.R_MMC5[Address & 0x07] = Value;
+	// N163
+	else if (Address == 0xF800)
+		m_iN163Address = Value;
+	else if (Address == 0x4800) {
+		m_Regs.R_N163[m_iN163Address & 0x7F] = Value;
+		if (m_iN163Address & 0x80)
+			m_iN163Address = 0x80 | ((m_iN163Address + 1) & 0x7F);
+	}
+	// S5B
+	else if (Address == 0xC000)
+		m_iS5BAddress = Value & 0x0F;
+	else if (Address == 0xE000)
+		m_Regs.R_S5B[m_iS5BAddress] = Value;
+}
+
+const stRegs *CRegisterState::GetRegs() const
+{
+	return &m_Regs;
+}
+
+// CNSFEmulator
+
+const unsigned char CNSFEmulator::CYCLE_TABLE[256] = {
+//	 0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F
+	 7, 6, 2, 8, 3, 3, 5, 5, 3, 2, 2, 2, 4, 4, 6, 6,	// 0
+	 2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,	// 1
+	 6, 6, 2, 8, 3, 3, 5, 5, 4, 2, 2, 2, 4, 4, 6, 6,	// 2
+	 2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,	// 3
+	 6, 6, 2, 8, 3, 3, 5, 5, 3, 2, 2, 2, 3, 4, 6, 6,	// 4
+	 2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,	// 5
+	 6, 6, 2, 8, 3, 3, 5, 5, 4, 2, 2, 2, 5, 4, 6, 6,	// 6
+	 2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,	// 7
+	 2, 6, 2, 6, 3, 3, 3, 3, 2, 2, 2, 2, 4, 4, 4, 4,	// 8
+	 2, 6, 2, 6, 4, 4, 4, 4, 2, 5, 2, 5, 5, 5, 5, 5,	// 9
+	 2, 6, 2, 6, 3, 3, 3, 3, 2, 2, 2, 2, 4, 4, 4, 4,	// A
+	 2, 5, 2, 5, 4, 4, 4, 4, 2, 4, 2, 4, 4, 4, 4, 4,	// B
+	 2, 6, 2, 8, 3, 3, 5, 5, 2, 2, 2, 2, 4, 4, 6, 6,	// C
+	 2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,	// D
+	 2, 6, 2, 8, 3, 3, 5, 5, 2, 2, 2, 2, 4, 4, 6, 6,	// E
+	 2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,	// F
+};
+
+CNSFEmulator::CNSFEmulator() :
+	m_iPC(0), m_iA(0), m_iX(0), m_iY(0), m_iSP(0xFF),
+	m_bCarry(false), m_bZero(false), m_bInterrupt(true), m_bDecimal(false), m_bOverflow(false), m_bNegative(false),
+	m_iCycles(0),
+	m_bHalted(false),
+	m_bBankswitched(false),
+	m_bFDS(false),
+	m_iBankCount(0),
+	m_iInitAddress(0),
+	m_iPadding(0),
+	m_iPlayAddress(0),
+	m_iRegion(0),
+	m_pObserver(NULL)
+{
+	memset(m_iRAM, 0, sizeof(m_iRAM));
+	memset(m_iWRAM, 0, sizeof(m_iWRAM));
+	memset(m_iInitBanks, 0, sizeof(m_iInitBanks));
+
+	for (int i = 0; i < 16; ++i) {
+		m_pPages[i] = NULL;
+		m_iPageBank[i] = -1;
+	}
+}
+
+CNSFEmulator::~CNSFEmulator()
+{
+}
+
+bool CNSFEmulator::Load(const stNSFHeader *pHeader, const char *pData, int Size)
+{
+	// Setup memory from an NSF file
+	if (memcmp(pHeader->Ident, "NESM\x1A", 5) != 0)
+		return false;
+
+	m_bFDS = (pHeader->SoundChip & SNDCHIP_FDS) != 0;
+
+	if (pHeader->LoadAddr < (m_bFDS ? 0x6000 : 0x8000))
+		return false;
+
+	m_iInitAddress = pHeader->InitAddr;
+	m_iPlayAddress = pHeader->PlayAddr;
+	m_iRegion = (pHeader->Flags & 0x01) ? 1 : 0;
+
+	m_bBankswitched = false;
+	for (int i = 0; i < 8; ++i) {
+		if (pHeader->BankValues[i] != 0)
+			m_bBankswitched = true;
+	}
+
+	// Data is placed in 4kB banks, with the first bank starting on the page of the load address
+	int Padding;
+
+	if (m_bBankswitched) {
+		Padding = pHeader->LoadAddr & (PAGE_SIZE - 1);
+		for (int i = 0; i < 8; ++i)
+			m_iInitBanks[i + 2] = pHeader->BankValues[i];
+		// FDS uses the banks at $5FF6 and $5FF7 for $6000-$7FFF, they are initialized from the last two banks
+		m_iInitBanks[0] = pHeader->BankValues[6];
+		m_iInitBanks[1] = pHeader->BankValues[7];
+	}
+	else {
+		int Origin = m_bFDS ? 0x6000 : 0x8000;
+		Padding = pHeader->LoadAddr - Origin;
+		for (int i = 0; i < 10; ++i)
+			m_iInitBanks[i] = m_bFDS ? i : (i - 2);
+	}
+
+	m_iPadding = Padding;
+	m_iBankCount = (Padding + Size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+	m_vROM.assign(m_iBankCount * PAGE_SIZE, 0);
+	memcpy(&m_vROM[Padding], pData, Size);
+
+	return m_iBankCount > 0;
+}
+
+int CNSFEmulator::RunInit(int Song)
+{
+	// Reset memory
+	memset(m_iRAM, 0, sizeof(m_iRAM));
+	memset(m_iWRAM, 0, sizeof(m_iWRAM));
+
+	for (int i = 0; i < 16; ++i) {
+		m_pPages[i] = NULL;
+		m_iPageBank[i] = -1;
+	}
+
+	// $6000-$7FFF is always RAM
+	m_pPages[6] = m_iWRAM;
+	m_pPages[7] = m_iWRAM + PAGE_SIZE;
+
+	for (int i = 0; i < 10; ++i) {
+		if (m_bFDS || i >= 2)
+			SwitchBank(i + 6, m_iInitBanks[i]);
+	}
+
+	m_Registers.Reset();
+	m_bHalted = false;
+
+	m_iA = m_iX = m_iY = 0;
+	m_iSP = 0xFF;
+	SetStatus(0x04);
+
+	return RunRoutine(m_iInitAddress, Song, m_iRegion);
+}
+
+int CNSFEmulator::RunPlay()
+{
+	return RunRoutine(m_iPlayAddress, 0, 0);
+}
+
+bool CNSFEmulator::IsHalted() const
+{
+	return m_bHalted;
+}
+
+const stRegs *CNSFEmulator::GetRegisters() const
+{
+	return m_Registers.GetRegs();
+}
+
+void CNSFEmulator::SetReadObserver(CNSFReadObserver *pObserver)
+{
+	m_pObserver = pObserver;
+}
+
+int CNSFEmulator::RunRoutine(unsigned short Address, unsigned char A, unsigned char X)
+{
+	// Call a routine and run until it returns, returns the number of cycles
+	if (m_bHalted)
+		return 0;
+
+	m_iA = A;
+	m_iX = X;
+	m_iSP = 0xFF;
+
+	// Return to an address outside of the program
+	Push((RETURN_ADDRESS - 1) >> 8);
+	Push((RETURN_ADDRESS - 1) & 0xFF);
+
+	m_iPC = Address;
+	m_iCycles = 0;
+
+	while (m_iPC != RETURN_ADDRESS && !m_bHalted) {
+		m_iCycles += Step();
+		if (m_iCycles > MAX_ROUTINE_CYCLES) {
+			TRACE1("NSF emulator: routine at $%04X did not return\n", Address);
+			m_bHalted = true;
+		}
+	}
+
+	return m_iCycles;
+}
+
+// Memory
+
+unsigned char CNSFEmulator::Read(unsigned short Address) const
+{
+	if (Address < 0x2000)
+		return m_iRAM[Address & 0x7FF];
+
+	int Page = Address >> 12;
+	const unsigned char *pPage = m_pPages[Page];
+
+	if (pPage != NULL) {
+		if (m_pObserver != NULL && m_iPageBank[Page] >= 0) {
+			int Offset = m_iPageBank[Page] * PAGE_SIZE + (Address & (PAGE_SIZE - 1)) - m_iPadding;
+			if (Offset >= 0)
+				m_pObserver->OnRead(Offset);
+		}
+		return pPage[Address & (PAGE_SIZE - 1)];
+	}
+
+	// Open bus
+	return 0;
+}
+
+void CNSFEmulator::Write(unsigned short Address, unsigned char Value)
+{
+	if (Address < 0x2000) {
+		m_iRAM[Address & 0x7FF] = Value;
+		return;
+	}
+
+	if (Address >= 0x5FF6 && Address <= 0x5FFF) {
+		// Bankswitching
+		if (Address >= 0x5FF8)
+			SwitchBank(Address - 0x5FF8 + 8, Value);
+		else if (m_bFDS)
+			SwitchBank(Address - 0x5FF6 + 6, Value);
+		return;
+	}
+
+	int Page = Address >> 12;
+
+	// Writable pages are backed by RAM
+	if (m_pPages[Page] >= m_iWRAM && m_pPages[Page] < m_iWRAM + sizeof(m_iWRAM))
+		m_pPages[Page][Address & (PAGE_SIZE - 1)] = Value;
+
+	m_Registers.Write(Address, Value);
+}
+
+void CNSFEmulator::SwitchBank(int Page, int Bank)
+{
+	ASSERT(Page >= 6 && Page < 16);
+
+	bool Valid = (Bank >= 0 && Bank < m_iBankCount);
+
+	m_iPageBank[Page] = Valid ? Bank : -1;
+
+	if (m_bFDS) {
+		// FDS has RAM in the whole area, banks are copied
+		m_pPages[Page] = m_iWRAM + (Page - 6) * PAGE_SIZE;
+		if (Valid)
+			memcpy(m_pPages[Page], &m_vROM[Bank * PAGE_SIZE], PAGE_SIZE);
+		else
+			memset(m_pPages[Page], 0, PAGE_SIZE);
+	}
+	else
+		m_pPages[Page] = Valid ? &m_vROM[Bank * PAGE_SIZE] : NULL;
+}
+
+// CPU
+
+unsigned char CNSFEmulator::Fetch()
+{
+	return Read(m_iPC++);
+}
+
+unsigned short CNSFEmulator::FetchWord()
+{
+	unsigned short Lo = Fetch();
+	unsigned short Hi = Fetch();
+	return Lo | (Hi << 8);
+}
+
+unsigned short CNSFEmulator::ReadWordZP(unsigned char Address) const
+{
+	return Read(Address) | (Read((Address + 1) & 0xFF) << 8);
+}
+
+void CNSFEmulator::Push(unsigned char Value)
+{
+	m_iRAM[0x100 | m_iSP--] = Value;
+}
+
+unsigned char CNSFEmulator::Pop()
+{
+	return m_iRAM[0x100 | ++m_iSP];
+}
+
+void CNSFEmulator::SetNZ(unsigned char Value)
+{
+	m_bZero = (Value == 0);
+	m_bNegative = (Value & 0x80) != 0;
+}
+
+unsigned char CNSFEmulator::GetStatus(bool Break) const
+{
+	return (m_bCarry ? 0x01 : 0) | (m_bZero ? 0x02 : 0) | (m_bInterrupt ? 0x04 : 0) | (m_bDecimal ? 0x08 : 0) |
+		(Break ? 0x10 : 0) | 0x20 | (m_bOverflow ? 0x40 : 0) | (m_bNegative ? 0x80 : 0);
+}
+
+void CNSFEmulator::SetStatus(unsigned char Value)
+{
+	m_bCarry = (Value & 0x01) != 0;
+	m_bZero = (Value & 0x02) != 0;
+	m_bInterrupt = (Value & 0x04) != 0;
+	m_bDecimal = (Value & 0x08) != 0;
+	m_bOverflow = (Value & 0x40) != 0;
+	m_bNegative = (Value & 0x80) != 0;
+}
+
+void CNSFEmulator::Branch(bool Condition)
+{
+	signed char Offset = (signed char)Fetch();
+
+	if (Condition) {
+		unsigned short Target = m_iPC + Offset;
+		m_iCycles += ((Target ^ m_iPC) & 0xFF00) ? 2 : 1;
+		m_iPC = Target;
+	}
+}
+
+void CNSFEmulator::ADC(unsigned char Value)
+{
+	// No decimal mode on the 2A03
+	int Result = m_iA + Value + (m_bCarry ? 1 : 0);
+	m_bOverflow = (~(m_iA ^ Value) & (m_iA ^ Result) & 0x80) != 0;
+	m_bCarry = Result > 0xFF;
+	m_iA = Result & 0xFF;
+	SetNZ(m_iA);
+}
+
+void CNSFEmulator::Compare(unsigned char Reg, unsigned char Value)
+{
+	m_bCarry = Reg >= Value;
+	SetNZ(Reg - Value);
+}
+
+unsigned short CNSFEmulator::AddrZeroPage(unsigned char Index)
+{
+	return (Fetch() + Index) & 0xFF;
+}
+
+unsigned short CNSFEmulator::AddrAbsolute(unsigned char Index, bool Penalty)
+{
+	unsigned short Base = FetchWord();
+	unsigned short Address = Base + Index;
+	if (Penalty && ((Base ^ Address) & 0xFF00))
+		++m_iCycles;
+	return Address;
+}
+
+unsigned short CNSFEmulator::AddrIndirectX()
+{
+	return ReadWordZP(Fetch() + m_iX);
+}
+
+unsigned short CNSFEmulator::AddrIndirectY(bool Penalty)
+{
+	unsigned short Base = ReadWordZP(Fetch());
+	unsigned short Address = Base + m_iY;
+	if (Penalty && ((Base ^ Address) & 0xFF00))
+		++m_iCycles;
+	return Address;
+}
+
+int CNSFEmulator::Step()
+{
+	// Execute one instruction, returns the base cycle count. Extra cycles are added directly to m_iCycles
+	unsigned short PC = m_iPC;
+	unsigned char Opcode = Fetch();
+	unsigned short Address = 0;
+	unsigned char Value;
+
+	// Effective address, read instructions get a penalty on page crossing
+	switch (Opcode) {
+		// Zero page
+		case 0x05: case 0x06: case 0x24: case 0x25: case 0x26: case 0x45: case 0x46: case 0x65: case 0x66:
+		case 0x84: case 0x85: case 0x86: case 0xA4: case 0xA5: case 0xA6: case 0xC4: case 0xC5: case 0xC6:
+		case 0xE4: case 0xE5: case 0xE6:
+			Address = AddrZeroPage(0);
+			break;
+		// Zero page, X
+		case 0x15: case 0x16: case 0x35: case 0x36: case 0x55: case 0x56: case 0x75: case 0x76:
+		case 0x94: case 0x95: case 0xB4: case 0xB5: case 0xD5: case 0xD6: case 0xF5: case 0xF6:
+			Address = AddrZeroPage(m_iX);
+			break;
+		// Zero page, Y
+		case 0x96: case 0xB6:
+			Address = AddrZeroPage(m_iY);
+			break;
+		// Absolute
+		case 0x0D: case 0x0E: case 0x20: case 0x2C: case 0x2D: case 0x2E: case 0x4C: case 0x4D: case 0x4E:
+		case 0x6D: case 0x6E: case 0x8C: case 0x8D: case 0x8E: case 0xAC: case 0xAD: case 0xAE: case 0xCC:
+		case 0xCD: case 0xCE: case 0xEC: case 0xED: case 0xEE:
+			Address = AddrAbsolute(0, false);
+			break;
+		// Absolute, X
+		case 0x1D: case 0x3D: case 0x5D: case 0x7D: case 0xBC: case 0xBD: case 0xDD: case 0xFD:
+			Address = AddrAbsolute(m_iX, true);
+			break;
+		case 0x1E: case 0x3E: case 0x5E: case 0x7E: case 0x9D: case 0xDE: case 0xFE:
+			Address = AddrAbsolute(m_iX, false);
+			break;
+		// Absolute, Y
+		case 0x19: case 0x39: case 0x59: case 0x79: case 0xB9: case 0xBE: case 0xD9: case 0xF9:
+			Address = AddrAbsolute(m_iY, true);
+			break;
+		case 0x99:
+			Address = AddrAbsolute(m_iY, false);
+			break;
+		// (Indirect, X)
+		case 0x01: case 0x21: case 0x41: case 0x61: case 0x81: case 0xA1: case 0xC1: case 0xE1:
+			Address = AddrIndirectX();
+			break;
+		// (Indirect), Y
+		case 0x11: case 0x31: case 0x51: case 0x71: case 0xB1: case 0xD1: case 0xF1:
+			Address = AddrIndirectY(true);
+			break;
+		case 0x91:
+			Address = AddrIndirectY(false);
+			break;
+		// Immediate
+		case 0x09: case 0x29: case 0x49: case 0x69: case 0xA0: case 0xA2: case 0xA9: case 0xC0: case 0xC9:
+		case 0xE0: case 0xE9:
+			Address = m_iPC++;
+			break;
+	}
+
+	switch (Opcode) {
+		// Loads and stores
+		case 0xA9: case 0xA5: case 0xB5: case 0xAD: case 0xBD: case 0xB9: case 0xA1: case 0xB1:
+			m_iA = Read(Address);
+			SetNZ(m_iA);
+			break;
+		case 0xA2: case 0xA6: case 0xB6: case 0xAE: case 0xBE:
+			m_iX = Read(Address);
+			SetNZ(m_iX);
+			break;
+		case 0xA0: case 0xA4: case 0xB4: case 0xAC: case 0xBC:
+			m_iY = Read(Address);
+			SetNZ(m_iY);
+			break;
+		case 0x85: case 0x95: case 0x8D: case 0x9D: case 0x99: case 0x81: case 0x91:
+			Write(Address, m_iA);
+			break;
+		case 0x86: case 0x96: case 0x8E:
+			Write(Address, m_iX);
+			break;
+		case 0x84: case 0x94: case 0x8C:
+			Write(Address, m_iY);
+			break;
+		// Arithmetic
+		case 0x69: case 0x65: case 0x75: case 0x6D: case 0x7D: case 0x79: case 0x61: case 0x71:
+			ADC(Read(Address));
+			break;
+		case 0xE9: case 0xE5: case 0xF5: case 0xED: case 0xFD: case 0xF9: case 0xE1: case 0xF1:
+			ADC(~Read(Address));
+			break;
+		case 0x29: case 0x25: case 0x35: case 0x2D: case 0x3D: case 0x39: case 0x21: case 0x31:
+			m_iA &= Read(Address);
+			SetNZ(m_iA);
+			break;
+		case 0x09: case 0x05: case 0x15: case 0x0D: case 0x1D: case 0x19: case 0x01: case 0x11:
+			m_iA |= Read(Address);
+			SetNZ(m_iA);
+			break;
+		case 0x49: case 0x45: case 0x55: case 0x4D: case 0x5D: case 0x59: case 0x41: case 0x51:
+			m_iA ^= Read(Address);
+			SetNZ(m_iA);
+			break;
+		case 0xC9: case 0xC5: case 0xD5: case 0xCD: case 0xDD: case 0xD9: case 0xC1: case 0xD1:
+			Compare(m_iA, Read(Address));
+			break;
+		case 0xE0: case 0xE4: case 0xEC:
+			Compare(m_iX, Read(Address));
+			break;
+		case 0xC0: case 0xC4: case 0xCC:
+			Compare(m_iY, Read(Address));
+			break;
+		case 0x24: case 0x2C:
+			Value = Read(Address);
+			m_bZero = (m_iA & Value) == 0;
+			m_bOverflow = (Value & 0x40) != 0;
+			m_bNegative = (Value & 0x80) != 0;
+			break;
+		// Read-modify-write
+		case 0xE6: case 0xF6: case 0xEE: case 0xFE:
+			Value = Read(Address) + 1;
+			Write(Address, Value);
+			SetNZ(Value);
+			break;
+		case 0xC6: case 0xD6: case 0xCE: case 0xDE:
+			Value = Read(Address) - 1;
+			Write(Address, Value);
+			SetNZ(Value);
+			break;
+		case 0x06: case 0x16: case 0x0E: case 0x1E:
+			Value = Read(Address);
+			m_bCarry = (Value & 0x80) != 0;
+			Value <<= 1;
+			Write(Address, Value);
+			SetNZ(Value);
+			break;
+		case 0x46: case 0x56: case 0x4E: case 0x5E:
+			Value = Read(Address);
+			m_bCarry = (Value & 0x01) != 0;
+			Value >>= 1;
+			Write(Address, Value);
+			SetNZ(Value);
+			break;
+		case 0x26: case 0x36: case 0x2E: case 0x3E: {
+			Value = Read(Address);
+			bool Carry = (Value & 0x80) != 0;
+			Value = (Value << 1) | (m_bCarry ? 0x01 : 0);
+			m_bCarry = Carry;
+			Write(Address, Value);
+			SetNZ(Value);
+			break;
+		}
+		case 0x66: case 0x76: case 0x6E: case 0x7E: {
+			Value = Read(Address);
+			bool Carry = (Value & 0x01) != 0;
+			Value = (Value >> 1) | (m_bCarry ? 0x80 : 0);
+			m_bCarry = Carry;
+			Write(Address, Value);
+			SetNZ(Value);
+			break;
+		}
+		// Accumulator
+		case 0x0A:
+			m_bCarry = (m_iA & 0x80) != 0;
+			m_iA <<= 1;
+			SetNZ(m_iA);
+			break;
+		case 0x4A:
+			m_bCarry = (m_iA & 0x01) != 0;
+			m_iA >>= 1;
+			SetNZ(m_iA);
+			break;
+		case 0x2A: {
+			bool Carry = (m_iA & 0x80) != 0;
+			m_iA = (m_iA << 1) | (m_bCarry ? 0x01 : 0);
+			m_bCarry = Carry;
+			SetNZ(m_iA);
+			break;
+		}
+		case 0x6A: {
+			bool Carry = (m_iA & 0x01) != 0;
+			m_iA = (m_iA >> 1) | (m_bCarry ? 0x80 : 0);
+			m_bCarry = Carry;
+			SetNZ(m_iA);
+			break;
+		}
+		// Registers
+		case 0xAA: m_iX = m_iA; SetNZ(m_iX); break;
+		case 0x8A: m_iA = m_iX; SetNZ(m_iA); break;
+		case 0xA8: m_iY = m_iA; SetNZ(m_iY); break;
+		case 0x98: m_iA = m_iY; SetNZ(m_iA); break;
+		case 0xBA: m_iX = m_iSP; SetNZ(m_iX); break;
+		case 0x9A: m_iSP = m_iX; break;
+		case 0xE8: ++m_iX; SetNZ(m_iX); break;
+		case 0xCA: --m_iX; SetNZ(m_iX); break;
+		case 0xC8: ++m_iY; SetNZ(m_iY); break;
+		case 0x88: --m_iY; SetNZ(m_iY); break;
+		// Flags
+		case 0x18: m_bCarry = false; break;
+		case 0x38: m_bCarry = true; break;
+		case 0x58: m_bInterrupt = false; break;
+		case 0x78: m_bInterrupt = true; break;
+		case 0xB8: m_bOverflow = false; break;
+		case 0xD8: m_bDecimal = false; break;
+		case 0xF8: m_bDecimal = true; break;
+		// Stack
+		case 0x48: Push(m_iA); break;
+		case 0x68: m_iA = Pop(); SetNZ(m_iA); break;
+		case 0x08: Push(GetStatus(true)); break;
+		case 0x28: SetStatus(Pop()); break;
+		// Branches
+		case 0x10: Branch(!m_bNegative); break;
+		case 0x30: Branch(m_bNegative); break;
+		case 0x50: Branch(!m_bOverflow); break;
+		case 0x70: Branch(m_bOverflow); break;
+		case 0x90: Branch(!m_bCarry); break;
+		case 0xB0: Branch(m_bCarry); break;
+		case 0xD0: Branch(!m_bZero); break;
+		case 0xF0: Branch(m_bZero); break;
+		// Jumps
+		case 0x4C:
+			m_iPC = Address;
+			break;
+		case 0x6C: {
+			// The indirect vector does not cross pages
+			unsigned short Pointer = FetchWord();
+			m_iPC = Read(Pointer) | (Read((Pointer & 0xFF00) | ((Pointer + 1) & 0xFF)) << 8);
+			break;
+		}
+		case 0x20:
+			Push((m_iPC - 1) >> 8);
+			Push((m_iPC - 1) & 0xFF);
+			m_iPC = Address;
+			break;
+		case 0x60:
+			m_iPC = Pop();
+			m_iPC |= Pop() << 8;
+			++m_iPC;
+			break;
+		case 0x40:
+			SetStatus(Pop());
+			m_iPC = Pop();
+			m_iPC |= Pop() << 8;
+			break;
+		case 0x00:
+			// There are no interrupt handlers for NSF, treat as an error
+		default:
+			TRACE2("NSF emulator: unsupported opcode $%02X at $%04X\n", Opcode, PC);
+			m_bHalted = true;
+			break;
+		case 0xEA:
+			break;
+	}
+
+	return CYCLE_TABLE[Opcode];
+}
@@ -0,0 +1,148 @@
+/*
+** FamiTracker - NES/Famicom sound tracker
+** Copyright (C) 2005-2014  Jonathan Liss
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+*/
+
+#pragma once
+
+// std::vector is required by this header file
+
+struct stNSFHeader;
+
+// Sound chip registers, as seen at the end of a frame
+
+struct stRegs {
+	unsigned char R_2A03[0x20];
+	unsigned char R_VRC6[0x10];
+	unsigned char R_VRC7[0x40];
+	unsigned char R_FDS[0x10];
+	unsigned char R_MMC5[0x08];
+	unsigned char R_N163[0x100];
+	unsigned char R_S5B[0x10];
+};
+
+// Translates register writes into the stRegs layout,
+// used for both the tracker and the emulated NSF
+
+class CRegisterState
+{
+public:
+	CRegisterState();
+
+	void Reset();
+	void Write(unsigned short Address, unsigned char Value);
+	const stRegs *GetRegs() const;
+
+private:
+	stRegs m_Regs;
+
+	// Address latches
+	unsigned char m_iVRC7Address;
+	unsigned char m_iN163Address;
+	unsigned char m_iS5BAddress;
+};
+
+// Receives reads from the NSF data area
+
+class CNSFReadObserver
+{
+public:
+	virtual ~CNSFReadObserver() {}
+	virtual void OnRead(unsigned int Offset) = 0;		// Offset in the NSF data, excluding the header
+};
+
+// NSF player, a 6502 core with the NSF memory map and bankswitching
+
+class CNSFEmulator
+{
+public:
+	CNSFEmulator();
+	~CNSFEmulator();
+
+	bool Load(const stNSFHeader *pHeader, const char *pData, int Size);
+
+	int RunInit(int Song);
+	int RunPlay();
+
+	bool IsHalted() const;
+	const stRegs *GetRegisters() const;
+
+	void SetReadObserver(CNSFReadObserver *pObserver);
+
+public:
+	static const int MAX_ROUTINE_CYCLES = 1000000;		// Fail if a routine doesn't return within this time
+
+private:
+	int RunRoutine(unsigned short Address, unsigned char A, unsigned char X);
+	int Step();
+
+	// Memory
+	unsigned char Read(unsigned short Address) const;
+	void Write(unsigned short Address, unsigned char Value);
+	void SwitchBank(int Page, int Bank);
+
+	// CPU helpers
+	unsigned char Fetch();
+	unsigned short FetchWord();
+	unsigned short ReadWordZP(unsigned char Address) const;
+	void Push(unsigned char Value);
+	unsigned char Pop();
+	void SetNZ(unsigned char Value);
+	unsigned char GetStatus(bool Break) const;
+	void SetStatus(unsigned char Value);
+	void Branch(bool Condition);
+	void ADC(unsigned char Value);
+	void Compare(unsigned char Reg, unsigned char Value);
+
+	// Addressing modes, returns the effective address
+	unsigned short AddrZeroPage(unsigned char Index);
+	unsigned short AddrAbsolute(unsigned char Index, bool Penalty);
+	unsigned short AddrIndirectX();
+	unsigned short AddrIndirectY(bool Penalty);
+
+private:
+	static const unsigned short RETURN_ADDRESS = 0x4100;	// Unmapped address used to detect the end of a routine
+	static const int PAGE_SIZE = 0x1000;
+	static const unsigned char CYCLE_TABLE[256];
+
+	// CPU state
+	unsigned short	m_iPC;
+	unsigned char	m_iA, m_iX, m_iY, m_iSP;
+	bool			m_bCarry, m_bZero, m_bInterrupt, m_bDecimal, m_bOverflow, m_bNegative;
+	int				m_iCycles;
+	bool			m_bHalted;
+
+	// Memory
+	unsigned char	m_iRAM[0x800];
+	unsigned char	m_iWRAM[0xA000];			// $6000-$FFFF, only $6000-$7FFF is used unless FDS is enabled
+	std::vector<unsigned char> m_vROM;
+	unsigned char	*m_pPages[16];				// 4kB pages
+	int				m_iPageBank[16];			// Bank mapped to each page, -1 for RAM
+	int				m_iPadding;					// Size of the padding before the data in the first bank
+	bool			m_bBankswitched;
+	bool			m_bFDS;
+	int				m_iBankCount;
+
+	unsigned short	m_iInitAddress;
+	unsigned short	m_iPlayAddress;
+	unsigned char	m_iInitBanks[10];			// Bank values for $6000-$FFFF
+	int				m_iRegion;
+
+	CRegisterState	m_Registers;
+	CNSFReadObserver *m_pObserver;
+};
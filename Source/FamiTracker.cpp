@@ -33,6 +33,9 @@
 #include "ChannelMap.h"
 #include "CustomExporters.h"
 #include "CommandLineExport.h"
+#include "ModuleAnalyzer.h"
+#include "RenderService.h"
+#include "TextExporter.h"
 
 #ifdef EXPORT_TEST
 #include "ExportTest/ExportTest.h"
@@ -73,6 +76,8 @@ END_MESSAGE_MAP()
 
 CFamiTrackerApp::CFamiTrackerApp() :
 	m_bThemeActive(false),
+	m_bHeadless(false),
+	m_bRenderServer(false),
 	m_pMIDI(NULL),
 	m_pAccel(NULL),
 	m_pSettings(NULL),
@@ -138,6 +143,26 @@ BOOL CFamiTrackerApp::InitInstance()
 	CFTCommandLineInfo cmdInfo;
 	ParseCommandLine(cmdInfo);
 
+	// Render requests are sent to the render server process, which is started if needed
+	if (cmdInfo.m_bRender) {
+		stRenderRequest Request;
+		Request.Module = CRenderService::GetFullPath(cmdInfo.m_strFileName);
+		Request.Wave = CRenderService::GetFullPath(cmdInfo.m_strRenderFile);
+		Request.Track = cmdInfo.m_iRenderTrack - 1;
+		Request.Loops = cmdInfo.m_iRenderLoops;
+		Request.MuteMask = cmdInfo.m_iRenderMute;
+		Request.Event.Format(_T("FamiTrackerRender%u"), GetCurrentProcessId());
+		HWND hWnd = CRenderService::StartServer();
+		ExitProcess(hWnd != NULL && CRenderService::SendRequest(hWnd, Request) ? 0 : 1);
+	}
+
+	// The render server runs hidden and keeps the settings and recent files of the user untouched
+	if (cmdInfo.m_bRenderServer) {
+		m_bRenderServer = true;
+		m_bHeadless = true;
+		SAFE_RELEASE(m_pRecentFileList);
+	}
+
 	if (CheckSingleInstance(cmdInfo))
 		return FALSE;
 
@@ -231,6 +256,31 @@ BOOL CFamiTrackerApp::InitInstance()
 		ExitProcess(0);
 	}
 
+	// Handle command line module analyzer
+	if (cmdInfo.m_bAnalyze) {
+		CModuleAnalyzer analyzer;
+		m_bHeadless = true;
+		bool Result = analyzer.Analyze(cmdInfo.m_strAnalyzeInput, cmdInfo.m_strAnalyzeOutput);
+		ExitProcess(Result ? 0 : 1);
+	}
+
+	// Handle command line cleanup benchmark
+	if (cmdInfo.m_bBenchmark) {
+		m_bHeadless = true;
+		CString Result = CFamiTrackerDoc::BenchmarkCleanup();
+		printf("%s\n", (LPCTSTR)Result);
+		ExitProcess(0);
+	}
+
+	// Handle command line text import benchmark
+	if (cmdInfo.m_bTextBenchmark) {
+		m_bHeadless = true;
+		CString Result;
+		bool bOK = CTextExport::BenchmarkImport(Result);
+		printf("%s\n", (LPCTSTR)Result);
+		ExitProcess(bOK ? 0 : 1);
+	}
+
 	// Dispatch commands specified on the command line.  Will return FALSE if
 	// app was launched with /RegServer, /Register, /Unregserver or /Unregister.
 	if (!ProcessShellCommand(cmdInfo)) {
@@ -247,6 +297,13 @@ BOOL CFamiTrackerApp::InitInstance()
 	}
 
 	// The one and only window has been initialized, so show and update it
+#ifdef EXPORT_TEST
+	// Export verification from the command line runs without a window
+	if (cmdInfo.m_bVerifyExport)
+		m_nCmdShow = SW_HIDE;
+#endif /* EXPORT_TEST */
+	if (m_bRenderServer)
+		m_nCmdShow = SW_HIDE;
 	m_pMainWnd->ShowWindow(m_nCmdShow);
 	m_pMainWnd->UpdateWindow();
 	// call DragAcceptFiles only if there's a suffix
@@ -264,8 +321,9 @@ BOOL CFamiTrackerApp::InitInstance()
 		return FALSE;
 	}
 	
-	// Initialize midi unit
-	m_pMIDI->Init();
+	// Initialize midi unit, the render server leaves the devices to the user's instances
+	if (!m_bRenderServer)
+		m_pMIDI->Init();
 	
 	if (cmdInfo.m_bPlay)
 		theApp.StartPlayer(MODE_PLAY);
@@ -282,8 +340,11 @@ BOOL CFamiTrackerApp::InitInstance()
 	}
 #endif
 
-	// Save the main window handle
-	RegisterSingleInstance();
+	// Save the main window handle, the render server is only found by render clients
+	if (m_bRenderServer)
+		m_hWndMapFile = CRenderService::RegisterServer(m_pMainWnd->m_hWnd);
+	else
+		RegisterSingleInstance();
 
 #ifndef _DEBUG
 	// WIP
@@ -314,14 +375,16 @@ int CFamiTrackerApp::ExitInstance()
 	}
 
 	if (m_pAccel) {
-		m_pAccel->SaveShortcuts(m_pSettings);
+		if (!m_bRenderServer)
+			m_pAccel->SaveShortcuts(m_pSettings);
 		m_pAccel->Shutdown();
 		delete m_pAccel;
 		m_pAccel = NULL;
 	}
 
 	if (m_pSettings) {
-		m_pSettings->SaveSettings();
+		if (!m_bRenderServer)
+			m_pSettings->SaveSettings();
 		m_pSettings = NULL;
 	}
 
@@ -385,6 +448,16 @@ bool CFamiTrackerApp::IsThemeActive() const
 	return m_bThemeActive;
 }
 
+bool CFamiTrackerApp::IsHeadless() const
+{
+	return m_bHeadless;
+}
+
+bool CFamiTrackerApp::IsRenderServer() const
+{
+	return m_bRenderServer;
+}
+
 bool GetFileVersion(LPCTSTR Filename, WORD &Major, WORD &Minor, WORD &Revision, WORD &Build)
 {
 	DWORD Handle;
@@ -532,10 +605,16 @@ bool CFamiTrackerApp::CheckSingleInstance(CFTCommandLineInfo &cmdInfo)
 {	
 	// Returns true if program should close
 	
-	if (!GetSettings()->General.bSingleInstance)
+	if (cmdInfo.m_bExport || cmdInfo.m_bAnalyze || cmdInfo.m_bBenchmark || cmdInfo.m_bTextBenchmark)
 		return false;
 
-	if (cmdInfo.m_bExport)
+	// Only one render server is started, it is never used as a single instance
+	if (cmdInfo.m_bRenderServer) {
+		m_pInstanceMutex = new CMutex(FALSE, CRenderService::SERVER_MUTEX_NAME);
+		return GetLastError() == ERROR_ALREADY_EXISTS;
+	}
+
+	if (!GetSettings()->General.bSingleInstance)
 		return false;
 
 	m_pInstanceMutex = new CMutex(FALSE, FT_SHARED_MUTEX_NAME);
@@ -699,6 +778,27 @@ void CFamiTrackerApp::ResetPlayer()
 		m_pSoundGenerator->ResetPlayer(Track);
 }
 
+int CFamiTrackerApp::DoMessageBox(LPCTSTR lpszPrompt, UINT nType, UINT nIDPrompt)
+{
+	// Nobody is there to answer when running headless, messages are traced and the negative choice is taken
+	if (m_bHeadless) {
+		TRACE(_T("App: Message box suppressed: %s\n"), lpszPrompt);
+		switch (nType & MB_TYPEMASK) {
+			case MB_OKCANCEL:
+			case MB_RETRYCANCEL:
+				return IDCANCEL;
+			case MB_YESNO:
+			case MB_YESNOCANCEL:
+				return IDNO;
+			case MB_ABORTRETRYIGNORE:
+				return IDABORT;
+		}
+		return IDOK;
+	}
+
+	return CWinApp::DoMessageBox(lpszPrompt, nType, nIDPrompt);
+}
+
 // File load/save
 
 void CFamiTrackerApp::OnFileOpen() 
@@ -796,7 +896,7 @@ void CFamiTrackerApp::VerifyExport() const
 	if (pExportTest->Setup()) {
 		const CMainFrame *pMainFrame = static_cast<CMainFrame*>(m_pMainWnd);
 		pExportTest->RunInit(pMainFrame->GetSelectedTrack());
-		GetSoundGenerator()->PostThreadMessage(WM_USER_VERIFY_EXPORT, (WPARAM)pExportTest, pMainFrame->GetSelectedTrack());
+		GetSoundGenerator()->PostCommand(CMD_VERIFY_EXPORT, (WPARAM)pExportTest, pMainFrame->GetSelectedTrack());
 	}
 	else
 		delete pExportTest;
@@ -811,7 +911,7 @@ void CFamiTrackerApp::VerifyExport(LPCTSTR File) const
 	if (pExportTest->Setup(File)) {
 		const CMainFrame *pMainFrame = static_cast<CMainFrame*>(m_pMainWnd);
 		pExportTest->RunInit(pMainFrame->GetSelectedTrack());
-		GetSoundGenerator()->PostThreadMessage(WM_USER_VERIFY_EXPORT, (WPARAM)pExportTest, pMainFrame->GetSelectedTrack());
+		GetSoundGenerator()->PostCommand(CMD_VERIFY_EXPORT, (WPARAM)pExportTest, pMainFrame->GetSelectedTrack());
 	}
 	else
 		delete pExportTest;
@@ -903,12 +1003,24 @@ CFTCommandLineInfo::CFTCommandLineInfo() : CCommandLineInfo(),
 	m_bLog(false), 
 	m_bExport(false), 
 	m_bPlay(false),
+	m_bAnalyze(false),
+	m_bRender(false),
+	m_bRenderServer(false),
+	m_bBenchmark(false),
+	m_bTextBenchmark(false),
 #ifdef EXPORT_TEST
 	m_bVerifyExport(false),
 #endif
 	m_strExportFile(_T("")),
 	m_strExportLogFile(_T("")),
-	m_strExportDPCMFile(_T(""))
+	m_strExportDPCMFile(_T("")),
+	m_strAnalyzeInput(_T("")),
+	m_strAnalyzeOutput(_T("")),
+	m_strRenderFile(_T("")),
+	m_iRenderTrack(1),
+	m_iRenderLoops(1),
+	m_iRenderMute(0),
+	m_iRenderParams(0)
 {
 }
 
@@ -925,6 +1037,31 @@ void CFTCommandLineInfo::ParseParam(const TCHAR* pszParam, BOOL bFlag, BOOL bLas
 			m_bPlay = true;
 			return;
 		}
+		// Analyze modules (/analyze), takes a directory or a list file and an output .csv or .json file
+		else if (!_tcsicmp(pszParam, _T("analyze"))) {
+			m_bAnalyze = true;
+			return;
+		}
+		// Render to wave file (/render), the request is sent to the render server which is started if needed
+		else if (!_tcsicmp(pszParam, _T("render"))) {
+			m_bRender = true;
+			return;
+		}
+		// Run as the hidden render server (/renderserver), started by /render
+		else if (!_tcsicmp(pszParam, _T("renderserver"))) {
+			m_bRenderServer = true;
+			return;
+		}
+		// Time the module cleanup on a generated module (/benchmark), use with /console to see the result
+		else if (!_tcsicmp(pszParam, _T("benchmark"))) {
+			m_bBenchmark = true;
+			return;
+		}
+		// Time the text import of a generated module (/textbenchmark), use with /console to see the result
+		else if (!_tcsicmp(pszParam, _T("textbenchmark"))) {
+			m_bTextBenchmark = true;
+			return;
+		}
 		// Disable crash dumps (/nodump)
 		else if (!_tcsicmp(pszParam, _T("nodump"))) { 
 #ifdef ENABLE_CRASH_HANDLER
@@ -977,6 +1114,27 @@ void CFTCommandLineInfo::ParseParam(const TCHAR* pszParam, BOOL bFlag, BOOL bLas
 				return;
 			}
 		}
+		else if (m_bAnalyze) {
+			if (m_strAnalyzeInput.GetLength() == 0)
+			{
+				m_strAnalyzeInput = CString(pszParam);
+				return;
+			}
+			else if (m_strAnalyzeOutput.GetLength() == 0)
+			{
+				m_strAnalyzeOutput = CString(pszParam);
+				return;
+			}
+		}
+		else if (m_bRender) {
+			// Wave file name, track, loop count and hexadecimal channel mute mask
+			switch (m_iRenderParams++) {
+				case 0: m_strRenderFile = CString(pszParam); return;
+				case 1: m_iRenderTrack = _ttoi(pszParam); return;
+				case 2: m_iRenderLoops = _ttoi(pszParam); return;
+				case 3: m_iRenderMute = _tcstoul(pszParam, NULL, 16); return;
+			}
+		}
 #ifdef EXPORT_TEST
 		else if (m_bVerifyExport) {
 			if (m_strVerifyFile.GetLength() == 0)
@@ -37,7 +37,8 @@
 // Inter-process commands
 enum {
 	IPC_LOAD = 1,	
-	IPC_LOAD_PLAY
+	IPC_LOAD_PLAY,
+	IPC_RENDER
 };
 
 #ifdef RELEASE_BUILD
@@ -55,6 +56,11 @@ public:
 	bool m_bLog;
 	bool m_bExport;
 	bool m_bPlay;
+	bool m_bAnalyze;
+	bool m_bRender;
+	bool m_bRenderServer;
+	bool m_bBenchmark;
+	bool m_bTextBenchmark;
 #ifdef EXPORT_TEST
 	bool m_bVerifyExport;
 	CString m_strVerifyFile;
@@ -62,6 +68,13 @@ public:
 	CString m_strExportFile;
 	CString m_strExportLogFile;
 	CString m_strExportDPCMFile;
+	CString m_strAnalyzeInput;
+	CString m_strAnalyzeOutput;
+	CString m_strRenderFile;
+	int m_iRenderTrack;
+	int m_iRenderLoops;
+	unsigned int m_iRenderMute;
+	int m_iRenderParams;
 };
 
 
@@ -94,6 +107,9 @@ public:
 	void			ReloadColorScheme();
 	int				GetCPUUsage() const;
 	bool			IsThemeActive() const;
+	bool			IsHeadless() const;
+	bool			IsRenderServer() const;
+	void			UnregisterSingleInstance();
 	void			RemoveSoundGenerator();
 	void			ThreadDisplayMessage(LPCTSTR lpszText, UINT nType = 0, UINT nIDHelp = 0);
 	void			ThreadDisplayMessage(UINT nIDPrompt, UINT nType = 0, UINT nIDHelp = 0);
@@ -131,7 +147,6 @@ private:
 	void ShutDownSynth();
 	bool CheckSingleInstance(CFTCommandLineInfo &cmdInfo);
 	void RegisterSingleInstance();
-	void UnregisterSingleInstance();
 	void CheckNewVersion();
 	void LoadLocalization();
 
@@ -154,6 +169,8 @@ private:
 	HANDLE			m_hWndMapFile;
 
 	bool			m_bThemeActive;
+	bool			m_bHeadless;				// Message boxes are suppressed when running from command line
+	bool			m_bRenderServer;			// Hidden process serving render requests, never used for editing
 
 #ifdef EXPORT_TEST
 	bool			m_bExportTesting;
@@ -167,6 +184,7 @@ private:
 public:
 	virtual BOOL InitInstance();
 	virtual int ExitInstance();	
+	virtual int DoMessageBox(LPCTSTR lpszPrompt, UINT nType, UINT nIDPrompt);
 
 	// Implementation
 	DECLARE_MESSAGE_MAP()
@@ -40,16 +40,20 @@
 */
 
 #include "stdafx.h"
+#include <vector>
 #include <algorithm>
 #include "FamiTracker.h"
 #include "FamiTrackerDoc.h"
 #include "TrackerChannel.h"
+#include "TrackSnapshot.h"
+#include "ControlPlayer.h"
 #include "MainFrm.h"
 #include "DocumentFile.h"
 #include "Settings.h"
 #include "SoundGen.h"
 #include "ChannelMap.h"
 #include "APU/APU.h"
+#include "AutoSave.h"
 
 #ifdef _DEBUG
 #define new DEBUG_NEW
@@ -91,6 +95,13 @@ static const char *FILE_BLOCK_SEQUENCES_N106 = "SEQUENCES_N106";
 // Sunsoft
 static const char *FILE_BLOCK_SEQUENCES_S5B = "SEQUENCES_S5B";
 
+// Pattern block version, see WriteBlock_Patterns
+#ifdef TRANSPOSE_FDS
+static const int PATTERN_BLOCK_VERSION		= 5;
+#else
+static const int PATTERN_BLOCK_VERSION		= 4;
+#endif
+
 // FTI instruments files
 static const char INST_HEADER[] = "FTI";
 static const char INST_VERSION[] = "2.4";
@@ -193,7 +204,8 @@ CFamiTrackerDoc::CFamiTrackerDoc() :
 	m_bFileLoadFailed(false), 
 	m_iRegisteredChannels(0), 
 	m_iNamcoChannels(DEFAULT_NAMCO_CHANS),
-	m_bDisplayComment(false)
+	m_bDisplayComment(false),
+	m_iSnapshotSerial(0)
 {
 	// Initialize document object
 
@@ -204,6 +216,12 @@ CFamiTrackerDoc::CFamiTrackerDoc() :
 	memset(m_pSequencesVRC6, 0, sizeof(CSequence*) * MAX_SEQUENCES * SEQ_COUNT);
 	memset(m_pSequencesN163, 0, sizeof(CSequence*) * MAX_SEQUENCES * SEQ_COUNT);
 	memset(m_pSequencesS5B, 0, sizeof(CSequence*) * MAX_SEQUENCES * SEQ_COUNT);
+	memset(m_pSnapshots, 0, sizeof(CTrackSnapshot*) * MAX_TRACKS);
+	memset(m_iSnapshotRevision, 0, sizeof(unsigned int) * MAX_TRACKS);
+
+	m_iAutoSaveCounter = 0;
+	m_pAutoSave = NULL;
+	m_iAutoSaveTime = 0;
 
 	// Register this object to the sound generator
 	CSoundGen *pSoundGen = theApp.GetSoundGenerator();
@@ -226,6 +244,10 @@ CFamiTrackerDoc::~CFamiTrackerDoc()
 		SAFE_RELEASE(m_pTracks[i]);
 	}
 
+	ReleaseSnapshots();
+
+	SAFE_RELEASE(m_pAutoSave);
+
 	// Instruments
 	for (int i = 0; i < MAX_INSTRUMENTS; ++i) {
 		if (m_pInstruments[i] != NULL) {
@@ -273,6 +295,83 @@ BOOL CFamiTrackerDoc::UnlockDocument() const
 	return m_csDocumentLock.Unlock();
 }
 
+// Player snapshots
+
+void CFamiTrackerDoc::PublishSnapshots(bool bForce)
+{
+	// Make the latest track data visible to the player thread. Only tracks that
+	// have been edited since the last call are copied, pattern blocks are shared.
+	// The player never has to lock the document to read pattern data.
+
+	// Called from main thread
+	ASSERT(GetCurrentThreadId() == theApp.m_nThreadID);
+
+	bool bPublished = false;
+
+	for (unsigned int i = 0; i < MAX_TRACKS; ++i) {
+		const CPatternData *pTrack = (i < m_iTrackCount) ? m_pTracks[i] : NULL;
+		unsigned int Revision = (pTrack != NULL) ? pTrack->GetRevision() : 0;
+
+		if (!bForce && m_iSnapshotRevision[i] == Revision)
+			continue;
+
+		CTrackSnapshot *pSnapshot = NULL;
+		
+		if (pTrack != NULL)
+			pSnapshot = new CTrackSnapshot(pTrack, m_iRegisteredChannels, m_iChannelTypes);
+
+		m_csSnapshots.Lock();
+		CTrackSnapshot *pOld = m_pSnapshots[i];
+		m_pSnapshots[i] = pSnapshot;
+		m_csSnapshots.Unlock();
+
+		if (pOld != NULL)
+			pOld->Release();
+
+		m_iSnapshotRevision[i] = Revision;
+		bPublished = true;
+	}
+
+	if (bPublished)
+		InterlockedIncrement(&m_iSnapshotSerial);
+}
+
+CTrackSnapshot *CFamiTrackerDoc::AcquireSnapshot(unsigned int Track) const
+{
+	// Returns a referenced snapshot or NULL, caller must release it
+	ASSERT(Track < MAX_TRACKS);
+
+	m_csSnapshots.Lock();
+	CTrackSnapshot *pSnapshot = m_pSnapshots[Track];
+	if (pSnapshot != NULL)
+		pSnapshot->Retain();
+	m_csSnapshots.Unlock();
+
+	return pSnapshot;
+}
+
+LONG CFamiTrackerDoc::GetSnapshotSerial() const
+{
+	return m_iSnapshotSerial;
+}
+
+void CFamiTrackerDoc::ReleaseSnapshots()
+{
+	m_csSnapshots.Lock();
+
+	for (unsigned int i = 0; i < MAX_TRACKS; ++i) {
+		if (m_pSnapshots[i] != NULL) {
+			m_pSnapshots[i]->Release();
+			m_pSnapshots[i] = NULL;
+		}
+		m_iSnapshotRevision[i] = 0;
+	}
+
+	m_csSnapshots.Unlock();
+
+	InterlockedIncrement(&m_iSnapshotSerial);
+}
+
 //
 // Overrides
 //
@@ -312,9 +411,7 @@ BOOL CFamiTrackerDoc::OnOpenDocument(LPCTSTR lpszPathName)
 	// Update main frame
 	ApplyExpansionChip();
 
-#ifdef AUTOSAVE
 	SetupAutoSave();
-#endif
 
 	// Remove modified flag
 	SetModifiedFlag(FALSE);
@@ -408,6 +505,8 @@ void CFamiTrackerDoc::DeleteContents()
 		m_sTrackNames[i].Empty();
 	}
 
+	ReleaseSnapshots();
+
 	// Clear song info
 	memset(m_strName, 0, 32);
 	memset(m_strArtist, 0, 32);
@@ -430,9 +529,7 @@ void CFamiTrackerDoc::DeleteContents()
 	m_vTmpSequences.RemoveAll();
 
 	// Auto save
-#ifdef AUTOSAVE
 	ClearAutoSave();
-#endif
 
 	m_strComment.Empty();
 	m_bDisplayComment = false;
@@ -448,10 +545,8 @@ void CFamiTrackerDoc::DeleteContents()
 void CFamiTrackerDoc::SetModifiedFlag(BOOL bModified)
 {
 	// Trigger auto-save in 10 seconds
-#ifdef AUTOSAVE
 	if (bModified)
 		m_iAutoSaveCounter = 10;
-#endif
 
 	BOOL bWasModified = IsModified();
 	CDocument::SetModifiedFlag(bModified);
@@ -480,9 +575,7 @@ void CFamiTrackerDoc::CreateEmpty()
 	// and select 2A03 only
 	SelectExpansionChip(SNDCHIP_NONE);
 
-#ifdef AUTOSAVE
 	SetupAutoSave();
-#endif
 
 	SetModifiedFlag(FALSE);
 
@@ -676,6 +769,7 @@ BOOL CFamiTrackerDoc::SaveDocument(LPCTSTR lpszPathName) const
 		return FALSE;
 	}
 
+	DocumentFile.SetCompression(theApp.GetSettings()->General.bCompressModules);
 	DocumentFile.BeginDocument();
 
 	if (!WriteBlocks(&DocumentFile)) {
@@ -736,6 +830,18 @@ BOOL CFamiTrackerDoc::SaveDocument(LPCTSTR lpszPathName) const
 
 bool CFamiTrackerDoc::WriteBlocks(CDocumentFile *pDocFile) const
 {
+	if (!WriteHeadBlocks(pDocFile))
+		return false;
+	if (!WriteBlock_Patterns(pDocFile))
+		return false;
+	if (!WriteTailBlocks(pDocFile))
+		return false;
+	return true;
+}
+
+bool CFamiTrackerDoc::WriteHeadBlocks(CDocumentFile *pDocFile) const
+{
+	// Blocks stored before the patterns
 	if (!WriteBlock_Parameters(pDocFile))
 		return false;
 	if (!WriteBlock_SongInfo(pDocFile))
@@ -748,8 +854,12 @@ bool CFamiTrackerDoc::WriteBlocks(CDocumentFile *pDocFile) const
 		return false;
 	if (!WriteBlock_Frames(pDocFile))
 		return false;
-	if (!WriteBlock_Patterns(pDocFile))
-		return false;
+	return true;
+}
+
+bool CFamiTrackerDoc::WriteTailBlocks(CDocumentFile *pDocFile) const
+{
+	// Blocks stored after the patterns
 	if (!WriteBlock_DSamples(pDocFile))
 		return false;
 	if (!WriteBlock_Comments(pDocFile))
@@ -1130,6 +1240,8 @@ bool CFamiTrackerDoc::WriteBlock_Frames(CDocumentFile *pDocFile) const
 	 * 1. Number of channels (5 for 2A03 only)
 	 * 2. 
 	 * 
+	 * Songs can have up to MAX_FRAMES frames in the same block version, files with
+	 * more than 128 frames in a song can't be loaded by older versions.
 	 */ 
 
 	pDocFile->CreateBlock(FILE_BLOCK_FRAMES, 3);
@@ -1165,11 +1277,7 @@ bool CFamiTrackerDoc::WriteBlock_Patterns(CDocumentFile *pDocFile) const
 	 *
 	 */ 
 
-#ifdef TRANSPOSE_FDS
-	pDocFile->CreateBlock(FILE_BLOCK_PATTERNS, 5);
-#else
-	pDocFile->CreateBlock(FILE_BLOCK_PATTERNS, 4);
-#endif
+	pDocFile->CreateBlock(FILE_BLOCK_PATTERNS, PATTERN_BLOCK_VERSION, true);
 
 	for (unsigned t = 0; t < m_iTrackCount; ++t) {
 		for (unsigned i = 0; i < m_iChannelsAvailable; ++i) {
@@ -1221,7 +1329,7 @@ bool CFamiTrackerDoc::WriteBlock_DSamples(CDocumentFile *pDocFile) const
 {
 	int Count = 0;
 
-	pDocFile->CreateBlock(FILE_BLOCK_DSAMPLES, 1);
+	pDocFile->CreateBlock(FILE_BLOCK_DSAMPLES, 1, true);
 
 	for (int i = 0; i < MAX_DSAMPLES; ++i) {
 		if (m_DSamples[i].GetSize() > 0)
@@ -1556,7 +1664,7 @@ BOOL CFamiTrackerDoc::OpenDocumentNew(CDocumentFile &DocumentFile)
 	}
 
 	// File version is too new
-	if (m_iFileVersion > CDocumentFile::FILE_VER) {
+	if (m_iFileVersion > CDocumentFile::FILE_VER_COMPRESSED) {
 		AfxMessageBox(IDS_FILE_VERSION_TOO_NEW, MB_ICONERROR);
 		DocumentFile.Close();
 		return FALSE;
@@ -2168,7 +2276,7 @@ bool CFamiTrackerDoc::ReadBlock_Frames(CDocumentFile *pDocFile)
 		for (unsigned i = 0; i < FrameCount; ++i) {
 			for (unsigned j = 0; j < m_iChannelsAvailable; ++j) {
 				unsigned Pattern = (unsigned)pDocFile->GetBlockChar();
-				ASSERT_FILE_DATA(Pattern < MAX_FRAMES);
+				ASSERT_FILE_DATA(Pattern < MAX_PATTERN);
 				pTrack->SetFramePattern(i, j, Pattern);
 			}
 		}
@@ -3517,7 +3625,7 @@ void CFamiTrackerDoc::GetNoteData(unsigned int Track, unsigned int Frame, unsign
 	// Sets the notes of the pattern
 	CPatternData *pTrack = GetTrack(Track);
 	int Pattern = pTrack->GetFramePattern(Frame, Channel);
-	memcpy(pData, pTrack->GetPatternData(Channel, Pattern, Row), sizeof(stChanNote));
+	memcpy(pData, pTrack->ReadPatternData(Channel, Pattern, Row), sizeof(stChanNote));
 }
 
 void CFamiTrackerDoc::SetDataAtPattern(unsigned int Track, unsigned int Pattern, unsigned int Channel, unsigned int Row, const stChanNote *pData)
@@ -3543,7 +3651,17 @@ void CFamiTrackerDoc::GetDataAtPattern(unsigned int Track, unsigned int Pattern,
 
 	// Get note from a direct pattern
 	CPatternData *pTrack = GetTrack(Track);
-	memcpy(pData, pTrack->GetPatternData(Channel, Pattern, Row), sizeof(stChanNote));
+	memcpy(pData, pTrack->ReadPatternData(Channel, Pattern, Row), sizeof(stChanNote));
+}
+
+const stChanNote *CFamiTrackerDoc::GetPatternRows(unsigned int Track, unsigned int Pattern, unsigned int Channel) const
+{
+	ASSERT(Track < MAX_TRACKS);
+	ASSERT(Pattern < MAX_PATTERN);
+	ASSERT(Channel < MAX_CHANNELS);
+
+	// Direct read access to all rows of a pattern, the pointer is invalidated by edits
+	return GetTrack(Track)->ReadPatternRows(Channel, Pattern);
 }
 
 bool CFamiTrackerDoc::InsertRow(unsigned int Track, unsigned int Frame, unsigned int Channel, unsigned int Row)
@@ -4145,6 +4263,9 @@ void CFamiTrackerDoc::ApplyExpansionChip()
 	// Change period tables
 	theApp.GetSoundGenerator()->LoadMachineSettings(m_iMachine, m_iEngineSpeed, m_iNamcoChannels);
 
+	// Channel layout has changed
+	PublishSnapshots(true);
+
 	SetModifiedFlag();
 }
 
@@ -4228,6 +4349,11 @@ bool CFamiTrackerDoc::IsPatternEmpty(unsigned int Track, unsigned int Channel, u
 	return GetTrack(Track)->IsPatternEmpty(Channel, Pattern);
 }
 
+bool CFamiTrackerDoc::IsCellFree(unsigned int Track, unsigned int Channel, unsigned int Pattern, unsigned int Row) const
+{
+	return GetTrack(Track)->IsCellFree(Channel, Pattern, Row);
+}
+
 // Channel interface, these functions must be synchronized!!!
 
 int CFamiTrackerDoc::GetChannelType(int Channel) const
@@ -4331,7 +4457,6 @@ bool CFamiTrackerDoc::HasLastLoadFailed() const
 	return m_bFileLoadFailed;
 }
 
-#ifdef AUTOSAVE
 
 // Auto-save (experimental)
 
@@ -4339,6 +4464,13 @@ void CFamiTrackerDoc::SetupAutoSave()
 {
 	TCHAR TempPath[MAX_PATH], TempFile[MAX_PATH];
 
+	// Only the document in the main window is saved, not the ones opened for export or analysis
+	if (!theApp.GetSettings()->General.bAutoSave || theApp.IsHeadless() || GetDocTemplate() == NULL)
+		return;
+
+	if (m_pAutoSave == NULL)
+		m_pAutoSave = new CAutoSave();
+
 	GetTempPath(MAX_PATH, TempPath);
 	GetTempFileName(TempPath, _T("Aut"), 21587, TempFile);
 
@@ -4367,6 +4499,11 @@ void CFamiTrackerDoc::ClearAutoSave()
 	if (m_sAutoSaveFile.GetLength() == 0)
 		return;
 
+	if (m_pAutoSave != NULL) {
+		m_pAutoSave->Wait();
+		m_pAutoSave->Reset();
+	}
+
 	DeleteFile(m_sAutoSaveFile);
 
 	m_sAutoSaveFile = _T("");
@@ -4377,19 +4514,64 @@ void CFamiTrackerDoc::ClearAutoSave()
 
 void CFamiTrackerDoc::AutoSave()
 {
-	// Autosave
+	// Autosave, called once every second from the main window
+	// Only the small blocks are written on this thread, patterns are saved in the background
+	if (m_pAutoSave == NULL || !theApp.GetSettings()->General.bAutoSave)
+		return;
+
+	bool bSuccess;
+	DWORD Time;
+	unsigned int Updated, Patterns;
+
+	if (m_pAutoSave->GetResult(bSuccess, Time, Updated, Patterns)) {
+		CMainFrame *pMainFrame = static_cast<CMainFrame*>(AfxGetMainWnd());
+		if (pMainFrame != NULL) {
+			CString text;
+			if (bSuccess)
+				text.Format(_T("Auto saved in %i ms (%i ms in background), %i of %i patterns written"), m_iAutoSaveTime + Time, Time, Updated, Patterns);
+			else
+				text = _T("Auto save failed");
+			pMainFrame->SetMessageText(text);
+		}
+	}
+
 	if (!m_iAutoSaveCounter || !m_bFileLoaded || m_sAutoSaveFile.GetLength() == 0)
 		return;
 
+	if (ExpansionEnabled(SNDCHIP_S5B))
+		return;
+
+	// Wait for the last auto save to finish
+	if (m_pAutoSave->IsBusy())
+		return;
+
 	m_iAutoSaveCounter--;
 
 	if (m_iAutoSaveCounter == 0) {
 		TRACE("Doc: Performing auto save\n");
-		SaveDocument(m_sAutoSaveFile);
+
+		DWORD StartTime = GetTickCount();
+
+		CMemoryDocumentFile Head, Tail;
+
+		Head.BeginDocument();
+		if (!WriteHeadBlocks(&Head) || !WriteTailBlocks(&Tail))
+			return;
+		Tail.EndDocument();
+
+		// Track snapshots share pattern blocks with the document
+		CTrackSnapshot *pSnapshots[MAX_TRACKS];
+		PublishSnapshots();
+		for (unsigned int i = 0; i < m_iTrackCount; ++i)
+			pSnapshots[i] = AcquireSnapshot(i);
+
+		m_pAutoSave->Start(m_sAutoSaveFile, Head.GetData(), Tail.GetData(), pSnapshots, m_iTrackCount, 
+			m_iChannelsAvailable, FILE_BLOCK_PATTERNS, PATTERN_BLOCK_VERSION);
+
+		m_iAutoSaveTime = GetTickCount() - StartTime;
 	}
 }
 
-#endif
 
 //
 // Comment functions
@@ -4462,246 +4644,356 @@ int CFamiTrackerDoc::GetSecondHighlight() const
 unsigned int CFamiTrackerDoc::ScanActualLength(unsigned int Track, unsigned int Count, unsigned int &RowCount) const 
 {
 	// Return number for frames played for a certain number of loops
+	stSongLength Length;
+	ScanSongLength(Track, Length);
 
-	int FrameVisited[MAX_FRAMES];
-	int JumpTo = -1;
-	int SkipTo = -1;
-	int FirstLoop = 0;
-	int SecondLoop = 0;
-	int Frame = 0;
-	bool bScanning = true;
-	int FrameCount = GetFrameCount(Track);
-	int FirstLoopRows = 0;
-	int SecondLoopRows = 0;
-	int Rows = 0;
-	int TotalFrames = 0;
-	bool InFirstLoop = true;
-	int PatternRowCount = 0;
-
-	memset(FrameVisited, 0, sizeof(int) * MAX_FRAMES);
-
-	while (bScanning) {
-
-		JumpTo = -1;
-		SkipTo = -1;
-
-		for (unsigned k = 0; k < GetPatternLength(Track) && JumpTo == -1 && SkipTo == -1; ++k) {
-			PatternRowCount = k + 1;
-			for (int j = 0; j < GetChannelCount(); ++j) {
-				stChanNote Note;
-				GetNoteData(Track, Frame, j, k, &Note);
-				for (unsigned l = 0; l < GetEffColumns(Track, j) + 1; ++l) {
-					switch (Note.EffNumber[l]) {
-						case EF_JUMP:
-							JumpTo = Note.EffParam[l];
-							break;
-						case EF_SKIP:
-							SkipTo = Frame + 1;
-							break;
-						case EF_HALT:
-							Count = 1;
-							bScanning = false;
-							break;
-					}
-				}
-			}
-		}
+	RowCount = Length.IntroRows + Length.LoopRows * Count;
 
-		if (FrameVisited[Frame] == 0) {
-			Rows += PatternRowCount;
-			++FirstLoop;
-		}
-		else if (FrameVisited[Frame] == 1) {
-			++SecondLoop;
-			if (InFirstLoop) {
-				FirstLoopRows = Rows;
-				Rows = 0;
-			}
-			Rows += PatternRowCount;
-			InFirstLoop = false;
-		}
-		else if (FrameVisited[Frame] == 2)
-			bScanning = false;
+	return Length.IntroFrames + Length.LoopFrames * Count;
+}
 
-		++FrameVisited[Frame];
+void CFamiTrackerDoc::ScanSongLength(unsigned int Track, stSongLength &Length) const
+{
+	// Play the track with the control player. The loop is played twice since tempo 
+	// changes in the first pass carry over to the following passes.
 
-		if (JumpTo != -1)
-			Frame = JumpTo;
-		else if (SkipTo != -1)
-			Frame = SkipTo;
-		else
-			++Frame;
-		if (Frame >= FrameCount)
-			Frame = 0;
-	}
+	CTrackSnapshot *pSnapshot = new CTrackSnapshot(GetTrack(Track), m_iRegisteredChannels, m_iChannelTypes);
+	CControlPlayer Player(pSnapshot, GetFrameRate(), GetSpeedSplitPoint());
+	pSnapshot->Release();
 
-	SecondLoopRows = Rows;
+	Player.Run(2);
 
-	if (Count > 1) {
-		RowCount = FirstLoopRows + SecondLoopRows * (Count - 1);
-		TotalFrames = FirstLoop + SecondLoop * (Count - 1);
-	}
-	else if (Count == 1) {
-		RowCount = Rows;//FirstLoopRows;
-		TotalFrames = FirstLoop;
-	}
+	const int Loops = Player.GetLoopCount();
 
-	return TotalFrames;
+	Length.IntroFrames = Player.GetIntroFrames();
+	Length.IntroRows = Player.GetIntroRows();
+	Length.IntroSeconds = Player.GetSeconds(Player.GetIntroTicks());
+	Length.LoopFrames = Player.GetLoopFrames();
+	Length.LoopRows = Player.GetLoopRows();
+	Length.LoopSeconds = (Loops > 0) ? Player.GetSeconds(Player.GetLoopTicks(Loops - 1)) : 0.0;
+	Length.LoopPoint = Player.GetLoopPoint();
 }
 
 // Operations
 
 void CFamiTrackerDoc::RemoveUnusedInstruments()
 {
-	for (int i = 0; i < MAX_INSTRUMENTS; ++i) {
-		if (IsInstrumentUsed(i)) {
-			bool Used = false;
-			for (unsigned int j = 0; j < m_iTrackCount; ++j) {
-				for (unsigned int Channel = 0; Channel < m_iChannelsAvailable; ++Channel) {
-					for (unsigned int Frame = 0; Frame < m_pTracks[j]->GetFrameCount(); ++Frame) {
-						unsigned int Pattern = m_pTracks[j]->GetFramePattern(Frame, Channel);
-						for (unsigned int Row = 0; Row < m_pTracks[j]->GetPatternLength(); ++Row) {
-							stChanNote *pNote = m_pTracks[j]->GetPatternData(Channel, Pattern, Row);
-							if (pNote->Instrument == i)
-								Used = true;
+	CleanupModule(CLEANUP_INSTRUMENTS);
+}
+
+void CFamiTrackerDoc::RemoveUnusedPatterns()
+{
+	CleanupModule(CLEANUP_PATTERNS);
+}
+
+void CFamiTrackerDoc::MergeDuplicatedPatterns()
+{
+	CleanupModule(CLEANUP_MERGE_PATTERNS);
+}
+
+static unsigned int HashPatternRows(const stChanNote *pRows, unsigned int Rows)
+{
+	// 32-bit FNV-1a
+	const unsigned char *pData = reinterpret_cast<const unsigned char*>(pRows);
+	const unsigned int Size = Rows * sizeof(stChanNote);
+	unsigned int Hash = 2166136261U;
+
+	for (unsigned int i = 0; i < Size; ++i) {
+		Hash ^= pData[i];
+		Hash *= 16777619U;
+	}
+
+	return Hash;
+}
+
+void CFamiTrackerDoc::CleanupModule(int Steps)
+{
+	// Runs the selected cleanup steps with one pass over the frame lists and patterns.
+	// Duplicated patterns are found by hash, usage of instruments, sequences and samples
+	// is collected from the patterns left in the frame lists and all changes are applied
+	// at the end.
+
+	static const int HASH_SIZE = 256;		// Buckets, must be a power of two
+
+	bool bInstrumentUsed[MAX_INSTRUMENTS];
+	bool bModified = false;
+
+	memset(bInstrumentUsed, 0, sizeof(bInstrumentUsed));
+
+	for (unsigned int i = 0; i < m_iTrackCount; ++i) {
+		CPatternData *pTrack = m_pTracks[i];
+		const unsigned int FrameCount = pTrack->GetFrameCount();
+		const unsigned int PatternLength = pTrack->GetPatternLength();
+
+		for (unsigned int c = 0; c < m_iChannelsAvailable; ++c) {
+			unsigned int PatternMap[MAX_PATTERN];
+			bool bPatternUsed[MAX_PATTERN];
+			unsigned int LastUsed = 0;
+
+			memset(bPatternUsed, 0, sizeof(bPatternUsed));
+
+			for (unsigned int f = 0; f < FrameCount; ++f) {
+				unsigned int Pattern = pTrack->GetFramePattern(f, c);
+				bPatternUsed[Pattern] = true;
+				LastUsed = max(LastUsed, Pattern);
+			}
+
+			for (unsigned int p = 0; p < MAX_PATTERN; ++p)
+				PatternMap[p] = p;
+
+			if (Steps & CLEANUP_MERGE_PATTERNS) {
+				// A used pattern is mapped to the first pattern with the same rows, patterns after
+				// the last used pattern can't be a target. Only the first pattern of each content
+				// is put in the hash table.
+				int Buckets[HASH_SIZE];
+				int Next[MAX_PATTERN];
+				unsigned int Hashes[MAX_PATTERN];
+
+				memset(Buckets, -1, sizeof(Buckets));
+
+				const stChanNote *pEmptyRows = NULL;
+				unsigned int EmptyHash = 0;
+
+				for (unsigned int p = 0; p <= LastUsed; ++p) {
+					const stChanNote *pRows = pTrack->ReadPatternRows(c, p);
+
+					// Patterns that are not allocated share the same empty rows
+					if (pTrack->GetPatternBlock(c, p) == NULL) {
+						if (pEmptyRows == NULL) {
+							pEmptyRows = pRows;
+							EmptyHash = HashPatternRows(pRows, PatternLength);
 						}
+						Hashes[p] = EmptyHash;
+					}
+					else
+						Hashes[p] = HashPatternRows(pRows, PatternLength);
+
+					const int Bucket = Hashes[p] & (HASH_SIZE - 1);
+
+					for (int q = Buckets[Bucket]; q != -1; q = Next[q]) {
+						const stChanNote *pOther = pTrack->ReadPatternRows(c, q);
+						if (Hashes[q] == Hashes[p] && (pOther == pRows || !memcmp(pOther, pRows, sizeof(stChanNote) * PatternLength))) {
+							PatternMap[p] = q;
+							TRACE2("Duplicate: %d = %d\n", p, q);
+							break;
+						}
+					}
+
+					if (PatternMap[p] == p) {
+						Next[p] = Buckets[Bucket];
+						Buckets[Bucket] = p;
+					}
+				}
+
+				for (unsigned int f = 0; f < FrameCount; ++f) {
+					unsigned int Pattern = pTrack->GetFramePattern(f, c);
+					if (PatternMap[Pattern] != Pattern) {
+						pTrack->SetFramePattern(f, c, PatternMap[Pattern]);
+						bModified = true;
+					}
+				}
+
+				// Usage after merging
+				for (unsigned int p = 0; p <= LastUsed; ++p) {
+					if (bPatternUsed[p] && PatternMap[p] != p) {
+						bPatternUsed[p] = false;
+						bPatternUsed[PatternMap[p]] = true;
 					}
 				}
 			}
-			if (!Used)
+
+			// Each used pattern is scanned once for instruments
+			if (Steps & CLEANUP_INSTRUMENTS) {
+				for (unsigned int p = 0; p <= LastUsed; ++p) {
+					if (!bPatternUsed[p] || pTrack->GetPatternBlock(c, p) == NULL)
+						continue;
+					const stChanNote *pRows = pTrack->ReadPatternRows(c, p);
+					for (unsigned int r = 0; r < PatternLength; ++r) {
+						if (pRows[r].Instrument < MAX_INSTRUMENTS)
+							bInstrumentUsed[pRows[r].Instrument] = true;
+					}
+				}
+			}
+
+			if (Steps & CLEANUP_PATTERNS) {
+				for (unsigned int p = 0; p < MAX_PATTERN; ++p) {
+					if (!bPatternUsed[p] && pTrack->GetPatternBlock(c, p) != NULL) {
+						pTrack->ClearPattern(c, p);
+						bModified = true;
+					}
+				}
+			}
+		}
+	}
+
+	if (Steps & CLEANUP_INSTRUMENTS) {
+		for (int i = 0; i < MAX_INSTRUMENTS; ++i) {
+			if (IsInstrumentUsed(i) && !bInstrumentUsed[i])
 				RemoveInstrument(i);
 		}
 	}
 
-	// Also remove unused sequences
-	for (unsigned int i = 0; i < MAX_SEQUENCES; ++i) {
-		for (int j = 0; j < SEQ_COUNT; ++j) {
-			// Scan through all 2A03 sequences
-			if (GetSequence(i, j)->GetItemCount() > 0) {
-				bool Used = false;
-				for (int k = 0; k < MAX_INSTRUMENTS; ++k) {
-					if (IsInstrumentUsed(k) && GetInstrumentType(k) == INST_2A03) {
-						CInstrument2A03 *pInstrument = static_cast<CInstrument2A03*>(GetInstrument(k));
-						if (pInstrument->GetSeqIndex(j) == i) {
-							Used = true;
-							break;
+	// Sequences and samples used by the remaining instruments, collected in one pass
+	if (Steps & (CLEANUP_INSTRUMENTS | CLEANUP_SAMPLES)) {
+		enum { SEQ_2A03, SEQ_VRC6, SEQ_N163, SEQ_S5B, SEQ_CHIPS };
+
+		bool bSequenceUsed[SEQ_CHIPS][MAX_SEQUENCES][SEQ_COUNT];
+		bool bSampleUsed[MAX_DSAMPLES];
+
+		memset(bSequenceUsed, 0, sizeof(bSequenceUsed));
+		memset(bSampleUsed, 0, sizeof(bSampleUsed));
+
+		for (int i = 0; i < MAX_INSTRUMENTS; ++i) {
+			CInstrument *pInstrument = GetInstrument(i);
+			if (pInstrument == NULL)
+				continue;
+			switch (pInstrument->GetType()) {
+				case INST_2A03: {
+						CInstrument2A03 *pInst = static_cast<CInstrument2A03*>(pInstrument);
+						for (int j = 0; j < SEQ_COUNT; ++j)
+							bSequenceUsed[SEQ_2A03][pInst->GetSeqIndex(j)][j] = true;
+						for (int o = 0; o < OCTAVE_RANGE; ++o) {
+							for (int n = 0; n < NOTE_RANGE; ++n) {
+								int Sample = pInst->GetSample(o, n);
+								if (Sample > 0 && Sample <= MAX_DSAMPLES)
+									bSampleUsed[Sample - 1] = true;
+							}
 						}
-						pInstrument->Release();
 					}
-				}
-				if (!Used)
-					GetSequence(i, j)->Clear();
+					break;
+				case INST_VRC6:
+					for (int j = 0; j < SEQ_COUNT; ++j)
+						bSequenceUsed[SEQ_VRC6][static_cast<CInstrumentVRC6*>(pInstrument)->GetSeqIndex(j)][j] = true;
+					break;
+				case INST_N163:
+					for (int j = 0; j < SEQ_COUNT; ++j)
+						bSequenceUsed[SEQ_N163][static_cast<CInstrumentN163*>(pInstrument)->GetSeqIndex(j)][j] = true;
+					break;
+				case INST_S5B:
+					for (int j = 0; j < SEQ_COUNT; ++j)
+						bSequenceUsed[SEQ_S5B][static_cast<CInstrumentS5B*>(pInstrument)->GetSeqIndex(j)][j] = true;
+					break;
 			}
-			// Scan through all VRC6 sequences
-			if (GetSequenceVRC6(i, j)->GetItemCount() > 0) {
-				bool Used = false;
-				for (int k = 0; k < MAX_INSTRUMENTS; ++k) {
-					if (IsInstrumentUsed(k) && GetInstrumentType(k) == INST_VRC6) {
-						CInstrumentVRC6 *pInstrument = static_cast<CInstrumentVRC6*>(GetInstrument(k));
-						if (pInstrument->GetSeqIndex(j) == i) {
-							Used = true;
-							break;
+			pInstrument->Release();
+		}
+
+		if (Steps & CLEANUP_INSTRUMENTS) {
+			for (unsigned int i = 0; i < MAX_SEQUENCES; ++i) {
+				for (int j = 0; j < SEQ_COUNT; ++j) {
+					CSequence *pSequences[SEQ_CHIPS] = {
+						GetSequence(i, j), GetSequenceVRC6(i, j), GetSequenceN163(i, j), GetSequenceS5B(i, j)
+					};
+					for (int k = 0; k < SEQ_CHIPS; ++k) {
+						if (!bSequenceUsed[k][i][j] && pSequences[k]->GetItemCount() > 0) {
+							pSequences[k]->Clear();
+							bModified = true;
 						}
-						pInstrument->Release();
 					}
 				}
-				if (!Used)
-					GetSequenceVRC6(i, j)->Clear();
 			}
-			// Scan through all VRC6 sequences
-			if (GetSequenceN163(i, j)->GetItemCount() > 0) {
-				bool Used = false;
-				for (int k = 0; k < MAX_INSTRUMENTS; ++k) {
-					if (IsInstrumentUsed(k) && GetInstrumentType(k) == INST_N163) {
-						CInstrumentN163 *pInstrument = static_cast<CInstrumentN163*>(GetInstrument(k));
-						if (pInstrument->GetSeqIndex(j) == i) {
-							Used = true;
-							break;
-						}
-						pInstrument->Release();
-					}
-				}
-				if (!Used)
-					GetSequenceN163(i, j)->Clear();
-			}	
+		}
+
+		if (Steps & CLEANUP_SAMPLES) {
+			for (int i = 0; i < MAX_DSAMPLES; ++i) {
+				if (!bSampleUsed[i])
+					RemoveSample(i);
+			}
 		}
 	}
+
+	// Instruments and samples set the flag when removed
+	if (bModified)
+		SetModifiedFlag();
 }
 
-void CFamiTrackerDoc::RemoveUnusedPatterns()
+CString CFamiTrackerDoc::BenchmarkCleanup()
 {
-	for (unsigned int i = 0; i < m_iTrackCount; ++i) {
-		for (unsigned int c = 0; c < m_iChannelsAvailable; ++c) {
+	// Times a full cleanup of the generated benchmark module
+	// Called from the command line (/benchmark) only.
+
+	CFamiTrackerDoc *pDoc = CreateBenchmarkModule();
+
+	if (pDoc == NULL)
+		return CString(_T("Could not create benchmark module"));
+
+	LARGE_INTEGER StartTime, EndTime, Freq;
+
+	QueryPerformanceCounter(&StartTime);
+	pDoc->CleanupModule(CLEANUP_ALL);
+	QueryPerformanceCounter(&EndTime);
+	QueryPerformanceFrequency(&Freq);
+
+	CString Text;
+	Text.Format(_T("Cleanup: %i tracks, %i channels, %i instruments left, %.1f ms"), MAX_TRACKS, pDoc->GetAvailableChannels(),
+		pDoc->GetInstrumentCount(), double(EndTime.QuadPart - StartTime.QuadPart) * 1000.0 / double(Freq.QuadPart));
+
+	TRACE(_T("%s\n"), (LPCTSTR)Text);
+
+	delete pDoc;
+
+	return Text;
+}
+
+CFamiTrackerDoc *CFamiTrackerDoc::CreateBenchmarkModule()
+{
+	// Generates a 2A03 module of maximum size, all tracks, frames, patterns, rows, instruments
+	// and samples are used. Patterns repeat every 32 patterns and a quarter of the instruments
+	// and samples are not used. Returns NULL on failure, the caller deletes the document.
+
+	CFamiTrackerDoc *pDoc = static_cast<CFamiTrackerDoc*>(RUNTIME_CLASS(CFamiTrackerDoc)->CreateObject());
+
+	if (pDoc == NULL)
+		return NULL;
+
+	// Set up a 2A03 module directly, CreateEmpty would select the chip in the sound generator
+	pDoc->m_iMachine = DEFAULT_MACHINE_TYPE;
+	pDoc->m_iExpansionChip = SNDCHIP_NONE;
+	pDoc->m_iTrackCount = 1;
+	pDoc->AllocateTrack(0);
+
+	theApp.GetSoundGenerator()->RegisterChannels(SNDCHIP_NONE, pDoc);
+	pDoc->m_iChannelsAvailable = pDoc->GetChannelCount();
+
+	while (pDoc->GetTrackCount() < MAX_TRACKS)
+		pDoc->AddTrack();
+
+	for (int i = 0; i < MAX_INSTRUMENTS; ++i)
+		pDoc->AddInstrument("Benchmark", SNDCHIP_NONE);
+
+	for (int i = 0; i < MAX_DSAMPLES; ++i)
+		pDoc->GetSample(i)->Allocate(0xFF1);
+
+	for (int i = 0; i < MAX_INSTRUMENTS; ++i) {
+		CInstrument2A03 *pInstrument = static_cast<CInstrument2A03*>(pDoc->GetInstrument(i));
+		for (int j = 0; j < SEQ_COUNT; ++j) {
+			pInstrument->SetSeqIndex(j, i);
+			pDoc->GetSequence(i, j)->SetItemCount(MAX_SEQUENCE_ITEMS);
+		}
+		pInstrument->SetSample(0, 0, (i % MAX_DSAMPLES) * 3 / 4 + 1);
+		pInstrument->Release();
+	}
+
+	for (unsigned int i = 0; i < MAX_TRACKS; ++i) {
+		pDoc->SetFrameCount(i, MAX_FRAMES);
+		pDoc->SetPatternLength(i, MAX_PATTERN_LENGTH);
+		for (unsigned int c = 0; c < pDoc->GetAvailableChannels(); ++c) {
+			for (unsigned int f = 0; f < MAX_FRAMES; ++f)
+				pDoc->SetPatternAtFrame(i, f, c, f % MAX_PATTERN);
 			for (unsigned int p = 0; p < MAX_PATTERN; ++p) {
-				bool bRemove(true);
-				// Check if pattern is used in frame list
-				unsigned int FrameCount = m_pTracks[i]->GetFrameCount();
-				for (unsigned int f = 0; f < FrameCount; ++f) {
-					bRemove = (m_pTracks[i]->GetFramePattern(f, c) == p) ? false : bRemove;
+				for (unsigned int r = 0; r < MAX_PATTERN_LENGTH; ++r) {
+					stChanNote Note;
+					memset(&Note, 0, sizeof(stChanNote));
+					Note.Note = C;
+					Note.Octave = (p % 32) / 4;
+					Note.Vol = MAX_VOLUME;
+					Note.Instrument = (r * 7 + p % 32) % (MAX_INSTRUMENTS * 3 / 4);
+					pDoc->SetDataAtPattern(i, p, c, r, &Note);
 				}
-				if (bRemove)
-					m_pTracks[i]->ClearPattern(c, p);
 			}
 		}
 	}
-}
 
-void CFamiTrackerDoc::MergeDuplicatedPatterns()
-{
-    for (unsigned int i = 0; i < m_iTrackCount; ++i)
-    for (unsigned int c = 0; c < m_iChannelsAvailable; ++c)
-    {
-        TRACE2("Trim: %d, %d\n", i, c);
-
-        unsigned int uiPatternUsed[MAX_PATTERN];
-
-        // mark all as unused
-        for (unsigned int ui=0; ui < MAX_PATTERN; ++ui)
-        {
-            uiPatternUsed[ui] = MAX_PATTERN;
-        }
-
-        // map used patterns to themselves
-        for (unsigned int f=0; f < m_pTracks[i]->GetFrameCount(); ++f)
-        {
-            unsigned int uiPattern = m_pTracks[i]->GetFramePattern(f,c);
-            uiPatternUsed[uiPattern] = uiPattern;
-        }
-
-        // remap duplicates
-        for (unsigned int ui=0; ui < MAX_PATTERN; ++ui)
-        {
-            if (uiPatternUsed[ui] == MAX_PATTERN) continue;
-            for (unsigned int uj=0; uj < ui; ++uj)
-            {
-                unsigned int uiLen = m_pTracks[i]->GetPatternLength();
-                bool bSame = true;
-                for (unsigned int uk = 0; uk < uiLen; ++uk)
-                {
-                    stChanNote* a = m_pTracks[i]->GetPatternData(c, ui, uk);
-                    stChanNote* b = m_pTracks[i]->GetPatternData(c, uj, uk);
-                    if (0 != ::memcmp(a, b, sizeof(stChanNote)))
-                    {
-                        bSame = false;
-                        break;
-                    }
-                }
-                if (bSame)
-                {
-                    uiPatternUsed[ui] = uj;
-                    TRACE2("Duplicate: %d = %d\n", ui, uj);
-                    break;
-                }
-            }
-        }
-
-        // apply mapping
-        for (unsigned int f=0; f < m_pTracks[i]->GetFrameCount(); ++f)
-        {
-            unsigned int uiPattern = m_pTracks[i]->GetFramePattern(f,c);
-            m_pTracks[i]->SetFramePattern(f,c,uiPatternUsed[uiPattern]);
-        }
-    }
+	return pDoc;
 }
 
 void CFamiTrackerDoc::SwapInstruments(int First, int Second)
@@ -81,6 +81,26 @@ enum {
 	UPDATE_CLOSE			// Document is closing (TODO remove)
 };
 
+// Module cleanup steps, see CleanupModule
+enum {
+	CLEANUP_MERGE_PATTERNS = 1,		// Merge duplicated patterns
+	CLEANUP_PATTERNS = 2,			// Remove patterns not in the frame list
+	CLEANUP_INSTRUMENTS = 4,		// Remove unused instruments and sequences
+	CLEANUP_SAMPLES = 8,			// Remove DPCM samples not used by any instrument
+	CLEANUP_ALL = 15
+};
+
+// Song length, see ScanSongLength
+struct stSongLength {
+	unsigned int IntroFrames;		// Frames played before the loop point
+	unsigned int IntroRows;
+	double		 IntroSeconds;
+	unsigned int LoopFrames;		// Frames in one loop, 0 if the song is stopped by Cxx
+	unsigned int LoopRows;
+	double		 LoopSeconds;
+	int			 LoopPoint;			// Frame the loop starts at, -1 if the song is stopped by Cxx
+};
+
 // Old sequence list, kept for compability
 struct stSequence {
 	unsigned int Count;
@@ -96,6 +116,8 @@ struct stSequence {
 // External classes
 class CTrackerChannel;
 class CDocumentFile;
+class CTrackSnapshot;
+class CAutoSave;
 
 //
 // I'll try to organize this class, things are quite messy right now!
@@ -113,9 +135,7 @@ public:
 
 
 	// Other
-#ifdef AUTOSAVE
 	void AutoSave();
-#endif
 
 	//
 	// Public functions
@@ -152,6 +172,11 @@ public:
 	BOOL			LockDocument(DWORD dwTimeout) const;
 	BOOL			UnlockDocument() const;
 
+	// Player snapshots, these are published from the main thread
+	void			PublishSnapshots(bool bForce = false);
+	CTrackSnapshot*	AcquireSnapshot(unsigned int Track) const;
+	LONG			GetSnapshotSerial() const;
+
 	//
 	// Document data access functions
 	//
@@ -174,6 +199,7 @@ public:
 	void			SetPatternAtFrame(unsigned int Track, unsigned int Frame, unsigned int Channel, unsigned int Pattern);
 
 	bool			IsPatternEmpty(unsigned int Track, unsigned int Channel, unsigned int Pattern) const;
+	bool			IsCellFree(unsigned int Track, unsigned int Channel, unsigned int Pattern, unsigned int Row) const;
 
 	// Pattern editing
 	void			SetNoteData(unsigned int Track, unsigned int Frame, unsigned int Channel, unsigned int Row, const stChanNote *pData);
@@ -181,6 +207,7 @@ public:
 
 	void			SetDataAtPattern(unsigned int Track, unsigned int Pattern, unsigned int Channel, unsigned int Row, const stChanNote *pData);
 	void			GetDataAtPattern(unsigned int Track, unsigned int Pattern, unsigned int Channel, unsigned int Row, stChanNote *pData) const;
+	const stChanNote *GetPatternRows(unsigned int Track, unsigned int Pattern, unsigned int Channel) const;
 
 	void			ClearPatterns(unsigned int Track);
 	void			ClearPattern(unsigned int Track, unsigned int Frame, unsigned int Channel);
@@ -310,11 +337,15 @@ public:
 
 	// Other
 	unsigned int	ScanActualLength(unsigned int Track, unsigned int Count, unsigned int &RowCount) const;
+	void			ScanSongLength(unsigned int Track, stSongLength &Length) const;
 
 	// Operations
 	void			RemoveUnusedInstruments();
 	void			RemoveUnusedPatterns();
 	void			MergeDuplicatedPatterns();
+	void			CleanupModule(int Steps);
+	static CString	BenchmarkCleanup();
+	static CFamiTrackerDoc *CreateBenchmarkModule();
 	void			SwapInstruments(int First, int Second);
 
 	// For file version compability
@@ -352,6 +383,8 @@ private:
 	BOOL			OpenDocumentNew(CDocumentFile &DocumentFile);
 
 	bool			WriteBlocks(CDocumentFile *pDocFile) const;
+	bool			WriteHeadBlocks(CDocumentFile *pDocFile) const;
+	bool			WriteTailBlocks(CDocumentFile *pDocFile) const;
 	bool			WriteBlock_Parameters(CDocumentFile *pDocFile) const;
 	bool			WriteBlock_SongInfo(CDocumentFile *pDocFile) const;
 	bool			WriteBlock_Header(CDocumentFile *pDocFile) const;
@@ -383,10 +416,8 @@ private:
 	void			ReorderSequences();
 	void			ConvertSequences();
 
-#ifdef AUTOSAVE
 	void			SetupAutoSave();
 	void			ClearAutoSave();
-#endif
 
 	//
 	// Internal module operations
@@ -397,6 +428,8 @@ private:
 	CPatternData*	GetTrack(unsigned int Track) const;
 	void			SwapTracks(unsigned int Track1, unsigned int Track2);
 
+	void			ReleaseSnapshots();
+
 	void			SetupChannels(unsigned char Chip);
 	void			ApplyExpansionChip();
 
@@ -433,11 +466,11 @@ private:
 	bool			m_bAdjustFDSArpeggio;
 #endif
 
-#ifdef AUTOSAVE
 	// Auto save
 	int				m_iAutoSaveCounter;
 	CString			m_sAutoSaveFile;
-#endif
+	CAutoSave		*m_pAutoSave;
+	DWORD			m_iAutoSaveTime;		// Time spent on the main thread
 
 	//
 	// Document data
@@ -488,10 +521,16 @@ private:
 	// End of document data
 	//
 
+	// Published player snapshots
+	CTrackSnapshot	*m_pSnapshots[MAX_TRACKS];
+	unsigned int	m_iSnapshotRevision[MAX_TRACKS];				// Track revision each snapshot was made from
+	volatile LONG	m_iSnapshotSerial;								// Incremented every time snapshots are published
+
 	// Thread synchronization
 private:
 	mutable CCriticalSection m_csInstrument;
 	mutable CMutex			 m_csDocumentLock;
+	mutable CCriticalSection m_csSnapshots;						// Only held while swapping snapshot pointers
 
 // Operations
 public:
@@ -44,8 +44,11 @@ const int MAX_SEQUENCE_ITEMS = /*128*/ 253;		// TODO: need to check if this expo
 // Maximum number of patterns per channel
 const int MAX_PATTERN = 128;
 
-// Maximum number of frames
-const int MAX_FRAMES = 128;
+// Maximum number of frames, Bxx can address 256 frames. Frame lists grow when needed
+const int MAX_FRAMES = 256;
+
+// Maximum number of frames in exported songs, cannot be increased unless the NSF driver is modified.
+const int MAX_DRIVER_FRAMES = 128;
 
 // Maximum length of patterns (in rows). 256 is max in NSF
 const int MAX_PATTERN_LENGTH = 256;
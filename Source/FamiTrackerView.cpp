@@ -35,6 +35,7 @@
 #include "Settings.h"
 #include "Accelerator.h"
 #include "TrackerChannel.h"
+#include "TrackSnapshot.h"
 #include "Clipboard.h"
 #include "APU/APU.h"
 
@@ -723,6 +724,10 @@ void CFamiTrackerView::PeriodicUpdate()
 
 	CSoundGen *pSoundGen = theApp.GetSoundGenerator();
 
+	// Hand edited tracks over to the player
+	if (pDoc->IsFileLoaded())
+		pDoc->PublishSnapshots();
+
 	if (pSoundGen != NULL) {
 
 #ifdef EXPORT_TEST
@@ -1342,12 +1347,12 @@ void CFamiTrackerView::PlayerTick()
 	while (m_iAutoArpPtr != OldPtr);
 }
 
-bool CFamiTrackerView::PlayerGetNote(int Track, int Frame, int Channel, int Row, stChanNote &NoteData)
+bool CFamiTrackerView::PlayerGetNote(const CTrackSnapshot *pSnapshot, int Frame, int Channel, int Row, stChanNote &NoteData)
 {
-	CFamiTrackerDoc *pDoc = GetDocument();
+	// Callback from sound thread, pattern data is read from the player snapshot
 	bool ValidCommand = false;
 
-	pDoc->GetNoteData(Track, Frame, Channel, Row, &NoteData);
+	pSnapshot->GetNoteData(Frame, Channel, Row, &NoteData);
 	
 	if (!IsChannelMuted(Channel)) {
 		// Let view know what is about to play
@@ -1357,7 +1362,7 @@ bool CFamiTrackerView::PlayerGetNote(int Track, int Frame, int Channel, int Row,
 	else {
 		// These effects will pass even if the channel is muted
 		const int PASS_EFFECTS[] = {EF_HALT, EF_JUMP, EF_SPEED, EF_SKIP};
-		int Columns = pDoc->GetEffColumns(Track, Channel) + 1;
+		int Columns = pSnapshot->GetEffColumns(Channel) + 1;
 		
 		NoteData.Note		= HALT;
 		NoteData.Octave		= 0;
@@ -34,6 +34,7 @@ enum {
 
 // External classes
 class CFamiTrackerDoc;
+class CTrackSnapshot;
 class CPatternEditor;
 class CFrameEditor;
 class CAction;
@@ -89,7 +90,7 @@ public:
 
 	// Player callback (TODO move to new interface)
 	void		 PlayerTick();
-	bool		 PlayerGetNote(int Track, int Frame, int Channel, int Row, stChanNote &NoteData);
+	bool		 PlayerGetNote(const CTrackSnapshot *pSnapshot, int Frame, int Channel, int Row, stChanNote &NoteData);
 	void		 PlayerPlayNote(int Channel, stChanNote *pNote);
 
 	void		 MakeSilent();
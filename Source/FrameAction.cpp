@@ -192,7 +192,7 @@ bool CFrameAction::SaveState(CMainFrame *pMainFrm)
 		case ACT_CHANGE_PATTERN_ALL:
 			SaveFrame(pDocument);
 			for (int i = 0; i < Channels; ++i) {
-				if (m_iPatterns[i] + m_iPatternDelta < 0 || m_iPatterns[i] + m_iPatternDelta >= MAX_FRAMES)
+				if (m_iPatterns[i] + m_iPatternDelta < 0 || m_iPatterns[i] + m_iPatternDelta >= MAX_PATTERN)
 					return false;
 			}
 			break;
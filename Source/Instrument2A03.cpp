@@ -394,9 +394,7 @@ int CInstrument2A03::Compile(CFamiTrackerDoc *pDoc, CChunk *pChunk, int Index)
 	for (int i = 0; i < SEQUENCE_COUNT; ++i) {
 		const CSequence *pSequence = pDoc->GetSequence(unsigned(GetSeqIndex(i)), i);
 		if (GetSeqEnable(i) != 0 && (pSequence->GetItemCount() != 0)) {
-			CStringA str;
-			str.Format(CCompiler::LABEL_SEQ_2A03, GetSeqIndex(i) * SEQUENCE_COUNT + i);
-			pChunk->StoreReference(str);
+			pChunk->StoreReference(SYMBOL_SEQ_2A03, GetSeqIndex(i) * SEQUENCE_COUNT + i);
 			StoredBytes += 2;
 		}
 	}
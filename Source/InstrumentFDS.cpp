@@ -292,8 +292,6 @@ bool CInstrumentFDS::LoadFile(CInstrumentFile *pFile, int iVersion, CFamiTracker
 
 int CInstrumentFDS::Compile(CFamiTrackerDoc *pDoc, CChunk *pChunk, int Index)
 {
-	CStringA str;
-
 	// Store wave
 //	int Table = pCompiler->AddWavetable(m_iSamples);
 //	int Table = 0;
@@ -316,20 +314,17 @@ int CInstrumentFDS::Compile(CFamiTrackerDoc *pDoc, CChunk *pChunk, int Index)
 
 	// Volume
 	if (Switch & 1) {
-		str.Format(CCompiler::LABEL_SEQ_FDS, Index * 5 + 0);
-		pChunk->StoreReference(str);
+		pChunk->StoreReference(SYMBOL_SEQ_FDS, Index * 5 + 0);
 	}
 
 	// Arpeggio
 	if (Switch & 2) {
-		str.Format(CCompiler::LABEL_SEQ_FDS, Index * 5 + 1);
-		pChunk->StoreReference(str);
+		pChunk->StoreReference(SYMBOL_SEQ_FDS, Index * 5 + 1);
 	}
 	
 	// Pitch
 	if (Switch & 4) {
-		str.Format(CCompiler::LABEL_SEQ_FDS, Index * 5 + 2);
-		pChunk->StoreReference(str);
+		pChunk->StoreReference(SYMBOL_SEQ_FDS, Index * 5 + 2);
 	}
 
 	int size = FIXED_FDS_INST_SIZE;
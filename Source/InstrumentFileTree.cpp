@@ -19,17 +19,31 @@
 */
 
 // The instrument file tree, used in the instrument toolbar to quickly load an instrument
+// Files are listed by the instrument library, which scans the folder in the background
 
+#include <vector>
 #include "stdafx.h"
+#include "FamiTrackerTypes.h"
+#include "Instrument.h"
+#include "InstrumentLibrary.h"
 #include "InstrumentFileTree.h"
 
-CInstrumentFileTree::CInstrumentFileTree() : m_pRootMenu(NULL), m_iFileIndex(0), m_bShouldRebuild(true)
+CInstrumentFileTree::CInstrumentFileTree() : 
+	m_pRootMenu(NULL), 
+	m_iFileIndex(0), 
+	m_iTimeout(0), 
+	m_bShouldRebuild(true), 
+	m_iTotalMenusAdded(0), 
+	m_iRevision(0), 
+	m_bScanning(false)
 {
+	m_pLibrary = new CInstrumentLibrary();
 }
 
 CInstrumentFileTree::~CInstrumentFileTree()
 {
 	DeleteMenuObjects();
+	SAFE_RELEASE(m_pLibrary);
 }
 
 void CInstrumentFileTree::DeleteMenuObjects()
@@ -60,7 +74,11 @@ void CInstrumentFileTree::Changed()
 bool CInstrumentFileTree::ShouldRebuild() const
 {
 	// Check if tree expired, to allow changes in the file system to be visible
-	return (GetTickCount() > m_iTimeout) || m_bShouldRebuild;
+	if ((GetTickCount() > m_iTimeout) || m_bShouldRebuild)
+		return true;
+
+	// The library has found changes since the menu was built
+	return m_iRevision != m_pLibrary->GetRevision() || (m_bScanning && !m_pLibrary->IsUpdating());
 }
 
 bool CInstrumentFileTree::BuildMenuTree(CString instrumentPath)
@@ -80,24 +98,50 @@ bool CInstrumentFileTree::BuildMenuTree(CString instrumentPath)
 	m_pRootMenu->AppendMenu(MF_SEPARATOR);
 	m_pRootMenu->SetDefaultItem(0, TRUE);
 
+	instrumentPath.TrimRight(_T('\\'));
+
 	if (instrumentPath.GetLength() == 0) {
 		m_bShouldRebuild = true;
 		m_pRootMenu->AppendMenu(MF_STRING | MF_DISABLED, MENU_BASE + 2, _T("(select a directory)"));
 	}
 	else {
+		// Scan the folder again in the background when the cached tree has expired
+		if (m_bShouldRebuild || GetTickCount() > m_iTimeout || instrumentPath.CompareNoCase(m_strPath)) {
+			m_pLibrary->Update(instrumentPath);
+			m_strPath = instrumentPath;
+			m_iTimeout = GetTickCount() + CACHE_TIMEOUT;
+			m_bShouldRebuild = false;
+		}
+
+		// Give the first scan a moment, the stored index is usually available at once
+		for (DWORD Start = GetTickCount(); m_pLibrary->GetRevision() == 0 && m_pLibrary->IsUpdating() && GetTickCount() - Start < SCAN_WAIT; )
+			Sleep(10);
+
+		m_iRevision = m_pLibrary->GetRevision();
+		m_bScanning = m_pLibrary->IsUpdating();
+
+		// Entries below the selected folder, the index may still hold a previous folder
+		std::vector<stInstrumentInfo> AllEntries, Entries;
+		m_pLibrary->GetEntries(AllEntries);
+
+		const CString Prefix = instrumentPath + _T("\\");
+
+		for (std::vector<stInstrumentInfo>::const_iterator it = AllEntries.begin(); it != AllEntries.end(); ++it) {
+			if (!it->Path.Left(Prefix.GetLength()).CompareNoCase(Prefix))
+				Entries.push_back(*it);
+		}
+
 		m_iFileIndex = 2;
 
-		if (!ScanDirectory(instrumentPath, m_pRootMenu, 0)) {
+		if (!AddEntries(Entries, 0, Entries.size(), Prefix.GetLength(), m_pRootMenu)) {
 			// No files found
-			m_pRootMenu->AppendMenu(MF_STRING | MF_DISABLED, MENU_BASE + 2, _T("(no files found)"));
-			m_bShouldRebuild = true;
+			m_pRootMenu->AppendMenu(MF_STRING | MF_DISABLED, MENU_BASE + 2, m_bScanning ? _T("(scanning...)") : _T("(no files found)"));
 		}
 		else {
+			if (!m_bScanning && Entries.size() <= MAX_GROUPED_FILES)
+				AddGroupMenus(Prefix);
 			m_fileList.FreeExtra();
 			m_menuArray.FreeExtra();
-
-			m_iTimeout = GetTickCount() + CACHE_TIMEOUT;
-			m_bShouldRebuild = false;
 		}
 	}
 
@@ -106,46 +150,146 @@ bool CInstrumentFileTree::BuildMenuTree(CString instrumentPath)
 	return true;
 }
 
-bool CInstrumentFileTree::ScanDirectory(CString path, CMenu *pMenu, int level)
+bool CInstrumentFileTree::AddEntries(const std::vector<stInstrumentInfo> &Entries, unsigned int Begin, unsigned int End, int PathLength, CMenu *pMenu)
 {
-	CFileFind fileFinder;
+	// Entries are sorted by path, so the files of each sub directory follow each other
 	bool bNoFile = true;
 
-	if (level > RECURSION_LIMIT)
-		return false;
+	// First add directories
+	for (unsigned int i = Begin; i < End; ) {
+		const CString &Path = Entries[i].Path;
+		int Pos = Path.Find(_T('\\'), PathLength);
+
+		if (Pos == -1) {
+			++i;
+			continue;
+		}
+
+		const CString Directory = Path.Left(Pos + 1);
+		unsigned int Next = i + 1;
 
-	BOOL working = fileFinder.FindFile(path + _T("\\*.*"));
+		while (Next < End && !Entries[Next].Path.Left(Pos + 1).CompareNoCase(Directory))
+			++Next;
 
-	// First scan directories
-	while (working) {
-		working = fileFinder.FindNextFile();
+		CMenu *pSubMenu = CreateSubMenu();
 
-		if (fileFinder.IsDirectory() && !fileFinder.IsHidden() && !fileFinder.IsDots() && m_iTotalMenusAdded++ < MAX_MENUS) {
-			CMenu *pSubMenu = new CMenu();
-			m_menuArray.Add(pSubMenu);
-			pSubMenu->CreatePopupMenu();
-			// Recursive scan
-			bool bDisabled = false;
-			if (!ScanDirectory(path + _T("\\") + fileFinder.GetFileName(), pSubMenu, level + 1))
-				bDisabled = true;
-			pMenu->AppendMenu(MF_STRING | MF_POPUP | (bDisabled ? MF_DISABLED : MF_ENABLED), (UINT)pSubMenu->m_hMenu, fileFinder.GetFileName());		
+		if (pSubMenu != NULL) {
+			bool bDisabled = !AddEntries(Entries, i, Next, Pos + 1, pSubMenu);
+			pMenu->AppendMenu(MF_STRING | MF_POPUP | (bDisabled ? MF_DISABLED : MF_ENABLED), (UINT)pSubMenu->m_hMenu, Path.Mid(PathLength, Pos - PathLength));
 			bNoFile = false;
 		}
-	}
 
-	working = fileFinder.FindFile(path + _T("\\*.fti"));
+		i = Next;
+	}
 
 	// Then files
-	while (working) {
-		working = fileFinder.FindNextFile();
-		pMenu->AppendMenu(MF_STRING | MF_ENABLED, MENU_BASE + m_iFileIndex++, fileFinder.GetFileTitle());
-		m_fileList.Add(path + _T("\\") + fileFinder.GetFileName());
+	for (unsigned int i = Begin; i < End; ++i) {
+		const CString &Path = Entries[i].Path;
+
+		if (Path.Find(_T('\\'), PathLength) != -1)
+			continue;
+
+		// File name without extension
+		CString Title = Path.Mid(PathLength);
+		Title = Title.Left(Title.GetLength() - 4);
+
+		AddFile(pMenu, Path, Title);
 		bNoFile = false;
 	}
 
 	return !bNoFile;
 }
 
+void CInstrumentFileTree::AddGroupMenus(const CString &Prefix)
+{
+	// Files of each chip and instruments by name, from the library queries
+
+	static const struct {
+		int Type;
+		LPCTSTR pName;
+	} CHIPS[] = {
+		{INST_2A03, _T("2A03")},
+		{INST_VRC6, _T("VRC6")},
+		{INST_VRC7, _T("VRC7")},
+		{INST_FDS, _T("FDS")},
+		{INST_N163, _T("N163")}
+	};
+
+	static const char *NAME_GROUPS[] = {
+		"0123456789", "A", "B", "C", "D", "E", "F", "G", "H", "I", "J", "K", "L", "M",
+		"N", "O", "P", "Q", "R", "S", "T", "U", "V", "W", "X", "Y", "Z"
+	};
+
+	const int CHIP_COUNT = sizeof(CHIPS) / sizeof(CHIPS[0]);
+	const int GROUP_COUNT = sizeof(NAME_GROUPS) / sizeof(NAME_GROUPS[0]);
+
+	// Every group could need a menu
+	if (m_iTotalMenusAdded + CHIP_COUNT + GROUP_COUNT + 2 > MAX_MENUS)
+		return;
+
+	std::vector<stInstrumentInfo> Entries;
+
+	CMenu *pChipMenu = CreateSubMenu();
+
+	for (int i = 0; i < CHIP_COUNT; ++i) {
+		CMenu *pSubMenu = NULL;
+		m_pLibrary->FindByType(CHIPS[i].Type, Entries);
+		for (std::vector<stInstrumentInfo>::const_iterator it = Entries.begin(); it != Entries.end(); ++it) {
+			if (it->Path.Left(Prefix.GetLength()).CompareNoCase(Prefix))
+				continue;
+			if (pSubMenu == NULL)
+				pSubMenu = CreateSubMenu();
+			// File name without extension
+			CString Title = it->Path.Mid(it->Path.ReverseFind(_T('\\')) + 1);
+			AddFile(pSubMenu, it->Path, Title.Left(Title.GetLength() - 4));
+		}
+		if (pSubMenu != NULL)
+			pChipMenu->AppendMenu(MF_STRING | MF_POPUP | MF_ENABLED, (UINT)pSubMenu->m_hMenu, CHIPS[i].pName);
+	}
+
+	CMenu *pNameMenu = CreateSubMenu();
+
+	for (int i = 0; i < GROUP_COUNT; ++i) {
+		CMenu *pSubMenu = NULL;
+		for (const char *pGroup = NAME_GROUPS[i]; *pGroup != 0; ++pGroup) {
+			const char Initial[2] = {*pGroup, 0};
+			m_pLibrary->FindByPrefix(Initial, Entries);
+			for (std::vector<stInstrumentInfo>::const_iterator it = Entries.begin(); it != Entries.end(); ++it) {
+				if (!it->bValid || it->Path.Left(Prefix.GetLength()).CompareNoCase(Prefix))
+					continue;
+				if (pSubMenu == NULL)
+					pSubMenu = CreateSubMenu();
+				AddFile(pSubMenu, it->Path, CString(it->Name));
+			}
+		}
+		if (pSubMenu != NULL)
+			pNameMenu->AppendMenu(MF_STRING | MF_POPUP | MF_ENABLED, (UINT)pSubMenu->m_hMenu, CString(i == 0 ? "0-9" : NAME_GROUPS[i]));
+	}
+
+	m_pRootMenu->AppendMenu(MF_SEPARATOR);
+	m_pRootMenu->AppendMenu(MF_STRING | MF_POPUP | (pChipMenu->GetMenuItemCount() > 0 ? MF_ENABLED : MF_DISABLED), (UINT)pChipMenu->m_hMenu, _T("By chip"));
+	m_pRootMenu->AppendMenu(MF_STRING | MF_POPUP | (pNameMenu->GetMenuItemCount() > 0 ? MF_ENABLED : MF_DISABLED), (UINT)pNameMenu->m_hMenu, _T("By name"));
+}
+
+CMenu *CInstrumentFileTree::CreateSubMenu()
+{
+	// Returns NULL when the menu limit is reached
+	if (m_iTotalMenusAdded++ >= MAX_MENUS)
+		return NULL;
+
+	CMenu *pMenu = new CMenu();
+	m_menuArray.Add(pMenu);
+	pMenu->CreatePopupMenu();
+
+	return pMenu;
+}
+
+void CInstrumentFileTree::AddFile(CMenu *pMenu, const CString &Path, const CString &Text)
+{
+	pMenu->AppendMenu(MF_STRING | MF_ENABLED, MENU_BASE + m_iFileIndex++, Text);
+	m_fileList.Add(Path);
+}
+
 CMenu *CInstrumentFileTree::GetMenu() const
 {
 	return m_pRootMenu;
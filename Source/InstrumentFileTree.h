@@ -20,6 +20,8 @@
 
 #pragma once
 
+class CInstrumentLibrary;
+struct stInstrumentInfo;
 
 // CInstrumentFileTree
 
@@ -36,19 +38,24 @@ public:
 	void Changed();
 
 public:
-	// Limits, to avoid very deep recursions
-	static const int RECURSION_LIMIT = 6;
+	// Limits, to avoid very large menus
 	static const int MAX_MENUS = 200;
 
 	static const int MENU_BASE = 0x9000;	// Choose a range where no strings are located
 
 	static const int CACHE_TIMEOUT = 60000;	// 1 minute
+	static const int SCAN_WAIT = 1000;		// Max time to wait for the first scan
+	static const int MAX_GROUPED_FILES = 500;	// Chip and name menus are left out for larger folders
 
 protected:
-	bool ScanDirectory(CString path, CMenu *pMenu, int level);
+	bool AddEntries(const std::vector<stInstrumentInfo> &Entries, unsigned int Begin, unsigned int End, int PathLength, CMenu *pMenu);
+	void AddGroupMenus(const CString &Prefix);
+	CMenu *CreateSubMenu();
+	void AddFile(CMenu *pMenu, const CString &Path, const CString &Text);
 	void DeleteMenuObjects();
 
 private:
+	CInstrumentLibrary *m_pLibrary;
 	CMenu *m_pRootMenu;
 	int m_iFileIndex;
 	CArray<CString, CString> m_fileList;
@@ -56,4 +63,7 @@ private:
 	DWORD m_iTimeout;
 	bool m_bShouldRebuild;
 	int m_iTotalMenusAdded;
+	unsigned int m_iRevision;
+	bool m_bScanning;
+	CString m_strPath;
 };
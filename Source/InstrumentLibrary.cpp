@@ -0,0 +1,651 @@
+/*
+** FamiTracker - NES/Famicom sound tracker
+** Copyright (C) 2005-2014  Jonathan Liss
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+*/
+
+#include <vector>
+#include <algorithm>
+#include "stdafx.h"
+#include "FamiTrackerTypes.h"
+#include "Instrument.h"
+#include "InstrumentLibrary.h"
+
+/*
+ * Instrument library
+ *
+ * Keeps a summary of all instrument files below the instrument folder. The index is stored
+ * in the local application data folder and is updated on a worker thread, only files with
+ * a changed size or write time are read again. Instrument files are parsed without a
+ * document, the format follows the LoadFile functions of the instrument classes.
+ *
+ */
+
+namespace {
+
+const char INDEX_ID[] = "FTIX";
+const char INST_HEADER[] = "FTI";
+
+const unsigned int MAX_FILE_SIZE = 0x100000;
+
+// Bounds checked reader for files in memory
+class CMemoryReader
+{
+public:
+	CMemoryReader(const std::vector<unsigned char> &Data) : m_Data(Data), m_iPos(0), m_bError(false) {}
+
+	bool Read(void *pBuffer, unsigned int Count) {
+		if (m_bError || Count > m_Data.size() - m_iPos) {
+			m_bError = true;
+			return false;
+		}
+		if (Count > 0)
+			memcpy(pBuffer, &m_Data[m_iPos], Count);
+		m_iPos += Count;
+		return true;
+	}
+
+	void Skip(unsigned int Count) {
+		if (m_bError || Count > m_Data.size() - m_iPos)
+			m_bError = true;
+		else
+			m_iPos += Count;
+	}
+
+	unsigned char ReadChar() {
+		unsigned char Value = 0;
+		Read(&Value, 1);
+		return Value;
+	}
+
+	int ReadInt() {
+		int Value = 0;
+		Read(&Value, sizeof(int));
+		return Value;
+	}
+
+	ULONGLONG ReadInt64() {
+		ULONGLONG Value = 0;
+		Read(&Value, sizeof(ULONGLONG));
+		return Value;
+	}
+
+	bool IsError() const {
+		return m_bError;
+	}
+
+private:
+	const std::vector<unsigned char> &m_Data;
+	unsigned int m_iPos;
+	bool m_bError;
+};
+
+// Sorts entry indices by instrument name
+struct CompareName {
+	const std::vector<stInstrumentInfo> *pEntries;
+	bool operator()(int First, int Second) const {
+		return _stricmp((*pEntries)[First].Name, (*pEntries)[Second].Name) < 0;
+	}
+};
+
+bool ReadFileData(LPCTSTR pFile, std::vector<unsigned char> &Data)
+{
+	CFile File;
+
+	if (!File.Open(pFile, CFile::modeRead | CFile::shareDenyWrite))
+		return false;
+
+	ULONGLONG Length = File.GetLength();
+
+	if (Length > MAX_FILE_SIZE) {
+		File.Close();
+		return false;
+	}
+
+	Data.resize((size_t)Length);
+
+	UINT Count = (Length > 0) ? File.Read(&Data.front(), (UINT)Length) : 0;
+
+	File.Close();
+
+	return Count == Length;
+}
+
+void WriteString(CFile &File, const CString &String)
+{
+	int Length = String.GetLength();
+	File.Write(&Length, sizeof(int));
+	File.Write((LPCTSTR)String, Length * sizeof(TCHAR));
+}
+
+bool ReadString(CMemoryReader &Reader, CString &String)
+{
+	unsigned int Length = Reader.ReadInt();
+
+	if (Length > MAX_PATH * 4)
+		return false;
+
+	std::vector<TCHAR> Buffer(Length + 1);
+	Reader.Read(&Buffer.front(), Length * sizeof(TCHAR));
+	Buffer[Length] = 0;
+	String = &Buffer.front();
+
+	return !Reader.IsError();
+}
+
+void ReadSequences(CMemoryReader &Reader, stInstrumentInfo &Info, int iVersion)
+{
+	// 2A03, VRC6 and N163 sequences
+	unsigned char SeqCount = Reader.ReadChar();
+
+	for (unsigned int i = 0; i < SeqCount && !Reader.IsError(); ++i) {
+		if (Reader.ReadChar() != 1)
+			continue;
+		int Count = Reader.ReadInt();
+		if (Count < 0 || Count > MAX_SEQUENCE_ITEMS) {
+			Reader.Skip(MAX_FILE_SIZE);
+			return;
+		}
+		if (Info.Type != INST_N163 && iVersion < 20) {
+			// Length and value pairs
+			Reader.Skip(Count * 2);
+		}
+		else {
+			// Loop, release and setting
+			Reader.Skip(4);
+			if (Info.Type == INST_N163 || iVersion > 20)
+				Reader.Skip(4);
+			if (Info.Type == INST_N163 || iVersion >= (Info.Type == INST_VRC6 ? 22 : 23))
+				Reader.Skip(4);
+			Reader.Skip(Count);
+		}
+		if (Count > 0 && i < 32)
+			Info.SeqMask |= 1 << i;
+		Info.SeqItems += Count;
+	}
+}
+
+}
+
+CInstrumentLibrary::CInstrumentLibrary() :
+	m_iRevision(0),
+	m_bIndexLoaded(false),
+	m_pThread(NULL),
+	m_bRunning(false),
+	m_bRescan(false),
+	m_bStop(false)
+{
+}
+
+CInstrumentLibrary::~CInstrumentLibrary()
+{
+	m_bStop = true;
+
+	if (m_pThread != NULL) {
+		::WaitForSingleObject(m_pThread->m_hThread, INFINITE);
+		delete m_pThread;
+	}
+}
+
+void CInstrumentLibrary::Update(const CString &Root)
+{
+	// Called from main thread, starts the worker or tells it to scan again when done
+
+	m_csEntries.Lock();
+	bool bRunning = m_bRunning;
+	m_strRoot = Root;
+	m_strRoot.TrimRight(_T('\\'));
+	if (bRunning)
+		m_bRescan = true;
+	else
+		m_bRunning = true;
+	m_csEntries.Unlock();
+
+	if (bRunning)
+		return;
+
+	// The previous worker has finished
+	if (m_pThread != NULL) {
+		::WaitForSingleObject(m_pThread->m_hThread, INFINITE);
+		delete m_pThread;
+	}
+
+	m_pThread = AfxBeginThread(&ThreadProcFunc, (LPVOID)this, THREAD_PRIORITY_BELOW_NORMAL, 0, CREATE_SUSPENDED);
+
+	if (m_pThread == NULL) {
+		m_bRunning = false;
+		return;
+	}
+
+	m_pThread->m_bAutoDelete = FALSE;
+	m_pThread->ResumeThread();
+}
+
+bool CInstrumentLibrary::IsUpdating() const
+{
+	return m_bRunning;
+}
+
+unsigned int CInstrumentLibrary::GetRevision() const
+{
+	return m_iRevision;
+}
+
+void CInstrumentLibrary::GetEntries(std::vector<stInstrumentInfo> &Entries) const
+{
+	CSingleLock Lock(&m_csEntries, TRUE);
+	Entries = m_vEntries;
+}
+
+void CInstrumentLibrary::FindByPrefix(LPCSTR pPrefix, std::vector<stInstrumentInfo> &Entries) const
+{
+	// Case insensitive search on instrument names
+
+	CSingleLock Lock(&m_csEntries, TRUE);
+
+	const size_t Length = strlen(pPrefix);
+
+	// Find first name not less than the prefix
+	unsigned int Low = 0;
+	unsigned int High = m_vNameOrder.size();
+
+	while (Low < High) {
+		unsigned int Mid = (Low + High) / 2;
+		if (_strnicmp(m_vEntries[m_vNameOrder[Mid]].Name, pPrefix, Length) < 0)
+			Low = Mid + 1;
+		else
+			High = Mid;
+	}
+
+	Entries.clear();
+
+	for (unsigned int i = Low; i < m_vNameOrder.size(); ++i) {
+		const stInstrumentInfo &Info = m_vEntries[m_vNameOrder[i]];
+		if (_strnicmp(Info.Name, pPrefix, Length) != 0)
+			break;
+		Entries.push_back(Info);
+	}
+
+	std::sort(Entries.begin(), Entries.end(), ComparePath);
+}
+
+void CInstrumentLibrary::FindByType(int Type, std::vector<stInstrumentInfo> &Entries) const
+{
+	CSingleLock Lock(&m_csEntries, TRUE);
+
+	Entries.clear();
+
+	if (Type < 0 || Type >= TYPE_COUNT)
+		return;
+
+	for (std::vector<int>::const_iterator it = m_vTypeEntries[Type].begin(); it != m_vTypeEntries[Type].end(); ++it)
+		Entries.push_back(m_vEntries[*it]);
+}
+
+UINT CInstrumentLibrary::ThreadProcFunc(LPVOID pParam)
+{
+	CInstrumentLibrary *pLibrary = reinterpret_cast<CInstrumentLibrary*>(pParam);
+
+	for (;;) {
+		pLibrary->UpdateIndex();
+
+		CSingleLock Lock(&pLibrary->m_csEntries, TRUE);
+		if (!pLibrary->m_bRescan || pLibrary->m_bStop) {
+			pLibrary->m_bRunning = false;
+			break;
+		}
+		pLibrary->m_bRescan = false;
+	}
+
+	return 0;
+}
+
+void CInstrumentLibrary::UpdateIndex()
+{
+	// Runs on the worker thread, which is the only one changing the entries
+
+	if (!m_bIndexLoaded) {
+		LoadIndex();
+		m_bIndexLoaded = true;
+	}
+
+	m_csEntries.Lock();
+	CString Root = m_strRoot;
+	m_csEntries.Unlock();
+
+	std::vector<stInstrumentInfo> Entries;
+	unsigned int Reused = 0;
+
+	if (!Root.IsEmpty())
+		ScanDirectory(Root, 0, Entries, Reused);
+
+	if (m_bStop)
+		return;
+
+	// Nothing added, changed or removed
+	if (Reused == Entries.size() && Entries.size() == m_vEntries.size())
+		return;
+
+	std::sort(Entries.begin(), Entries.end(), ComparePath);
+
+	m_csEntries.Lock();
+	m_vEntries.swap(Entries);
+	BuildQueryTables();
+	++m_iRevision;
+	m_csEntries.Unlock();
+
+	SaveIndex();
+
+	TRACE(_T("Library: %i instruments, %i files read\n"), m_vEntries.size(), m_vEntries.size() - Reused);
+}
+
+void CInstrumentLibrary::ScanDirectory(const CString &Path, int Level, std::vector<stInstrumentInfo> &Entries, unsigned int &Reused) const
+{
+	CFileFind fileFinder;
+
+	if (Level > RECURSION_LIMIT)
+		return;
+
+	BOOL working = fileFinder.FindFile(Path + _T("\\*.*"));
+
+	while (working && !m_bStop) {
+		working = fileFinder.FindNextFile();
+
+		if (fileFinder.IsDots() || fileFinder.IsHidden())
+			continue;
+
+		if (fileFinder.IsDirectory()) {
+			ScanDirectory(fileFinder.GetFilePath(), Level + 1, Entries, Reused);
+			continue;
+		}
+
+		if (fileFinder.GetFileName().Right(4).CompareNoCase(_T(".fti")))
+			continue;
+
+		FILETIME Time;
+		fileFinder.GetLastWriteTime(&Time);
+
+		stInstrumentInfo Info = stInstrumentInfo();
+		Info.Path = fileFinder.GetFilePath();
+		Info.Size = fileFinder.GetLength();
+		Info.WriteTime = ((ULONGLONG)Time.dwHighDateTime << 32) | Time.dwLowDateTime;
+
+		const stInstrumentInfo *pOld = FindEntry(Info.Path);
+
+		if (pOld != NULL && pOld->Size == Info.Size && pOld->WriteTime == Info.WriteTime) {
+			Entries.push_back(*pOld);
+			++Reused;
+		}
+		else {
+			ReadInstrument(Info);
+			Entries.push_back(Info);
+		}
+	}
+}
+
+const stInstrumentInfo *CInstrumentLibrary::FindEntry(const CString &Path) const
+{
+	stInstrumentInfo Key;
+	Key.Path = Path;
+
+	std::vector<stInstrumentInfo>::const_iterator it = std::lower_bound(m_vEntries.begin(), m_vEntries.end(), Key, ComparePath);
+
+	if (it != m_vEntries.end() && !it->Path.CompareNoCase(Path))
+		return &*it;
+
+	return NULL;
+}
+
+void CInstrumentLibrary::BuildQueryTables()
+{
+	m_vNameOrder.resize(m_vEntries.size());
+
+	for (int i = 0; i < TYPE_COUNT; ++i)
+		m_vTypeEntries[i].clear();
+
+	for (unsigned int i = 0; i < m_vEntries.size(); ++i) {
+		m_vNameOrder[i] = i;
+		if (m_vEntries[i].bValid && m_vEntries[i].Type < TYPE_COUNT)
+			m_vTypeEntries[m_vEntries[i].Type].push_back(i);
+	}
+
+	CompareName Compare;
+	Compare.pEntries = &m_vEntries;
+	std::sort(m_vNameOrder.begin(), m_vNameOrder.end(), Compare);
+}
+
+bool CInstrumentLibrary::ComparePath(const stInstrumentInfo &First, const stInstrumentInfo &Second)
+{
+	return First.Path.CompareNoCase(Second.Path) < 0;
+}
+
+void CInstrumentLibrary::ReadInstrument(stInstrumentInfo &Info)
+{
+	// Reads the summary of an instrument file, bValid is cleared if it can't be loaded
+
+	std::vector<unsigned char> Data;
+
+	Info.bValid = false;
+
+	if (!ReadFileData(Info.Path, Data))
+		return;
+
+	CMemoryReader Reader(Data);
+
+	// Signature
+	char Text[256];
+	memset(Text, 0, sizeof(Text));
+	Reader.Read(Text, (UINT)strlen(INST_HEADER));
+
+	if (strcmp(Text, INST_HEADER) != 0)
+		return;
+
+	// Version
+	memset(Text, 0, sizeof(Text));
+	Reader.Read(Text, 3);
+
+	int iInstMaj = 0, iInstMin = 0;
+	sscanf(Text, "%i.%i", &iInstMaj, &iInstMin);
+	int iVersion = iInstMaj * 10 + iInstMin;
+
+	if (iVersion > MAX_FILE_VERSION)
+		return;
+
+	// Type
+	Info.Type = Reader.ReadChar();
+
+	if (Info.Type == INST_NONE)
+		Info.Type = INST_2A03;
+
+	// Name
+	unsigned int NameLen = Reader.ReadInt();
+
+	if (NameLen >= 256)
+		return;
+
+	Reader.Read(Text, NameLen);
+	Text[NameLen] = 0;
+	Info.Name = Text;
+
+	switch (Info.Type) {
+		case INST_2A03: {
+				ReadSequences(Reader, Info, iVersion);
+				// Note assignments
+				unsigned int Count = Reader.ReadInt();
+				Reader.Skip(Count * (iVersion >= 24 ? 4 : 3));
+				// Samples
+				Info.SampleCount = Reader.ReadInt();
+				for (unsigned int i = 0; i < Info.SampleCount && !Reader.IsError(); ++i) {
+					Reader.Skip(4);
+					Reader.Skip(Reader.ReadInt());
+					unsigned int Size = Reader.ReadInt();
+					Reader.Skip(Size);
+					Info.SampleBytes += Size;
+				}
+			}
+			break;
+		case INST_VRC6:
+			ReadSequences(Reader, Info, iVersion);
+			break;
+		case INST_N163: {
+				ReadSequences(Reader, Info, iVersion);
+				unsigned int WaveSize = Reader.ReadInt();
+				Reader.Skip(4);
+				unsigned int WaveCount = Reader.ReadInt();
+				if (WaveSize > CInstrumentN163::MAX_WAVE_SIZE || WaveCount > CInstrumentN163::MAX_WAVE_COUNT)
+					return;
+				Info.WaveBytes = WaveSize * WaveCount;
+				Reader.Skip(Info.WaveBytes);
+			}
+			break;
+		case INST_FDS:
+			// Wave, modulation table and parameters
+			Reader.Skip(CInstrumentFDS::WAVE_SIZE + CInstrumentFDS::MOD_SIZE + 3 * 4);
+			Info.WaveBytes = CInstrumentFDS::WAVE_SIZE;
+			// Volume, arpeggio and pitch
+			for (int i = 0; i < 3; ++i) {
+				unsigned int Count = Reader.ReadInt();
+				if (Count > MAX_SEQUENCE_ITEMS)
+					return;
+				Reader.Skip(3 * 4 + Count);
+				if (Count > 0)
+					Info.SeqMask |= 1 << i;
+				Info.SeqItems += Count;
+			}
+			break;
+		case INST_VRC7:
+			// Patch and custom registers
+			Reader.Skip(4 + 8);
+			break;
+		default:
+			// Not supported by the loader
+			return;
+	}
+
+	Info.bValid = !Reader.IsError();
+}
+
+CString CInstrumentLibrary::GetIndexFile()
+{
+	TCHAR Path[MAX_PATH];
+
+	if (FAILED(SHGetFolderPath(NULL, CSIDL_LOCAL_APPDATA | CSIDL_FLAG_CREATE, NULL, SHGFP_TYPE_CURRENT, Path)))
+		return CString();
+
+	CString File(Path);
+	File += _T("\\FamiTracker");
+	CreateDirectory(File, NULL);
+
+	return File + _T("\\InstrumentIndex.dat");
+}
+
+bool CInstrumentLibrary::LoadIndex()
+{
+	std::vector<unsigned char> Data;
+	CString File = GetIndexFile();
+
+	if (File.IsEmpty() || !ReadFileData(File, Data))
+		return false;
+
+	CMemoryReader Reader(Data);
+
+	char Id[4];
+	Reader.Read(Id, 4);
+
+	if (memcmp(Id, INDEX_ID, 4) != 0 || Reader.ReadInt() != INDEX_VERSION || Reader.ReadInt() != sizeof(TCHAR))
+		return false;
+
+	unsigned int Count = Reader.ReadInt();
+
+	std::vector<stInstrumentInfo> Entries;
+
+	for (unsigned int i = 0; i < Count && !Reader.IsError(); ++i) {
+		stInstrumentInfo Info = stInstrumentInfo();
+		if (!ReadString(Reader, Info.Path))
+			return false;
+		Info.Size = Reader.ReadInt64();
+		Info.WriteTime = Reader.ReadInt64();
+		Info.bValid = Reader.ReadChar() != 0;
+		Info.Type = Reader.ReadChar();
+		unsigned int NameLen = Reader.ReadInt();
+		if (NameLen >= 256)
+			return false;
+		char Name[256];
+		Reader.Read(Name, NameLen);
+		Name[NameLen] = 0;
+		Info.Name = Name;
+		Info.SeqMask = Reader.ReadInt();
+		Info.SeqItems = Reader.ReadInt();
+		Info.WaveBytes = Reader.ReadInt();
+		Info.SampleCount = Reader.ReadInt();
+		Info.SampleBytes = Reader.ReadInt();
+		Entries.push_back(Info);
+	}
+
+	if (Reader.IsError())
+		return false;
+
+	std::sort(Entries.begin(), Entries.end(), ComparePath);
+
+	m_csEntries.Lock();
+	m_vEntries.swap(Entries);
+	BuildQueryTables();
+	++m_iRevision;
+	m_csEntries.Unlock();
+
+	return true;
+}
+
+bool CInstrumentLibrary::SaveIndex() const
+{
+	// The index is written to a temporary file first, an interrupted write keeps the old index
+
+	CString File = GetIndexFile();
+	CString TempFile = File + _T(".new");
+	CFile IndexFile;
+
+	if (File.IsEmpty() || !IndexFile.Open(TempFile, CFile::modeCreate | CFile::modeWrite))
+		return false;
+
+	int Version = INDEX_VERSION;
+	int CharSize = sizeof(TCHAR);
+	int Count = m_vEntries.size();
+
+	IndexFile.Write(INDEX_ID, 4);
+	IndexFile.Write(&Version, sizeof(int));
+	IndexFile.Write(&CharSize, sizeof(int));
+	IndexFile.Write(&Count, sizeof(int));
+
+	for (std::vector<stInstrumentInfo>::const_iterator it = m_vEntries.begin(); it != m_vEntries.end(); ++it) {
+		WriteString(IndexFile, it->Path);
+		IndexFile.Write(&it->Size, sizeof(ULONGLONG));
+		IndexFile.Write(&it->WriteTime, sizeof(ULONGLONG));
+		unsigned char Flags[2];
+		Flags[0] = it->bValid ? 1 : 0;
+		Flags[1] = it->Type;
+		IndexFile.Write(Flags, 2);
+		int NameLen = it->Name.GetLength();
+		IndexFile.Write(&NameLen, sizeof(int));
+		IndexFile.Write((LPCSTR)it->Name, NameLen);
+		unsigned int Values[] = {it->SeqMask, it->SeqItems, it->WaveBytes, it->SampleCount, it->SampleBytes};
+		IndexFile.Write(Values, sizeof(Values));
+	}
+
+	IndexFile.Close();
+
+	return MoveFileEx(TempFile, File, MOVEFILE_REPLACE_EXISTING) != 0;
+}
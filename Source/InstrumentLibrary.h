@@ -0,0 +1,94 @@
+/*
+** FamiTracker - NES/Famicom sound tracker
+** Copyright (C) 2005-2014  Jonathan Liss
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+*/
+
+#pragma once
+
+// Summary of one instrument file
+struct stInstrumentInfo {
+	CString		 Path;
+	ULONGLONG	 Size;
+	ULONGLONG	 WriteTime;
+	bool		 bValid;				// File could be read
+	unsigned char Type;					// inst_type_t
+	CStringA	 Name;
+	unsigned int SeqMask;				// Bit set for each used sequence
+	unsigned int SeqItems;				// Items in all sequences
+	unsigned int WaveBytes;				// FDS and N163 wave data
+	unsigned int SampleCount;			// DPCM samples
+	unsigned int SampleBytes;
+};
+
+// Index of instrument files below a folder, kept on disk and updated on a worker thread
+class CInstrumentLibrary
+{
+public:
+	CInstrumentLibrary();
+	~CInstrumentLibrary();
+
+	void Update(const CString &Root);
+	bool IsUpdating() const;
+	unsigned int GetRevision() const;
+
+	// Queries, results are sorted by path
+	void GetEntries(std::vector<stInstrumentInfo> &Entries) const;
+	void FindByPrefix(LPCSTR pPrefix, std::vector<stInstrumentInfo> &Entries) const;
+	void FindByType(int Type, std::vector<stInstrumentInfo> &Entries) const;
+
+public:
+	static const int RECURSION_LIMIT = 6;
+
+private:
+	static const unsigned int INDEX_VERSION = 1;
+	static const int MAX_FILE_VERSION = 24;		// Same as INST_VERSION in the document
+	static const int TYPE_COUNT = 8;
+
+private:
+	void UpdateIndex();
+	void ScanDirectory(const CString &Path, int Level, std::vector<stInstrumentInfo> &Entries, unsigned int &Reused) const;
+	const stInstrumentInfo *FindEntry(const CString &Path) const;
+	void BuildQueryTables();
+
+	bool LoadIndex();
+	bool SaveIndex() const;
+	static CString GetIndexFile();
+
+	static void ReadInstrument(stInstrumentInfo &Info);
+	static UINT ThreadProcFunc(LPVOID pParam);
+
+	static bool ComparePath(const stInstrumentInfo &First, const stInstrumentInfo &Second);
+
+private:
+	// Entries are sorted by path and only replaced by the worker thread
+	std::vector<stInstrumentInfo> m_vEntries;
+	std::vector<int>	m_vNameOrder;				// Entries sorted by name
+	std::vector<int>	m_vTypeEntries[TYPE_COUNT];
+
+	CString				m_strRoot;
+	volatile unsigned int m_iRevision;
+	bool				m_bIndexLoaded;
+
+	// Worker thread state, guarded by m_csEntries
+	CWinThread			*m_pThread;
+	volatile bool		m_bRunning;
+	bool				m_bRescan;
+	volatile bool		m_bStop;
+
+	mutable CCriticalSection m_csEntries;
+};
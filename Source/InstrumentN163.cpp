@@ -267,9 +267,7 @@ int CInstrumentN163::Compile(CFamiTrackerDoc *pDoc, CChunk *pChunk, int Index)
 	StoredBytes += 2;
 
 	// Store reference to wave
-	CStringA waveLabel;
-	waveLabel.Format(CCompiler::LABEL_WAVES, Index);
-	pChunk->StoreReference(waveLabel);
+	pChunk->StoreReference(SYMBOL_WAVES, Index);
 	StoredBytes += 2;
 
 	// Store sequences
@@ -282,9 +280,7 @@ int CInstrumentN163::Compile(CFamiTrackerDoc *pDoc, CChunk *pChunk, int Index)
 
 	for (int i = 0; i < SEQUENCE_COUNT; ++i) {
 		if (GetSeqEnable(i) != 0 && (pDoc->GetSequence(SNDCHIP_N163, GetSeqIndex(i), i)->GetItemCount() != 0)) {
-			CStringA str;
-			str.Format(CCompiler::LABEL_SEQ_N163, GetSeqIndex(i) * SEQUENCE_COUNT + i);
-			pChunk->StoreReference(str);
+			pChunk->StoreReference(SYMBOL_SEQ_N163, GetSeqIndex(i) * SEQUENCE_COUNT + i);
 			StoredBytes += 2;
 		}
 	}
@@ -188,9 +188,7 @@ int CInstrumentVRC6::Compile(CFamiTrackerDoc *pDoc, CChunk *pChunk, int Index)
 
 	for (int i = 0; i < SEQUENCE_COUNT; ++i) {
 		if (GetSeqEnable(i) != 0 && (pDoc->GetSequence(SNDCHIP_VRC6, GetSeqIndex(i), i)->GetItemCount() != 0)) {
-			CStringA str;
-			str.Format(CCompiler::LABEL_SEQ_VRC6, GetSeqIndex(i) * SEQUENCE_COUNT + i);
-			pChunk->StoreReference(str);
+			pChunk->StoreReference(SYMBOL_SEQ_VRC6, GetSeqIndex(i) * SEQUENCE_COUNT + i);
 			StoredBytes += 2;
 		}
 	}
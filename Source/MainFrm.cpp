@@ -50,6 +50,7 @@
 #include "PatternEditor.h"
 #include "FrameEditor.h"
 #include "APU/APU.h"
+#include "RenderService.h"
 
 #ifdef _DEBUG
 #define new DEBUG_NEW
@@ -74,7 +75,9 @@ static UINT indicators[] =
 enum {
 	TMR_WELCOME, 
 	TMR_AUDIO_CHECK, 
-	TMR_AUTOSAVE
+	TMR_AUTOSAVE,
+	TMR_RENDER,
+	TMR_RENDER_EXIT
 };
 
 // Repeat config
@@ -124,6 +127,7 @@ CMainFrame::CMainFrame() :
 	m_pActionHandler(NULL),
 	m_iFrameEditorPos(FRAME_EDIT_POS_TOP),
 	m_pInstrumentFileTree(NULL),
+	m_pRenderService(new CRenderService()),
 	m_iInstrument(0),
 	m_iTrack(0),
 	m_iOctave(3)
@@ -148,6 +152,7 @@ CMainFrame::~CMainFrame()
 	SAFE_RELEASE(m_pVisualizerWnd);
 	SAFE_RELEASE(m_pActionHandler);
 	SAFE_RELEASE(m_pInstrumentFileTree);
+	SAFE_RELEASE(m_pRenderService);
 }
 
 BEGIN_MESSAGE_MAP(CMainFrame, CFrameWnd)
@@ -177,6 +182,7 @@ BEGIN_MESSAGE_MAP(CMainFrame, CFrameWnd)
 	ON_COMMAND(ID_CLEANUP_REMOVEUNUSEDINSTRUMENTS, OnEditRemoveUnusedInstruments)
 	ON_COMMAND(ID_CLEANUP_REMOVEUNUSEDPATTERNS, OnEditRemoveUnusedPatterns)
 	ON_COMMAND(ID_CLEANUP_MERGEDUPLICATEDPATTERNS, OnEditMergeDuplicatedPatterns)
+	ON_COMMAND(ID_CLEANUP_ALL, OnEditCleanupAll)
 	ON_COMMAND(ID_INSTRUMENT_NEW, OnAddInstrument)
 	ON_COMMAND(ID_INSTRUMENT_REMOVE, OnRemoveInstrument)
 	ON_COMMAND(ID_INSTRUMENT_CLONE, OnCloneInstrument)
@@ -359,9 +365,11 @@ int CMainFrame::OnCreate(LPCREATESTRUCT lpCreateStruct)
 	SetTimer(TMR_AUDIO_CHECK, 500, NULL);
 
 	// Auto save
-#ifdef AUTOSAVE
 	SetTimer(TMR_AUTOSAVE, 1000, NULL);
-#endif
+
+	// The render server exits if no request arrives
+	if (theApp.IsRenderServer())
+		SetTimer(TMR_RENDER_EXIT, CRenderService::SERVER_IDLE_TIMEOUT, NULL);
 
 	m_wndOctaveBar.CheckDlgButton(IDC_FOLLOW, theApp.GetSettings()->FollowMode);
 	m_wndOctaveBar.SetDlgItemInt(IDC_HIGHLIGHT1, CFamiTrackerDoc::DEFAULT_FIRST_HIGHLIGHT, 0);
@@ -1576,17 +1584,29 @@ void CMainFrame::OnTimer(UINT nIDEvent)
 		case TMR_AUDIO_CHECK:
 			CheckAudioStatus();
 			break;
-#ifdef AUTOSAVE
 		// Auto save
 		case TMR_AUTOSAVE: {
-			/*
 				CFamiTrackerDoc *pDoc = dynamic_cast<CFamiTrackerDoc*>(GetActiveDocument());
 				if (pDoc != NULL)
 					pDoc->AutoSave();
-					*/
 			}
 			break;
-#endif
+		// Render requests
+		case TMR_RENDER:
+			m_pRenderService->Poll();
+			if (m_pRenderService->IsIdle()) {
+				KillTimer(TMR_RENDER);
+				SetTimer(TMR_RENDER_EXIT, CRenderService::SERVER_IDLE_TIMEOUT, NULL);
+			}
+			break;
+		// Idle render server
+		case TMR_RENDER_EXIT:
+			KillTimer(TMR_RENDER_EXIT);
+			if (m_pRenderService->IsIdle()) {
+				theApp.UnregisterSingleInstance();
+				PostMessage(WM_CLOSE);
+			}
+			break;
 	}
 
 	CFrameWnd::OnTimer(nIDEvent);
@@ -2133,7 +2153,7 @@ void CMainFrame::OnDestroy()
 		pSoundGen->SetVisualizerWindow(NULL);
 		// Kill the sound interface since the main window is being destroyed
 		CEvent *pSoundEvent = new CEvent(FALSE, FALSE);
-		pSoundGen->PostThreadMessage(WM_USER_CLOSE_SOUND, (WPARAM)pSoundEvent, NULL);
+		pSoundGen->PostCommand(CMD_CLOSE_SOUND, (WPARAM)pSoundEvent, NULL);
 		// Wait for sound to close
 		DWORD dwResult = ::WaitForSingleObject(pSoundEvent->m_hObject, CSoundGen::AUDIO_TIMEOUT + 1000);
 
@@ -2325,11 +2345,28 @@ BOOL CMainFrame::OnCopyData(CWnd* pWnd, COPYDATASTRUCT* pCopyDataStruct)
 				!CFamiTrackerDoc::GetDoc()->HasLastLoadFailed())
 				theApp.GetSoundGenerator()->StartPlayer(MODE_PLAY_START, 0);
 			return TRUE;
+		case IPC_RENDER:
+			// Render to wave file, only the render server takes requests
+			if (!theApp.IsRenderServer())
+				return FALSE;
+			return QueueRender((LPCTSTR)pCopyDataStruct->lpData) ? TRUE : FALSE;
 	}
 
 	return CFrameWnd::OnCopyData(pWnd, pCopyDataStruct);
 }
 
+bool CMainFrame::QueueRender(LPCTSTR pRequest)
+{
+	if (!m_pRenderService->QueueRequest(pRequest))
+		return false;
+
+	// Requests are started and finished by the timer
+	KillTimer(TMR_RENDER_EXIT);
+	SetTimer(TMR_RENDER, 100, NULL);
+
+	return true;
+}
+
 bool CMainFrame::AddAction(CAction *pAction)
 {
 	ASSERT(m_pActionHandler != NULL);
@@ -2539,6 +2576,27 @@ void CMainFrame::OnEditMergeDuplicatedPatterns()
 	AddAction(new CFrameAction(CFrameAction::ACT_MERGE_DUPLICATED_PATTERNS));
 }
 
+void CMainFrame::OnEditCleanupAll()
+{
+	// Merges duplicated patterns and removes everything unused in one pass
+
+	CFamiTrackerDoc *pDoc = static_cast<CFamiTrackerDoc*>(GetActiveDocument());
+
+	if (AfxMessageBox(IDS_CLEANUP_ALL, MB_YESNO | MB_ICONINFORMATION) == IDNO)
+		return;
+
+	// Current instrument might disappear
+	CloseInstrumentEditor();
+
+	pDoc->CleanupModule(CLEANUP_ALL);
+
+	// Frame actions can't be undone after the patterns have changed
+	ResetUndo();
+
+	pDoc->UpdateAllViews(NULL, UPDATE_FRAME);
+	pDoc->UpdateAllViews(NULL, UPDATE_INSTRUMENT);
+}
+
 void CMainFrame::OnUpdateSelectionEnabled(CCmdUI *pCmdUI)
 {
 	CFamiTrackerView *pView	= static_cast<CFamiTrackerView*>(GetActiveView());
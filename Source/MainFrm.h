@@ -44,6 +44,7 @@ class CInstrumentFileTree;
 class CAction;
 class CActionHandler;
 class CFrameEditor;
+class CRenderService;
 
 class CMainFrame : public CFrameWnd
 {
@@ -95,6 +96,9 @@ public:
 
 	bool	ChangeAllPatterns() const;
 
+	// Render requests
+	bool	QueueRender(LPCTSTR pRequest);
+
 // Overrides
 public:
 
@@ -174,6 +178,8 @@ private:  // control bar embedded members
 
 	CInstrumentFileTree	*m_pInstrumentFileTree;
 
+	CRenderService		*m_pRenderService;
+
 	// State variables
 	int					m_iOctave;					// Selected octave
 	int					m_iInstrument;				// Selected instrument
@@ -317,6 +323,7 @@ public:
 	afx_msg void OnEditRemoveUnusedInstruments();
 	afx_msg void OnEditRemoveUnusedPatterns();
 	afx_msg void OnEditMergeDuplicatedPatterns();
+	afx_msg void OnEditCleanupAll();
 	afx_msg void OnEditEnableMIDI();
 	afx_msg void OnUpdateEditUndo(CCmdUI *pCmdUI);
 	afx_msg void OnUpdateEditRedo(CCmdUI *pCmdUI);
@@ -0,0 +1,386 @@
+/*
+** FamiTracker - NES/Famicom sound tracker
+** Copyright (C) 2005-2014  Jonathan Liss
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+*/
+
+#include <vector>
+#include "stdafx.h"
+#include "FamiTracker.h"
+#include "FamiTrackerDoc.h"
+#include "Compiler.h"
+#include "ModuleAnalyzer.h"
+
+/*
+ * Module analyzer
+ *
+ * Modules are loaded in batches on the main thread since the document registers channels
+ * with the sound generator when loading. While the worker threads analyze one batch the
+ * main thread loads the next one. The compiler size pass is serialized since the active
+ * compiler object is global.
+ *
+ */
+
+CCriticalSection CModuleAnalyzer::m_csCompiler;
+
+CModuleAnalyzer::CModuleAnalyzer() : m_iBatchSize(0), m_iBatchStart(0), m_iNextModule(0)
+{
+}
+
+CModuleAnalyzer::~CModuleAnalyzer()
+{
+}
+
+bool CModuleAnalyzer::Analyze(const CString &Input, const CString &Output)
+{
+	// Input is either a directory which is searched for modules or a text file with one module per line
+
+	m_vStats.clear();
+
+	DWORD Attributes = GetFileAttributes(Input);
+
+	if (Attributes != INVALID_FILE_ATTRIBUTES && (Attributes & FILE_ATTRIBUTE_DIRECTORY))
+		FindModules(Input, 0);
+	else if (!ReadFileList(Input))
+		return false;
+
+	// The sound generator keeps the first document created, this one is never deleted
+	CFamiTrackerDoc *pHostDoc = static_cast<CFamiTrackerDoc*>(RUNTIME_CLASS(CFamiTrackerDoc)->CreateObject());
+	if (pHostDoc == NULL)
+		return false;
+
+	SYSTEM_INFO SystemInfo;
+	GetSystemInfo(&SystemInfo);
+
+	int Threads = min((int)SystemInfo.dwNumberOfProcessors, MAXIMUM_WAIT_OBJECTS);
+	m_iBatchSize = Threads * BATCH_PER_THREAD;
+
+	std::vector<CFamiTrackerDoc*> Next;
+
+	LoadBatch(0, Next);
+
+	for (unsigned int Start = 0; Start < m_vStats.size(); Start += m_iBatchSize) {
+		m_vBatch.swap(Next);
+		m_iBatchStart = Start;
+		m_iNextModule = 0;
+
+		std::vector<CWinThread*> Workers;
+		std::vector<HANDLE> Handles;
+
+		// The main thread loads the next batch meanwhile
+		for (int i = 0; i < min(Threads, (int)m_vBatch.size()); ++i) {
+			CWinThread *pThread = AfxBeginThread(&ThreadProcFunc, (LPVOID)this, THREAD_PRIORITY_NORMAL, 0, CREATE_SUSPENDED);
+			if (pThread == NULL)
+				break;
+			pThread->m_bAutoDelete = FALSE;
+			pThread->ResumeThread();
+			Workers.push_back(pThread);
+			Handles.push_back(pThread->m_hThread);
+		}
+
+		LoadBatch(Start + m_iBatchSize, Next);
+
+		if (Handles.empty())
+			AnalyzeWorker();
+		else
+			::WaitForMultipleObjects(Handles.size(), &Handles[0], TRUE, INFINITE);
+
+		for (std::vector<CWinThread*>::iterator it = Workers.begin(); it != Workers.end(); ++it)
+			delete *it;
+
+		UnloadBatch(m_vBatch);
+	}
+
+	int nPos = Output.ReverseFind(TCHAR('.'));
+	if (nPos >= 0 && !Output.Mid(nPos).CompareNoCase(_T(".json")))
+		return WriteJSON(Output);
+
+	return WriteCSV(Output);
+}
+
+void CModuleAnalyzer::FindModules(const CString &Path, int Level)
+{
+	CFileFind fileFinder;
+
+	if (Level > RECURSION_LIMIT)
+		return;
+
+	BOOL working = fileFinder.FindFile(Path + _T("\\*.*"));
+
+	// Modules are listed in the order they are found, directories are scanned recursively
+	while (working) {
+		working = fileFinder.FindNextFile();
+
+		if (fileFinder.IsDots() || fileFinder.IsHidden())
+			continue;
+
+		if (fileFinder.IsDirectory()) {
+			FindModules(fileFinder.GetFilePath(), Level + 1);
+		}
+		else if (!fileFinder.GetFileName().Right(4).CompareNoCase(_T(".ftm"))) {
+			stModuleStats Stats = stModuleStats();
+			Stats.File = fileFinder.GetFilePath();
+			m_vStats.push_back(Stats);
+		}
+	}
+}
+
+bool CModuleAnalyzer::ReadFileList(const CString &File)
+{
+	CStdioFile ListFile;
+	CString Line;
+
+	if (!ListFile.Open(File, CFile::modeRead | CFile::typeText))
+		return false;
+
+	while (ListFile.ReadString(Line)) {
+		Line.Trim();
+		if (Line.IsEmpty())
+			continue;
+		stModuleStats Stats = stModuleStats();
+		Stats.File = Line;
+		m_vStats.push_back(Stats);
+	}
+
+	return true;
+}
+
+void CModuleAnalyzer::LoadBatch(unsigned int Start, std::vector<CFamiTrackerDoc*> &Batch)
+{
+	// Called from main thread, documents that fails to load are stored as NULL
+
+	const unsigned int Count = m_vStats.size();
+
+	Batch.clear();
+
+	for (unsigned int i = Start; i < Count && i < Start + m_iBatchSize; ++i) {
+		stModuleStats &Stats = m_vStats[i];
+
+		CFamiTrackerDoc *pDoc = static_cast<CFamiTrackerDoc*>(RUNTIME_CLASS(CFamiTrackerDoc)->CreateObject());
+
+		if (pDoc != NULL && !pDoc->OnOpenDocument(Stats.File)) {
+			TRACE(_T("Analyzer: Could not load %s\n"), (LPCTSTR)Stats.File);
+			delete pDoc;
+			pDoc = NULL;
+		}
+
+		CFileStatus Status;
+		if (CFile::GetStatus(Stats.File, Status))
+			Stats.FileSize = Status.m_size;
+
+		Stats.bLoaded = (pDoc != NULL);
+		Batch.push_back(pDoc);
+	}
+}
+
+void CModuleAnalyzer::UnloadBatch(std::vector<CFamiTrackerDoc*> &Batch)
+{
+	for (std::vector<CFamiTrackerDoc*>::iterator it = Batch.begin(); it != Batch.end(); ++it)
+		delete *it;
+
+	Batch.clear();
+}
+
+void CModuleAnalyzer::AnalyzeWorker()
+{
+	// Runs on the worker threads, each module is handled by one thread
+
+	const LONG Count = m_vBatch.size();
+
+	for (LONG i = InterlockedIncrement(&m_iNextModule) - 1; i < Count; i = InterlockedIncrement(&m_iNextModule) - 1) {
+		if (m_vBatch[i] != NULL)
+			AnalyzeModule(m_vBatch[i], m_vStats[m_iBatchStart + i]);
+	}
+}
+
+UINT CModuleAnalyzer::ThreadProcFunc(LPVOID pParam)
+{
+	CModuleAnalyzer *pAnalyzer = reinterpret_cast<CModuleAnalyzer*>(pParam);
+	pAnalyzer->AnalyzeWorker();
+	return 0;
+}
+
+void CModuleAnalyzer::AnalyzeModule(const CFamiTrackerDoc *pDoc, stModuleStats &Stats)
+{
+	Stats.Chip = pDoc->GetExpansionChip();
+	Stats.Machine = pDoc->GetMachine();
+	Stats.Channels = pDoc->GetAvailableChannels();
+	Stats.Tracks = pDoc->GetTrackCount();
+	Stats.Instruments = pDoc->GetInstrumentCount();
+	Stats.SampleBytes = pDoc->GetTotalSampleSize();
+
+	// Sequences
+	for (int i = 0; i < MAX_SEQUENCES; ++i) {
+		for (int j = 0; j < SEQ_COUNT; ++j) {
+			const CSequence *pSequences[] = {
+				pDoc->GetSequence(i, j),
+				pDoc->GetSequenceVRC6(i, j),
+				pDoc->GetSequenceN163(i, j),
+				pDoc->GetSequenceS5B(i, j)
+			};
+			for (int k = 0; k < sizeof(pSequences) / sizeof(CSequence*); ++k) {
+				if (pSequences[k] != NULL && pSequences[k]->GetItemCount() > 0)
+					++Stats.Sequences;
+			}
+		}
+	}
+
+	// Patterns and song length
+	for (unsigned int Track = 0; Track < Stats.Tracks; ++Track) {
+		const unsigned int PatternLength = pDoc->GetPatternLength(Track);
+
+		for (unsigned int Channel = 0; Channel < Stats.Channels; ++Channel) {
+			for (unsigned int Pattern = 0; Pattern < MAX_PATTERN; ++Pattern) {
+				unsigned int UsedRows = 0;
+				for (unsigned int Row = 0; Row < PatternLength; ++Row) {
+					if (!pDoc->IsCellFree(Track, Channel, Pattern, Row))
+						++UsedRows;
+				}
+				if (UsedRows > 0) {
+					++Stats.Patterns;
+					Stats.Rows += PatternLength;
+					Stats.UsedRows += UsedRows;
+				}
+			}
+		}
+
+		stSongLength Length;
+		pDoc->ScanSongLength(Track, Length);
+		Stats.Seconds += Length.IntroSeconds + Length.LoopSeconds;
+	}
+
+	// NSF size
+	m_csCompiler.Lock();
+
+	{
+		CCompiler Compiler(const_cast<CFamiTrackerDoc*>(pDoc), NULL);
+		stNSFSize Size;
+
+		if (Compiler.MeasureNSF(Size)) {
+			Stats.bCompiled = true;
+			Stats.DriverSize = Size.DriverSize;
+			Stats.MusicSize = Size.MusicSize;
+			Stats.SamplesSize = Size.SamplesSize;
+			Stats.NSFSize = Size.FileSize;
+			Stats.bBankswitched = Size.bBankswitched;
+		}
+	}
+
+	m_csCompiler.Unlock();
+}
+
+bool CModuleAnalyzer::WriteCSV(const CString &File) const
+{
+	CStdioFile OutFile;
+	CString Line;
+
+	if (!OutFile.Open(File, CFile::modeCreate | CFile::modeWrite | CFile::typeText))
+		return false;
+
+	OutFile.WriteString(_T("file,loaded,file_size,chips,machine,channels,tracks,instruments,sequences,patterns,rows,used_rows,density,dpcm_bytes,seconds,compiled,driver_size,music_size,samples_size,nsf_size,bankswitched\n"));
+
+	for (std::vector<stModuleStats>::const_iterator it = m_vStats.begin(); it != m_vStats.end(); ++it) {
+		CString Name = it->File;
+		Name.Replace(_T("\""), _T("\"\""));
+		Line.Format(_T("\"%s\",%i,%I64u"), (LPCTSTR)Name, it->bLoaded, it->FileSize);
+		OutFile.WriteString(Line);
+
+		// Columns of modules that failed to load or compile are left empty
+		if (it->bLoaded) {
+			Line.Format(_T(",%s,%s,%u,%u,%u,%u,%u,%u,%u,%.3f,%u,%.2f"),
+				(LPCTSTR)GetChipNames(it->Chip), it->Machine == PAL ? _T("PAL") : _T("NTSC"),
+				it->Channels, it->Tracks, it->Instruments, it->Sequences, it->Patterns, it->Rows, it->UsedRows,
+				it->Rows > 0 ? double(it->UsedRows) / double(it->Rows) : 0.0, it->SampleBytes, it->Seconds);
+			OutFile.WriteString(Line);
+		}
+		else
+			OutFile.WriteString(_T(",,,,,,,,,,,,"));
+
+		if (it->bCompiled) {
+			Line.Format(_T(",1,%u,%u,%u,%u,%i\n"), it->DriverSize, it->MusicSize, it->SamplesSize, it->NSFSize, it->bBankswitched);
+			OutFile.WriteString(Line);
+		}
+		else
+			OutFile.WriteString(_T(",0,,,,,\n"));
+	}
+
+	OutFile.Close();
+
+	return true;
+}
+
+bool CModuleAnalyzer::WriteJSON(const CString &File) const
+{
+	CStdioFile OutFile;
+	CString Line;
+
+	if (!OutFile.Open(File, CFile::modeCreate | CFile::modeWrite | CFile::typeText))
+		return false;
+
+	OutFile.WriteString(_T("[\n"));
+
+	for (std::vector<stModuleStats>::const_iterator it = m_vStats.begin(); it != m_vStats.end(); ++it) {
+		Line.Format(_T("  {\"file\": \"%s\", \"loaded\": %s, \"file_size\": %I64u"), (LPCTSTR)EscapeJSON(it->File), it->bLoaded ? _T("true") : _T("false"), it->FileSize);
+		OutFile.WriteString(Line);
+
+		if (it->bLoaded) {
+			Line.Format(_T(", \"chips\": \"%s\", \"machine\": \"%s\", \"channels\": %u, \"tracks\": %u, \"instruments\": %u, \"sequences\": %u")
+				_T(", \"patterns\": %u, \"rows\": %u, \"used_rows\": %u, \"density\": %.3f, \"dpcm_bytes\": %u, \"seconds\": %.2f"),
+				(LPCTSTR)GetChipNames(it->Chip), it->Machine == PAL ? _T("PAL") : _T("NTSC"), it->Channels, it->Tracks, it->Instruments, it->Sequences,
+				it->Patterns, it->Rows, it->UsedRows, it->Rows > 0 ? double(it->UsedRows) / double(it->Rows) : 0.0, it->SampleBytes, it->Seconds);
+			OutFile.WriteString(Line);
+		}
+
+		if (it->bCompiled) {
+			Line.Format(_T(", \"driver_size\": %u, \"music_size\": %u, \"samples_size\": %u, \"nsf_size\": %u, \"bankswitched\": %s"),
+				it->DriverSize, it->MusicSize, it->SamplesSize, it->NSFSize, it->bBankswitched ? _T("true") : _T("false"));
+			OutFile.WriteString(Line);
+		}
+
+		OutFile.WriteString((it + 1) != m_vStats.end() ? _T("},\n") : _T("}\n"));
+	}
+
+	OutFile.WriteString(_T("]\n"));
+	OutFile.Close();
+
+	return true;
+}
+
+CString CModuleAnalyzer::GetChipNames(unsigned char Chip)
+{
+	const unsigned char CHIPS[] = {SNDCHIP_VRC6, SNDCHIP_VRC7, SNDCHIP_FDS, SNDCHIP_MMC5, SNDCHIP_N163, SNDCHIP_S5B};
+	const LPCTSTR NAMES[] = {_T("VRC6"), _T("VRC7"), _T("FDS"), _T("MMC5"), _T("N163"), _T("5B")};
+
+	CString Names = _T("2A03");
+
+	for (int i = 0; i < sizeof(CHIPS); ++i) {
+		if (Chip & CHIPS[i]) {
+			Names += _T("+");
+			Names += NAMES[i];
+		}
+	}
+
+	return Names;
+}
+
+CString CModuleAnalyzer::EscapeJSON(const CString &Text)
+{
+	CString Escaped = Text;
+	Escaped.Replace(_T("\\"), _T("\\\\"));
+	Escaped.Replace(_T("\""), _T("\\\""));
+	return Escaped;
+}
@@ -0,0 +1,89 @@
+/*
+** FamiTracker - NES/Famicom sound tracker
+** Copyright (C) 2005-2014  Jonathan Liss
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+*/
+
+#pragma once
+
+class CFamiTrackerDoc;
+
+// Statistics collected for one module
+struct stModuleStats {
+	CString		 File;
+	bool		 bLoaded;
+	ULONGLONG	 FileSize;
+	unsigned char Chip;
+	unsigned int Machine;
+	unsigned int Channels;
+	unsigned int Tracks;
+	unsigned int Instruments;
+	unsigned int Sequences;			// Non-empty sequences of all chips
+	unsigned int Patterns;			// Non-empty patterns of all tracks
+	unsigned int Rows;				// Rows in those patterns
+	unsigned int UsedRows;			// Rows with any data
+	unsigned int SampleBytes;
+	double		 Seconds;			// Intro and one loop of all tracks
+	bool		 bCompiled;
+	unsigned int DriverSize;
+	unsigned int MusicSize;
+	unsigned int SamplesSize;
+	unsigned int NSFSize;
+	bool		 bBankswitched;
+};
+
+// Command line module analyzer, collects statistics from many modules to a CSV or JSON file
+class CModuleAnalyzer
+{
+public:
+	CModuleAnalyzer();
+	~CModuleAnalyzer();
+
+	bool Analyze(const CString &Input, const CString &Output);
+
+private:
+	void FindModules(const CString &Path, int Level);
+	bool ReadFileList(const CString &File);
+
+	void LoadBatch(unsigned int Start, std::vector<CFamiTrackerDoc*> &Batch);
+	void UnloadBatch(std::vector<CFamiTrackerDoc*> &Batch);
+	void AnalyzeWorker();
+	static void AnalyzeModule(const CFamiTrackerDoc *pDoc, stModuleStats &Stats);
+	static UINT ThreadProcFunc(LPVOID pParam);
+
+	bool WriteCSV(const CString &File) const;
+	bool WriteJSON(const CString &File) const;
+
+	static CString GetChipNames(unsigned char Chip);
+	static CString EscapeJSON(const CString &Text);
+
+private:
+	static const int RECURSION_LIMIT = 16;
+	static const unsigned int BATCH_PER_THREAD = 2;		// Modules loaded at once per worker thread
+
+private:
+	std::vector<stModuleStats> m_vStats;
+
+	// Batch being analyzed by the worker threads
+	std::vector<CFamiTrackerDoc*> m_vBatch;
+	unsigned int	m_iBatchSize;
+	unsigned int	m_iBatchStart;
+	volatile LONG	m_iNextModule;
+
+	// The compiler object is global
+	static CCriticalSection m_csCompiler;
+};
@@ -90,8 +90,6 @@ enum command_t {
 const unsigned char CMD_EFF_VRC7_PATCH = CMD_EFF_FDS_MOD_DEPTH;	// TODO: hack, fix this
 */
 
-const unsigned char CMD_LOOP_POINT = 26;	// Currently unused
-
 CPatternCompiler::CPatternCompiler(CFamiTrackerDoc *pDoc, unsigned int *pInstList, DPCM_List_t *pDPCMList, CCompilerLog *pLogger) :
 	m_pDocument(pDoc),
 	m_pInstrumentList(pInstList),
@@ -109,16 +107,20 @@ void CPatternCompiler::CompileData(int Track, int Pattern, int Channel)
 {
 	int EffColumns = m_pDocument->GetEffColumns(Track, Channel) + 1;
 
+	CTrackerChannel *pTrackerChannel = m_pDocument->GetChannel(Channel);
+	int ChanID = pTrackerChannel->GetID();
+	int ChipID = pTrackerChannel->GetChip();
+
 	stSpacingInfo SpaceInfo;
-	stChanNote ChanNote;
 
 	// Global init
-	m_iHash = 0;
+	m_iHash = CCompiler::HASH_OFFSET;
 	m_iDuration = 0;
 	m_iCurrentDefaultDuration = 0xFF;
 
 	m_vData.clear();
-	m_vCompressedData.clear();
+	m_vEntryPoints.clear();
+	m_vRowPositions.clear();
 
 	// Local init
 	unsigned int iPatternLen = m_pDocument->GetPatternLength(Track);
@@ -126,9 +128,24 @@ void CPatternCompiler::CompileData(int Track, int Pattern, int Channel)
 	unsigned char DPCMInst = 0;
 	unsigned char NESNote = 0;
 
+	// Pattern rows are read in place
+	const stChanNote *pRows = m_pDocument->GetPatternRows(Track, Pattern, Channel);
+
+#ifdef OPTIMIZE_DURATIONS
+	ScanNoteLengths(pRows, iPatternLen, EffColumns);
+#endif /* OPTIMIZE_DURATIONS */
+
+	MarkEntryPoint();
+
 	for (unsigned int i = 0; i < iPatternLen; ++i) {
 
-		m_pDocument->GetDataAtPattern(Track, Pattern, Channel, i, &ChanNote);
+		const stChanNote &ChanNote = pRows[i];
+
+		m_vRowPositions.push_back(m_vData.size());
+
+		// Effects can be cleared on delayed rows
+		unsigned char EffNumber[MAX_EFFECT_COLUMNS];
+		memcpy(EffNumber, ChanNote.EffNumber, sizeof(EffNumber));
 
 		unsigned char Note = ChanNote.Note;
 		unsigned char Octave = ChanNote.Octave;
@@ -137,10 +154,6 @@ void CPatternCompiler::CompileData(int Track, int Pattern, int Channel)
 		
 		bool Action = false;
 
-		CTrackerChannel *pTrackerChannel = m_pDocument->GetChannel(Channel);
-		int ChanID = pTrackerChannel->GetID();
-		int ChipID = pTrackerChannel->GetChip();
-
 		if (ChanNote.Instrument != MAX_INSTRUMENTS && Note != HALT && Note != NONE && Note != RELEASE) {
 			if (!pTrackerChannel->IsInstrumentCompatible(ChanNote.Instrument, m_pDocument)) {
 				CString str;
@@ -151,21 +164,21 @@ void CPatternCompiler::CompileData(int Track, int Pattern, int Channel)
 
 		// Check for delays, must come first
 		for (int j = 0; j < EffColumns; ++j) {
-			unsigned char Effect   = ChanNote.EffNumber[j];
+			unsigned char Effect   = EffNumber[j];
 			unsigned char EffParam = ChanNote.EffParam[j];
 			if (Effect == EF_DELAY && EffParam > 0) {
 				WriteDuration();
 				for (int k = 0; k < EffColumns; ++k) {
 					// Clear skip and jump commands on delayed rows
-					if (ChanNote.EffNumber[k] == EF_SKIP) {
+					if (EffNumber[k] == EF_SKIP) {
 						WriteData(Command(CMD_EFF_SKIP));
 						WriteData(ChanNote.EffParam[k] + 1);
-						ChanNote.EffNumber[k] = 0;
+						EffNumber[k] = 0;
 					}
-					else if (ChanNote.EffNumber[k] == EF_JUMP) {
+					else if (EffNumber[k] == EF_JUMP) {
 						WriteData(Command(CMD_EFF_JUMP));
 						WriteData(ChanNote.EffParam[k] + 1);
-						ChanNote.EffNumber[k] = 0;
+						EffNumber[k] = 0;
 					}
 				}
 				Action = true;
@@ -177,7 +190,7 @@ void CPatternCompiler::CompileData(int Track, int Pattern, int Channel)
 #ifdef OPTIMIZE_DURATIONS
 
 		// Determine length of space between notes
-		SpaceInfo = ScanNoteLengths(Track, i, Pattern, Channel);
+		SpaceInfo = m_vSpacingInfo[i];
 
 		if (SpaceInfo.SpaceCount > 2) {
 			if (SpaceInfo.SpaceSize != m_iCurrentDefaultDuration && SpaceInfo.SpaceCount != 0xFF) {
@@ -286,7 +299,7 @@ void CPatternCompiler::CompileData(int Track, int Pattern, int Channel)
 
 		for (int j = 0; j < EffColumns; ++j) {
 
-			unsigned char Effect   = ChanNote.EffNumber[j];
+			unsigned char Effect   = EffNumber[j];
 			unsigned char EffParam = ChanNote.EffParam[j];
 			
 			if (Effect > 0) {
@@ -505,6 +518,8 @@ void CPatternCompiler::CompileData(int Track, int Pattern, int Channel)
 			if (Action) {
 				// A instrument/effect command was issued but no new note, write rest command
 				WriteData(0);
+				if (m_iCurrentDefaultDuration != 0xFF)
+					MarkEntryPoint();
 			}
 			AccumulateDuration();
 		}
@@ -512,13 +527,13 @@ void CPatternCompiler::CompileData(int Track, int Pattern, int Channel)
 			// Write note command
 			WriteDuration();
 			WriteData(NESNote + 1);
+			if (m_iCurrentDefaultDuration != 0xFF)
+				MarkEntryPoint();
 			AccumulateDuration();
 		}
 	}
 
 	WriteDuration();
-
-//	OptimizeString();
 }
 
 unsigned char CPatternCompiler::Command(int cmd) const
@@ -544,72 +559,70 @@ unsigned int CPatternCompiler::FindSample(int Instrument, int Octave, int Key) c
 	return (*m_pDPCMList)[Instrument][Octave][Key - 1];
 }
 
-CPatternCompiler::stSpacingInfo CPatternCompiler::ScanNoteLengths(int Track, unsigned int StartRow, int Pattern, int Channel)
+static bool IsRowUsed(const stChanNote &Note, int EffColumns)
 {
-	stChanNote NoteData;
-	int StartSpace = -1, Space = 0, SpaceCount = 0;
-	stSpacingInfo Info;
-
-	Info.SpaceCount = 0;
-	Info.SpaceSize = 0;
-
-	for (unsigned i = StartRow; i < m_pDocument->GetPatternLength(Track); ++i) {
-		m_pDocument->GetDataAtPattern(Track, Pattern, Channel, i, &NoteData);
-		bool NoteUsed = false;
-
-		if (NoteData.Note > 0)
-			NoteUsed = true;
-		if (NoteData.Instrument < MAX_INSTRUMENTS)
-			NoteUsed = true;
-		if (NoteData.Vol < 0x10)
-			NoteUsed = true;
-		for (unsigned j = 0; j < (m_pDocument->GetEffColumns(Track, Channel) + 1); ++j) {
-			if (NoteData.EffNumber[j] != EF_NONE)
-				NoteUsed = true;
-		}
+	if (Note.Note > 0 || Note.Instrument < MAX_INSTRUMENTS || Note.Vol < 0x10)
+		return true;
+
+	for (int i = 0; i < EffColumns; ++i) {
+		if (Note.EffNumber[i] != EF_NONE)
+			return true;
+	}
+
+	return false;
+}
+
+void CPatternCompiler::ScanNoteLengths(const stChanNote *pRows, unsigned int Rows, int EffColumns)
+{
+	// Calculates the spacing info for all rows in one backward pass
+	//
+	// For a used row, SpaceSize is the number of empty rows up to the next used row and 
+	// SpaceCount is how many of the following used rows are followed by equally long gaps 
+	// (the empty rows at the end of the pattern are counted as a gap). Empty rows get 
+	// SpaceCount 0xFF, rows without any used row after them get SpaceSize -1.
+	//
+
+	m_vSpacingInfo.resize(Rows);
+
+	int NextRow = -1;		// Next used row
+	int NextGap = 0;		// Gap after the next used row
+	int NextCount = 0;		// Number of equal gaps starting at the next used row
 
-		if (i == StartRow && NoteUsed == false) {
+	for (int i = Rows - 1; i >= 0; --i) {
+		stSpacingInfo &Info = m_vSpacingInfo[i];
+
+		if (!IsRowUsed(pRows[i], EffColumns)) {
 			Info.SpaceCount = 0xFF;
-			Info.SpaceSize = StartSpace;
-			return Info;
+			Info.SpaceSize = -1;
+			continue;
 		}
 
-		if (i > StartRow) {
-			if (NoteUsed) {
-				if (StartSpace == -1)
-					StartSpace = Space;
-				else {
-					if (StartSpace == Space)
-						SpaceCount++;
-					else {
-						Info.SpaceCount = SpaceCount;
-						Info.SpaceSize = StartSpace;
-						return Info;
-					}
-				}
-				Space = 0;
-			}
-			else
-				Space++;
+		int Gap;
+		int Count;
+
+		if (NextRow == -1) {
+			Info.SpaceCount = 0;
+			Info.SpaceSize = -1;
+			Gap = Rows - 1 - i;
+			Count = 1;
+		}
+		else {
+			Gap = NextRow - i - 1;
+			Info.SpaceCount = (NextGap == Gap) ? NextCount : 0;
+			Info.SpaceSize = Gap;
+			Count = Info.SpaceCount + 1;
 		}
-	}
 
-	if (StartSpace == Space) {
-		SpaceCount++;
+		NextRow = i;
+		NextGap = Gap;
+		NextCount = Count;
 	}
-
-	Info.SpaceCount = SpaceCount;
-	Info.SpaceSize = StartSpace;
-
-	return Info;
 }
 
 void CPatternCompiler::WriteData(unsigned char Value)
 {
 	m_vData.push_back(Value);
-	m_iHash += Value;				// Simple CRC-hash
-	m_iHash += (m_iHash << 10);
-	m_iHash ^= (m_iHash >> 6);
+	m_iHash = (m_iHash ^ Value) * CCompiler::HASH_PRIME;	// FNV-1a
 }
 
 void CPatternCompiler::AccumulateDuration()
@@ -622,150 +635,28 @@ void CPatternCompiler::WriteDuration()
 	if (m_iCurrentDefaultDuration == 0xFF) {
 		if (!m_vData.size() && m_iDuration > 0)
 			WriteData(0x00);
-		if (m_iDuration > 0)
+		if (m_iDuration > 0) {
 			WriteData(m_iDuration - 1);
+			MarkEntryPoint();
+		}
 	}
 
 	m_iDuration = 0;
 }
 
-// Returns the size of the block at 'position' in the data array. A block is terminated by a note
-int CPatternCompiler::GetBlockSize(int Position)
+void CPatternCompiler::MarkEntryPoint()
 {
-	unsigned int Pos = Position;
-
-	int iDuration = 1;
-
-	// Find if note duration optimization is on
-	for (int i = 0; i < Position; ++i) {
-		if (m_vData[i] == Command(CMD_SET_DURATION))
-			iDuration = 0;
-		else if (m_vData[i] == Command(CMD_RESET_DURATION))
-			iDuration = 1;
-	}
-
-	for (; Pos < m_vData.size(); Pos++) {
-		unsigned char data = m_vData[Pos];
-		if (data < 0x80) {		// Note
-			//int size = (Pos + 1 + iDuration) - Position;
-			int size = (Pos - Position);
-//			if (size > 1)
-//				return size - 1;
-
-			return size + 1 + iDuration;// (Pos + 1 + iDuration) - Position;
-		}
-		else if (data == Command(CMD_SET_DURATION))
-			iDuration = 0;
-		else if (data == Command(CMD_RESET_DURATION))
-			iDuration = 1;
-		else {
-			if (data < 0xE0 || data > 0xEF)
-				Pos++;				// Command, skip parameter
-		}
-	//	Pos++;
-	}
-
-	// Error
-	return 1;
+	// A row entry ends with a note and its duration, the next entry starts here
+	if (!m_vEntryPoints.empty() && m_vEntryPoints.back().Position == m_vData.size())
+		m_vEntryPoints.pop_back();
+
+	stEntryPoint Entry;
+	Entry.Position = m_vData.size();
+	Entry.Duration = m_iCurrentDefaultDuration;
+	m_vEntryPoints.push_back(Entry);
 }
 
-void CPatternCompiler::OptimizeString()
-{
-	// Try to optimize by finding repeating patterns and compress them into a loop (simple RLE)
-	//
-
-	//
-	// Ok, just figured this won't work without using loads of NES RAM so I'll
-	// probably put this on hold for a while
-	//
-
-	unsigned int i, j, k, l;
-	int matches, best_length, last_inst;
-	bool matched;
-
-	/*
-
-	80 00 2E 00 2E 00 2E 00 2E 00 2E 00 2E 00 ->
-	80 00 2E 00 FF 06 02
-
-	*/
-
-	// Always copy first 2 bytes
-//	memcpy(m_pCompressedData, m_pData, 2);
-//	m_iCompressedDataPointer += 2;
-
-	if (m_vData[0] == 0x80)
-		last_inst = m_vData[1];
-	else
-		last_inst = 0;
-
-	// Loop from start
-	for (i = 0; i < m_vData.size(); /*i += 2*/) {
-
-		int best_matches = 0;
-
-		// Instrument
-		if (m_vData[i] == 0x80)
-			last_inst = m_vData[i + 1];
-		else if (m_vData[i] >= 0xE0 && m_vData[i] <= 0xEF)
-			last_inst = m_vData[i & 0xF];
-
-		// Start checking from the first tuple
-		for (l = GetBlockSize(i); l < (m_vData.size() - i); /*l += 2*/) {
-			matches = 0;
-			// See how many following matches there are from this combination in a row
-			for (j = i + l; j <= m_vData.size(); j += l) {
-				matched = true;
-				// Compare one word
-				for (k = 0; k < l; k++) {
-					if (m_vData[i + k] != m_vData[j + k])
-						matched = false;
-				}
-				if (!matched)
-					break;
-				matches++;
-				/*
-				if ((j + l) <= m_iDataPointer) {
-					if (memcmp(m_pData + i, m_pData + j, l) == 0)
-						matches++;
-					else
-						break;
-				}
-				*/
-			}
-			// Save
-			if (matches > best_matches) {
-				best_matches = matches;
-				best_length = l;
-			}
-
-			l += GetBlockSize(i + l);
-		}
-		// Compress
-		if ((best_matches > 1 && best_length > 4) || best_matches > 2 /*&& (best_length > 2 && best_matches > 1)*/) {
-			// Include the first one
-			best_matches++;
-			int size = best_length * best_matches;
-			//
-			// Last known instrument must also be added
-			//
-			std::copy(m_vData.begin() + i, m_vData.begin() + i + best_length, m_vCompressedData.end());
-			// Define a loop point: 0xFF (number of loops) (number of bytes)
-			m_vCompressedData.push_back(Command(CMD_LOOP_POINT));
-			m_vCompressedData.push_back(best_matches - 1);	// the nsf code sees one less
-			m_vCompressedData.push_back(best_length);
-			i += size;
-		}
-		else {
-			// No loop
-			int size = GetBlockSize(i);
-			std::copy(m_vData.begin() + i, m_vData.begin() + i + size, m_vCompressedData.end());
-			i += size;
-		}
-	}
-}	
-
-unsigned int CPatternCompiler::GetHash() const
+ULONGLONG CPatternCompiler::GetHash() const
 {
 	return m_iHash;
 }
@@ -786,17 +677,17 @@ const std::vector<char> &CPatternCompiler::GetData() const
 	return m_vData;
 }
 
-const std::vector<char> &CPatternCompiler::GetCompressedData() const
+const std::vector<CPatternCompiler::stEntryPoint> &CPatternCompiler::GetEntryPoints() const
 {
-	return m_vCompressedData;
+	return m_vEntryPoints;
 }
 
-unsigned int CPatternCompiler::GetDataSize() const
+const std::vector<unsigned int> &CPatternCompiler::GetRowPositions() const
 {
-	return m_vData.size();
+	return m_vRowPositions;
 }
 
-unsigned int CPatternCompiler::GetCompressedDataSize() const
+unsigned int CPatternCompiler::GetDataSize() const
 {
-	return m_vCompressedData.size();
+	return m_vData.size();
 }
@@ -27,20 +27,27 @@ typedef unsigned char DPCM_List_t[MAX_INSTRUMENTS][OCTAVE_RANGE][NOTE_RANGE];
 
 class CPatternCompiler
 {
+public:
+	// Start of a row entry in the compiled data
+	struct stEntryPoint {
+		unsigned int Position;
+		unsigned int Duration;		// Default duration at this point, 0xFF when durations are stored
+	};
+
 public:
 	CPatternCompiler(CFamiTrackerDoc *pDoc, unsigned int *pInstList, DPCM_List_t *pDPCMList, CCompilerLog *pLogger);
 	~CPatternCompiler();
 
 	void			CompileData(int Track, int Pattern, int Channel);
 	
-	unsigned int	GetHash() const;
+	ULONGLONG		GetHash() const;
 	bool			CompareData(const std::vector<char> &data) const;
 
 	const std::vector<char> &GetData() const;
-	const std::vector<char> &GetCompressedData() const;
+	const std::vector<stEntryPoint> &GetEntryPoints() const;
+	const std::vector<unsigned int> &GetRowPositions() const;
 
 	unsigned int	GetDataSize() const;
-	unsigned int	GetCompressedDataSize() const;
 
 private:	
 	struct stSpacingInfo {
@@ -57,21 +64,22 @@ private:
 	void			WriteData(unsigned char Value);
 	void			WriteDuration();
 	void			AccumulateDuration();
-	void			OptimizeString();
-	int				GetBlockSize(int Position);
-	stSpacingInfo	ScanNoteLengths(int Track, unsigned int StartRow, int Pattern, int Channel);
+	void			MarkEntryPoint();
+	void			ScanNoteLengths(const stChanNote *pRows, unsigned int Rows, int EffColumns);
 
 	// Debugging
 	void			Print(LPCTSTR text) const;
 
 private:
 	std::vector<char> m_vData;
-	std::vector<char> m_vCompressedData;
+	std::vector<stEntryPoint> m_vEntryPoints;
+	std::vector<unsigned int> m_vRowPositions;		// Data position when each row begins
+	std::vector<stSpacingInfo> m_vSpacingInfo;
 
 	unsigned int	m_iDuration;
 	unsigned int	m_iCurrentDefaultDuration;
 	bool			m_bDSamplesAccessed[OCTAVE_RANGE * NOTE_RANGE]; // <- check the range, its not optimal right now
-	unsigned int	m_iHash;
+	ULONGLONG		m_iHash;
 	unsigned int	*m_pInstrumentList;
 
 	DPCM_List_t		*m_pDPCMList;
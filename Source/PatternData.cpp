@@ -22,52 +22,241 @@
 #include "FamiTrackerDoc.h"
 #include "PatternData.h"
 
+// Contents of an unallocated pattern
+const stChanNote CPatternBlock::EMPTY_NOTE = {0, 0, MAX_VOLUME, MAX_INSTRUMENTS, {0}, {0}};
+
+// Rows of an unallocated pattern
+static const struct stEmptyPattern {
+	stEmptyPattern() {
+		for (int i = 0; i < MAX_PATTERN_LENGTH; ++i)
+			Notes[i] = CPatternBlock::EMPTY_NOTE;
+	}
+	stChanNote Notes[MAX_PATTERN_LENGTH];
+} EMPTY_PATTERN;
+
+// Flow summary of an unallocated pattern
+static const stPatternFlow EMPTY_FLOW = {-1, -1, -1, false, -1};
+
+// Guards the cached flow summaries of all blocks
+static CCriticalSection FlowCacheLock;
+
+// Frame list and pattern table growth
+static const unsigned int FRAME_ALLOCATION = 16;
+static const unsigned int PATTERN_ALLOCATION = 16;
+
+// Released pattern blocks kept for reuse
+struct stFreeBlock {
+	stFreeBlock *pNext;
+};
+
+static const int MAX_POOLED_BLOCKS = 256;
+
+static CCriticalSection BlockPoolLock;
+static stFreeBlock *pBlockPool = NULL;
+static int BlockPoolSize = 0;
+
+// CPatternBlock, one pattern of note data
+
+CPatternBlock::CPatternBlock() : m_iRefCount(1), m_iFlowLength(0), m_iFlowColumns(0)
+{
+	for (int i = 0; i < MAX_PATTERN_LENGTH; ++i)
+		m_Notes[i] = EMPTY_NOTE;
+}
+
+CPatternBlock::CPatternBlock(const CPatternBlock &Block) : m_iRefCount(1), m_iFlowLength(0), m_iFlowColumns(0)
+{
+	memcpy(m_Notes, Block.m_Notes, sizeof(stChanNote) * MAX_PATTERN_LENGTH);
+}
+
+void CPatternBlock::Retain() const
+{
+	InterlockedIncrement(&m_iRefCount);
+}
+
+void CPatternBlock::Release() const
+{
+	// May be called from the player thread
+	if (InterlockedDecrement(&m_iRefCount) == 0)
+		delete this;
+}
+
+void *CPatternBlock::operator new(size_t Size)
+{
+	// May be called from the player thread through Release
+	ASSERT(Size == sizeof(CPatternBlock));
+
+	BlockPoolLock.Lock();
+	stFreeBlock *pBlock = pBlockPool;
+	if (pBlock != NULL) {
+		pBlockPool = pBlock->pNext;
+		--BlockPoolSize;
+	}
+	BlockPoolLock.Unlock();
+
+	if (pBlock != NULL)
+		return pBlock;
+
+	return ::operator new(Size);
+}
+
+void CPatternBlock::operator delete(void *pBlock)
+{
+	if (pBlock == NULL)
+		return;
+
+	BlockPoolLock.Lock();
+	if (BlockPoolSize < MAX_POOLED_BLOCKS) {
+		stFreeBlock *pFree = static_cast<stFreeBlock*>(pBlock);
+		pFree->pNext = pBlockPool;
+		pBlockPool = pFree;
+		++BlockPoolSize;
+		pBlock = NULL;
+	}
+	BlockPoolLock.Unlock();
+
+	if (pBlock != NULL)
+		::operator delete(pBlock);
+}
+
+bool CPatternBlock::IsShared() const
+{
+	return m_iRefCount > 1;
+}
+
+bool CPatternBlock::IsRowFree(unsigned int Row) const
+{
+	const stChanNote *pNote = m_Notes + Row;
+
+	return pNote->Note == NONE && 
+		pNote->EffNumber[0] == 0 && pNote->EffNumber[1] == 0 && 
+		pNote->EffNumber[2] == 0 && pNote->EffNumber[3] == 0 && 
+		pNote->Vol == MAX_VOLUME && pNote->Instrument == MAX_INSTRUMENTS;
+}
+
+stPatternFlow CPatternBlock::GetFlow(unsigned int Start, unsigned int Length, unsigned int Columns) const
+{
+	FlowCacheLock.Lock();
+
+	if (m_iFlowColumns != Columns || m_iFlowLength != Length) {
+		ScanFlow(0, Length, Columns, m_Flow);
+		m_iFlowLength = Length;
+		m_iFlowColumns = Columns;
+	}
+
+	stPatternFlow Flow = m_Flow;
+
+	FlowCacheLock.Unlock();
+
+	// A pattern entered by Dxx, the cached summary is only valid if its rows are not before the start row
+	if ((Flow.Row != -1 && Flow.Row < (int)Start) || (Flow.TimingRow != -1 && Flow.TimingRow < (int)Start))
+		ScanFlow(Start, Length, Columns, Flow);
+
+	return Flow;
+}
+
+void CPatternBlock::ScanFlow(unsigned int Start, unsigned int Length, unsigned int Columns, stPatternFlow &Flow) const
+{
+	// Find the first row that leaves the pattern, scanning stops at that row
+	Flow = EMPTY_FLOW;
+
+	for (unsigned int i = Start; i < Length && Flow.Row == -1; ++i) {
+		for (unsigned int j = 0; j < Columns; ++j) {
+			switch (m_Notes[i].EffNumber[j]) {
+				case EF_JUMP:
+					Flow.JumpTo = m_Notes[i].EffParam[j];
+					Flow.Row = i;
+					break;
+				case EF_SKIP:
+					Flow.SkipTo = m_Notes[i].EffParam[j];
+					Flow.Row = i;
+					break;
+				case EF_HALT:
+					Flow.bHalt = true;
+					Flow.Row = i;
+					break;
+				case EF_SPEED:
+				case EF_DELAY:
+					if (Flow.TimingRow == -1)
+						Flow.TimingRow = i;
+					break;
+			}
+		}
+	}
+}
+
+void CPatternBlock::InvalidateFlow()
+{
+	FlowCacheLock.Lock();
+	m_iFlowColumns = 0;
+	FlowCacheLock.Unlock();
+}
+
 // This class contains pattern data
 // A list of these objects exists inside the document one for each song
 
+volatile LONG CPatternData::m_iRevisionCounter = 0;
+
 CPatternData::CPatternData(unsigned int PatternLength, unsigned int Speed, unsigned int Tempo) :
 	m_iPatternLength(PatternLength),
 	m_iFrameCount(1),
 	m_iSongSpeed(Speed),
 	m_iSongTempo(Tempo),
 	m_iRowHighlight1(CFamiTrackerDoc::DEFAULT_FIRST_HIGHLIGHT),
-	m_iRowHighlight2(CFamiTrackerDoc::DEFAULT_SECOND_HIGHLIGHT)
+	m_iRowHighlight2(CFamiTrackerDoc::DEFAULT_SECOND_HIGHLIGHT),
+	m_pFrameList(NULL),
+	m_iFramesAllocated(0)
 {
-	// Clear memory
-	memset(m_iFrameList, 0, sizeof(char) * MAX_FRAMES * MAX_CHANNELS);
-	memset(m_pPatternData, 0, sizeof(stChanNote*) * MAX_CHANNELS * MAX_PATTERN);
+	// Clear memory, frames and patterns are allocated when used
+	memset(m_pPatternData, 0, sizeof(CPatternBlock**) * MAX_CHANNELS);
+	memset(m_iPatternsAllocated, 0, sizeof(unsigned int) * MAX_CHANNELS);
 	memset(m_iEffectColumns, 0, sizeof(char) * MAX_CHANNELS);
+
+	Modified();
 }
 
 CPatternData::~CPatternData()
 {
-	// Deallocate memory
+	// Release memory, snapshots may still hold references to the blocks
 	for (int i = 0; i < MAX_CHANNELS; ++i) {
-		for (int j = 0; j < MAX_PATTERN; ++j) {
-			SAFE_RELEASE_ARRAY(m_pPatternData[i][j]);
+		for (unsigned int j = 0; j < m_iPatternsAllocated[i]; ++j) {
+			if (m_pPatternData[i][j] != NULL)
+				m_pPatternData[i][j]->Release();
 		}
+		SAFE_RELEASE_ARRAY(m_pPatternData[i]);
 	}
+
+	SAFE_RELEASE_ARRAY(m_pFrameList);
+}
+
+void CPatternData::Modified()
+{
+	// Revisions are taken from a shared counter so a recycled track never repeats an old revision
+	m_iRevision = InterlockedIncrement(&m_iRevisionCounter);
+}
+
+CPatternBlock *CPatternData::GetBlock(unsigned int Channel, unsigned int Pattern) const
+{
+	// Returns NULL for unallocated patterns
+	if (Pattern >= m_iPatternsAllocated[Channel])
+		return NULL;
+
+	return m_pPatternData[Channel][Pattern];
 }
 
 bool CPatternData::IsCellFree(unsigned int Channel, unsigned int Pattern, unsigned int Row) const
 {
-	stChanNote *pNote = GetPatternData(Channel, Pattern, Row);
+	const CPatternBlock *pBlock = GetBlock(Channel, Pattern);
 
-	if (pNote == NULL)
+	if (pBlock == NULL)
 		return true;
 
-	bool IsFree = pNote->Note == NONE && 
-		pNote->EffNumber[0] == 0 && pNote->EffNumber[1] == 0 && 
-		pNote->EffNumber[2] == 0 && pNote->EffNumber[3] == 0 && 
-		pNote->Vol == MAX_VOLUME && pNote->Instrument == MAX_INSTRUMENTS;
-
-	return IsFree;
+	return pBlock->IsRowFree(Row);
 }
 
 bool CPatternData::IsPatternEmpty(unsigned int Channel, unsigned int Pattern) const
 {
 	// Unallocated pattern means empty
-	if (!m_pPatternData[Channel][Pattern])
+	if (!GetBlock(Channel, Pattern))
 		return true;
 
 	// Check if allocated pattern is empty
@@ -83,48 +272,100 @@ bool CPatternData::IsPatternInUse(unsigned int Channel, unsigned int Pattern) co
 {
 	// Check if pattern is addressed in frame list
 	for (unsigned i = 0; i < m_iFrameCount; ++i) {
-		if (m_iFrameList[i][Channel] == Pattern)
+		if (GetFramePattern(i, Channel) == Pattern)
 			return true;
 	}
 
 	return false;
 }
 
-stChanNote *CPatternData::GetPatternData(unsigned int Channel, unsigned int Pattern, unsigned int Row) const
+const stChanNote *CPatternData::GetPatternData(unsigned int Channel, unsigned int Pattern, unsigned int Row) const
 {
 	// Private method, may return NULL
-	if (!m_pPatternData[Channel][Pattern])
+	const CPatternBlock *pBlock = GetBlock(Channel, Pattern);
+
+	if (!pBlock)
 		return NULL;
 
-	return m_pPatternData[Channel][Pattern] + Row;
+	return pBlock->GetRow(Row);
 }
 
 stChanNote *CPatternData::GetPatternData(unsigned int Channel, unsigned int Pattern, unsigned int Row)
 {
-	if (!m_pPatternData[Channel][Pattern])		// Allocate pattern if accessed for the first time
+	// Returned data may be written to, make sure the block isn't shared
+	CPatternBlock *pBlock = GetBlock(Channel, Pattern);
+
+	if (!pBlock)		// Allocate pattern if accessed for the first time
 		AllocatePattern(Channel, Pattern);
+	else if (pBlock->IsShared()) {
+		// Copy on write
+		m_pPatternData[Channel][Pattern] = new CPatternBlock(*pBlock);
+		pBlock->Release();
+	}
+	else
+		pBlock->InvalidateFlow();
 
-	return m_pPatternData[Channel][Pattern] + Row;
+	Modified();
+
+	return m_pPatternData[Channel][Pattern]->GetRow(Row);
 }
 
-void CPatternData::AllocatePattern(unsigned int Channel, unsigned int Pattern)
+const stChanNote *CPatternData::ReadPatternData(unsigned int Channel, unsigned int Pattern, unsigned int Row) const
 {
-	// Allocate memory
-	m_pPatternData[Channel][Pattern] = new stChanNote[MAX_PATTERN_LENGTH];
+	// Read-only access, does not allocate or copy patterns
+	const stChanNote *pNote = GetPatternData(Channel, Pattern, Row);
+	return pNote == NULL ? &CPatternBlock::EMPTY_NOTE : pNote;
+}
 
-	// Clear memory
-	for (int i = 0; i < MAX_PATTERN_LENGTH; ++i) {
-		stChanNote *pNote = m_pPatternData[Channel][Pattern] + i;
-		pNote->Note		  = 0;
-		pNote->Octave	  = 0;
-		pNote->Instrument = MAX_INSTRUMENTS;
-		pNote->Vol		  = MAX_VOLUME;
+const CPatternBlock *CPatternData::GetPatternBlock(unsigned int Channel, unsigned int Pattern) const
+{
+	// May return NULL
+	return GetBlock(Channel, Pattern);
+}
 
-		for (int n = 0; n < MAX_EFFECT_COLUMNS; ++n) {
-			pNote->EffNumber[n] = 0;
-			pNote->EffParam[n] = 0;
-		}
+const stChanNote *CPatternData::ReadPatternRows(unsigned int Channel, unsigned int Pattern) const
+{
+	// Read-only access to all rows of a pattern, valid until the pattern is changed
+	const CPatternBlock *pBlock = GetBlock(Channel, Pattern);
+	return pBlock == NULL ? EMPTY_PATTERN.Notes : pBlock->GetRow(0);
+}
+
+void CPatternData::AllocatePattern(unsigned int Channel, unsigned int Pattern)
+{
+	// Allocate memory, blocks are cleared when created
+	ASSERT(Pattern < MAX_PATTERN);
+
+	if (Pattern >= m_iPatternsAllocated[Channel]) {
+		// Grow the pattern table of this channel
+		unsigned int Count = min((Pattern / PATTERN_ALLOCATION + 1) * PATTERN_ALLOCATION, (unsigned int)MAX_PATTERN);
+		CPatternBlock **pTable = new CPatternBlock*[Count];
+		memset(pTable, 0, sizeof(CPatternBlock*) * Count);
+		if (m_pPatternData[Channel] != NULL)
+			memcpy(pTable, m_pPatternData[Channel], sizeof(CPatternBlock*) * m_iPatternsAllocated[Channel]);
+		SAFE_RELEASE_ARRAY(m_pPatternData[Channel]);
+		m_pPatternData[Channel] = pTable;
+		m_iPatternsAllocated[Channel] = Count;
 	}
+
+	m_pPatternData[Channel][Pattern] = new CPatternBlock();
+}
+
+void CPatternData::AllocateFrames(unsigned int Frames)
+{
+	// Grow the frame list, new frames are cleared
+	ASSERT(Frames <= MAX_FRAMES);
+
+	if (Frames <= m_iFramesAllocated)
+		return;
+
+	unsigned int Count = min((Frames + FRAME_ALLOCATION - 1) / FRAME_ALLOCATION * FRAME_ALLOCATION, (unsigned int)MAX_FRAMES);
+	unsigned char *pList = new unsigned char[Count * MAX_CHANNELS];
+	memset(pList, 0, sizeof(char) * Count * MAX_CHANNELS);
+	if (m_pFrameList != NULL)
+		memcpy(pList, m_pFrameList, sizeof(char) * m_iFramesAllocated * MAX_CHANNELS);
+	SAFE_RELEASE_ARRAY(m_pFrameList);
+	m_pFrameList = pList;
+	m_iFramesAllocated = Count;
 }
 
 void CPatternData::ClearEverything()
@@ -132,33 +373,48 @@ void CPatternData::ClearEverything()
 	// Release all patterns and clear frame list
 
 	// Frame list
-	memset(m_iFrameList, 0, sizeof(char) * MAX_FRAMES * MAX_CHANNELS);
+	SAFE_RELEASE_ARRAY(m_pFrameList);
+	m_iFramesAllocated = 0;
 	m_iFrameCount = 1;
+	Modified();
 	
 	// Patterns, deallocate everything
 	for (int i = 0; i < MAX_CHANNELS; ++i) {
-		for (int j = 0; j < MAX_PATTERN; ++j) {
+		for (unsigned int j = 0; j < m_iPatternsAllocated[i]; ++j) {
 			ClearPattern(i, j);
 		}
+		SAFE_RELEASE_ARRAY(m_pPatternData[i]);
+		m_iPatternsAllocated[i] = 0;
 	}
 }
 
 void CPatternData::ClearPattern(unsigned int Channel, unsigned int Pattern)
 {
 	// Deletes a specified pattern in a channel
-	if (m_pPatternData[Channel][Pattern] != NULL) {
-		SAFE_RELEASE_ARRAY(m_pPatternData[Channel][Pattern]);
+	if (GetBlock(Channel, Pattern) != NULL) {
+		m_pPatternData[Channel][Pattern]->Release();
+		m_pPatternData[Channel][Pattern] = NULL;
+		Modified();
 	}
 }
 
 unsigned int CPatternData::GetFramePattern(unsigned int Frame, unsigned int Channel) const
 { 
-	return m_iFrameList[Frame][Channel]; 
+	ASSERT(Frame < MAX_FRAMES && Channel < MAX_CHANNELS);
+
+	if (Frame >= m_iFramesAllocated)
+		return 0;
+
+	return m_pFrameList[Frame * MAX_CHANNELS + Channel]; 
 }
 
 void CPatternData::SetFramePattern(unsigned int Frame, unsigned int Channel, unsigned int Pattern)
 {
-	m_iFrameList[Frame][Channel] = Pattern;
+	ASSERT(Frame < MAX_FRAMES && Channel < MAX_CHANNELS);
+
+	AllocateFrames(Frame + 1);
+	m_pFrameList[Frame * MAX_CHANNELS + Channel] = Pattern;
+	Modified();
 }
 
 void CPatternData::SetHighlight(unsigned int First, unsigned int Second)
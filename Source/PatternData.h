@@ -31,6 +31,56 @@ struct stChanNote {
 	unsigned char EffParam[MAX_EFFECT_COLUMNS];
 };
 
+// Control flow summary of a pattern
+struct stPatternFlow {
+	int  Row;				// First row with a Bxx, Dxx or Cxx effect, -1 if the pattern plays to the end
+	int  JumpTo;			// Bxx parameter on that row, -1 if none
+	int  SkipTo;			// Dxx parameter on that row, -1 if none
+	bool bHalt;				// Cxx on that row
+	int  TimingRow;			// First row with a Fxx or Gxx effect up to that row, -1 if none
+};
+
+// Reference counted pattern storage, blocks are shared between the document and player snapshots.
+// A shared block is never written to, the owner must make a private copy first (copy on write).
+class CPatternBlock {
+public:
+	CPatternBlock();
+	CPatternBlock(const CPatternBlock &Block);
+
+	void Retain() const;
+	void Release() const;
+	bool IsShared() const;
+
+	stChanNote *GetRow(unsigned int Row) { return m_Notes + Row; };
+	const stChanNote *GetRow(unsigned int Row) const { return m_Notes + Row; };
+	bool IsRowFree(unsigned int Row) const;
+
+	// Flow summary from a start row. The summary from row 0 is cached until the block is written to, 
+	// the cache is guarded since blocks are shared with snapshots on other threads
+	stPatternFlow GetFlow(unsigned int Start, unsigned int Length, unsigned int Columns) const;
+	void InvalidateFlow();
+
+	// Contents of an unallocated pattern
+	static const stChanNote EMPTY_NOTE;
+
+	// Blocks are recycled through a pool, copy on write allocates blocks often
+	static void *operator new(size_t Size);
+	static void operator delete(void *pBlock);
+
+private:
+	~CPatternBlock() {};
+
+	void ScanFlow(unsigned int Start, unsigned int Length, unsigned int Columns, stPatternFlow &Flow) const;
+
+private:
+	mutable volatile LONG m_iRefCount;
+	stChanNote m_Notes[MAX_PATTERN_LENGTH];
+
+	mutable stPatternFlow m_Flow;
+	mutable unsigned int m_iFlowLength;
+	mutable unsigned int m_iFlowColumns;		// 0 when the summary is not valid
+};
+
 // TODO rename to CTrack perhaps?
 
 // CPatternData holds all notes in the patterns
@@ -40,32 +90,32 @@ public:
 	~CPatternData();
 
 	char GetNote(unsigned int Channel, unsigned int Pattern, unsigned int Row) const { 
-		stChanNote *pNote = GetPatternData(Channel, Pattern, Row);
+		const stChanNote *pNote = GetPatternData(Channel, Pattern, Row);
 		return pNote == NULL ? 0 : pNote->Note; 
 	};
 
 	char GetOctave(unsigned int Channel, unsigned int Pattern, unsigned int Row) const { 
-		stChanNote *pNote = GetPatternData(Channel, Pattern, Row);
+		const stChanNote *pNote = GetPatternData(Channel, Pattern, Row);
 		return pNote == NULL ? 0 : pNote->Octave; 
 	};
 
 	char GetInstrument(unsigned int Channel, unsigned int Pattern, unsigned int Row) const { 
-		stChanNote *pNote = GetPatternData(Channel, Pattern, Row);
+		const stChanNote *pNote = GetPatternData(Channel, Pattern, Row);
 		return pNote == NULL ? 0 : pNote->Instrument; 
 	};
 
 	char GetVolume(unsigned int Channel, unsigned int Pattern, unsigned int Row) const { 
-		stChanNote *pNote = GetPatternData(Channel, Pattern, Row);
+		const stChanNote *pNote = GetPatternData(Channel, Pattern, Row);
 		return pNote == NULL ? 0 : pNote->Vol; 
 	};
 
 	char GetEffect(unsigned int Channel, unsigned int Pattern, unsigned int Row, unsigned int Column) const { 
-		stChanNote *pNote = GetPatternData(Channel, Pattern, Row);
+		const stChanNote *pNote = GetPatternData(Channel, Pattern, Row);
 		return pNote == NULL ? 0 : pNote->EffNumber[Column]; 
 	};
 
 	char GetEffectParam(unsigned int Channel, unsigned int Pattern, unsigned int Row, unsigned int Column) const { 
-		stChanNote *pNote = GetPatternData(Channel, Pattern, Row);
+		const stChanNote *pNote = GetPatternData(Channel, Pattern, Row);
 		return pNote == NULL ? 0 : pNote->EffParam[Column]; 
 	};
 
@@ -79,12 +129,16 @@ public:
 
 	void SetEffectColumnCount(int Channel, int Count) { 
 		m_iEffectColumns[Channel] = Count; 
+		Modified();
 	};
 
 	void ClearEverything();
 	void ClearPattern(unsigned int Channel, unsigned int Pattern);
 
 	stChanNote *GetPatternData(unsigned int Channel, unsigned int Pattern, unsigned int Row);
+	const stChanNote *ReadPatternData(unsigned int Channel, unsigned int Pattern, unsigned int Row) const;
+	const CPatternBlock *GetPatternBlock(unsigned int Channel, unsigned int Pattern) const;
+	const stChanNote *ReadPatternRows(unsigned int Channel, unsigned int Pattern) const;
 
 	unsigned int GetPatternLength() const { 
 		return m_iPatternLength;
@@ -104,18 +158,22 @@ public:
 
 	void SetPatternLength(unsigned int Length) {
 		m_iPatternLength = Length; 
+		Modified();
 	};
 
 	void SetFrameCount(unsigned int Count) {
 		m_iFrameCount = Count;
+		Modified();
 	};
 
 	void SetSongSpeed(unsigned int Speed) {
 		m_iSongSpeed = Speed;
+		Modified();
 	};
 
 	void SetSongTempo(unsigned int Tempo) {
 		m_iSongTempo = Tempo;
+		Modified();
 	};
 
 	unsigned int GetFramePattern(unsigned int Frame, unsigned int Channel) const;
@@ -125,9 +183,20 @@ public:
 	unsigned int GetFirstRowHighlight() const;
 	unsigned int GetSecondRowHighlight() const;
 
+	// Changes every time the track is edited, used to publish player snapshots
+	unsigned int GetRevision() const {
+		return m_iRevision;
+	};
+
 private:
-	stChanNote *GetPatternData(unsigned int Channel, unsigned int Pattern, unsigned int Row) const;
+	const stChanNote *GetPatternData(unsigned int Channel, unsigned int Pattern, unsigned int Row) const;
+	CPatternBlock *GetBlock(unsigned int Channel, unsigned int Pattern) const;
 	void AllocatePattern(unsigned int Channel, unsigned int Patterns);
+	void AllocateFrames(unsigned int Frames);
+	void Modified();
+
+	CPatternData(const CPatternData &Track);
+	CPatternData &operator=(const CPatternData &Track);
 
 	// Pattern data
 private:
@@ -145,9 +214,17 @@ private:
 	// Number of visible effect columns for each channel
 	unsigned char m_iEffectColumns[MAX_CHANNELS];
 
-	// List of the patterns assigned to frames
-	unsigned char m_iFrameList[MAX_FRAMES][MAX_CHANNELS];		
+	// List of the patterns assigned to frames, MAX_CHANNELS entries per frame.
+	// Grows when frames are added, unallocated frames use pattern 0
+	unsigned char *m_pFrameList;
+	unsigned int m_iFramesAllocated;
 
 	// All accesses to m_pPatternData must go through GetPatternData()
-	stChanNote *m_pPatternData[MAX_CHANNELS][MAX_PATTERN];
+	// Each channel grows up to the highest allocated pattern
+	CPatternBlock **m_pPatternData[MAX_CHANNELS];
+	unsigned int m_iPatternsAllocated[MAX_CHANNELS];
+
+	// Edit revision, unique among all tracks
+	unsigned int m_iRevision;
+	static volatile LONG m_iRevisionCounter;
 };
@@ -0,0 +1,200 @@
+/*
+** FamiTracker - NES/Famicom sound tracker
+** Copyright (C) 2005-2014  Jonathan Liss
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+*/
+
+#include <vector>
+#include <algorithm>
+#include "stdafx.h"
+#include "FamiTrackerDoc.h"
+#include "PatternCompiler.h"
+#include "PatternMatcher.h"
+
+/**
+ * CPatternMatcher - Back-reference search for compiled pattern streams
+ *
+ * Patterns are added in the order they are stored. Each row entry is checked against 
+ * earlier data through a hash chain and the longest match that ends on an entry is 
+ * replaced by a call, a call returns when the referenced range ends so the driver 
+ * needs a single level of return address. Calls are never made into other calls.
+ *
+ * A range can only be referenced when the default duration matches, since it decides
+ * whether notes are followed by a duration byte.
+ *
+ * The driver has no call command, the result is only an estimate of the size. The 
+ * referenced data has no return marker so a call is assumed to store the address and 
+ * the length of the range, the return address is kept in RAM.
+ *
+ */
+
+const int CPatternMatcher::WINDOW_SIZE		= 0x1000;	// Stay within one NSF bank
+const int CPatternMatcher::MIN_LENGTH		= 6;		// Saves at least two bytes
+const int CPatternMatcher::MAX_LENGTH		= 0xFF;		// Length is a single byte
+const int CPatternMatcher::REFERENCE_SIZE	= 4;		// Command byte, address and length
+const int CPatternMatcher::MAX_CHAIN		= 64;
+const int CPatternMatcher::HASH_BITS		= 12;
+
+CPatternMatcher::CPatternMatcher() :
+	m_vHashHead(1 << HASH_BITS, -1),
+	m_iInputSize(0),
+	m_iOutputSize(0),
+	m_iReferences(0)
+{
+}
+
+void CPatternMatcher::AddPattern(const std::vector<char> &Data, const std::vector<CPatternCompiler::stEntryPoint> &Entries)
+{
+	unsigned int i = 0;
+
+	m_iInputSize += Data.size();
+
+	while (i < Entries.size() && Entries[i].Position < Data.size()) {
+		unsigned int Start = Entries[i].Position;
+		unsigned int Length = FindMatch(Data, Entries, i);
+
+		if (Length > 0) {
+			AppendReference();
+			// Continue from the entry where the match ended
+			while (i < Entries.size() && Entries[i].Position < Start + Length)
+				++i;
+		}
+		else {
+			unsigned int End = (i + 1 < Entries.size()) ? Entries[i + 1].Position : Data.size();
+			AppendLiteral(Data, Start, End, Entries[i].Duration);
+			++i;
+		}
+	}
+}
+
+unsigned int CPatternMatcher::GetInputSize() const
+{
+	return m_iInputSize;
+}
+
+unsigned int CPatternMatcher::GetOutputSize() const
+{
+	return m_iOutputSize;
+}
+
+unsigned int CPatternMatcher::GetReferenceCount() const
+{
+	return m_iReferences;
+}
+
+unsigned int CPatternMatcher::Hash(const unsigned char *pData, unsigned int Duration) const
+{
+	unsigned int Value = (pData[0] << 24) | (pData[1] << 16) | (pData[2] << 8) | pData[3];
+	Value ^= Duration * 0x9E3779B1;
+	return (Value * 2654435761U) >> (32 - HASH_BITS);
+}
+
+unsigned int CPatternMatcher::FindMatch(const std::vector<char> &Data, const std::vector<CPatternCompiler::stEntryPoint> &Entries, unsigned int Entry) const
+{
+	// Returns the length of the longest earlier copy of the data at Entry, or 0 if no call should be made
+
+	const unsigned int Start = Entries[Entry].Position;
+	const unsigned int Duration = Entries[Entry].Duration;
+
+	if (Start + MIN_LENGTH > Data.size())
+		return 0;
+
+	const unsigned char *pData = reinterpret_cast<const unsigned char*>(&Data[0]);
+	const int WindowEnd = m_vWindow.size();
+
+	unsigned int BestLength = 0;
+	int Chain = 0;
+
+	for (int Pos = m_vHashHead[Hash(pData + Start, Duration)]; Pos != -1 && Chain < MAX_CHAIN; Pos = m_vHashChain[Pos], ++Chain) {
+		if (WindowEnd - Pos > WINDOW_SIZE)
+			break;
+		if (m_vEntryDuration[Pos] != (int)Duration)
+			continue;
+
+		// Compare literal data
+		unsigned int Length = 0;
+		while (Length < (unsigned)MAX_LENGTH && Start + Length < Data.size() && Pos + (int)Length < WindowEnd && m_vLiteral[Pos + Length] && m_vWindow[Pos + Length] == pData[Start + Length])
+			++Length;
+
+		// The call must return on an entry point
+		unsigned int End = Start + Length;
+		if (End < Data.size()) {
+			unsigned int k = Entry;
+			while (k + 1 < Entries.size() && Entries[k + 1].Position <= End)
+				++k;
+			End = Entries[k].Position;
+		}
+
+		if (End - Start > BestLength)
+			BestLength = End - Start;
+	}
+
+	return (BestLength >= (unsigned)MIN_LENGTH) ? BestLength : 0;
+}
+
+void CPatternMatcher::AppendLiteral(const std::vector<char> &Data, unsigned int Start, unsigned int End, unsigned int Duration)
+{
+	m_vPendingEntries.push_back(m_vWindow.size());
+
+	for (unsigned int i = Start; i < End; ++i) {
+		m_vWindow.push_back(Data[i]);
+		m_vLiteral.push_back(true);
+		m_vEntryDuration.push_back(i == Start ? Duration : -1);
+		m_vHashChain.push_back(-1);
+	}
+
+	m_iOutputSize += End - Start;
+
+	InsertEntries();
+}
+
+void CPatternMatcher::AppendReference()
+{
+	for (int i = 0; i < REFERENCE_SIZE; ++i) {
+		m_vWindow.push_back(0);
+		m_vLiteral.push_back(false);
+		m_vEntryDuration.push_back(-1);
+		m_vHashChain.push_back(-1);
+	}
+
+	m_iOutputSize += REFERENCE_SIZE;
+	++m_iReferences;
+
+	InsertEntries();
+}
+
+void CPatternMatcher::InsertEntries()
+{
+	// Add entry points to the hash chains once enough data follows them
+	std::vector<int>::iterator it = m_vPendingEntries.begin();
+
+	for (; it != m_vPendingEntries.end(); ++it) {
+		int Pos = *it;
+		if (Pos + MIN_LENGTH > (int)m_vWindow.size())
+			break;
+		bool Literal = true;
+		for (int i = 0; i < MIN_LENGTH; ++i)
+			Literal = Literal && m_vLiteral[Pos + i];
+		if (Literal) {
+			unsigned int Index = Hash(&m_vWindow[Pos], m_vEntryDuration[Pos]);
+			m_vHashChain[Pos] = m_vHashHead[Index];
+			m_vHashHead[Index] = Pos;
+		}
+	}
+
+	m_vPendingEntries.erase(m_vPendingEntries.begin(), it);
+}
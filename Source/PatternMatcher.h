@@ -0,0 +1,66 @@
+/*
+** FamiTracker - NES/Famicom sound tracker
+** Copyright (C) 2005-2014  Jonathan Liss
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+*/
+
+#pragma once
+
+
+// Finds ranges of compiled pattern data that could be replaced by a call to an earlier copy
+
+class CPatternMatcher
+{
+public:
+	CPatternMatcher();
+
+	void			AddPattern(const std::vector<char> &Data, const std::vector<CPatternCompiler::stEntryPoint> &Entries);
+
+	unsigned int	GetInputSize() const;
+	unsigned int	GetOutputSize() const;
+	unsigned int	GetReferenceCount() const;
+
+public:
+	static const int WINDOW_SIZE;		// Max distance from a call to the referenced data
+	static const int MIN_LENGTH;		// Shortest range replaced by a call
+	static const int MAX_LENGTH;		// Longest range a call can cover
+	static const int REFERENCE_SIZE;	// Size of a call command
+	static const int MAX_CHAIN;			// Max number of earlier positions checked
+	static const int HASH_BITS;
+
+private:
+	unsigned int	Hash(const unsigned char *pData, unsigned int Duration) const;
+	unsigned int	FindMatch(const std::vector<char> &Data, const std::vector<CPatternCompiler::stEntryPoint> &Entries, unsigned int Entry) const;
+	void			AppendLiteral(const std::vector<char> &Data, unsigned int Start, unsigned int End, unsigned int Duration);
+	void			AppendReference();
+	void			InsertEntries();
+
+private:
+	// Output stream of all patterns in the song, calls are not followed into so only literal data is referenced
+	std::vector<unsigned char>	m_vWindow;
+	std::vector<bool>			m_vLiteral;
+	std::vector<int>			m_vEntryDuration;	// Default duration for entry points, -1 for other bytes
+
+	// Hash chains over entry points
+	std::vector<int>			m_vHashHead;
+	std::vector<int>			m_vHashChain;
+	std::vector<int>			m_vPendingEntries;	// Entry points waiting for enough data to be hashed
+
+	unsigned int	m_iInputSize;
+	unsigned int	m_iOutputSize;
+	unsigned int	m_iReferences;
+};
@@ -57,6 +57,8 @@ BOOL CPerformanceDlg::OnInitDialog()
 
 	theApp.GetCPUUsage();
 	theApp.GetSoundGenerator()->GetFrameRate();
+	int Latency, MaxLatency;
+	theApp.GetSoundGenerator()->GetCommandLatency(Latency, MaxLatency);
 
 	SetTimer(1, 1000, NULL);
 
@@ -70,6 +72,8 @@ void CPerformanceDlg::OnTimer(UINT nIDEvent)
 	unsigned int Usage = theApp.GetCPUUsage();
 	unsigned int Rate = theApp.GetSoundGenerator()->GetFrameRate();
 	unsigned int Underruns = theApp.GetSoundGenerator()->GetUnderruns();
+	int Latency, MaxLatency;
+	theApp.GetSoundGenerator()->GetCommandLatency(Latency, MaxLatency);
 	CString Text;
 
 	Text.Format(_T("%i%%"), Usage / 100);
@@ -81,6 +85,12 @@ void CPerformanceDlg::OnTimer(UINT nIDEvent)
 	AfxFormatString1(Text, IDS_PERFORMANCE_UNDERRUN_FORMAT, MakeIntString(Underruns));
 	SetDlgItemText(IDC_UNDERRUN, Text);
 
+	// Only updated when commands were sent
+	if (MaxLatency > 0) {
+		AfxFormatString2(Text, IDS_PERFORMANCE_LATENCY_FORMAT, MakeIntString(Latency / 1000), MakeIntString(MaxLatency / 1000));
+		SetDlgItemText(IDC_LATENCY, Text);
+	}
+
 	pBar->SetRange(0, 100);
 	pBar->SetPos(Usage / 100);
 
@@ -0,0 +1,418 @@
+/*
+** FamiTracker - NES/Famicom sound tracker
+** Copyright (C) 2005-2014  Jonathan Liss
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+*/
+
+#include <vector>
+#include "stdafx.h"
+#include "FamiTracker.h"
+#include "FamiTrackerDoc.h"
+#include "FamiTrackerView.h"
+#include "SoundGen.h"
+#include "RenderService.h"
+
+/*
+ * Render service
+ *
+ * A hidden server process (/renderserver) renders wave files for other processes, the client
+ * (/render) starts the server if needed, sends a request with WM_COPYDATA and waits for a named
+ * event. The server is never an instance the user is editing in, it has its own mutex and window
+ * handle. The document stays loaded between requests and is only parsed again when the module
+ * content changes, the sound generator and its tables are already set up.
+ *
+ */
+
+const TCHAR CRenderService::SERVER_MUTEX_NAME[] = _T("FamiTrackerRenderMutex");
+
+const TCHAR SERVER_MEM_NAME[]	= _T("FamiTrackerRenderWnd");	// Holds the window handle of the server
+const DWORD SERVER_MEM_SIZE		= 256;
+
+CRenderService::CRenderService() : m_bActive(false), m_iRenderCount(0), m_iLoadedHash(0)
+{
+}
+
+CRenderService::~CRenderService()
+{
+	// Clients waiting for queued requests are released
+	for (std::vector<stRenderRequest>::const_iterator it = m_vRequests.begin(); it != m_vRequests.end(); ++it)
+		FinishRequest(*it, false);
+}
+
+bool CRenderService::QueueRequest(LPCTSTR pRequest)
+{
+	stRenderRequest Request;
+
+	if (!ParseRequest(pRequest, Request))
+		return false;
+
+	m_vRequests.push_back(Request);
+
+	return true;
+}
+
+bool CRenderService::IsIdle() const
+{
+	return !m_bActive && m_vRequests.empty();
+}
+
+void CRenderService::Poll()
+{
+	// Called from main thread by a timer
+
+	CSoundGen *pSoundGen = theApp.GetSoundGenerator();
+
+	if (m_bActive) {
+		if (pSoundGen->GetRenderCount() == m_iRenderCount)
+			return;
+		m_bActive = false;
+		CFamiTrackerView::GetView()->UnmuteAllChannels();
+		FinishRequest(m_ActiveRequest, true);
+	}
+
+	// Wait until the previous file is done
+	if (pSoundGen->IsRendering())
+		return;
+
+	while (!m_vRequests.empty()) {
+		stRenderRequest Request = m_vRequests.front();
+		m_vRequests.erase(m_vRequests.begin());
+
+		if (StartRequest(Request)) {
+			m_ActiveRequest = Request;
+			m_bActive = true;
+			return;
+		}
+
+		FinishRequest(Request, false);
+	}
+}
+
+bool CRenderService::StartRequest(stRenderRequest &Request)
+{
+	if (!LoadModule(Request.Module))
+		return false;
+
+	CFamiTrackerDoc *pDoc = CFamiTrackerDoc::GetDoc();
+	CFamiTrackerView *pView = CFamiTrackerView::GetView();
+	CSoundGen *pSoundGen = theApp.GetSoundGenerator();
+
+	if (Request.Track < 0 || Request.Track >= (int)pDoc->GetTrackCount())
+		return false;
+
+	// Same as the wave export dialog
+	pView->UnmuteAllChannels();
+
+	for (unsigned int i = 0; i < pDoc->GetAvailableChannels() && i < 32; ++i) {
+		if (Request.MuteMask & (1 << i))
+			pView->ToggleChannel(i);
+	}
+
+	m_iRenderCount = pSoundGen->GetRenderCount();
+
+	bool bResult = pSoundGen->RenderToFile(Request.Wave.GetBuffer(), SONG_LOOP_LIMIT, Request.Loops < 1 ? 1 : Request.Loops, Request.Track);
+	Request.Wave.ReleaseBuffer();
+
+	if (!bResult)
+		pView->UnmuteAllChannels();
+
+	return bResult;
+}
+
+void CRenderService::FinishRequest(const stRenderRequest &Request, bool bSuccess) const
+{
+	if (Request.Event.IsEmpty())
+		return;
+
+	HANDLE hEvent = OpenEvent(EVENT_MODIFY_STATE, FALSE, bSuccess ? Request.Event : Request.Event + _T("Failed"));
+
+	if (hEvent != NULL) {
+		SetEvent(hEvent);
+		CloseHandle(hEvent);
+	}
+}
+
+bool CRenderService::LoadModule(const CString &Path)
+{
+	// Requests for the module already in the document skips loading
+
+	CFamiTrackerDoc *pDoc = CFamiTrackerDoc::GetDoc();
+	ULONGLONG Hash;
+
+	if (!GetModuleHash(Path, Hash))
+		return false;
+
+	if (Hash == m_iLoadedHash && !m_strLoadedPath.IsEmpty() && !m_strLoadedPath.CompareNoCase(pDoc->GetPathName()))
+		return true;
+
+	m_strLoadedPath.Empty();
+
+	// The document belongs to the server, loading never asks to save it
+	pDoc->SetModifiedFlag(FALSE);
+
+	// The document template does not load a file again if it is already open
+	if (!Path.CompareNoCase(pDoc->GetPathName()))
+		theApp.GetMainWnd()->SendMessage(WM_COMMAND, ID_FILE_NEW);
+
+	theApp.OpenDocumentFile(Path);
+
+	pDoc = CFamiTrackerDoc::GetDoc();
+
+	if (!pDoc->IsFileLoaded() || pDoc->HasLastLoadFailed())
+		return false;
+
+	m_strLoadedPath = pDoc->GetPathName();
+	m_iLoadedHash = Hash;
+
+	return true;
+}
+
+bool CRenderService::GetModuleHash(const CString &Path, ULONGLONG &Hash)
+{
+	// The content hash is computed again when the size or write time of a file has changed
+
+	WIN32_FILE_ATTRIBUTE_DATA Attributes;
+
+	if (!GetFileAttributesEx(Path, GetFileExInfoStandard, &Attributes))
+		return false;
+
+	const ULONGLONG Size = ((ULONGLONG)Attributes.nFileSizeHigh << 32) | Attributes.nFileSizeLow;
+
+	stModuleFile File;
+	bool bFound = false;
+
+	for (std::vector<stModuleFile>::iterator it = m_vModuleFiles.begin(); it != m_vModuleFiles.end(); ++it) {
+		if (!it->Path.CompareNoCase(Path)) {
+			File = *it;
+			bFound = (File.Size == Size && !CompareFileTime(&File.WriteTime, &Attributes.ftLastWriteTime));
+			m_vModuleFiles.erase(it);
+			break;
+		}
+	}
+
+	if (!bFound) {
+		if (!HashFile(Path, File.Hash))
+			return false;
+		File.Path = Path;
+		File.Size = Size;
+		File.WriteTime = Attributes.ftLastWriteTime;
+	}
+
+	m_vModuleFiles.insert(m_vModuleFiles.begin(), File);
+
+	if (m_vModuleFiles.size() > MAX_MODULE_FILES)
+		m_vModuleFiles.pop_back();
+
+	Hash = File.Hash;
+
+	return true;
+}
+
+bool CRenderService::HashFile(const CString &Path, ULONGLONG &Hash)
+{
+	// 64-bit FNV-1a of the file
+
+	CFile File;
+	unsigned char Buffer[0x10000];
+	UINT Count;
+
+	if (!File.Open(Path, CFile::modeRead | CFile::shareDenyWrite))
+		return false;
+
+	Hash = 0xCBF29CE484222325ULL;
+
+	while ((Count = File.Read(Buffer, sizeof(Buffer))) > 0) {
+		for (UINT i = 0; i < Count; ++i) {
+			Hash ^= Buffer[i];
+			Hash *= 0x100000001B3ULL;
+		}
+	}
+
+	File.Close();
+
+	return true;
+}
+
+HANDLE CRenderService::RegisterServer(HWND hWnd)
+{
+	// Called by the server process, publishes the window handle for clients
+	// The returned handle is closed when the server exits
+
+	HANDLE hMapFile = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, SERVER_MEM_SIZE, SERVER_MEM_NAME);
+
+	if (hMapFile != NULL) {
+		LPTSTR pBuf = (LPTSTR) MapViewOfFile(hMapFile, FILE_MAP_ALL_ACCESS, 0, 0, SERVER_MEM_SIZE);
+		if (pBuf != NULL) {
+			_itot_s((int)hWnd, pBuf, SERVER_MEM_SIZE / sizeof(TCHAR), 10);
+			UnmapViewOfFile(pBuf);
+		}
+	}
+
+	return hMapFile;
+}
+
+HWND CRenderService::FindServer()
+{
+	HWND hWnd = NULL;
+	HANDLE hMapFile = OpenFileMapping(FILE_MAP_READ, FALSE, SERVER_MEM_NAME);
+
+	if (hMapFile != NULL) {
+		LPCTSTR pBuf = (LPCTSTR) MapViewOfFile(hMapFile, FILE_MAP_READ, 0, 0, SERVER_MEM_SIZE);
+		if (pBuf != NULL) {
+			hWnd = (HWND)_ttoi(pBuf);
+			UnmapViewOfFile(pBuf);
+		}
+		CloseHandle(hMapFile);
+	}
+
+	if (hWnd != NULL && !IsWindow(hWnd))
+		return NULL;
+
+	return hWnd;
+}
+
+HWND CRenderService::StartServer()
+{
+	// Called by the client process, returns the window of the render server and starts
+	// the server if none is running, returns NULL if it could not be started
+
+	HWND hWnd = FindServer();
+
+	if (hWnd != NULL)
+		return hWnd;
+
+	TCHAR Path[MAX_PATH];
+
+	if (GetModuleFileName(NULL, Path, MAX_PATH) == 0)
+		return NULL;
+
+	CString CommandLine;
+	CommandLine.Format(_T("\"%s\" /renderserver"), Path);
+
+	STARTUPINFO StartupInfo;
+	PROCESS_INFORMATION ProcessInfo;
+
+	memset(&StartupInfo, 0, sizeof(StartupInfo));
+	StartupInfo.cb = sizeof(StartupInfo);
+
+	BOOL bStarted = CreateProcess(Path, CommandLine.GetBuffer(), NULL, NULL, FALSE, 0, NULL, NULL, &StartupInfo, &ProcessInfo);
+	CommandLine.ReleaseBuffer();
+
+	if (!bStarted)
+		return NULL;
+
+	CloseHandle(ProcessInfo.hThread);
+
+	// Another client may have started a server at the same time, the new process then exits
+	// and the window of the other one is found instead
+	for (DWORD Time = 0; Time < SERVER_START_TIMEOUT && hWnd == NULL; Time += 100) {
+		Sleep(100);
+		hWnd = FindServer();
+	}
+
+	CloseHandle(ProcessInfo.hProcess);
+
+	return hWnd;
+}
+
+bool CRenderService::SendRequest(HWND hWnd, const stRenderRequest &Request)
+{
+	// Called by the client process, sends a request to the render server and waits until it is done
+
+	HANDLE hEvents[2];
+	hEvents[0] = CreateEvent(NULL, TRUE, FALSE, Request.Event);
+	hEvents[1] = CreateEvent(NULL, TRUE, FALSE, Request.Event + _T("Failed"));
+
+	CString Text = FormatRequest(Request);
+	bool bSuccess = false;
+
+	COPYDATASTRUCT data;
+	data.dwData = IPC_RENDER;
+	data.cbData = (DWORD)((Text.GetLength() + 1) * sizeof(TCHAR));
+	data.lpData = Text.GetBuffer();
+
+	DWORD_PTR result = FALSE;
+
+	if (hEvents[0] != NULL && hEvents[1] != NULL && SendMessageTimeout(hWnd, WM_COPYDATA, NULL, (LPARAM)&data, SMTO_NORMAL, 1000, &result) && result) {
+		// Stop waiting if the instance is closed
+		for (DWORD Time = 0; Time < RENDER_TIMEOUT && IsWindow(hWnd); Time += 1000) {
+			DWORD Wait = ::WaitForMultipleObjects(2, hEvents, FALSE, 1000);
+			if (Wait != WAIT_TIMEOUT) {
+				bSuccess = (Wait == WAIT_OBJECT_0);
+				break;
+			}
+		}
+	}
+
+	Text.ReleaseBuffer();
+
+	for (int i = 0; i < 2; ++i) {
+		if (hEvents[i] != NULL)
+			CloseHandle(hEvents[i]);
+	}
+
+	return bSuccess;
+}
+
+CString CRenderService::GetFullPath(LPCTSTR pPath)
+{
+	// Client and service have different working directories
+	TCHAR Path[MAX_PATH];
+
+	if (GetFullPathName(pPath, MAX_PATH, Path, NULL) == 0)
+		return CString(pPath);
+
+	return CString(Path);
+}
+
+CString CRenderService::FormatRequest(const stRenderRequest &Request)
+{
+	CString Text;
+	Text.Format(_T("%s\t%s\t%i\t%i\t%X\t%s"), (LPCTSTR)Request.Module, (LPCTSTR)Request.Wave, Request.Track, Request.Loops, Request.MuteMask, (LPCTSTR)Request.Event);
+	return Text;
+}
+
+bool CRenderService::ParseRequest(LPCTSTR pRequest, stRenderRequest &Request)
+{
+	CString Text(pRequest);
+	CString Field[6];
+	int Pos = 0;
+
+	// Only the event name may be empty
+	for (int i = 0; i < 6; ++i) {
+		int Next = Text.Find(_T('\t'), Pos);
+		if (Next == -1) {
+			if (i < 5)
+				return false;
+			Next = Text.GetLength();
+		}
+		Field[i] = Text.Mid(Pos, Next - Pos);
+		Pos = Next + 1;
+	}
+
+	if (Field[0].IsEmpty() || Field[1].IsEmpty())
+		return false;
+
+	Request.Module = Field[0];
+	Request.Wave = Field[1];
+	Request.Track = _ttoi(Field[2]);
+	Request.Loops = _ttoi(Field[3]);
+	Request.MuteMask = _tcstoul(Field[4], NULL, 16);
+	Request.Event = Field[5];
+
+	return true;
+}
@@ -0,0 +1,89 @@
+/*
+** FamiTracker - NES/Famicom sound tracker
+** Copyright (C) 2005-2014  Jonathan Liss
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+*/
+
+#pragma once
+
+// Render request, sent from another process as tab separated text
+struct stRenderRequest {
+	CString		 Module;
+	CString		 Wave;
+	int			 Track;
+	int			 Loops;
+	unsigned int MuteMask;			// Channels to mute, bit 0 is the first channel
+	CString		 Event;				// Named event set when done, empty if nobody waits
+};
+
+// Cached content hash of a module file
+struct stModuleFile {
+	CString		 Path;
+	ULONGLONG	 Size;
+	FILETIME	 WriteTime;
+	ULONGLONG	 Hash;
+};
+
+// Renders modules to wave files on request from other processes, see IPC_RENDER
+class CRenderService
+{
+public:
+	CRenderService();
+	~CRenderService();
+
+	bool QueueRequest(LPCTSTR pRequest);
+	bool IsIdle() const;
+	void Poll();
+
+	static HANDLE RegisterServer(HWND hWnd);
+	static HWND StartServer();
+	static bool SendRequest(HWND hWnd, const stRenderRequest &Request);
+	static CString GetFullPath(LPCTSTR pPath);
+
+	static CString FormatRequest(const stRenderRequest &Request);
+	static bool ParseRequest(LPCTSTR pRequest, stRenderRequest &Request);
+
+private:
+	bool StartRequest(stRenderRequest &Request);
+	void FinishRequest(const stRenderRequest &Request, bool bSuccess) const;
+	bool LoadModule(const CString &Path);
+	bool GetModuleHash(const CString &Path, ULONGLONG &Hash);
+
+	static bool HashFile(const CString &Path, ULONGLONG &Hash);
+	static HWND FindServer();
+
+public:
+	static const TCHAR SERVER_MUTEX_NAME[];					// Held by the render server process
+	static const DWORD RENDER_TIMEOUT = 60 * 60 * 1000;	// Max time a client waits for a render
+	static const DWORD SERVER_START_TIMEOUT = 30 * 1000;	// Max time a client waits for the server to start
+	static const UINT  SERVER_IDLE_TIMEOUT = 5 * 60 * 1000;	// The server exits when idle this long
+
+private:
+	static const unsigned int MAX_MODULE_FILES = 64;		// Module hashes kept
+
+private:
+	std::vector<stRenderRequest> m_vRequests;
+	std::vector<stModuleFile> m_vModuleFiles;				// Most recently used first
+
+	stRenderRequest	m_ActiveRequest;
+	bool			m_bActive;
+	unsigned int	m_iRenderCount;				// Render count of the sound generator when the request started
+
+	// The module currently in the document
+	CString			m_strLoadedPath;
+	ULONGLONG		m_iLoadedHash;
+};
@@ -22,11 +22,16 @@
 #include "Sequence.h"
 #include "DocumentFile.h"
 
-CSequence::CSequence()
+CSequence::CSequence() : m_pValues(NULL)
 {
 	Clear();
 }
 
+CSequence::~CSequence()
+{
+	SAFE_RELEASE_ARRAY(m_pValues);
+}
+
 void CSequence::Clear()
 {
 	m_iItemCount = 0;
@@ -34,15 +39,34 @@ void CSequence::Clear()
 	m_iReleasePoint = -1;
 	m_iSetting = 0;
 
-	memset(m_cValues, 0, sizeof(char) * MAX_SEQUENCE_ITEMS);
+	// The item buffer is never released while the sequence exists since
+	// the player thread may be reading it
+	if (m_pValues != NULL)
+		memset(m_pValues, 0, sizeof(char) * MAX_SEQUENCE_ITEMS);
 
 	m_iPlaying = -1;
 }
 
+void CSequence::Allocate()
+{
+	// Sequences that are never written use no item storage, items read as zero until then
+	if (m_pValues != NULL)
+		return;
+
+	signed char *pValues = new signed char[MAX_SEQUENCE_ITEMS];
+	memset(pValues, 0, sizeof(char) * MAX_SEQUENCE_ITEMS);
+	m_pValues = pValues;
+}
+
 void CSequence::SetItem(int Index, signed char Value)
 {
-	ASSERT(Index <= MAX_SEQUENCE_ITEMS);
-	m_cValues[Index] = Value;
+	ASSERT(Index >= 0 && Index < MAX_SEQUENCE_ITEMS);
+
+	if (Index < 0 || Index >= MAX_SEQUENCE_ITEMS)
+		return;
+
+	Allocate();
+	m_pValues[Index] = Value;
 }
 
 void CSequence::SetItemCount(unsigned int Count)
@@ -81,7 +105,13 @@ void CSequence::SetSetting(unsigned int Setting)
 signed char CSequence::GetItem(int Index) const
 {
 	ASSERT(Index <= MAX_SEQUENCE_ITEMS);
-	return m_cValues[Index];
+
+	const signed char *pValues = m_pValues;
+
+	if (pValues == NULL || Index < 0 || Index >= MAX_SEQUENCE_ITEMS)
+		return 0;
+
+	return pValues[Index];
 }
 
 unsigned int CSequence::GetItemCount() const
@@ -104,6 +134,13 @@ unsigned int CSequence::GetSetting() const
 	return m_iSetting;
 }
 
+const signed char *CSequence::ReadItems(unsigned int &Stored) const
+{
+	// Direct read access, items from Stored and up are zero
+	Stored = (m_pValues != NULL) ? MAX_SEQUENCE_ITEMS : 0;
+	return m_pValues;
+}
+
 void CSequence::Copy(const CSequence *pSeq)
 {
 	// Copy all values from pSeq
@@ -112,5 +149,11 @@ void CSequence::Copy(const CSequence *pSeq)
 	m_iReleasePoint = pSeq->m_iReleasePoint;
 	m_iSetting = pSeq->m_iSetting;
 
-	memcpy(m_cValues, pSeq->m_cValues, MAX_SEQUENCE_ITEMS);
+	if (pSeq->m_pValues != NULL) {
+		Allocate();
+		memcpy(m_pValues, pSeq->m_pValues, sizeof(char) * MAX_SEQUENCE_ITEMS);
+	}
+	else if (m_pValues != NULL) {
+		memset(m_pValues, 0, sizeof(char) * MAX_SEQUENCE_ITEMS);
+	}
 }
@@ -31,6 +31,7 @@ class CDocumentFile;
 class CSequence: public CSequenceInterface {
 public:
 	CSequence();
+	~CSequence();
 
 	void		 Clear();
 	signed char	 GetItem(int Index) const;
@@ -38,6 +39,7 @@ public:
 	unsigned int GetLoopPoint() const;
 	unsigned int GetReleasePoint() const;
 	unsigned int GetSetting() const;
+	const signed char *ReadItems(unsigned int &Stored) const;
 	void		 SetItem(int Index, signed char Value);
 	void		 SetItemCount(unsigned int Count);
 	void		 SetLoopPoint(unsigned int Point);
@@ -45,13 +47,19 @@ public:
 	void		 SetSetting(unsigned int Setting); 
 	void		 Copy(const CSequence *pSeq);
 
+private:
+	CSequence(const CSequence &Seq);
+	CSequence &operator=(const CSequence &Seq);
+
+	void		 Allocate();
+
 private:
 	// Sequence data
 	unsigned int m_iItemCount;
 	unsigned int m_iLoopPoint;
 	unsigned int m_iReleasePoint;
 	unsigned int m_iSetting;
-	signed char	 m_cValues[MAX_SEQUENCE_ITEMS];
+	signed char	 *volatile m_pValues;	// Allocated on first write and kept, the player reads it without locking
 	int			 m_iPlaying;
 };
 
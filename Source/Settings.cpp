@@ -100,6 +100,8 @@ void CSettings::SetupSettings()
 	SETTING_BOOL("General", "Preview full row", false, &General.bPreviewFullRow);
 	SETTING_BOOL("General", "Display flats", false, &General.bDisplayFlats);
 	SETTING_BOOL("General", "Double click selection", false, &General.bDblClickSelect);
+	SETTING_BOOL("General", "Compress modules", false, &General.bCompressModules);
+	SETTING_BOOL("General", "Auto save", true, &General.bAutoSave);
 
 	// Keys
 	SETTING_INT("Keys", "Note cut",		0x31, &Keys.iKeyNoteCut);
@@ -116,6 +118,8 @@ void CSettings::SetupSettings()
 	SETTING_INT("Sound", "Treble filter freq", 12000, &Sound.iTrebleFilter);
 	SETTING_INT("Sound", "Treble filter damping", 24, &Sound.iTrebleDamping);
 	SETTING_INT("Sound", "Volume", 100, &Sound.iMixVolume);
+	SETTING_INT("Sound", "Output", 0, &Sound.iOutput);	// See audio_output_t
+	SETTING_STRING("Sound", "Output file", _T(""), &Sound.strOutputFile);
 
 	// Midi
 	SETTING_INT("MIDI", "Device", 0, &Midi.iMidiDevice);
@@ -169,6 +173,10 @@ void CSettings::SetupSettings()
 	SETTING_INT("Mixer", "FDS", 0, &ChipLevels.iLevelFDS);
 	SETTING_INT("Mixer", "N163", 0, &ChipLevels.iLevelN163);
 	SETTING_INT("Mixer", "S5B", 0, &ChipLevels.iLevelS5B);
+
+	// Export
+	SETTING_BOOL("Export", "Profile driver", false, &Export.bProfileDriver);
+	SETTING_INT("Export", "Cycle warning", 100, &Export.iCycleWarning);
 }
 
 template<class T> void CSettings::AddSetting(LPCTSTR pSection, LPCTSTR pEntry, T tDefault, T* pVariable)
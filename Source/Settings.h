@@ -119,6 +119,8 @@ public:
 		bool	bPreviewFullRow;
 		bool	bDisplayFlats;
 		bool	bDblClickSelect;
+		bool	bCompressModules;
+		bool	bAutoSave;
 	} General;
 
 	struct {
@@ -130,6 +132,8 @@ public:
 		int		iTrebleFilter;
 		int		iTrebleDamping;
 		int		iMixVolume;
+		int		iOutput;
+		CString	strOutputFile;
 	} Sound;
 
 	struct {
@@ -187,6 +191,11 @@ public:
 		int		iLevelS5B;
 	} ChipLevels;
 
+	struct {
+		bool	bProfileDriver;
+		int		iCycleWarning;		// Percent of a frame
+	} Export;
+
 	CString InstrumentMenuPath;
 
 private:
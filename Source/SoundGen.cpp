@@ -47,12 +47,17 @@
 #include "ChannelsN163.h"
 #include "ChannelsS5B.h"
 #include "SoundGen.h"
+#include "CommandQueue.h"
 #include "Settings.h"
 #include "TrackerChannel.h"
+#include "TrackSnapshot.h"
 #include "MIDI.h"
 
 #ifdef EXPORT_TEST
 #include "ExportTest/ExportTest.h"
+
+// Register writes from the player, compared to the exported NSF
+static CRegisterState InternalRegs;
 #endif /* EXPORT_TEST */
 
 // 1kHz test tone
@@ -67,6 +72,12 @@
 // Enable audio dithering
 //#define DITHERING
 
+// Use SSE2 for sample conversion
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SSE2_CONVERSION
+#include <emmintrin.h>
+#endif
+
 // The depth of each vibrato level
 const double CSoundGen::NEW_VIBRATO_DEPTH[] = {
 	1.0, 1.5, 2.5, 4.0, 5.0, 7.0, 10.0, 12.0, 14.0, 17.0, 22.0, 30.0, 44.0, 64.0, 96.0, 128.0
@@ -79,19 +90,6 @@ const double CSoundGen::OLD_VIBRATO_DEPTH[] = {
 IMPLEMENT_DYNCREATE(CSoundGen, CWinThread)
 
 BEGIN_MESSAGE_MAP(CSoundGen, CWinThread)
-	ON_THREAD_MESSAGE(WM_USER_SILENT_ALL, OnSilentAll)
-	ON_THREAD_MESSAGE(WM_USER_LOAD_SETTINGS, OnLoadSettings)
-	ON_THREAD_MESSAGE(WM_USER_PLAY, OnStartPlayer)
-	ON_THREAD_MESSAGE(WM_USER_STOP, OnStopPlayer)
-	ON_THREAD_MESSAGE(WM_USER_RESET, OnResetPlayer)
-	ON_THREAD_MESSAGE(WM_USER_START_RENDER, OnStartRender)
-	ON_THREAD_MESSAGE(WM_USER_STOP_RENDER, OnStopRender)
-	ON_THREAD_MESSAGE(WM_USER_PREVIEW_SAMPLE, OnPreviewSample)
-	ON_THREAD_MESSAGE(WM_USER_WRITE_APU, OnWriteAPU)
-	ON_THREAD_MESSAGE(WM_USER_CLOSE_SOUND, OnCloseSound)
-	ON_THREAD_MESSAGE(WM_USER_SET_CHIP, OnSetChip)
-	ON_THREAD_MESSAGE(WM_USER_VERIFY_EXPORT, OnVerifyExport)
-	ON_THREAD_MESSAGE(WM_USER_REMOVE_DOCUMENT, OnRemoveDocument)
 END_MESSAGE_MAP()
 
 #ifdef DITHERING
@@ -102,12 +100,16 @@ CSoundGen::CSoundGen() :
 	m_pAPU(NULL),
 	m_pSampleMem(NULL),
 	m_pDSound(NULL),
-	m_pDSoundChannel(NULL),
+	m_pAudioSink(NULL),
 	m_pAccumBuffer(NULL),
 	m_iGraphBuffer(NULL),
 	m_pDocument(NULL),
 	m_pTrackerView(NULL),
+	m_pSnapshot(NULL),
+	m_iSnapshotSerial(0),
+	m_iSnapshotTrack(-1),
 	m_bRendering(false),
+	m_iRenderCount(0),
 	m_bPlaying(false),
 	m_bHaltRequest(false),
 	m_pPreviewSample(NULL),
@@ -128,6 +130,14 @@ CSoundGen::CSoundGen() :
 	m_bBufferUnderrun(false),
 	m_bAudioClipping(false),
 	m_iClipCounter(0),
+	m_iBlockPeak(0),
+	m_iBlockClips(0),
+	m_iPeakLevel(0),
+	m_iClippedSamples(0),
+	m_iLatencySum(0),
+	m_iLatencyCount(0),
+	m_iLatencyMax(0),
+	m_iPendingLatencyCount(0),
 	m_pSequencePlayPos(NULL),
 	m_iSequencePlayPos(0),
 	m_iSequenceTimeout(0)
@@ -143,6 +153,9 @@ CSoundGen::CSoundGen() :
 	// Create all kinds of channels
 	CreateChannels();
 
+	m_pCommandQueue = new CCommandQueue();
+	QueryPerformanceFrequency(&m_iPerfFrequency);
+
 #ifdef EXPORT_TEST
 	m_bExportTesting = false;
 #endif /* EXPORT_TEST */
@@ -153,6 +166,7 @@ CSoundGen::~CSoundGen()
 	// Delete APU
 	SAFE_RELEASE(m_pAPU);
 	SAFE_RELEASE(m_pSampleMem);
+	SAFE_RELEASE(m_pCommandQueue);
 
 	// Remove channels
 	for (int i = 0; i < CHANNELS; ++i) {
@@ -278,7 +292,7 @@ void CSoundGen::RemoveDocument()
 	StopPlayer();
 	WaitForStop();
 
-	PostThreadMessage(WM_USER_REMOVE_DOCUMENT, 0, 0);
+	PostCommand(CMD_REMOVE_DOCUMENT, 0, 0);
 
 	// Wait 5s for thread to clear the pointer
 	for (int i = 0; i < 50 && m_pDocument != NULL; ++i)
@@ -335,7 +349,7 @@ void CSoundGen::SelectChip(int Chip)
 		return;
 	}
 
-	PostThreadMessage(WM_USER_SET_CHIP, Chip, 0);
+	PostCommand(CMD_SET_CHIP, Chip, 0);
 }
 
 CChannelHandler *CSoundGen::GetChannel(int Index) const
@@ -364,7 +378,11 @@ void CSoundGen::StartPlayer(play_mode_t Mode, int Track)
 	if (!m_hThread)
 		return;
 
-	PostThreadMessage(WM_USER_PLAY, Mode, Track);
+	// Make sure the player starts with the current pattern data
+	if (m_pDocument != NULL)
+		m_pDocument->PublishSnapshots();
+
+	PostCommand(CMD_PLAY, Mode, Track);
 }
 
 void CSoundGen::StopPlayer()
@@ -372,7 +390,7 @@ void CSoundGen::StopPlayer()
 	if (!m_hThread)
 		return;
 
-	PostThreadMessage(WM_USER_STOP, 0, 0);
+	PostCommand(CMD_STOP, 0, 0);
 }
 
 void CSoundGen::ResetPlayer(int Track)
@@ -380,7 +398,10 @@ void CSoundGen::ResetPlayer(int Track)
 	if (!m_hThread)
 		return;
 
-	PostThreadMessage(WM_USER_RESET, Track, 0);
+	if (m_pDocument != NULL)
+		m_pDocument->PublishSnapshots();
+
+	PostCommand(CMD_RESET, Track, 0);
 }
 
 void CSoundGen::LoadSettings()
@@ -388,7 +409,7 @@ void CSoundGen::LoadSettings()
 	if (!m_hThread)
 		return;
 
-	PostThreadMessage(WM_USER_LOAD_SETTINGS, 0, 0);
+	PostCommand(CMD_LOAD_SETTINGS, 0, 0);
 }
 
 void CSoundGen::SilentAll()
@@ -396,7 +417,45 @@ void CSoundGen::SilentAll()
 	if (!m_hThread)
 		return;
 
-	PostThreadMessage(WM_USER_SILENT_ALL, 0, 0);
+	PostCommand(CMD_SILENT_ALL, 0, 0);
+}
+
+bool CSoundGen::PostCommand(player_command_t Command, WPARAM wParam, LPARAM lParam)
+{
+	// Send a command to the player thread
+	if (!m_hThread)
+		return false;
+
+	stPlayerCommand Cmd;
+	Cmd.Command = Command;
+	Cmd.wParam = wParam;
+	Cmd.lParam = lParam;
+
+	return PushCommand(Cmd);
+}
+
+bool CSoundGen::PushCommand(stPlayerCommand &Command)
+{
+	QueryPerformanceCounter(&Command.Timestamp);
+
+	if (m_pCommandQueue->Push(Command))
+		return true;
+
+	// Queue is full, the player thread can't wait for itself
+	if (GetCurrentThreadId() == m_nThreadID) {
+		TRACE0("SoundGen: Command queue overflow!\n");
+		return false;
+	}
+
+	// Wait for the player to catch up
+	for (int i = 0; i < AUDIO_TIMEOUT; ++i) {
+		Sleep(1);
+		if (m_pCommandQueue->Push(Command))
+			return true;
+	}
+
+	TRACE0("SoundGen: Command queue timeout!\n");
+	return false;
 }
 
 void CSoundGen::WriteAPU(int Address, char Value)
@@ -405,7 +464,7 @@ void CSoundGen::WriteAPU(int Address, char Value)
 		return;
 
 	// Direct APU interface
-	PostThreadMessage(WM_USER_WRITE_APU, (WPARAM)Address, (LPARAM)Value);
+	PostCommand(CMD_WRITE_APU, (WPARAM)Address, (LPARAM)Value);
 }
 
 void CSoundGen::PreviewSample(CDSample *pSample, int Offset, int Pitch)
@@ -415,7 +474,7 @@ void CSoundGen::PreviewSample(CDSample *pSample, int Offset, int Pitch)
 
 	// Preview a DPCM sample. If the name of sample is null, 
 	// the sample will be removed after played
-	PostThreadMessage(WM_USER_PREVIEW_SAMPLE, (WPARAM)pSample, MAKELPARAM(Offset, Pitch));
+	PostCommand(CMD_PREVIEW_SAMPLE, (WPARAM)pSample, MAKELPARAM(Offset, Pitch));
 }
 
 void CSoundGen::CancelPreviewSample()
@@ -504,6 +563,7 @@ bool CSoundGen::ResetAudioDevice()
 	unsigned int SampleRate = pSettings->Sound.iSampleRate;
 	unsigned int BufferLen	= pSettings->Sound.iBufferLength;
 	unsigned int Device		= pSettings->Sound.iDevice;
+	unsigned int Output		= pSettings->Sound.iOutput;
 
 	m_iSampleSize = SampleSize;
 	m_iAudioUnderruns = 0;
@@ -512,37 +572,52 @@ bool CSoundGen::ResetAudioDevice()
 	// Close the old sound channel
 	CloseAudioDevice();
 
-	if (Device >= m_pDSound->GetDeviceCount()) {
-		// Invalid device detected, reset to 0
-		Device = 0;
-		pSettings->Sound.iDevice = 0;
-	}
-
-	// Reinitialize direct sound
-	if (!m_pDSound->SetupDevice(Device)) {
-		AfxMessageBox(IDS_DSOUND_ERROR, MB_ICONERROR);
-		return false;
-	}
-
 	int iBlocks = 2;	// default = 2
 
 	// Create more blocks if a bigger buffer than 100ms is used to reduce lag
 	if (BufferLen > 100)
 		iBlocks += (BufferLen / 66);
 
-	// Create channel
-	m_pDSoundChannel = m_pDSound->OpenChannel(SampleRate, SampleSize, 1, BufferLen, iBlocks);
+	if (Output == OUTPUT_NULL) {
+		// No sound device
+		m_pAudioSink = new CNullAudioSink(m_hInterruptEvent, SampleRate, SampleSize, 1, BufferLen, iBlocks);
+	}
+	else if (Output == OUTPUT_WAVE) {
+		// Stream to file
+		CWaveAudioSink *pWaveSink = new CWaveAudioSink(m_hInterruptEvent, SampleRate, SampleSize, 1, BufferLen, iBlocks);
+		if (!pWaveSink->OpenFile(pSettings->Sound.strOutputFile))
+			TRACE0("SoundGen: Could not open audio output file\n");
+		m_pAudioSink = pWaveSink;
+	}
+	else {
+		if (Device >= m_pDSound->GetDeviceCount()) {
+			// Invalid device detected, reset to 0
+			Device = 0;
+			pSettings->Sound.iDevice = 0;
+		}
 
-	// Channel failed
-	if (m_pDSoundChannel == NULL) {
-		AfxMessageBox(IDS_DSOUND_BUFFER_ERROR, MB_ICONERROR);
-		return false;
+		// Reinitialize direct sound
+		if (!m_pDSound->SetupDevice(Device)) {
+			AfxMessageBox(IDS_DSOUND_ERROR, MB_ICONERROR);
+			return false;
+		}
+
+		// Create channel
+		m_pAudioSink = m_pDSound->OpenChannel(SampleRate, SampleSize, 1, BufferLen, iBlocks);
+
+		// Channel failed
+		if (m_pAudioSink == NULL) {
+			AfxMessageBox(IDS_DSOUND_BUFFER_ERROR, MB_ICONERROR);
+			return false;
+		}
 	}
 
 	// Create a buffer
-	m_iBufSizeBytes	  = m_pDSoundChannel->GetBlockSize();
+	m_iBufSizeBytes	  = m_pAudioSink->GetBlockSize();
 	m_iBufSizeSamples = m_iBufSizeBytes / (SampleSize / 8);
 
+	m_AudioStats.Reset(m_iBufSizeSamples, SampleRate);
+
 	// Temp. audio buffer
 	SAFE_RELEASE_ARRAY(m_pAccumBuffer);
 	m_pAccumBuffer = new char[m_iBufSizeBytes];
@@ -594,11 +669,14 @@ bool CSoundGen::ResetAudioDevice()
 
 void CSoundGen::CloseAudioDevice()
 {
-	// Kill DirectSound
-	if (m_pDSoundChannel) {
-		m_pDSoundChannel->Stop();
-		m_pDSound->CloseChannel(m_pDSoundChannel);
-		m_pDSoundChannel = NULL;
+	// Close audio output
+	if (m_pAudioSink) {
+		stAudioStats Stats;
+		m_AudioStats.GetStats(Stats);
+		TRACE("SoundGen: Audio closed, %i blocks, %i underruns, jitter %i us (max %i us)\n", Stats.Blocks, Stats.Underruns, Stats.AverageJitter, Stats.MaxJitter);
+
+		m_pAudioSink->Stop();
+		SAFE_RELEASE(m_pAudioSink);
 	}
 }
 
@@ -628,20 +706,22 @@ void CSoundGen::ResetBuffer()
 
 	m_iBufferPtr = 0;
 
-	if (m_pDSoundChannel)
-		m_pDSoundChannel->ClearBuffer();
+	if (m_pAudioSink)
+		m_pAudioSink->ClearBuffer();
+
+	m_AudioStats.Restart();
 
 	m_pAPU->Reset();
 }
 
-void CSoundGen::FlushBuffer(int16 *pBuffer, uint32 Size)
+void CSoundGen::FlushBuffer(int32 *pBuffer, uint32 Size)
 {
 	// Callback method from emulation
 
 	// May only be called from sound player thread
 	ASSERT(GetCurrentThreadId() == m_nThreadID);
 
-	if (!m_pDSoundChannel)
+	if (!m_pAudioSink)
 		return;
 
 #ifdef EXPORT_TEST
@@ -649,10 +729,12 @@ void CSoundGen::FlushBuffer(int16 *pBuffer, uint32 Size)
 		return;
 #endif /* EXPORT_TEST */
 
-	if (m_iSampleSize == 8)
-		FillBuffer<uint8, 8>(pBuffer, Size);
-	else
-		FillBuffer<int16, 0>(pBuffer, Size);
+	switch (m_iSampleSize) {
+		case 8:	 FillBuffer<SAMPLE_U8>(pBuffer, Size); break;
+		case 24: FillBuffer<SAMPLE_S24>(pBuffer, Size); break;
+		case 32: FillBuffer<SAMPLE_FLOAT>(pBuffer, Size); break;
+		default: FillBuffer<SAMPLE_S16>(pBuffer, Size); break;
+	}
 
 	if (m_iClipCounter > 50) {
 		// Ignore some clipping to allow the HP-filter adjust itself
@@ -663,23 +745,150 @@ void CSoundGen::FlushBuffer(int16 *pBuffer, uint32 Size)
 		--m_iClipCounter;
 }
 
-template <class T, int SHIFT>
-void CSoundGen::FillBuffer(int16 *pBuffer, uint32 Size)
+// Mixer output is 24-bit, samples outside this range are clipped except for float output
+static const int32 SAMPLE_MAX = 0x7FFFFF;
+static const int32 SAMPLE_MIN = -0x800000;
+
+template <int FORMAT>
+static inline void StoreSample(int32 Sample, char *pDest)
+{
+	switch (FORMAT) {
+		case SAMPLE_U8:
+			*(uint8*)pDest = uint8((Sample >> 16) ^ 0x80);
+			break;
+		case SAMPLE_S16:
+			*(int16*)pDest = int16(Sample >> 8);
+			break;
+		case SAMPLE_S24:
+			pDest[0] = char(Sample);
+			pDest[1] = char(Sample >> 8);
+			pDest[2] = char(Sample >> 16);
+			break;
+		case SAMPLE_FLOAT:
+			*(float*)pDest = float(Sample) * (1.0f / 8388608.0f);
+			break;
+	}
+}
+
+// Converts a span of samples to the output format and copies them to the visualizer buffer.
+// Returns the number of clipped samples, Peak is raised to the largest absolute sample value.
+template <int FORMAT>
+static int ConvertSamples(const int32 *pSrc, char *pDest, short *pGraph, uint32 Count, int &Peak)
+{
+	const int SIZE = SAMPLE_BYTES(FORMAT);
+
+	int Clipped = 0;
+	int32 High = 0;
+	int32 Low = 0;
+	uint32 i = 0;
+
+#ifdef SSE2_CONVERSION
+	// Four samples at a time
+	const __m128i Max = _mm_set1_epi32(SAMPLE_MAX);
+	const __m128i Min = _mm_set1_epi32(SAMPLE_MIN);
+	const __m128i Zero = _mm_setzero_si128();
+
+	__m128i HighSamples = Zero;
+	__m128i LowSamples = Zero;
+
+	for (; i + 4 <= Count; i += 4) {
+		__m128i Samples = _mm_loadu_si128((const __m128i*)(pSrc + i));
+
+		// Clip to 24 bits, SSE2 has no 32-bit min/max so masks are used
+		__m128i Over = _mm_cmpgt_epi32(Samples, Max);
+		__m128i Under = _mm_cmplt_epi32(Samples, Min);
+		__m128i Outside = _mm_or_si128(Over, Under);
+		__m128i Clamped = _mm_or_si128(_mm_andnot_si128(Outside, Samples), _mm_or_si128(_mm_and_si128(Over, Max), _mm_and_si128(Under, Min)));
+
+		// Clip detection, rare so the bits are only counted when set
+		for (int Mask = _mm_movemask_ps(_mm_castsi128_ps(Outside)); Mask != 0; Mask &= Mask - 1)
+			++Clipped;
+
+		__m128i Higher = _mm_cmpgt_epi32(Clamped, HighSamples);
+		__m128i Lower = _mm_cmplt_epi32(Clamped, LowSamples);
+		HighSamples = _mm_or_si128(_mm_and_si128(Higher, Clamped), _mm_andnot_si128(Higher, HighSamples));
+		LowSamples = _mm_or_si128(_mm_and_si128(Lower, Clamped), _mm_andnot_si128(Lower, LowSamples));
+
+		// Visualizer
+		__m128i Words = _mm_packs_epi32(_mm_srai_epi32(Clamped, 8), Zero);
+		_mm_storel_epi64((__m128i*)(pGraph + i), Words);
+
+		// Convert
+		switch (FORMAT) {
+			case SAMPLE_U8: {
+					__m128i Bytes = _mm_packs_epi16(_mm_srai_epi16(Words, 8), Zero);
+					*(int*)(pDest + i) = _mm_cvtsi128_si32(_mm_xor_si128(Bytes, _mm_set1_epi8((char)0x80)));
+				}
+				break;
+			case SAMPLE_S16:
+				_mm_storel_epi64((__m128i*)(pDest + i * 2), Words);
+				break;
+			case SAMPLE_S24: {
+					int32 Values[4];
+					_mm_storeu_si128((__m128i*)Values, Clamped);
+					for (int j = 0; j < 4; ++j)
+						StoreSample<SAMPLE_S24>(Values[j], pDest + (i + j) * 3);
+				}
+				break;
+			case SAMPLE_FLOAT:
+				_mm_storeu_ps((float*)(pDest + i * 4), _mm_mul_ps(_mm_cvtepi32_ps(Samples), _mm_set1_ps(1.0f / 8388608.0f)));
+				break;
+		}
+	}
+
+	int32 HighValues[4], LowValues[4];
+	_mm_storeu_si128((__m128i*)HighValues, HighSamples);
+	_mm_storeu_si128((__m128i*)LowValues, LowSamples);
+	for (int j = 0; j < 4; ++j) {
+		High = max(High, HighValues[j]);
+		Low = min(Low, LowValues[j]);
+	}
+#endif /* SSE2_CONVERSION */
+
+	// Remaining samples
+	for (; i < Count; ++i) {
+		int32 Sample = pSrc[i];
+		int32 Clamped = Sample;
+
+		if (Sample > SAMPLE_MAX) {
+			Clamped = SAMPLE_MAX;
+			++Clipped;
+		}
+		else if (Sample < SAMPLE_MIN) {
+			Clamped = SAMPLE_MIN;
+			++Clipped;
+		}
+
+		High = max(High, Clamped);
+		Low = min(Low, Clamped);
+
+		pGraph[i] = short(Clamped >> 8);
+
+		// Float keeps the headroom
+		StoreSample<FORMAT>((FORMAT == SAMPLE_FLOAT) ? Sample : Clamped, pDest + i * SIZE);
+	}
+
+	Peak = max(Peak, (int)max(High, -Low));
+
+	return Clipped;
+}
+
+template <int FORMAT>
+void CSoundGen::FillBuffer(int32 *pBuffer, uint32 Size)
 {
 	// Called when the APU audio buffer is full and
 	// ready for playing
 
-	const int SAMPLE_MAX = 32768;
-
-	T *pConversionBuffer = (T*)m_pAccumBuffer;
+	const int SIZE = SAMPLE_BYTES(FORMAT);
 
+#if defined(AUDIO_TEST) || defined(DITHERING)
 	for (uint32 i = 0; i < Size; ++i) {
-		int16 Sample = pBuffer[i];
+		int32 Sample = pBuffer[i];
 
 		// 1000 Hz test tone
 #ifdef AUDIO_TEST
 		static double sine_phase = 0;
-		Sample = int32(sin(sine_phase) * 10000.0);
+		Sample = int32(sin(sine_phase) * 10000.0) << 8;
 
 		static double freq = 1000;
 		// Sweep
@@ -687,33 +896,45 @@ void CSoundGen::FillBuffer(int16 *pBuffer, uint32 Size)
 		if (freq > 20000)
 			freq = 20;
 
-		sine_phase += freq / (double(m_pDSoundChannel->GetSampleRate()) / 6.283184);
+		sine_phase += freq / (double(m_pAudioSink->GetSampleRate()) / 6.283184);
 		if (sine_phase > 6.283184)
 			sine_phase -= 6.283184;
 #endif /* AUDIO_TEST */
 
-		// Clip detection
-		if (Sample == (SAMPLE_MAX - 1) || Sample == -SAMPLE_MAX) {
-			++m_iClipCounter;
-		}
+#ifdef DITHERING
+		if (FORMAT == SAMPLE_U8)
+			Sample += dither(1 << 16);
+		else if (FORMAT == SAMPLE_S16)
+			Sample += dither(1 << 8);
+#endif
 
 		ASSERT(m_iBufferPtr < m_iBufSizeSamples);
 
-		// Visualizer
-		m_iGraphBuffer[m_iBufferPtr] = (short)Sample;
+		int Clipped = ConvertSamples<FORMAT>(&Sample, m_pAccumBuffer + m_iBufferPtr * SIZE, m_iGraphBuffer + m_iBufferPtr, 1, m_iBlockPeak);
+		m_iClipCounter += Clipped;
+		m_iBlockClips += Clipped;
 
-		// Convert sample and store in temp buffer
-#ifdef DITHERING
-		if (SHIFT > 0)
-			Sample = (Sample + dither(1 << SHIFT)) >> SHIFT;
+		++m_iBufferPtr;
+
+		// If buffer is filled, throw it to direct sound
+		if (m_iBufferPtr >= m_iBufSizeSamples) {
+			if (!PlayBuffer())
+				return;
+		}
+	}
 #else
-		Sample >>= SHIFT;
-#endif
+	// Convert in spans up to the end of the output block
+	uint32 Pos = 0;
 
-		if (SHIFT == 8)
-			Sample ^= 0x80;
+	while (Pos < Size) {
+		uint32 Count = min(Size - Pos, m_iBufSizeSamples - m_iBufferPtr);
 
-		pConversionBuffer[m_iBufferPtr++] = (T)Sample;
+		int Clipped = ConvertSamples<FORMAT>(pBuffer + Pos, m_pAccumBuffer + m_iBufferPtr * SIZE, m_iGraphBuffer + m_iBufferPtr, Count, m_iBlockPeak);
+		m_iClipCounter += Clipped;
+		m_iBlockClips += Clipped;
+
+		m_iBufferPtr += Count;
+		Pos += Count;
 
 		// If buffer is filled, throw it to direct sound
 		if (m_iBufferPtr >= m_iBufSizeSamples) {
@@ -721,21 +942,29 @@ void CSoundGen::FillBuffer(int16 *pBuffer, uint32 Size)
 				return;
 		}
 	}
+#endif /* AUDIO_TEST || DITHERING */
 }
 
 bool CSoundGen::PlayBuffer()
 {
+	// Levels of the finished block
+	m_iPeakLevel = m_iBlockPeak;
+	m_iClippedSamples = m_iBlockClips;
+	m_iBlockPeak = 0;
+	m_iBlockClips = 0;
+
 	if (m_bRendering) {
 		// Output to file
 		m_wfWaveFile.WriteWave(m_pAccumBuffer, m_iBufSizeBytes);
 		m_iBufferPtr = 0;
+		m_iPendingLatencyCount = 0;
 	}
 	else {
 		// Output to direct sound
 		DWORD dwEvent;
 
 		// Wait for a buffer event
-		while ((dwEvent = m_pDSoundChannel->WaitForSyncEvent(AUDIO_TIMEOUT)) != BUFFER_IN_SYNC) {
+		while ((dwEvent = m_pAudioSink->WaitForSyncEvent(AUDIO_TIMEOUT)) != BUFFER_IN_SYNC) {
 			switch (dwEvent) {
 				case BUFFER_TIMEOUT:
 					// Buffer timeout
@@ -748,12 +977,20 @@ bool CSoundGen::PlayBuffer()
 					// Buffer underrun detected
 					m_iAudioUnderruns++;
 					m_bBufferUnderrun = true;
+					m_AudioStats.Underrun();
 					break;
 			}
 		}
 
+		m_AudioStats.BlockReady();
+
 		// Write audio to buffer
-		m_pDSoundChannel->WriteBuffer(m_pAccumBuffer, m_iBufSizeBytes);
+		m_pAudioSink->WriteBuffer(m_pAccumBuffer, m_iBufSizeBytes);
+
+		m_AudioStats.BlockWritten(m_pAudioSink->GetFillLevel());
+
+		// Commands run before this block are heard in it
+		UpdateLatency();
 
 		// Draw graph
 		m_csVisualizerWndLock.Lock();
@@ -776,6 +1013,23 @@ unsigned int CSoundGen::GetUnderruns() const
 	return m_iAudioUnderruns;
 }
 
+int CSoundGen::GetPeakLevel() const
+{
+	// Largest absolute sample value in the last audio block, 24-bit scale
+	return m_iPeakLevel;
+}
+
+int CSoundGen::GetClippedSamples() const
+{
+	// Number of clipped samples in the last audio block
+	return m_iClippedSamples;
+}
+
+void CSoundGen::GetAudioStats(stAudioStats &Stats) const
+{
+	m_AudioStats.GetStats(Stats);
+}
+
 unsigned int CSoundGen::GetFrameRate()
 {
 	int FrameRate = m_iFrameCounter;
@@ -783,6 +1037,20 @@ unsigned int CSoundGen::GetFrameRate()
 	return FrameRate;
 }
 
+void CSoundGen::GetCommandLatency(int &Average, int &Max)
+{
+	// Time from posting a command until the first audio block containing its result
+	// reaches the play position, in microseconds. Read and reset.
+	m_csLatencyLock.Lock();
+	int Count = m_iLatencyCount;
+	Average = (Count > 0) ? int(m_iLatencySum / Count) : 0;
+	Max = m_iLatencyMax;
+	m_iLatencySum = 0;
+	m_iLatencyCount = 0;
+	m_iLatencyMax = 0;
+	m_csLatencyLock.Unlock();
+}
+
 //// Tracker playing routines //////////////////////////////////////////////////////////////////////////////
 
 void CSoundGen::GenerateVibratoTable(int Type)
@@ -844,7 +1112,7 @@ void CSoundGen::BeginPlayer(play_mode_t Mode, int Track)
 	ASSERT(m_pDocument != NULL);
 	ASSERT(m_pTrackerView != NULL);
 
-	if (!m_pDocument || !m_pDSoundChannel || !m_pDocument->IsFileLoaded())
+	if (!m_pDocument || !m_pAudioSink || !m_pDocument->IsFileLoaded())
 		return;
 
 	switch (Mode) {
@@ -885,6 +1153,8 @@ void CSoundGen::BeginPlayer(play_mode_t Mode, int Track)
 	m_bDirty			= true;
 	m_iPlayTrack		= Track;
 
+	UpdateSnapshot();
+
 	memset(m_bFramePlayed, false, sizeof(bool) * MAX_FRAMES);
 
 	ResetTempo();
@@ -1446,8 +1716,10 @@ bool CSoundGen::RenderToFile(LPTSTR pFile, render_end_t SongEndType, int SongEnd
 		AfxMessageBox(IDS_FILE_OPEN_ERROR);
 		return false;
 	}
-	else
-		PostThreadMessage(WM_USER_START_RENDER, 0, 0);
+	else {
+		m_pDocument->PublishSnapshots();
+		PostCommand(CMD_START_RENDER, 0, 0);
+	}
 
 	return true;
 }
@@ -1467,6 +1739,8 @@ void CSoundGen::StopRendering()
 	m_iPlayRow = 0;
 	m_wfWaveFile.CloseFile();
 
+	++m_iRenderCount;
+
 	MakeSilent();
 	ResetBuffer();
 }
@@ -1486,6 +1760,11 @@ bool CSoundGen::IsRendering() const
 	return m_bRendering;
 }
 
+unsigned int CSoundGen::GetRenderCount() const
+{
+	return m_iRenderCount;
+}
+
 bool CSoundGen::IsBackgroundTask() const
 {
 #ifdef EXPORT_TEST
@@ -1599,6 +1878,8 @@ int CSoundGen::ExitInstance()
 	SAFE_RELEASE_ARRAY(m_iGraphBuffer);
 	SAFE_RELEASE_ARRAY(m_pAccumBuffer);
 
+	ReleaseSnapshot();
+
 	// Make sure sound interface is shut down
 	CloseAudio();
 
@@ -1618,13 +1899,19 @@ BOOL CSoundGen::OnIdle(LONG lCount)
 	if (CWinThread::OnIdle(lCount))
 		return TRUE;
 
-	if (!m_pDocument || !m_pDSoundChannel || !m_pDocument->IsFileLoaded())
+	// Run commands posted by other threads
+	DrainCommands(false);
+
+	if (!m_pDocument || !m_pAudioSink || !m_pDocument->IsFileLoaded())
 		return TRUE;
 
 	++m_iFrameCounter;
 
-	// Access the document object, skip if access wasn't granted to avoid gaps in audio playback
-	if (m_pDocument->LockDocument(0)) {
+	// Pick up edits published by the document, pattern data is read from 
+	// the snapshot so the player never has to wait for the document lock
+	UpdateSnapshot();
+
+	if (m_pSnapshot != NULL) {
 
 		// Read module framerate
 		m_iFrameRate = m_pDocument->GetFrameRate();
@@ -1639,9 +1926,6 @@ BOOL CSoundGen::OnIdle(LONG lCount)
 
 		// Channel updates (instruments, effects etc)
 		UpdateChannels();
-
-		// Unlock document
-		m_pDocument->UnlockDocument();
 	}
 
 	// Update APU registers
@@ -1668,7 +1952,7 @@ BOOL CSoundGen::OnIdle(LONG lCount)
 	if (m_iDelayedStart > 0) {
 		--m_iDelayedStart;
 		if (!m_iDelayedStart) {
-			PostThreadMessage(WM_USER_PLAY, MODE_PLAY_START, m_iRenderTrack);
+			BeginPlayer(MODE_PLAY_START, m_iRenderTrack);
 		}
 	}
 
@@ -1684,11 +1968,11 @@ BOOL CSoundGen::OnIdle(LONG lCount)
 void CSoundGen::PlayChannelNotes()
 {
 	// Feed queued notes into channels
-	const int Channels = m_pDocument->GetChannelCount();
+	const int Channels = m_pSnapshot->GetChannelCount();
 
 	// Read notes
 	for (int i = 0; i < Channels; ++i) {
-		int Channel = m_pDocument->GetChannelType(i);
+		int Channel = m_pSnapshot->GetChannelType(i);
 		
 		// Run auto-arpeggio, if enabled
 		int Arpeggio = m_pTrackerView->GetAutoArpeggio(i);
@@ -1699,7 +1983,7 @@ void CSoundGen::PlayChannelNotes()
 		// Check if new note data has been queued for playing
 		if (m_pTrackerChannels[Channel]->NewNoteData()) {
 			stChanNote Note = m_pTrackerChannels[Channel]->GetNote();
-			PlayNote(Channel, &Note, m_pDocument->GetEffColumns(m_iPlayTrack, i) + 1);
+			PlayNote(Channel, &Note, m_pSnapshot->GetEffColumns(i) + 1);
 		}
 
 		// Pitch wheel
@@ -1717,6 +2001,30 @@ void CSoundGen::PlayChannelNotes()
 
 }
 
+void CSoundGen::PlayQueuedNote(CTrackerChannel *pTrackerChannel)
+{
+	// Start a note that was queued while the frame is being played, the channel 
+	// is processed and its registers are written at once
+
+	if (m_pSnapshot == NULL || m_bHaltRequest)
+		return;
+
+	const int Channels = m_pSnapshot->GetChannelCount();
+
+	for (int i = 0; i < Channels; ++i) {
+		int Channel = m_pSnapshot->GetChannelType(i);
+		if (m_pTrackerChannels[Channel] != pTrackerChannel || m_pChannels[Channel] == NULL)
+			continue;
+		if (pTrackerChannel->NewNoteData()) {
+			stChanNote Note = pTrackerChannel->GetNote();
+			PlayNote(Channel, &Note, m_pSnapshot->GetEffColumns(i) + 1);
+			m_pChannels[Channel]->ProcessChannel();
+			m_pChannels[Channel]->RefreshChannel();
+		}
+		break;
+	}
+}
+
 void CSoundGen::UpdatePlayer()
 {
 	// Update player state
@@ -1764,6 +2072,8 @@ void CSoundGen::UpdateAPU()
 		if (m_pChannels[i] != NULL) {
 			m_pChannels[i]->RefreshChannel();
 			m_pAPU->Process();
+			// Commands that only touch the APU are run between channels instead of waiting for the next frame
+			DrainCommands(true);
 			// Add some delay between each channel update
 			if (m_iFrameRate == CAPU::FRAME_RATE_NTSC || m_iFrameRate == CAPU::FRAME_RATE_PAL)
 				AddCycles(CHANNEL_DELAY);
@@ -1782,7 +2092,107 @@ void CSoundGen::UpdateAPU()
 
 // End of overloaded functions
 
-// Thread message handler
+// Command handling
+
+void CSoundGen::DrainCommands(bool bSubFrame)
+{
+	// Run queued commands. Between channel updates (bSubFrame) only commands that 
+	// don't disturb the frame are run, the rest waits for the next frame to keep order.
+
+	// Called from player thread
+	ASSERT(GetCurrentThreadId() == m_nThreadID);
+
+	stPlayerCommand Command;
+
+	for (;;) {
+		if (bSubFrame) {
+			const stPlayerCommand *pNext = m_pCommandQueue->Peek();
+			if (pNext == NULL)
+				break;
+			if (pNext->Command != CMD_WRITE_APU && pNext->Command != CMD_PREVIEW_SAMPLE && pNext->Command != CMD_QUEUE_NOTE)
+				break;
+		}
+
+		if (!m_pCommandQueue->Pop(Command))
+			break;
+
+		ExecuteCommand(Command);
+
+		// Notes queued between channel updates are started right away instead of on the next frame
+		if (bSubFrame && Command.Command == CMD_QUEUE_NOTE)
+			PlayQueuedNote(reinterpret_cast<CTrackerChannel*>(Command.wParam));
+
+		// Latency is measured when the audio block holding the result is written
+		if (m_iPendingLatencyCount < MAX_PENDING_LATENCY)
+			m_iPendingLatency[m_iPendingLatencyCount++] = Command.Timestamp;
+	}
+}
+
+void CSoundGen::UpdateLatency()
+{
+	// Called when an audio block has been written, measures the commands that were run before it.
+	// Latency is the time since the command was posted plus the audio queued ahead of the block.
+
+	if (m_iPendingLatencyCount == 0)
+		return;
+
+	LARGE_INTEGER Now;
+	QueryPerformanceCounter(&Now);
+
+	LONGLONG Queued = 0;
+	if (m_pAudioSink->GetBlocks() > 0)
+		Queued = LONGLONG(m_pAudioSink->GetFillLevel()) * m_pAudioSink->GetBufferLength() * 1000 / m_pAudioSink->GetBlocks();
+
+	LONGLONG LatencySum = 0;
+	int LatencyMax = 0;
+
+	for (int i = 0; i < m_iPendingLatencyCount; ++i) {
+		LONGLONG Latency = ((Now.QuadPart - m_iPendingLatency[i].QuadPart) * 1000000) / m_iPerfFrequency.QuadPart + Queued;
+		LatencySum += Latency;
+		if (Latency > LatencyMax)
+			LatencyMax = int(Latency);
+	}
+
+	// Counters are read and reset by the main thread
+	m_csLatencyLock.Lock();
+	m_iLatencySum += LatencySum;
+	m_iLatencyCount += m_iPendingLatencyCount;
+	if (LatencyMax > m_iLatencyMax)
+		m_iLatencyMax = LatencyMax;
+	m_csLatencyLock.Unlock();
+
+	m_iPendingLatencyCount = 0;
+}
+
+void CSoundGen::ExecuteCommand(const stPlayerCommand &Command)
+{
+	WPARAM wParam = Command.wParam;
+	LPARAM lParam = Command.lParam;
+
+	switch (Command.Command) {
+		case CMD_SILENT_ALL:		OnSilentAll(wParam, lParam); break;
+		case CMD_LOAD_SETTINGS:		OnLoadSettings(wParam, lParam); break;
+		case CMD_PLAY:				OnStartPlayer(wParam, lParam); break;
+		case CMD_STOP:				OnStopPlayer(wParam, lParam); break;
+		case CMD_RESET:				OnResetPlayer(wParam, lParam); break;
+		case CMD_START_RENDER:		OnStartRender(wParam, lParam); break;
+		case CMD_STOP_RENDER:		OnStopRender(wParam, lParam); break;
+		case CMD_PREVIEW_SAMPLE:	OnPreviewSample(wParam, lParam); break;
+		case CMD_WRITE_APU:			OnWriteAPU(wParam, lParam); break;
+		case CMD_CLOSE_SOUND:		OnCloseSound(wParam, lParam); break;
+		case CMD_SET_CHIP:			OnSetChip(wParam, lParam); break;
+		case CMD_VERIFY_EXPORT:		OnVerifyExport(wParam, lParam); break;
+		case CMD_REMOVE_DOCUMENT:	OnRemoveDocument(wParam, lParam); break;
+		case CMD_QUEUE_NOTE: {
+				// Picked up by PlayChannelNotes, or by PlayQueuedNote between channel updates
+				stChanNote Note = Command.Note;
+				reinterpret_cast<CTrackerChannel*>(wParam)->SetNote(Note, (note_prio_t)lParam);
+			}
+			break;
+	}
+}
+
+// Command handlers
 
 void CSoundGen::OnStartPlayer(WPARAM wParam, LPARAM lParam)
 {
@@ -1874,6 +2284,7 @@ void CSoundGen::OnVerifyExport(WPARAM wParam, LPARAM lParam)
 #ifdef EXPORT_TEST
 	m_pExportTest = reinterpret_cast<CExportTest*>(wParam);
 	m_bExportTesting = true;
+	InternalRegs.Reset();
 	BeginPlayer(MODE_PLAY_START, lParam);
 #endif /* EXPORT_TEST */
 }
@@ -1881,6 +2292,7 @@ void CSoundGen::OnVerifyExport(WPARAM wParam, LPARAM lParam)
 void CSoundGen::OnRemoveDocument(WPARAM wParam, LPARAM lParam)
 {
 	// Remove document and view pointers
+	ReleaseSnapshot();
 	m_pDocument = NULL;
 	m_pTrackerView = NULL;
 	TRACE0("SoundGen: Document removed\n");
@@ -1914,20 +2326,54 @@ bool CSoundGen::HasWaveChanged() const
 
 // Player state functions
 
+void CSoundGen::UpdateSnapshot()
+{
+	// Pick up the latest snapshot of the playing track, called from player thread
+	ASSERT(GetCurrentThreadId() == m_nThreadID);
+
+	LONG Serial = m_pDocument->GetSnapshotSerial();
+
+	if (m_pSnapshot != NULL && m_iSnapshotSerial == Serial && m_iSnapshotTrack == m_iPlayTrack)
+		return;
+
+	CTrackSnapshot *pSnapshot = m_pDocument->AcquireSnapshot(m_iPlayTrack);
+
+	// Keep the old one until a snapshot of the track has been published
+	if (pSnapshot == NULL)
+		return;
+
+	ReleaseSnapshot();
+
+	m_pSnapshot = pSnapshot;
+	m_iSnapshotSerial = Serial;
+	m_iSnapshotTrack = m_iPlayTrack;
+}
+
+void CSoundGen::ReleaseSnapshot()
+{
+	if (m_pSnapshot != NULL) {
+		m_pSnapshot->Release();
+		m_pSnapshot = NULL;
+	}
+}
+
 void CSoundGen::ReadPatternRow()
 {
-	const int Channels = m_pDocument->GetChannelCount();
+	const int Channels = m_pSnapshot->GetChannelCount();
 	stChanNote NoteData;
 
 	for (int i = 0; i < Channels; ++i) {
-		if (m_pTrackerView->PlayerGetNote(m_iPlayTrack, m_iPlayFrame, i, m_iPlayRow, NoteData))
-			QueueNote(i, NoteData, NOTE_PRIO_1);
+		if (m_pTrackerView->PlayerGetNote(m_pSnapshot, m_iPlayFrame, i, m_iPlayRow, NoteData)) {
+			// Channel layout is taken from the snapshot, document channels may be re-registered at any time
+			m_pTrackerChannels[m_pSnapshot->GetChannelType(i)]->SetNote(NoteData, NOTE_PRIO_1);
+			theApp.GetMIDI()->WriteNote(i, NoteData.Note, NoteData.Octave, NoteData.Vol);
+		}
 	}
 }
 
 void CSoundGen::PlayerStepRow()
 {
-	const int PatternLen = m_pDocument->GetPatternLength(m_iPlayTrack);
+	const int PatternLen = m_pSnapshot->GetPatternLength();
 
 	if (++m_iPlayRow >= PatternLen) {
 		m_iPlayRow = 0;
@@ -1940,7 +2386,7 @@ void CSoundGen::PlayerStepRow()
 
 void CSoundGen::PlayerStepFrame()
 {
-	const int Frames = m_pDocument->GetFrameCount(m_iPlayTrack);
+	const int Frames = m_pSnapshot->GetFrameCount();
 
 	m_bFramePlayed[m_iPlayFrame] = true;
 
@@ -1960,7 +2406,7 @@ void CSoundGen::PlayerStepFrame()
 
 void CSoundGen::PlayerJumpTo(int Frame)
 {
-	const int Frames = m_pDocument->GetFrameCount(m_iPlayTrack);
+	const int Frames = m_pSnapshot->GetFrameCount();
 
 	m_bFramePlayed[m_iPlayFrame] = true;
 
@@ -1978,8 +2424,8 @@ void CSoundGen::PlayerJumpTo(int Frame)
 
 void CSoundGen::PlayerSkipTo(int Row)
 {
-	const int Frames = m_pDocument->GetFrameCount(m_iPlayTrack);
-	const int Rows = m_pDocument->GetPatternLength(m_iPlayTrack);
+	const int Frames = m_pSnapshot->GetFrameCount();
+	const int Rows = m_pSnapshot->GetPatternLength();
 	
 	m_bFramePlayed[m_iPlayFrame] = true;
 
@@ -1996,13 +2442,19 @@ void CSoundGen::PlayerSkipTo(int Row)
 	m_bDirty = true;
 }
 
-void CSoundGen::QueueNote(int Channel, stChanNote &NoteData, note_prio_t Priority) const
+void CSoundGen::QueueNote(int Channel, stChanNote &NoteData, note_prio_t Priority)
 {
-	if (m_pDocument == NULL)
+	if (m_pDocument == NULL || !m_hThread)
 		return;
 
-	// Queue a note for play
-	m_pDocument->GetChannel(Channel)->SetNote(NoteData, Priority);
+	// Queue a note for play, the player thread hands it to the channel
+	stPlayerCommand Command;
+	Command.Command = CMD_QUEUE_NOTE;
+	Command.wParam = (WPARAM)m_pDocument->GetChannel(Channel);
+	Command.lParam = Priority;
+	Command.Note = NoteData;
+
+	PushCommand(Command);
 	theApp.GetMIDI()->WriteNote(Channel, NoteData.Note, NoteData.Octave, NoteData.Vol);
 }
 
@@ -2047,22 +2499,14 @@ int CSoundGen::GetQueueFrame() const
 
 #ifdef EXPORT_TEST
 
-static stRegs InternalRegs;
-
 void CSoundGen::WriteRegister(uint16 Reg, uint8 Value)
 {
-	InternalRegs.R_2A03[Reg & 0x1F] = Value;
+	InternalRegs.Write(Reg, Value);
 }
 
 void CSoundGen::WriteExternalRegister(uint16 Reg, uint8 Value)
 {
-	// VRC6
-	if (Reg >= 0x9000 && Reg < 0x9003)
-		InternalRegs.R_VRC6[Reg & 0x03] = Value;
-	else if (Reg >= 0xA000 && Reg < 0xA003)
-		InternalRegs.R_VRC6[(Reg & 0x03) + 3] = Value;
-	else if (Reg >= 0xB000 && Reg < 0xB003)
-		InternalRegs.R_VRC6[(Reg & 0x03) + 6] = Value;
+	InternalRegs.Write(Reg, Value);
 }
 
 #else /* EXPORT_TEST */
@@ -2093,40 +2537,15 @@ void CSoundGen::EndExportTest()
 
 void CSoundGen::CompareRegisters()
 {
-	bool bFailed = false;
-	stRegs ExternalRegs;
-
 	m_pExportTest->RunPlay();
 
-	// Read and compare regs
-
-	for (int i = 0; i < 0x14; ++i) {
-		ExternalRegs.R_2A03[i] = m_pExportTest->ReadReg(i, SNDCHIP_NONE);
-		if (InternalRegs.R_2A03[i] != ExternalRegs.R_2A03[i]) {
-			if (i == 0x11) {
-				if ((InternalRegs.R_2A03[i] & 0x7F) != (ExternalRegs.R_2A03[i] & 0x7F))
-					bFailed = true;
-			}
-			else if (i != 0x12)	// Ignore DPCM start address
-				bFailed = true;
-		}
-	}
-
-	if (m_pDocument->ExpansionEnabled(SNDCHIP_VRC6)) {
-		for (int i = 0; i < 9; ++i) {
-			ExternalRegs.R_VRC6[i] = m_pExportTest->ReadReg(i, SNDCHIP_VRC6);
-			if (InternalRegs.R_VRC6[i] != ExternalRegs.R_VRC6[i]) {
-				bFailed = true;
-			}
-		}
-	}
-
-	if (bFailed) {
+	// Compare registers of all enabled chips
+	if (!m_pExportTest->CompareRegisters(InternalRegs.GetRegs(), m_pDocument->GetExpansionChip())) {
 		// Update tracker view
 		m_pTrackerView->PostMessage(WM_USER_PLAYER);
 
 		// Display error message
-		if (m_pExportTest->ReportError(&InternalRegs, &ExternalRegs, m_iTempoFrames, m_pDocument->GetExpansionChip())) {
+		if (m_pExportTest->ReportError(InternalRegs.GetRegs(), m_pExportTest->GetRegisters(), m_iTempoFrames, m_pDocument->GetExpansionChip())) {
 			// Abort
 			m_bHaltRequest = true;
 			m_bExportTesting = false;
@@ -26,6 +26,7 @@
 
 #include <afxmt.h>		// Synchronization objects
 #include "WaveFile.h"
+#include "AudioSink.h"
 #include "Common.h"
 
 const int VIBRATO_LENGTH = 256;
@@ -33,21 +34,22 @@ const int TREMOLO_LENGTH = 256;
 
 const int NOTE_COUNT = 96;	// 96 available notes
 
-// Custom messages
-enum { 
-	WM_USER_SILENT_ALL = WM_USER + 1,
-	WM_USER_LOAD_SETTINGS,
-	WM_USER_PLAY,
-	WM_USER_STOP,
-	WM_USER_RESET,
-	WM_USER_START_RENDER,
-	WM_USER_STOP_RENDER,
-	WM_USER_PREVIEW_SAMPLE,
-	WM_USER_WRITE_APU,
-	WM_USER_CLOSE_SOUND,
-	WM_USER_SET_CHIP,
-	WM_USER_VERIFY_EXPORT,
-	WM_USER_REMOVE_DOCUMENT
+// Player thread commands, see CCommandQueue
+enum player_command_t {
+	CMD_SILENT_ALL,
+	CMD_LOAD_SETTINGS,
+	CMD_PLAY,
+	CMD_STOP,
+	CMD_RESET,
+	CMD_START_RENDER,
+	CMD_STOP_RENDER,
+	CMD_PREVIEW_SAMPLE,
+	CMD_WRITE_APU,
+	CMD_CLOSE_SOUND,
+	CMD_SET_CHIP,
+	CMD_VERIFY_EXPORT,
+	CMD_REMOVE_DOCUMENT,
+	CMD_QUEUE_NOTE
 };
 
 // Player modes
@@ -59,6 +61,16 @@ enum play_mode_t {
 	MODE_PLAY_FRAME			// Play frame
 };
 
+// Audio output formats
+enum sample_format_t {
+	SAMPLE_U8,				// 8 bit unsigned
+	SAMPLE_S16,				// 16 bit signed
+	SAMPLE_S24,				// 24 bit signed
+	SAMPLE_FLOAT			// 32 bit float
+};
+
+#define SAMPLE_BYTES(format) ((format) == SAMPLE_U8 ? 1 : (format) == SAMPLE_S16 ? 2 : (format) == SAMPLE_S24 ? 3 : 4)
+
 enum render_end_t { 
 	SONG_TIME_LIMIT, 
 	SONG_LOOP_LIMIT 
@@ -77,6 +89,9 @@ class CDSoundChannel;
 class CVisualizerWnd;
 class CDSample;
 class CTrackerChannel;
+class CTrackSnapshot;
+class CCommandQueue;
+struct stPlayerCommand;
 
 #ifdef EXPORT_TEST
 class CExportTest;
@@ -110,7 +125,7 @@ public:
 
 	// Sound
 	bool		InitializeSound(HWND hWnd);
-	void		FlushBuffer(int16 *Buffer, uint32 Size);
+	void		FlushBuffer(int32 *Buffer, uint32 Size);
 	CDSound		*GetSoundInterface() const { return m_pDSound; };
 
 	void		Interrupt() const;
@@ -142,6 +157,7 @@ public:
 	void		 ResetPlayer(int Track);
 	void		 LoadSettings();
 	void		 SilentAll();
+	bool		 PostCommand(player_command_t Command, WPARAM wParam = 0, LPARAM lParam = 0);
 
 	void		 ResetState();
 	void		 ResetTempo();
@@ -150,7 +166,11 @@ public:
 
 	// Stats
 	unsigned int GetUnderruns() const;
+	void		 GetAudioStats(stAudioStats &Stats) const;
+	int			 GetPeakLevel() const;
+	int			 GetClippedSamples() const;
 	unsigned int GetFrameRate();
+	void		 GetCommandLatency(int &Average, int &Max);
 
 	// Tracker playing
 	void		 SetJumpPattern(int Pattern);
@@ -163,6 +183,7 @@ public:
 	void		 StopRendering();
 	void		 GetRenderStat(int &Frame, int &Time, bool &Done, int &FramesToRender, int &Row, int &RowCount) const;
 	bool		 IsRendering() const;	
+	unsigned int GetRenderCount() const;
 	bool		 IsBackgroundTask() const;
 
 	// Sample previewing
@@ -193,7 +214,7 @@ public:
 	int			GetPlayerFrame() const;
 	int			GetPlayerTrack() const;
 	int			GetPlayerTicks() const;
-	void		QueueNote(int Channel, stChanNote &NoteData, note_prio_t Priority) const;
+	void		QueueNote(int Channel, stChanNote &NoteData, note_prio_t Priority);
 	void		MoveToFrame(int Frame);
 	void		SetQueueFrame(int Frame);
 	int			GetQueueFrame() const;
@@ -225,7 +246,7 @@ private:
 	bool		ResetAudioDevice();
 	void		CloseAudioDevice();
 	void		CloseAudio();
-	template<class T, int SHIFT> void FillBuffer(int16 *pBuffer, uint32 Size);
+	template<int FORMAT> void FillBuffer(int32 *pBuffer, uint32 Size);
 	bool		PlayBuffer();
 
 	// Player
@@ -233,6 +254,7 @@ private:
 	void		UpdateAPU();
 	void		UpdatePlayer();
 	void		PlayChannelNotes();
+	void		PlayQueuedNote(CTrackerChannel *pTrackerChannel);
 	void	 	PlayNote(int Channel, stChanNote *NoteData, int EffColumns);
 	void		RunFrame();
 	void		CheckControl();
@@ -241,6 +263,14 @@ private:
 	void		HaltPlayer();
 	void		MakeSilent();
 	void		SetupSpeed();
+	void		UpdateSnapshot();
+	void		ReleaseSnapshot();
+
+	// Commands
+	bool		PushCommand(stPlayerCommand &Command);
+	void		DrainCommands(bool bSubFrame);
+	void		ExecuteCommand(const stPlayerCommand &Command);
+	void		UpdateLatency();
 
 	// Misc
 	void		PlaySample(const CDSample *pSample, int Offset, int Pitch);
@@ -263,6 +293,7 @@ public:
 	static const double OLD_VIBRATO_DEPTH[];
 
 	static const int AUDIO_TIMEOUT = 2000;		// 2s buffer timeout
+	static const int MAX_PENDING_LATENCY = 64;	// Commands timed per audio block
 
 	//
 	// Private variables
@@ -273,10 +304,13 @@ private:
 	CTrackerChannel		*m_pTrackerChannels[CHANNELS];
 	CFamiTrackerDoc		*m_pDocument;
 	CFamiTrackerView	*m_pTrackerView;
+	CTrackSnapshot		*m_pSnapshot;						// Pattern data used by the player, see UpdateSnapshot
+	LONG				m_iSnapshotSerial;
+	int					m_iSnapshotTrack;
 
 	// Sound
 	CDSound				*m_pDSound;
-	CDSoundChannel		*m_pDSoundChannel;
+	IAudioSink			*m_pAudioSink;
 	CVisualizerWnd		*m_pVisualizerWnd;
 	CAPU				*m_pAPU;
 	CSampleMem			*m_pSampleMem;
@@ -287,6 +321,7 @@ private:
 
 	// Thread synchronization
 private:
+	CCommandQueue		*m_pCommandQueue;					// Commands from other threads, see PostCommand
 	mutable CCriticalSection m_csVisualizerWndLock;
 
 	// Handles
@@ -305,6 +340,20 @@ private:
 	bool				m_bBufferUnderrun;
 	bool				m_bAudioClipping;
 	int					m_iClipCounter;
+	int					m_iBlockPeak;						// Peak level and clipped samples of the block being filled
+	int					m_iBlockClips;
+	int					m_iPeakLevel;						// Levels of the last finished block
+	int					m_iClippedSamples;
+	CAudioStats			m_AudioStats;
+
+	// Command latency, in microseconds
+	LARGE_INTEGER		m_iPerfFrequency;
+	LONGLONG			m_iLatencySum;						// Counters are guarded by m_csLatencyLock
+	int					m_iLatencyCount;
+	int					m_iLatencyMax;
+	CCriticalSection	m_csLatencyLock;
+	LARGE_INTEGER		m_iPendingLatency[MAX_PENDING_LATENCY];	// Posting time of commands waiting for their audio block, player thread only
+	int					m_iPendingLatencyCount;
 	
 // Tracker playing variables
 private:
@@ -351,6 +400,7 @@ private:
 	int					m_iRenderTrack;
 	unsigned int		m_iRenderRowCount;
 	int					m_iRenderRow;
+	volatile unsigned int m_iRenderCount;				// Number of finished renders
 
 	int					m_iTempoDecrement;
 	int					m_iTempoRemainder;
@@ -391,18 +441,20 @@ public:
 	// Implementation
 public:
 	DECLARE_MESSAGE_MAP()
-	afx_msg void OnSilentAll(WPARAM wParam, LPARAM lParam);
-	afx_msg void OnLoadSettings(WPARAM wParam, LPARAM lParam);
-	afx_msg void OnStartPlayer(WPARAM wParam, LPARAM lParam);
-	afx_msg void OnStopPlayer(WPARAM wParam, LPARAM lParam);
-	afx_msg void OnResetPlayer(WPARAM wParam, LPARAM lParam);
-	afx_msg void OnStartRender(WPARAM wParam, LPARAM lParam);
-	afx_msg void OnStopRender(WPARAM wParam, LPARAM lParam);
-	afx_msg void OnPreviewSample(WPARAM wParam, LPARAM lParam);
-	afx_msg void OnHaltPreview(WPARAM wParam, LPARAM lParam);
-	afx_msg void OnWriteAPU(WPARAM wParam, LPARAM lParam);
-	afx_msg void OnCloseSound(WPARAM wParam, LPARAM lParam);
-	afx_msg void OnSetChip(WPARAM wParam, LPARAM lParam);
-	afx_msg void OnVerifyExport(WPARAM wParam, LPARAM lParam);
-	afx_msg void OnRemoveDocument(WPARAM wParam, LPARAM lParam);
+
+	// Command handlers
+private:
+	void OnSilentAll(WPARAM wParam, LPARAM lParam);
+	void OnLoadSettings(WPARAM wParam, LPARAM lParam);
+	void OnStartPlayer(WPARAM wParam, LPARAM lParam);
+	void OnStopPlayer(WPARAM wParam, LPARAM lParam);
+	void OnResetPlayer(WPARAM wParam, LPARAM lParam);
+	void OnStartRender(WPARAM wParam, LPARAM lParam);
+	void OnStopRender(WPARAM wParam, LPARAM lParam);
+	void OnPreviewSample(WPARAM wParam, LPARAM lParam);
+	void OnWriteAPU(WPARAM wParam, LPARAM lParam);
+	void OnCloseSound(WPARAM wParam, LPARAM lParam);
+	void OnSetChip(WPARAM wParam, LPARAM lParam);
+	void OnVerifyExport(WPARAM wParam, LPARAM lParam);
+	void OnRemoveDocument(WPARAM wParam, LPARAM lParam);
 };
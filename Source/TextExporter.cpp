@@ -18,6 +18,7 @@
 ** must bear this legend.
 */
 
+#include <vector>
 #include "stdafx.h"
 #include "TextExporter.h"
 #include "FamiTrackerDoc.h"
@@ -122,11 +123,43 @@ static const TCHAR* CT[CT_COUNT] =
 
 // =============================================================================
 
+// token in the text buffer, only valid while the buffer is open
+struct TokenView
+{
+	const TCHAR* str;
+	int len;
+
+	bool Is(const TCHAR* s) const
+	{
+		return (int)::_tcslen(s) == len && 0 == ::_tcsncmp(str, s, len);
+	}
+
+	bool IsNoCase(const TCHAR* s) const
+	{
+		return (int)::_tcslen(s) == len && 0 == ::_tcsnicmp(str, s, len);
+	}
+
+	CString ToString() const
+	{
+		return CString(str, len);
+	}
+};
+
+// digit value of a hexadecimal character, -1 if not a hex digit
+static int HexDigit(TCHAR c)
+{
+	if (c >= TCHAR('0') && c <= TCHAR('9')) return c - TCHAR('0');
+	if (c >= TCHAR('A') && c <= TCHAR('F')) return c - TCHAR('A') + 10;
+	if (c >= TCHAR('a') && c <= TCHAR('f')) return c - TCHAR('a') + 10;
+	return -1;
+}
+
+// reads tokens directly from the text buffer, tokens are returned as views when possible
 class Tokenizer
 {
 public:
-	Tokenizer(const CString* text_)
-		: text(text_), pos(0), line(1), linestart(0)
+	Tokenizer(const TCHAR* text_, int size_)
+		: text(text_), size(size_), pos(0), line(1), linestart(0)
 	{}
 
 	~Tokenizer()
@@ -141,27 +174,16 @@ public:
 
 	void ConsumeSpace()
 	{
-		if (!text) return;
-		while (pos < text->GetLength())
+		while (pos < size && (text[pos] == TCHAR(' ') || text[pos] == TCHAR('\t')))
 		{
-			TCHAR c = text->GetAt(pos);
-			if (c != TCHAR(' ') &&
-				c != TCHAR('\t'))
-			{
-				return;
-			}
 			++pos;
 		}
 	}
 
 	void FinishLine()
 	{
-		if (!text) return;
-		while (pos < text->GetLength() && text->GetAt(pos) != TCHAR('\n'))
-		{
-			++pos;
-		}
-		if (pos < text->GetLength()) ++pos; // skip newline
+		const TCHAR* eol = (pos < size) ? (const TCHAR*)::memchr(text + pos, TCHAR('\n'), size - pos) : NULL;
+		pos = (eol != NULL) ? int(eol - text) + 1 : size; // skip newline
 		++line;
 		linestart = pos;
 	}
@@ -173,14 +195,39 @@ public:
 
 	bool Finished() const
 	{
-		if (!text) return true;
-		return pos >= text->GetLength();
+		return pos >= size;
+	}
+
+	// reads a token without handling quotes
+	TokenView ReadView()
+	{
+		ConsumeSpace();
+
+		TokenView v;
+		v.str = text + pos;
+
+		while (pos < size)
+		{
+			TCHAR c = text[pos];
+			if (c == TCHAR(' ') || c == TCHAR('\t') || c == TCHAR('\r') || c == TCHAR('\n'))
+				break;
+			++pos;
+		}
+
+		v.len = int(text + pos - v.str);
+		return v;
 	}
 
 	CString ReadToken()
 	{
-		if (!text) return _T("");
+		int start = pos;
+		TokenView v = ReadView();
 
+		// only tokens with quotes need to be copied character by character
+		if (NULL == ::memchr(v.str, TCHAR('\"'), v.len))
+			return v.ToString();
+
+		pos = start;
 		ConsumeSpace();
 		CString t = _T("");
 
@@ -188,8 +235,8 @@ public:
 		bool lastQuote = false; // for finding double-quotes
 		do
 		{
-			if (pos >= text->GetLength()) break;
-			TCHAR c = text->GetAt(pos);
+			if (pos >= size) break;
+			TCHAR c = text[pos];
 			if ((c == TCHAR(' ') && !inQuote) ||
 				c == TCHAR('\t') ||
 				c == TCHAR('\r') ||
@@ -234,20 +281,26 @@ public:
 
 	bool ReadInt(int& i, int range_min, int range_max, CString* err)
 	{
-		CString t = ReadToken();
+		TokenView t = ReadView();
 		int c = GetColumn();
-		if (t.GetLength() < 1)
+		if (t.len < 1)
 		{
 			if (err) err->Format(_T("Line %d column %d: expected integer, no token found."), line, c);
 			return false;
 		}
 
-		int result = ::sscanf(t, "%d", &i);
-		if(result == EOF || result == 0)
+		// same as %d, trailing characters are ignored
+		int d = 0;
+		bool negative = (t.str[0] == TCHAR('-'));
+		if (t.str[0] == TCHAR('-') || t.str[0] == TCHAR('+')) ++d;
+		if (d >= t.len || t.str[d] < TCHAR('0') || t.str[d] > TCHAR('9'))
 		{
-			if (err) err->Format(_T("Line %d column %d: expected integer, '%s' found."), line, c, t);
+			if (err) err->Format(_T("Line %d column %d: expected integer, '%s' found."), line, c, t.ToString());
 			return false;
 		}
+		for (i = 0; d < t.len && t.str[d] >= TCHAR('0') && t.str[d] <= TCHAR('9'); ++d)
+			i = i * 10 + (t.str[d] - TCHAR('0'));
+		if (negative) i = -i;
 
 		if (i < range_min || i > range_max)
 		{
@@ -260,20 +313,24 @@ public:
 
 	bool ReadHex(int& i, int range_min, int range_max, CString* err)
 	{
-		CString t = ReadToken();
+		TokenView t = ReadView();
 		int c = GetColumn();
-		if (t.GetLength() < 1)
+		if (t.len < 1)
 		{
 			if (err) err->Format(_T("Line %d column %d: expected hexadecimal, no token found."), line, c);
 			return false;
 		}
 
-		int result = ::sscanf(t, "%x", &i);
-		if(result == EOF || result == 0)
+		// same as %x, an optional 0x prefix is allowed and trailing characters are ignored
+		int d = 0;
+		if (t.len > 2 && t.str[0] == TCHAR('0') && (t.str[1] == TCHAR('x') || t.str[1] == TCHAR('X')) && HexDigit(t.str[2]) >= 0) d = 2;
+		if (HexDigit(t.str[d]) < 0)
 		{
-			if (err) err->Format(_T("Line %d column %d: expected hexadecimal, '%s' found."), line, c, t);
+			if (err) err->Format(_T("Line %d column %d: expected hexadecimal, '%s' found."), line, c, t.ToString());
 			return false;
 		}
+		for (i = 0; d < t.len && HexDigit(t.str[d]) >= 0; ++d)
+			i = (i << 4) + HexDigit(t.str[d]);
 
 		if (i < range_min || i > range_max)
 		{
@@ -297,7 +354,7 @@ public:
 
 		if (Finished()) return true;
 
-		TCHAR eol = text->GetAt(pos);
+		TCHAR eol = text[pos];
 		if (eol != TCHAR('\r') && eol != TCHAR('\n'))
 		{
 			if (err) err->Format(_T("Line %d column %d: expected end of line, '%c' found."), line, c, eol);
@@ -314,7 +371,7 @@ public:
 		ConsumeSpace();
 		if (Finished()) return true;
 
-		TCHAR eol = text->GetAt(pos);
+		TCHAR eol = text[pos];
 		if (eol == TCHAR('\r') || eol == TCHAR('\n'))
 		{
 			FinishLine();
@@ -324,34 +381,69 @@ public:
 		return false;
 	}
 
-	const CString* text;
+	const TCHAR* text;
+	int size;
 	int pos;
 	int line;
 	int linestart;
 };
 
+// read-only view of a whole file, released when destroyed
+class MappedFile
+{
+public:
+	MappedFile()
+		: view(_T("")), size(0), mapping(NULL)
+	{}
+
+	~MappedFile()
+	{
+		if (mapping != NULL)
+		{
+			::UnmapViewOfFile(view);
+			::CloseHandle(mapping);
+		}
+	}
+
+	bool Map(CFile& f)
+	{
+		// empty files cannot be mapped
+		size = (int)f.GetLength();
+		if (size == 0) return true;
+
+		mapping = ::CreateFileMapping(f.m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping == NULL) return false;
+
+		view = (const TCHAR*)::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (view == NULL)
+		{
+			::CloseHandle(mapping);
+			mapping = NULL;
+			view = _T("");
+			return false;
+		}
+		return true;
+	}
+
+	const TCHAR* view;
+	int size;
+	HANDLE mapping;
+};
+
 // =============================================================================
 
-static bool ImportHex(CString& sToken, int& i, int line, int column, CString& sResult)
+static bool ImportHex(const TokenView& sToken, int& i, int line, int column, CString& sResult)
 {
 	i = 0;
-	for (int d=0; d < sToken.GetLength(); ++d)
+	for (int d=0; d < sToken.len; ++d)
 	{
-		const TCHAR* HEX_TEXT[16] = {
-			_T("0"), _T("1"), _T("2"), _T("3"), _T("4"), _T("5"), _T("6"), _T("7"),
-			_T("8"), _T("9"), _T("A"), _T("B"), _T("C"), _T("D"), _T("E"), _T("F") };
-
-		i <<= 4;
-		CString t = sToken.Mid(d,1);
-		int h = 0;
-		for (h=0; h < 16; ++h)
-			if (0 == t.CompareNoCase(HEX_TEXT[h])) break;
-		if (h >= 16)
+		int h = HexDigit(sToken.str[d]);
+		if (h < 0)
 		{
-			sResult.Format(_T("Line %d column %d: hexadecimal number expected, '%s' found."), line, column, sToken);
+			sResult.Format(_T("Line %d column %d: hexadecimal number expected, '%s' found."), line, column, sToken.ToString());
 			return false;
 		}
-		i += h;
+		i = (i << 4) + h;
 	}
 	return true;
 }
@@ -373,38 +465,36 @@ CString ExportString(const CString& s)
 
 // =============================================================================
 
+// decodes one cell of a ROW line straight from the text buffer
 static bool ImportCellText(
-	CFamiTrackerDoc* pDoc,
 	Tokenizer &t,
-	unsigned int track,
-	unsigned int pattern,
 	unsigned int channel,
-	unsigned int row,
+	unsigned int effects,
+	stChanNote& Cell,
 	CString& sResult)
 {
-	stChanNote Cell;
-
 	// empty Cell
 	::memset(&Cell, 0, sizeof(Cell));
 	Cell.Instrument = MAX_INSTRUMENTS;
 	Cell.Vol = 0x10;
 
-	CString sNote = t.ReadToken();
-	if      (sNote == _T("...")) { Cell.Note = 0; }
-	else if (sNote == _T("---")) { Cell.Note = HALT; }
-	else if (sNote == _T("===")) { Cell.Note = RELEASE; }
+	TokenView sNote = t.ReadView();
+	if      (sNote.Is(_T("..."))) { Cell.Note = 0; }
+	else if (sNote.Is(_T("---"))) { Cell.Note = HALT; }
+	else if (sNote.Is(_T("==="))) { Cell.Note = RELEASE; }
 	else
 	{
-		if (sNote.GetLength() != 3)
+		if (sNote.len != 3)
 		{
-			sResult.Format(_T("Line %d column %d: note column should be 3 characters wide, '%s' found."), t.line, t.GetColumn(), sNote);
+			sResult.Format(_T("Line %d column %d: note column should be 3 characters wide, '%s' found."), t.line, t.GetColumn(), sNote.ToString());
 			return false;
 		}
 
 		if (channel == 3) // noise
 		{
 			int h;
-			if (!ImportHex(sNote.Left(1), h, t.line, t.GetColumn(), sResult))
+			TokenView sFreq = {sNote.str, 1};
+			if (!ImportHex(sFreq, h, t.line, t.GetColumn(), sResult))
 				return false;
 			Cell.Note = (h % 12) + 1;
 			Cell.Octave = h / 12;
@@ -415,7 +505,7 @@ static bool ImportCellText(
 		else
 		{
 			int n = 0;
-			switch (sNote.GetAt(0))
+			switch (sNote.str[0])
 			{
 				case TCHAR('c'): case TCHAR('C'): n = 0; break;
 				case TCHAR('d'): case TCHAR('D'): n = 2; break;
@@ -425,39 +515,39 @@ static bool ImportCellText(
 				case TCHAR('a'): case TCHAR('A'): n = 9; break;
 				case TCHAR('b'): case TCHAR('B'): n = 11; break;
 				default:
-					sResult.Format(_T("Line %d column %d: unrecognized note '%s'."), t.line, t.GetColumn(), sNote);
+					sResult.Format(_T("Line %d column %d: unrecognized note '%s'."), t.line, t.GetColumn(), sNote.ToString());
 					return false;
 			}
-			switch (sNote.GetAt(1))
+			switch (sNote.str[1])
 			{
 				case TCHAR('-'): case TCHAR('.'): break;
 				case TCHAR('#'): case TCHAR('+'): n += 1; break;
 				case TCHAR('b'): case TCHAR('f'): n -= 1; break;
 				default:
-					sResult.Format(_T("Line %d column %d: unrecognized note '%s'."), t.line, t.GetColumn(), sNote);
+					sResult.Format(_T("Line %d column %d: unrecognized note '%s'."), t.line, t.GetColumn(), sNote.ToString());
 					return false;
 			}
 			while (n <   0) n += 12;
 			while (n >= 12) n -= 12;
 			Cell.Note = n + 1;
 
-			int o = sNote.GetAt(2) - TCHAR('0');
+			int o = sNote.str[2] - TCHAR('0');
 			if (o < 0 || o >= OCTAVE_RANGE)
 			{
-				sResult.Format(_T("Line %d column %d: unrecognized octave '%s'."), t.line, t.GetColumn(), sNote);
+				sResult.Format(_T("Line %d column %d: unrecognized octave '%s'."), t.line, t.GetColumn(), sNote.ToString());
 				return false;
 			}
 			Cell.Octave = o;
 		}
 	}
 
-	CString sInst = t.ReadToken();
-	if (sInst == _T("..")) { Cell.Instrument = MAX_INSTRUMENTS; }
+	TokenView sInst = t.ReadView();
+	if (sInst.Is(_T(".."))) { Cell.Instrument = MAX_INSTRUMENTS; }
 	else
 	{
-		if (sInst.GetLength() != 2)
+		if (sInst.len != 2)
 		{
-			sResult.Format(_T("Line %d column %d: instrument column should be 2 characters wide, '%s' found."), t.line, t.GetColumn(), sInst);
+			sResult.Format(_T("Line %d column %d: instrument column should be 2 characters wide, '%s' found."), t.line, t.GetColumn(), sInst.ToString());
 			return false;
 		}
 		int h;
@@ -465,108 +555,336 @@ static bool ImportCellText(
 			return false;
 		if (h >= MAX_INSTRUMENTS)
 		{
-			sResult.Format(_T("Line %d column %d: instrument '%s' is out of bounds."), t.line, t.GetColumn(), sInst);
+			sResult.Format(_T("Line %d column %d: instrument '%s' is out of bounds."), t.line, t.GetColumn(), sInst.ToString());
 			return false;
 		}
 		Cell.Instrument = h;
 	}
 
-	CString sVol  = t.ReadToken();
-	const TCHAR* VOL_TEXT[17] = {
-		_T("0"), _T("1"), _T("2"), _T("3"), _T("4"), _T("5"), _T("6"), _T("7"),
-		_T("8"), _T("9"), _T("A"), _T("B"), _T("C"), _T("D"), _T("E"), _T("F"),
-		_T(".") };
-	int v = 0;
-	for (; v <= 17; ++v)
-		if (0 == sVol.CompareNoCase(VOL_TEXT[v])) break;
-	if (v > 17)
+	// volume is a single hex digit or '.'
+	TokenView sVol = t.ReadView();
+	int v = (sVol.len == 1) ? HexDigit(sVol.str[0]) : -1;
+	if (sVol.Is(_T(".")))
+		v = 0x10;
+	if (v < 0)
 	{
-		sResult.Format(_T("Line %d column %d: unrecognized volume token '%s'."), t.line, t.GetColumn(), sVol);
+		sResult.Format(_T("Line %d column %d: unrecognized volume token '%s'."), t.line, t.GetColumn(), sVol.ToString());
 		return false;
 	}
 	Cell.Vol = v;
 
-	for (unsigned int e=0; e <= pDoc->GetEffColumns(track, channel); ++e)
+	for (unsigned int e=0; e <= effects; ++e)
 	{
-		CString sEff = t.ReadToken();
-		if (sEff != _T("..."))
+		TokenView sEff = t.ReadView();
+		if (!sEff.Is(_T("...")))
 		{
-			if (sEff.GetLength() != 3)
+			if (sEff.len != 3)
 			{
-				sResult.Format(_T("Line %d column %d: effect column should be 3 characters wide, '%s' found."), t.line, t.GetColumn(), sEff);
+				sResult.Format(_T("Line %d column %d: effect column should be 3 characters wide, '%s' found."), t.line, t.GetColumn(), sEff.ToString());
 				return false;
 			}
 
 			int p=0;
-			TCHAR pC = sEff.GetAt(0);
+			TCHAR pC = sEff.str[0];
 			if (pC >= TCHAR('a') && pC <= TCHAR('z')) pC += TCHAR('A') - TCHAR('a');
 			for (;p < EF_COUNT; ++p)
 				if (EFF_CHAR[p] == pC) break;
 			if (p >= EF_COUNT)
 			{
-				sResult.Format(_T("Line %d column %d: unrecognized effect '%s'."), t.line, t.GetColumn(), sEff);
+				sResult.Format(_T("Line %d column %d: unrecognized effect '%s'."), t.line, t.GetColumn(), sEff.ToString());
 				return false;
 			}
 			Cell.EffNumber[e] = p+1;
 
 			int h;
-			if (!ImportHex(sEff.Right(2), h, t.line, t.GetColumn(), sResult))
+			TokenView sParam = {sEff.str + 1, 2};
+			if (!ImportHex(sParam, h, t.line, t.GetColumn(), sResult))
 				return false;
 			Cell.EffParam[e] = h;
 		}
 	}
 
-	pDoc->SetDataAtPattern(track,pattern,channel,row,&Cell);
 	return true;
 }
 
-static const CString& ExportCellText(const stChanNote& stCell, unsigned int nEffects, bool bNoise)
+// output buffer used when exporting tracks, formats without going through CString
+class TextBuffer
 {
-	static CString s;
-	CString tmp;
+public:
+	void Reserve(size_t size)
+	{
+		data.reserve(size);
+	}
+
+	void Append(char c)
+	{
+		data.push_back(c);
+	}
+
+	void Append(const char* str)
+	{
+		while (*str)
+			data.push_back(*str++);
+	}
+
+	void Append(const char* str, int len)
+	{
+		data.insert(data.end(), str, str + len);
+	}
+
+	void AppendHex(unsigned int value, int digits)
+	{
+		// same output as %0*X
+		static const char HEX[] = "0123456789ABCDEF";
+		char tmp[8];
+		int len = 0;
+		do
+		{
+			tmp[len++] = HEX[value & 0x0F];
+			value >>= 4;
+		} while (value != 0 && len < 8);
+		for (int i=len; i < digits; ++i)
+			data.push_back('0');
+		while (len > 0)
+			data.push_back(tmp[--len]);
+	}
+
+	void AppendInt(int value)
+	{
+		// same output as %d
+		char tmp[12];
+		int len = 0;
+		unsigned int u = (value < 0) ? -(unsigned int)value : value;
+		do
+		{
+			tmp[len++] = '0' + (u % 10);
+			u /= 10;
+		} while (u != 0);
+		if (value < 0)
+			data.push_back('-');
+		while (len > 0)
+			data.push_back(tmp[--len]);
+	}
+
+	size_t GetSize() const
+	{
+		return data.size();
+	}
+
+	const char* GetData() const
+	{
+		return data.empty() ? NULL : &data[0];
+	}
+
+private:
+	std::vector<char> data;
+};
 
+// cell text is always 9 characters plus 4 for each effect column
+static const int CELL_TEXT_LENGTH = 9;
+static const int CELL_EFFECT_LENGTH = 4;
+
+static void ExportCellText(TextBuffer& buf, const stChanNote& stCell, unsigned int nEffects, bool bNoise)
+{
 	static const char* TEXT_NOTE[HALT+1] = {
 		_T("..."),
 		_T("C-?"), _T("C#?"), _T("D-?"), _T("D#?"), _T("E-?"), _T("F-?"),
 		_T("F#?"), _T("G-?"), _T("G#?"), _T("A-?"), _T("A#?"), _T("B-?"),
 		_T("==="), _T("---") };
 
-	s = (stCell.Note <= HALT) ? TEXT_NOTE[stCell.Note] : "...";
 	if (stCell.Note >= C && stCell.Note <= B)
 	{
 		if (bNoise)
 		{
-			char nNoiseFreq = (stCell.Note - 1 + stCell.Octave * 12) & 0x0F;
-			s.Format(_T("%01X-#"), nNoiseFreq);
+			buf.AppendHex((stCell.Note - 1 + stCell.Octave * 12) & 0x0F, 1);
+			buf.Append(_T("-#"));
 		}
 		else
 		{
-			s = s.Left(2);
-			tmp.Format(_T("%01d"), stCell.Octave);
-			s += tmp;
+			buf.Append(TEXT_NOTE[stCell.Note], 2);
+			buf.AppendInt(stCell.Octave);
 		}
 	}
+	else
+	{
+		buf.Append((stCell.Note <= HALT) ? TEXT_NOTE[stCell.Note] : _T("..."));
+	}
 
-	tmp.Format(_T(" %02X"), stCell.Instrument);
-	s += (stCell.Instrument == MAX_INSTRUMENTS) ? _T(" ..") : tmp;
+	if (stCell.Instrument == MAX_INSTRUMENTS)
+	{
+		buf.Append(_T(" .."));
+	}
+	else
+	{
+		buf.Append(' ');
+		buf.AppendHex(stCell.Instrument, 2);
+	}
 
-	tmp.Format(_T(" %01X"), stCell.Vol);
-	s += (stCell.Vol == 0x10) ? _T(" .") : tmp;
+	if (stCell.Vol == 0x10)
+	{
+		buf.Append(_T(" ."));
+	}
+	else
+	{
+		buf.Append(' ');
+		buf.AppendHex(stCell.Vol, 1);
+	}
 
 	for (unsigned int e=0; e < nEffects; ++e)
 	{
 		if (stCell.EffNumber[e] == 0)
 		{
-			s += _T(" ...");
+			buf.Append(_T(" ..."));
 		}
 		else
 		{
-			tmp.Format(_T(" %c%02X"), EFF_CHAR[stCell.EffNumber[e]-1], stCell.EffParam[e]);
-			s += tmp;
+			buf.Append(' ');
+			buf.Append(EFF_CHAR[stCell.EffNumber[e]-1]);
+			buf.AppendHex(stCell.EffParam[e], 2);
 		}
 	}
+}
 
-	return s;
+static void ExportTrackText(TextBuffer& buf, const CFamiTrackerDoc* pDoc, unsigned int t)
+{
+	// formats one complete track section, only reads from the document
+	const int channels = pDoc->GetChannelCount();
+	const unsigned int rows = pDoc->GetPatternLength(t);
+	const unsigned int frames = pDoc->GetFrameCount(t);
+
+	std::vector<int> used;
+	for (int p=0; p < MAX_PATTERN; ++p)
+	{
+		// detect and skip empty patterns
+		for (int c=0; c < channels; ++c)
+		{
+			if (!pDoc->IsPatternEmpty(t, c, p))
+			{
+				used.push_back(p);
+				break;
+			}
+		}
+	}
+
+	int rowLength = 8 + 1;
+	for (int c=0; c < channels; ++c)
+		rowLength += 3 + CELL_TEXT_LENGTH + CELL_EFFECT_LENGTH * (pDoc->GetEffColumns(t, c) + 1);
+	buf.Reserve(256 + frames * (12 + 3 * channels) + used.size() * (12 + rows * rowLength));
+
+	CString title = pDoc->GetTrackTitle(t);
+	CString s;
+	s.Format(_T("%s %3d %3d %3d %s\n"),
+		CT[CT_TRACK],
+		rows,
+		pDoc->GetSongSpeed(t),
+		pDoc->GetSongTempo(t),
+		ExportString(title));
+	buf.Append(s);
+
+	buf.Append(CT[CT_COLUMNS]);
+	buf.Append(_T(" :"));
+	for (int c=0; c < channels; ++c)
+	{
+		buf.Append(' ');
+		buf.AppendInt(pDoc->GetEffColumns(t, c)+1);
+	}
+	buf.Append(_T("\n\n"));
+
+	for (unsigned int o=0; o < frames; ++o)
+	{
+		buf.Append(CT[CT_ORDER]);
+		buf.Append(' ');
+		buf.AppendHex(o, 2);
+		buf.Append(_T(" :"));
+		for (int c=0; c < channels; ++c)
+		{
+			buf.Append(' ');
+			buf.AppendHex(pDoc->GetPatternAtFrame(t, o, c), 2);
+		}
+		buf.Append('\n');
+	}
+	buf.Append('\n');
+
+	for (std::vector<int>::const_iterator it = used.begin(); it != used.end(); ++it)
+	{
+		const int p = *it;
+
+		buf.Append(CT[CT_PATTERN]);
+		buf.Append(' ');
+		buf.AppendHex(p, 2);
+		buf.Append('\n');
+
+		for (unsigned int r=0; r < rows; ++r)
+		{
+			buf.Append(CT[CT_ROW]);
+			buf.Append(' ');
+			buf.AppendHex(r, 2);
+			for (int c=0; c < channels; ++c)
+			{
+				buf.Append(_T(" : "));
+				stChanNote stCell;
+				pDoc->GetDataAtPattern(t,p,c,r,&stCell);
+				ExportCellText(buf, stCell, pDoc->GetEffColumns(t, c)+1, c==3);
+			}
+			buf.Append('\n');
+		}
+		buf.Append('\n');
+	}
+}
+
+// tracks are independent, they are formatted on worker threads and written in order
+struct TrackExportJob
+{
+	const CFamiTrackerDoc* pDoc;
+	std::vector<TextBuffer> buffers;
+	volatile LONG next;
+};
+
+static void ExportTracksWorker(TrackExportJob* job)
+{
+	LONG index;
+	while ((index = InterlockedIncrement(&job->next) - 1) < (LONG)job->buffers.size())
+		ExportTrackText(job->buffers[index], job->pDoc, index);
+}
+
+static UINT ExportTracksThreadProc(LPVOID pParam)
+{
+	ExportTracksWorker(reinterpret_cast<TrackExportJob*>(pParam));
+	return 0;
+}
+
+static void ExportTracks(TrackExportJob& job)
+{
+	SYSTEM_INFO SystemInfo;
+	GetSystemInfo(&SystemInfo);
+
+	int threads = min((int)SystemInfo.dwNumberOfProcessors, (int)job.buffers.size());
+	threads = min(threads, MAXIMUM_WAIT_OBJECTS);
+
+	std::vector<CWinThread*> workers;
+	std::vector<HANDLE> handles;
+
+	job.next = 0;
+
+	// this thread is also used
+	for (int i=1; i < threads; ++i)
+	{
+		CWinThread* pThread = AfxBeginThread(&ExportTracksThreadProc, (LPVOID)&job, THREAD_PRIORITY_NORMAL, 0, CREATE_SUSPENDED);
+		if (pThread == NULL)
+			break;
+		pThread->m_bAutoDelete = FALSE;
+		pThread->ResumeThread();
+		workers.push_back(pThread);
+		handles.push_back(pThread->m_hThread);
+	}
+
+	ExportTracksWorker(&job);
+
+	if (!handles.empty())
+		::WaitForMultipleObjects(handles.size(), &handles[0], TRUE, INFINITE);
+
+	for (std::vector<CWinThread*>::iterator it = workers.begin(); it != workers.end(); ++it)
+		delete *it;
 }
 
 // =============================================================================
@@ -585,10 +903,10 @@ CTextExport::~CTextExport()
 
 #define CHECK_SYMBOL(x) \
 	{ \
-		CString symbol_ = t.ReadToken(); \
-		if (symbol_ != _T(x)) \
+		TokenView symbol_ = t.ReadView(); \
+		if (!symbol_.Is(_T(x))) \
 		{ \
-			sResult.Format(_T("Line %d column %d: expected '%s', '%s' found."), t.line, t.GetColumn(), _T(x), symbol_); \
+			sResult.Format(_T("Line %d column %d: expected '%s', '%s' found."), t.line, t.GetColumn(), _T(x), symbol_.ToString()); \
 			return sResult; \
 		} \
 	}
@@ -606,11 +924,12 @@ const CString& CTextExport::ImportFile(LPCTSTR FileName, CFamiTrackerDoc *pDoc)
 	static CString sResult;
 	sResult = _T("");
 
-	// read file into "text" CString
-	CString text = _T("");
-	CStdioFile f;
+	DWORD StartTime = ::GetTickCount();
+
+	// map the file into memory, the text is read directly from the mapping
+	CFile f;
 	CFileException oFileException;
-	if (!f.Open(FileName, CFile::modeRead | CFile::typeText, &oFileException))
+	if (!f.Open(FileName, CFile::modeRead | CFile::shareDenyWrite, &oFileException))
 	{
 		TCHAR szError[256];
 		oFileException.GetErrorMessage(szError, 256);
@@ -618,10 +937,12 @@ const CString& CTextExport::ImportFile(LPCTSTR FileName, CFamiTrackerDoc *pDoc)
 		sResult.Format(_T("Unable to open file:\n%s"), szError);
 		return sResult;
 	}
-	CString line;
-	while (f.ReadString(line))
-		text += line + TCHAR('\n');
-	f.Close();
+	MappedFile text;
+	if (!text.Map(f))
+	{
+		sResult = _T("Unable to read file.");
+		return sResult;
+	}
 
 	// begin a new document
 	if (!pDoc->OnNewDocument())
@@ -631,7 +952,7 @@ const CString& CTextExport::ImportFile(LPCTSTR FileName, CFamiTrackerDoc *pDoc)
 	}
 
 	// parse the file
-	Tokenizer t(&text);
+	Tokenizer t(text.view, text.size);
 	int i; // generic integer for reading
 	unsigned int dpcm_index = 0;
 	unsigned int dpcm_pos = 0;
@@ -641,11 +962,11 @@ const CString& CTextExport::ImportFile(LPCTSTR FileName, CFamiTrackerDoc *pDoc)
 	{
 		// read first token on line
 		if (t.IsEOL()) continue; // blank line
-		CString command = t.ReadToken();
+		TokenView command = t.ReadView();
 
 		int c = 0;
 		for (; c < CT_COUNT; ++c)
-			if (0 == command.CompareNoCase(CT[c])) break;
+			if (command.IsNoCase(CT[c])) break;
 
 		//DEBUG_OUT("Command read: %s\n", command);
 		switch (c)
@@ -1078,21 +1399,25 @@ const CString& CTextExport::ImportFile(LPCTSTR FileName, CFamiTrackerDoc *pDoc)
 					for (int c=0; c < pDoc->GetChannelCount(); ++c)
 					{
     					CHECK_COLON();
-						if (!ImportCellText(pDoc, t, track-1, pattern, c, i, sResult))
+						stChanNote Cell;
+						if (!ImportCellText(t, c, pDoc->GetEffColumns(track-1, c), Cell, sResult))
 						{
 							return sResult;
 						}
+						pDoc->SetDataAtPattern(track-1,pattern,c,i,&Cell);
 					}
 					CHECK(t.ReadEOL(&sResult));
 				}
 				break;
 			case CT_COUNT:
 			default:
-				sResult.Format(_T("Unrecognized command at line %d: '%s'."), t.line, command);
+				sResult.Format(_T("Unrecognized command at line %d: '%s'."), t.line, command.ToString());
 				return sResult;
 		}
 	}
 
+	TRACE1("Text import: %i ms\n", ::GetTickCount() - StartTime);
+
 	return sResult;
 }
 
@@ -1419,77 +1744,98 @@ const CString& CTextExport::ExportFile(LPCTSTR FileName, CFamiTrackerDoc *pDoc)
 
 	f.WriteString(_T("# Tracks\n\n"));
 
-	for (unsigned int t=0; t < pDoc->GetTrackCount(); ++t)
-	{
-		const char* zpTitle = pDoc->GetTrackTitle(t).GetString();
-		if (zpTitle == NULL) zpTitle = "";
-
-		s.Format(_T("%s %3d %3d %3d %s\n"),
-			CT[CT_TRACK],
-			pDoc->GetPatternLength(t),
-			pDoc->GetSongSpeed(t),
-			pDoc->GetSongTempo(t),
-			ExportString(zpTitle));
-		f.WriteString(s);
+	TrackExportJob job;
+	job.pDoc = pDoc;
+	job.buffers.resize(pDoc->GetTrackCount());
+	ExportTracks(job);
 
-		s.Format(_T("%s :"), CT[CT_COLUMNS]);
-		f.WriteString(s);
-		for (int c=0; c < pDoc->GetChannelCount(); ++c)
-		{
-			s.Format(_T(" %d"), pDoc->GetEffColumns(t, c)+1);
-			f.WriteString(s);
-		}
-		f.WriteString(_T("\n\n"));
+	// join the tracks so they go out in a single write
+	size_t size = 0;
+	for (std::vector<TextBuffer>::const_iterator it = job.buffers.begin(); it != job.buffers.end(); ++it)
+		size += it->GetSize();
 
-		for (unsigned int o=0; o < pDoc->GetFrameCount(t); ++o)
+	if (size > 0)
+	{
+		TextBuffer all;
+		all.Reserve(size);
+		for (std::vector<TextBuffer>::const_iterator it = job.buffers.begin(); it != job.buffers.end(); ++it)
 		{
-			s.Format(_T("%s %02X :"), CT[CT_ORDER], o);
-			f.WriteString(s);
-			for (int c=0; c < pDoc->GetChannelCount(); ++c)
-			{
-				s.Format(_T(" %02X"), pDoc->GetPatternAtFrame(t, o, c));
-				f.WriteString(s);
-			}
-			f.WriteString(_T("\n"));
+			if (it->GetSize() > 0)
+				all.Append(it->GetData(), (int)it->GetSize());
 		}
-		f.WriteString(_T("\n"));
+		job.buffers.clear();
+		f.Write(all.GetData(), (UINT)all.GetSize());
+	}
 
-		for (int p=0; p < MAX_PATTERN; ++p)
-		{
-			// detect and skip empty patterns
-			bool bUsed = false;
-			for (int c=0; c < pDoc->GetChannelCount(); ++c)
-			{
-				if (!pDoc->IsPatternEmpty(t, c, p))
-				{
-					bUsed = true;
-					break;
-				}
-			}
-			if (!bUsed) continue;
+	f.WriteString(_T("# End of export\n"));
+	return sResult;
+}
 
-			s.Format(_T("%s %02X\n"), CT[CT_PATTERN], p);
-			f.WriteString(s);
+bool CTextExport::BenchmarkImport(CString &Result)
+{
+	// Exports the generated benchmark module to a temporary file and times the import of it
+	// Called from the command line (/textbenchmark) only.
 
-			for (unsigned int r=0; r < pDoc->GetPatternLength(t); ++r)
-			{
-				s.Format(_T("%s %02X"), CT[CT_ROW], r);
-				f.WriteString(s);
-				for (int c=0; c < pDoc->GetChannelCount(); ++c)
-				{
-					f.WriteString(_T(" : "));
-					stChanNote stCell;
-					pDoc->GetDataAtPattern(t,p,c,r,&stCell);
-					f.WriteString(ExportCellText(stCell, pDoc->GetEffColumns(t, c)+1, c==3));
-				}
-				f.WriteString(_T("\n"));
-			}
-			f.WriteString(_T("\n"));
-		}
+	TCHAR TempPath[MAX_PATH], TempFile[MAX_PATH];
+
+	if (!GetTempPath(MAX_PATH, TempPath) || !GetTempFileName(TempPath, _T("Txt"), 0, TempFile)) {
+		Result = _T("Could not create temporary file");
+		return false;
 	}
 
-	f.WriteString(_T("# End of export\n"));
-	return sResult;
+	CFamiTrackerDoc *pSource = CFamiTrackerDoc::CreateBenchmarkModule();
+
+	if (pSource == NULL) {
+		DeleteFile(TempFile);
+		Result = _T("Could not create benchmark module");
+		return false;
+	}
+
+	CTextExport Exporter;
+	CString Error = Exporter.ExportFile(TempFile, pSource);
+	int Tracks = pSource->GetTrackCount();
+	delete pSource;
+
+	if (!Error.IsEmpty()) {
+		DeleteFile(TempFile);
+		Result.Format(_T("Text export failed: %s"), (LPCTSTR)Error);
+		return false;
+	}
+
+	ULONGLONG Size = 0;
+	CFileStatus Status;
+	if (CFile::GetStatus(TempFile, Status))
+		Size = Status.m_size;
+
+	CFamiTrackerDoc *pDoc = static_cast<CFamiTrackerDoc*>(RUNTIME_CLASS(CFamiTrackerDoc)->CreateObject());
+
+	if (pDoc == NULL) {
+		DeleteFile(TempFile);
+		Result = _T("Could not create document");
+		return false;
+	}
+
+	LARGE_INTEGER StartTime, EndTime, Freq;
+
+	QueryPerformanceCounter(&StartTime);
+	Error = Exporter.ImportFile(TempFile, pDoc);
+	QueryPerformanceCounter(&EndTime);
+	QueryPerformanceFrequency(&Freq);
+
+	delete pDoc;
+	DeleteFile(TempFile);
+
+	if (!Error.IsEmpty()) {
+		Result.Format(_T("Text import failed: %s"), (LPCTSTR)Error);
+		return false;
+	}
+
+	Result.Format(_T("Text import: %i tracks, %I64u bytes, %.1f ms"), Tracks, Size,
+		double(EndTime.QuadPart - StartTime.QuadPart) * 1000.0 / double(Freq.QuadPart));
+
+	TRACE(_T("%s\n"), (LPCTSTR)Result);
+
+	return true;
 }
 
 // end of file
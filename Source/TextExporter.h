@@ -31,4 +31,7 @@ public:
 	// returns an empty string on success, otherwise returns a descriptive error
 	const CString& ImportFile(LPCTSTR FileName, CFamiTrackerDoc *pDoc);
 	const CString& ExportFile(LPCTSTR FileName, CFamiTrackerDoc *pDoc);
+
+	// Times the import of the generated benchmark module, returns false on failure
+	static bool BenchmarkImport(CString &Result);
 };
@@ -0,0 +1,127 @@
+/*
+** FamiTracker - NES/Famicom sound tracker
+** Copyright (C) 2005-2014  Jonathan Liss
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+*/
+
+#include "stdafx.h"
+#include "FamiTrackerDoc.h"
+#include "TrackSnapshot.h"
+
+// This class is a read-only copy of a track used by the player thread
+// New snapshots are published by the document, see CFamiTrackerDoc::PublishSnapshots
+
+CTrackSnapshot::CTrackSnapshot(const CPatternData *pTrack, int Channels, const int *pChannelTypes) :
+	m_iRefCount(1),
+	m_iPatternLength(pTrack->GetPatternLength()),
+	m_iFrameCount(pTrack->GetFrameCount()),
+	m_iSongSpeed(pTrack->GetSongSpeed()),
+	m_iSongTempo(pTrack->GetSongTempo()),
+	m_iChannelCount(Channels)
+{
+	ASSERT(Channels <= CHANNELS);
+
+	memcpy(m_iChannelTypes, pChannelTypes, sizeof(int) * Channels);
+
+	// Only frames in the track are copied
+	m_pFrameList = new unsigned char[m_iFrameCount * MAX_CHANNELS];
+
+	for (int i = 0; i < MAX_CHANNELS; ++i) {
+		m_iEffectColumns[i] = pTrack->GetEffectColumnCount(i);
+		for (unsigned int j = 0; j < m_iFrameCount; ++j)
+			m_pFrameList[j * MAX_CHANNELS + i] = pTrack->GetFramePattern(j, i);
+		// Share pattern blocks, the document will copy them on write
+		for (int j = 0; j < MAX_PATTERN; ++j) {
+			m_pPatterns[i][j] = pTrack->GetPatternBlock(i, j);
+			if (m_pPatterns[i][j] != NULL)
+				m_pPatterns[i][j]->Retain();
+		}
+	}
+}
+
+CTrackSnapshot::~CTrackSnapshot()
+{
+	for (int i = 0; i < MAX_CHANNELS; ++i) {
+		for (int j = 0; j < MAX_PATTERN; ++j) {
+			if (m_pPatterns[i][j] != NULL)
+				m_pPatterns[i][j]->Release();
+		}
+	}
+
+	SAFE_RELEASE_ARRAY(m_pFrameList);
+}
+
+void CTrackSnapshot::Retain() const
+{
+	InterlockedIncrement(&m_iRefCount);
+}
+
+void CTrackSnapshot::Release() const
+{
+	if (InterlockedDecrement(&m_iRefCount) == 0)
+		delete this;
+}
+
+unsigned int CTrackSnapshot::GetEffColumns(unsigned int Channel) const
+{
+	ASSERT(Channel < MAX_CHANNELS);
+	return m_iEffectColumns[Channel];
+}
+
+unsigned int CTrackSnapshot::GetPatternAtFrame(unsigned int Frame, unsigned int Channel) const
+{
+	ASSERT(Frame < MAX_FRAMES && Channel < MAX_CHANNELS);
+
+	// Frames outside the track use the first pattern
+	if (Frame >= m_iFrameCount)
+		return 0;
+
+	return m_pFrameList[Frame * MAX_CHANNELS + Channel];
+}
+
+void CTrackSnapshot::GetNoteData(unsigned int Frame, unsigned int Channel, unsigned int Row, stChanNote *pData) const
+{
+	ASSERT(Frame < MAX_FRAMES);
+	ASSERT(Channel < MAX_CHANNELS);
+	ASSERT(Row < MAX_PATTERN_LENGTH);
+	ASSERT(pData != NULL);
+
+	const CPatternBlock *pBlock = m_pPatterns[Channel][GetPatternAtFrame(Frame, Channel)];
+
+	memcpy(pData, pBlock == NULL ? &CPatternBlock::EMPTY_NOTE : pBlock->GetRow(Row), sizeof(stChanNote));
+}
+
+const stChanNote *CTrackSnapshot::ReadNoteData(unsigned int Frame, unsigned int Channel, unsigned int Row) const
+{
+	// Read-only access without copying, valid as long as the snapshot is held
+	ASSERT(Frame < MAX_FRAMES);
+	ASSERT(Channel < MAX_CHANNELS);
+	ASSERT(Row < MAX_PATTERN_LENGTH);
+
+	const CPatternBlock *pBlock = m_pPatterns[Channel][GetPatternAtFrame(Frame, Channel)];
+
+	return pBlock == NULL ? &CPatternBlock::EMPTY_NOTE : pBlock->GetRow(Row);
+}
+
+const CPatternBlock *CTrackSnapshot::GetPatternBlock(unsigned int Channel, unsigned int Pattern) const
+{
+	// NULL for unallocated patterns, blocks are never modified while the snapshot is held
+	ASSERT(Channel < MAX_CHANNELS);
+	ASSERT(Pattern < MAX_PATTERN);
+
+	return m_pPatterns[Channel][Pattern];
+}
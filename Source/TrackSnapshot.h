@@ -0,0 +1,66 @@
+/*
+** FamiTracker - NES/Famicom sound tracker
+** Copyright (C) 2005-2014  Jonathan Liss
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful, 
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU 
+** Library General Public License for more details.  To obtain a 
+** copy of the GNU Library General Public License, write to the Free 
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+*/
+
+#pragma once
+
+
+// Immutable copy of the data the player reads from a track. Pattern blocks are shared with
+// the document, which copies them before editing. Snapshots are published by the main thread
+// and read by the player thread without locking the document.
+class CTrackSnapshot {
+public:
+	CTrackSnapshot(const CPatternData *pTrack, int Channels, const int *pChannelTypes);
+
+	void Retain() const;
+	void Release() const;
+
+	unsigned int GetPatternLength() const { return m_iPatternLength; };
+	unsigned int GetFrameCount() const { return m_iFrameCount; };
+	unsigned int GetSongSpeed() const { return m_iSongSpeed; };
+	unsigned int GetSongTempo() const { return m_iSongTempo; };
+
+	int GetChannelCount() const { return m_iChannelCount; };
+	int GetChannelType(int Channel) const { return m_iChannelTypes[Channel]; };
+
+	unsigned int GetEffColumns(unsigned int Channel) const;
+	unsigned int GetPatternAtFrame(unsigned int Frame, unsigned int Channel) const;
+	void GetNoteData(unsigned int Frame, unsigned int Channel, unsigned int Row, stChanNote *pData) const;
+	const stChanNote *ReadNoteData(unsigned int Frame, unsigned int Channel, unsigned int Row) const;
+	const CPatternBlock *GetPatternBlock(unsigned int Channel, unsigned int Pattern) const;
+
+private:
+	~CTrackSnapshot();
+
+private:
+	mutable volatile LONG m_iRefCount;
+
+	unsigned int m_iPatternLength;
+	unsigned int m_iFrameCount;
+	unsigned int m_iSongSpeed;
+	unsigned int m_iSongTempo;
+
+	int m_iChannelCount;
+	int m_iChannelTypes[CHANNELS];
+
+	unsigned char m_iEffectColumns[MAX_CHANNELS];
+	unsigned char *m_pFrameList;				// MAX_CHANNELS entries for each frame in the track
+
+	const CPatternBlock *m_pPatterns[MAX_CHANNELS][MAX_PATTERN];
+};
@@ -58,7 +58,7 @@ void CWavProgressDlg::OnBnClickedCancel()
 
 	if (pSoundGen->IsRendering()) {
 		//pSoundGen->StopRendering();
-		pSoundGen->PostThreadMessage(WM_USER_STOP_RENDER, 0, 0);
+		pSoundGen->PostCommand(CMD_STOP_RENDER, 0, 0);
 	}
 
 	EndDialog(0);
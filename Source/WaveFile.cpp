@@ -26,14 +26,38 @@ bool CWaveFile::OpenFile(LPTSTR Filename, int SampleRate, int SampleSize, int Ch
 	// Open a wave file for streaming
 	//
 
+	// 8, 16 and 24 bit samples are PCM, 32 bit samples are float
+	// 24 bit files use the extensible format
+	//
+
 	int nError;
 
-	WaveFormat.wf.wFormatTag	  = WAVE_FORMAT_PCM;
-	WaveFormat.wf.nChannels		  = Channels;
-	WaveFormat.wf.nSamplesPerSec  = SampleRate;
-	WaveFormat.wf.nBlockAlign	  = (SampleSize / 8) * Channels;
-	WaveFormat.wf.nAvgBytesPerSec = SampleRate * (SampleSize / 8) * Channels;
-	WaveFormat.wBitsPerSample	  = SampleSize;
+	const bool bFloat = (SampleSize == 32);
+	const bool bExtensible = (SampleSize == 24);
+
+	memset(&WaveFormat, 0, sizeof(WAVEFORMATEXTENSIBLE));
+
+	WaveFormat.Format.wFormatTag	  = bFloat ? WAVE_FORMAT_IEEE_FLOAT : WAVE_FORMAT_PCM;
+	WaveFormat.Format.nChannels		  = Channels;
+	WaveFormat.Format.nSamplesPerSec  = SampleRate;
+	WaveFormat.Format.nBlockAlign	  = (SampleSize / 8) * Channels;
+	WaveFormat.Format.nAvgBytesPerSec = SampleRate * (SampleSize / 8) * Channels;
+	WaveFormat.Format.wBitsPerSample  = SampleSize;
+	WaveFormat.Format.cbSize		  = 0;
+
+	if (bExtensible) {
+		WaveFormat.Format.wFormatTag		   = WAVE_FORMAT_EXTENSIBLE;
+		WaveFormat.Format.cbSize			   = sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX);
+		WaveFormat.Samples.wValidBitsPerSample = SampleSize;
+		WaveFormat.dwChannelMask			   = (Channels == 2) ? (SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT) : SPEAKER_FRONT_CENTER;
+		WaveFormat.SubFormat				   = KSDATAFORMAT_SUBTYPE_PCM;
+	}
+
+	// PCM files keep the short format header, extensible files use the 40 byte header
+	const LONG FormatSize = bExtensible ? sizeof(WAVEFORMATEXTENSIBLE) : (bFloat ? sizeof(WAVEFORMATEX) : sizeof(PCMWAVEFORMAT));
+
+	m_iFactOffset = 0;
+	m_iDataSize = 0;
 
 	hmmioOut = mmioOpen(Filename, NULL, MMIO_ALLOCBUF | MMIO_READWRITE | MMIO_CREATE);
 
@@ -46,16 +70,33 @@ bool CWaveFile::OpenFile(LPTSTR Filename, int SampleRate, int SampleSize, int Ch
 		return false;
 
 	ckOut.ckid	 = mmioFOURCC('f', 'm', 't', ' ');     
-	ckOut.cksize = sizeof(PCMWAVEFORMAT);
+	ckOut.cksize = FormatSize;
 
 	nError = mmioCreateChunk(hmmioOut, &ckOut, 0);
 
 	if (nError != MMSYSERR_NOERROR)
 		return false;
 
-	mmioWrite(hmmioOut, (HPSTR)&WaveFormat, sizeof(PCMWAVEFORMAT));
+	mmioWrite(hmmioOut, (HPSTR)&WaveFormat, FormatSize);
 	mmioAscend(hmmioOut, &ckOut, 0);
 
+	if (bFloat || bExtensible) {
+		// Non-PCM files need a fact chunk, the sample count is written when closing
+		DWORD SampleCount = 0;
+
+		ckOut.ckid	 = mmioFOURCC('f', 'a', 'c', 't');
+		ckOut.cksize = sizeof(DWORD);
+
+		nError = mmioCreateChunk(hmmioOut, &ckOut, 0);
+
+		if (nError != MMSYSERR_NOERROR)
+			return false;
+
+		m_iFactOffset = mmioSeek(hmmioOut, 0, SEEK_CUR);
+		mmioWrite(hmmioOut, (HPSTR)&SampleCount, sizeof(DWORD));
+		mmioAscend(hmmioOut, &ckOut, 0);
+	}
+
 	ckOut.ckid	 = mmioFOURCC('d', 'a', 't', 'a');
 	ckOut.cksize = 0;
 
@@ -80,6 +121,12 @@ void CWaveFile::CloseFile()
 	mmioAscend(hmmioOut, &ckOut, 0);
 	mmioAscend(hmmioOut, &ckOutRIFF, 0);
 
+	if (m_iFactOffset != 0) {
+		DWORD SampleCount = m_iDataSize / WaveFormat.Format.nBlockAlign;
+		mmioSeek(hmmioOut, m_iFactOffset, SEEK_SET);
+		mmioWrite(hmmioOut, (HPSTR)&SampleCount, sizeof(DWORD));
+	}
+
 	mmioSeek(hmmioOut, 0, SEEK_SET); 
 	mmioDescend(hmmioOut, &ckOutRIFF, NULL, 0);
 
@@ -102,5 +149,7 @@ void CWaveFile::WriteWave(char *Data, int Size)
 		*((BYTE*)mmioinfoOut.pchNext) = *((BYTE*)Data + cT); 
 		mmioinfoOut.pchNext++;
 	}
+
+	m_iDataSize += Size;
 }
 
@@ -22,6 +22,9 @@
 
 
 #include <mmsystem.h>
+#include <mmreg.h>
+#include <ks.h>
+#include <ksmedia.h>
 
 class CWaveFile
 {
@@ -31,10 +34,12 @@ class CWaveFile
 		void	WriteWave(char *Data, int Size);
 
 	private:
-		PCMWAVEFORMAT	WaveFormat;
+		WAVEFORMATEXTENSIBLE	WaveFormat;
 		MMCKINFO		ckOutRIFF, ckOut;
 		MMIOINFO		mmioinfoOut;
 		HMMIO			hmmioOut;
+		LONG			m_iFactOffset;		// Position of the sample count in the fact chunk, float files only
+		DWORD			m_iDataSize;
 
 };
 
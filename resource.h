@@ -202,8 +202,10 @@
 #define IDS_NORMAL_MODE                 315
 #define IDS_MIDI_MESSAGE_ON_FORMAT      316
 #define IDS_MIDI_MESSAGE_OFF            317
+#define IDS_PERFORMANCE_LATENCY_FORMAT  318
 #define IDI_RIGHT                       317
 #define IDR_SEQUENCE_POPUP              319
+#define IDS_CLEANUP_ALL                 320
 #define IDC_INSTRUMENTS                 1001
 #define IDC_INSTSETTINGS                1002
 #define IDC_INSTNAME                    1005
@@ -462,6 +464,11 @@
 #define IDC_SLIDER_N163                 1284
 #define IDC_SLIDER8                     1285
 #define IDC_SLIDER_S5B                  1285
+#define IDC_LATENCY                     1286
+#define IDC_OPT_COMPRESS                1287
+#define IDC_OPT_PROFILEDRIVER           1288
+#define IDC_CYCLE_WARNING               1289
+#define IDC_OPT_AUTOSAVE                1290
 #define ID_TRACKER_PLAY                 32771
 #define ID_TRACKER_PLAYPATTERN          32775
 #define ID_TRACKER_STOP                 32776
@@ -602,6 +609,7 @@
 #define ID_HELP_FAQ                     33122
 #define ID_POPUP_CLONESEQUENCE          33125
 #define ID_TRACKER_DISPLAYREGISTERSTATE 33126
+#define ID_CLEANUP_ALL                  33127
 #define ID_INSTRUMENT_ADD_2A03          36864
 #define ID_INSTRUMENT_ADD_FDS           36865
 #define ID_INSTRUMENT_ADD_MMC5          36866
@@ -621,9 +629,9 @@
 // 
 #ifdef APSTUDIO_INVOKED
 #ifndef APSTUDIO_READONLY_SYMBOLS
-#define _APS_NEXT_RESOURCE_VALUE        320
-#define _APS_NEXT_COMMAND_VALUE         33127
-#define _APS_NEXT_CONTROL_VALUE         1280
+#define _APS_NEXT_RESOURCE_VALUE        321
+#define _APS_NEXT_COMMAND_VALUE         33128
+#define _APS_NEXT_CONTROL_VALUE         1291
 #define _APS_NEXT_SYMED_VALUE           179
 #endif
 #endif